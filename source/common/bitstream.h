@@ -71,6 +71,9 @@ public:
     uint32_t getNumberOfWrittenBits()  const { return m_byteOccupancy * 8 + m_partialByteBits; }
     const uint8_t* getFIFO() const           { return m_fifo; }
 
+    /* discard bytes written after the first numBytes, stream must be byte aligned */
+    void     truncate(uint32_t numBytes)     { X265_CHECK(!m_partialByteBits && numBytes <= m_byteOccupancy, "invalid truncate\n"); m_byteOccupancy = numBytes; }
+
     void     write(uint32_t val, uint32_t numBits);
     void     writeByte(uint32_t val);
 
@@ -31,6 +31,14 @@
 #include <sys/timeb.h>
 #else
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if HAVE_LIBNUMA
+#include <numa.h>
+#include <numaif.h>
 #endif
 
 namespace X265_NS {
@@ -89,6 +97,68 @@ void x265_free(void *ptr)
 
 #endif // if _WIN32
 
+/* Allocate memory whose pages are bound to the given NUMA node. The buffer is
+ * page aligned so the binding covers all of it, and it must not be touched
+ * before the binding is applied. A negative node (or a system without NUMA
+ * support) gives a regular allocation. Release with x265_free() */
+void *x265_malloc_node(size_t size, int numaNode)
+{
+#if HAVE_LIBNUMA
+    if (numaNode >= 0 && numa_available() >= 0)
+    {
+        void *ptr;
+        size_t pageSize = (size_t)numa_pagesize();
+        if (posix_memalign((void**)&ptr, pageSize, size))
+            return NULL;
+        numa_tonode_memory(ptr, size, numaNode);
+        return ptr;
+    }
+#else
+    (void)numaNode;
+#endif
+    return x265_malloc(size);
+}
+
+/* Sample the resident pages of a buffer and count how many are on the given
+ * NUMA node and how many are elsewhere. Pages which have not been faulted in
+ * are not counted. Returns false if page locations cannot be queried */
+bool x265_numa_page_usage(const void *ptr, size_t size, int numaNode, uint64_t& localPages, uint64_t& remotePages)
+{
+#if HAVE_LIBNUMA
+    enum { MAX_SAMPLES = 64 };
+
+    if (!ptr || numaNode < 0 || numa_available() < 0)
+        return false;
+
+    size_t pageSize = (size_t)numa_pagesize();
+    size_t numPages = size / pageSize;
+    if (!numPages)
+        return false;
+
+    size_t step = (numPages + MAX_SAMPLES - 1) / MAX_SAMPLES;
+    void* pages[MAX_SAMPLES];
+    int status[MAX_SAMPLES];
+    int count = 0;
+    for (size_t i = 0; i < numPages && count < MAX_SAMPLES; i += step)
+        pages[count++] = (void*)(((uintptr_t)ptr + i * pageSize) & ~(uintptr_t)(pageSize - 1));
+
+    if (move_pages(0, count, pages, NULL, status, 0))
+        return false;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (status[i] == numaNode)
+            localPages++;
+        else if (status[i] >= 0)
+            remotePages++;
+    }
+    return true;
+#else
+    (void)ptr; (void)size; (void)numaNode; (void)localPages; (void)remotePages;
+    return false;
+#endif
+}
+
 /* Not a general-purpose function; multiplies input by -1/6 to convert
  * qp to qscale. */
 int x265_exp2fix8(double x)
@@ -216,4 +286,65 @@ error:
     return NULL;
 }
 
+/* map a whole file read-only into memory, the mapping remains valid until
+ * x265_unmap_file() even though the file itself is closed */
+void* x265_map_file(const char *filename, size_t& size)
+{
+    void *ptr = NULL;
+    size = 0;
+    if (!filename)
+        return NULL;
+
+#if _WIN32
+    HANDLE fh = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER fSize;
+        if (GetFileSizeEx(fh, &fSize) && fSize.QuadPart > 0 && (uint64_t)fSize.QuadPart <= (size_t)-1)
+        {
+            HANDLE mapping = CreateFileMapping(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping)
+            {
+                ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (ptr)
+                    size = (size_t)fSize.QuadPart;
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(fh);
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0)
+    {
+        struct stat st;
+        if (!fstat(fd, &st) && st.st_size > 0)
+        {
+            ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED)
+                ptr = NULL;
+            else
+                size = (size_t)st.st_size;
+        }
+        close(fd);
+    }
+#endif
+
+    if (!ptr)
+        x265_log(NULL, X265_LOG_ERROR, "unable to map file %s\n", filename);
+    return ptr;
+}
+
+void x265_unmap_file(void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+#if _WIN32
+    (void)size;
+    UnmapViewOfFile(ptr);
+#else
+    munmap(ptr, size);
+#endif
+}
+
 }
@@ -217,6 +217,15 @@ typedef int16_t  coeff_t;      // transform coefficient
             goto fail; \
         } \
     }
+#define CHECKED_MALLOC_NODE(var, type, count, node) \
+    { \
+        var = (type*)x265_malloc_node(sizeof(type) * (count), node); \
+        if (!var) \
+        { \
+            x265_log(NULL, X265_LOG_ERROR, "malloc of size %d failed\n", sizeof(type) * (count)); \
+            goto fail; \
+        } \
+    }
 #define CHECKED_MALLOC_ZERO(var, type, count) \
     { \
         var = (type*)x265_malloc(sizeof(type) * (count)); \
@@ -419,8 +428,12 @@ double   x265_qp2qScale(double qp);
 uint32_t x265_picturePlaneSize(int csp, int width, int height, int plane);
 
 void*    x265_malloc(size_t size);
+void*    x265_malloc_node(size_t size, int numaNode);
 void     x265_free(void *ptr);
+bool     x265_numa_page_usage(const void *ptr, size_t size, int numaNode, uint64_t& localPages, uint64_t& remotePages);
 char*    x265_slurp_file(const char *filename);
+void*    x265_map_file(const char *filename, size_t& size);
+void     x265_unmap_file(void *ptr, size_t size);
 
 /* located in primitives.cpp */
 void     x265_setup_primitives(x265_param* param);
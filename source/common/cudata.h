@@ -176,12 +176,16 @@ public:
     const CUData* m_cuAbove;          // pointer to above neighbor CTU
     const CUData* m_cuLeft;           // pointer to left neighbor CTU
 
+    bool          m_bFirstRowInSlice; // CTU row starts a slice, CTUs above are not available
+    bool          m_bLastRowInSlice;  // CTU row ends a slice
+    bool          m_bLastCuInSlice;   // CTU is the last of its slice segment
+
     CUData();
 
     void     initialize(const CUDataMemPool& dataPool, uint32_t depth, int csp, int instance);
     static void calcCTUGeoms(uint32_t ctuWidth, uint32_t ctuHeight, uint32_t maxCUSize, uint32_t minCUSize, CUGeom cuDataArray[CUGeom::MAX_GEOMS]);
 
-    void     initCTU(const Frame& frame, uint32_t cuAddr, int qp);
+    void     initCTU(const Frame& frame, uint32_t cuAddr, int qp, bool bFirstRowInSlice, bool bLastRowInSlice, bool bLastCuInSlice);
     void     initSubCU(const CUData& ctu, const CUGeom& cuGeom, int qp);
     void     initLosslessCU(const CUData& cu, const CUGeom& cuGeom);
 
@@ -39,24 +39,30 @@ Frame::Frame()
     m_next = NULL;
     m_prev = NULL;
     m_param = NULL;
+    m_quantOffsets = NULL;
+    m_quantOffsetsMode = X265_QPMAP_AQ;
     memset(&m_lowres, 0, sizeof(m_lowres));
 }
 
-bool Frame::create(x265_param *param)
+/* numaNode is the node of the thread pool which runs the lookahead, it
+ * downscales and analyzes the source picture before any frame encoder */
+bool Frame::create(x265_param *param, int numaNode)
 {
     m_fencPic = new PicYuv;
     m_param = param;
 
-    return m_fencPic->create(param->sourceWidth, param->sourceHeight, param->internalCsp) &&
-           m_lowres.create(m_fencPic, param->bframes, !!param->rc.aqMode);
+    return m_fencPic->create(param->sourceWidth, param->sourceHeight, param->internalCsp, numaNode) &&
+           m_lowres.create(m_fencPic, param->bframes, !!param->rc.aqMode, !!param->bHierarchicalLookahead, !!param->bHistBasedSceneCut, numaNode);
 }
 
-bool Frame::allocEncodeData(x265_param *param, const SPS& sps)
+/* numaNode is the node of the thread pool of the frame encoder which will
+ * reconstruct this picture */
+bool Frame::allocEncodeData(x265_param *param, const SPS& sps, int numaNode)
 {
     m_encData = new FrameData;
     m_reconPic = new PicYuv;
     m_encData->m_reconPic = m_reconPic;
-    bool ok = m_encData->create(param, sps) && m_reconPic->create(param->sourceWidth, param->sourceHeight, param->internalCsp);
+    bool ok = m_encData->create(param, sps) && m_reconPic->create(param->sourceWidth, param->sourceHeight, param->internalCsp, numaNode);
     if (ok)
     {
         /* initialize right border of m_reconpicYuv as SAO may read beyond the
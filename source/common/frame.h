@@ -54,6 +54,8 @@ public:
     int64_t                m_dts;
     int32_t                m_forceqp;            // Force to use the qp specified in qp file
     void*                  m_userData;           // user provided pointer passed in with this picture
+    double*                m_quantOffsets;       // user provided QP offset map, owned by the application
+    int                    m_quantOffsetsMode;
 
     Lowres                 m_lowres;
     bool                   m_lowresInit;         // lowres init complete (pre-analysis)
@@ -69,8 +71,8 @@ public:
     x265_analysis_data     m_analysisData;
     Frame();
 
-    bool create(x265_param *param);
-    bool allocEncodeData(x265_param *param, const SPS& sps);
+    bool create(x265_param *param, int numaNode);
+    bool allocEncodeData(x265_param *param, const SPS& sps, int numaNode);
     void reinit(const SPS& sps);
     void destroy();
 };
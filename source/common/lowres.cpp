@@ -23,17 +23,35 @@
 
 #include "picyuv.h"
 #include "lowres.h"
+#include "slice.h"
+#include "threading.h"
 #include "mv.h"
 
 using namespace X265_NS;
 
-bool Lowres::create(PicYuv *origPic, int _bframes, bool bAQEnabled)
+bool Lowres::create(PicYuv *origPic, int _bframes, bool bAQEnabled, bool bCoarse, bool _bSceneStats, int numaNode)
 {
-    isLowres = true;
     bframes = _bframes;
-    width = origPic->m_picWidth / 2;
-    lines = origPic->m_picHeight / 2;
-    lumaStride = width + 2 * origPic->m_lumaMarginX;
+    bSceneStats = _bSceneStats;
+    if (!alloc(origPic->m_picWidth / 2, origPic->m_picHeight / 2, origPic->m_lumaMarginX, origPic->m_lumaMarginY, bAQEnabled, numaNode))
+        return false;
+
+    if (bCoarse)
+    {
+        coarse = new Lowres();
+        coarse->bframes = bframes;
+        return coarse->alloc(width / 2, lines / 2, origPic->m_lumaMarginX, origPic->m_lumaMarginY, false, numaNode);
+    }
+
+    return true;
+}
+
+bool Lowres::alloc(int srcWidth, int srcHeight, int marginX, int marginY, bool bAQEnabled, int numaNode)
+{
+    isLowres = true;
+    width = srcWidth;
+    lines = srcHeight;
+    lumaStride = width + 2 * marginX;
     if (lumaStride & 31)
         lumaStride += 32 - (lumaStride & 31);
     maxBlocksInRow = (width + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS;
@@ -44,8 +62,8 @@ bool Lowres::create(PicYuv *origPic, int _bframes, bool bAQEnabled)
     width = maxBlocksInRow * X265_LOWRES_CU_SIZE;
     lines = maxBlocksInCol * X265_LOWRES_CU_SIZE;
 
-    size_t planesize = lumaStride * (lines + 2 * origPic->m_lumaMarginY);
-    size_t padoffset = lumaStride * origPic->m_lumaMarginY + origPic->m_lumaMarginX;
+    size_t planesize = lumaStride * (lines + 2 * marginY);
+    size_t padoffset = lumaStride * marginY + marginX;
 
     if (bAQEnabled)
     {
@@ -55,8 +73,9 @@ bool Lowres::create(PicYuv *origPic, int _bframes, bool bAQEnabled)
     }
     CHECKED_MALLOC(propagateCost, uint16_t, cuCount);
 
-    /* allocate lowres buffers */
-    CHECKED_MALLOC_ZERO(buffer[0], pixel, 4 * planesize);
+    /* allocate lowres buffers, on the node which runs the lookahead */
+    CHECKED_MALLOC_NODE(buffer[0], pixel, 4 * planesize, numaNode);
+    memset(buffer[0], 0, sizeof(pixel) * 4 * planesize);
 
     buffer[1] = buffer[0] + planesize;
     buffer[2] = buffer[1] + planesize;
@@ -87,6 +106,8 @@ bool Lowres::create(PicYuv *origPic, int _bframes, bool bAQEnabled)
         CHECKED_MALLOC(lowresMvCosts[1][i], int32_t, cuCount);
     }
 
+    weightedLock = new Lock;
+
     return true;
 
 fail:
@@ -95,6 +116,17 @@ fail:
 
 void Lowres::destroy()
 {
+    if (coarse)
+    {
+        coarse->destroy();
+        delete coarse;
+        coarse = NULL;
+    }
+
+    X265_CHECK(!weightedPlanes, "weighted lowres planes still referenced\n");
+    delete weightedLock;
+    weightedLock = NULL;
+
     X265_FREE(buffer[0]);
     X265_FREE(intraCost);
     X265_FREE(intraMode);
@@ -122,10 +154,89 @@ void Lowres::destroy()
     X265_FREE(propagateCost);
 }
 
+ReferencePlanes* Lowres::acquireWeighted(const WeightParam& wp)
+{
+    ScopedLock lock(*weightedLock);
+
+    for (WeightedLowres* planes = weightedPlanes; planes; planes = planes->next)
+    {
+        if (planes->w[0].weight == wp.inputWeight && planes->w[0].offset == wp.inputOffset &&
+            planes->w[0].shift == (int)wp.log2WeightDenom)
+        {
+            planes->refCount++;
+            return planes;
+        }
+    }
+
+    intptr_t planesize = buffer[1] - buffer[0];
+    intptr_t padoffset = lowresPlane[0] - buffer[0];
+
+    WeightedLowres* planes = new WeightedLowres;
+    planes->buffer = X265_MALLOC(pixel, 4 * planesize);
+    if (!planes->buffer)
+    {
+        delete planes;
+        return NULL;
+    }
+
+    int offset = wp.inputOffset << (X265_DEPTH - 8);
+    int scale = wp.inputWeight;
+    int denom = wp.log2WeightDenom;
+    int round = denom ? 1 << (denom - 1) : 0;
+    int correction = IF_INTERNAL_PREC - X265_DEPTH; // intermediate interpolation depth
+    int paddedLines = (int)(planesize / lumaStride);
+
+    for (int i = 0; i < 4; i++)
+    {
+        primitives.weight_pp(buffer[i], planes->buffer + i * planesize, lumaStride, (int)lumaStride, paddedLines,
+                             scale, round << correction, denom + correction, offset);
+        planes->lowresPlane[i] = planes->buffer + i * planesize + padoffset;
+    }
+
+    planes->fpelPlane[0] = planes->lowresPlane[0];
+    planes->lumaStride = lumaStride;
+    planes->isLowres = true;
+    planes->isWeighted = true;
+    planes->w[0].weight = wp.inputWeight;
+    planes->w[0].offset = wp.inputOffset;
+    planes->w[0].shift = wp.log2WeightDenom;
+    planes->w[0].round = round;
+    planes->refCount = 1;
+    planes->next = weightedPlanes;
+    weightedPlanes = planes;
+
+    return planes;
+}
+
+void Lowres::releaseWeighted(ReferencePlanes* ref)
+{
+    ScopedLock lock(*weightedLock);
+
+    for (WeightedLowres** link = &weightedPlanes; *link; link = &(*link)->next)
+    {
+        WeightedLowres* planes = *link;
+        if (planes != ref)
+            continue;
+
+        if (!--planes->refCount)
+        {
+            *link = planes->next;
+            X265_FREE(planes->buffer);
+            delete planes;
+        }
+        return;
+    }
+
+    X265_CHECK(0, "released unknown weighted lowres planes\n");
+}
+
 // (re) initialize lowres state
-void Lowres::init(PicYuv *origPic, int poc)
+void Lowres::reset(int poc)
 {
+    X265_CHECK(!weightedPlanes, "weighted lowres planes still referenced\n");
+
     bLastMiniGopBFrame = false;
+    bFinalQpOffsets = false;
     bScenecut = true;  // could be a scene-cut, until ruled out by flash detection
     bKeyframe = false; // Not a keyframe unless identified by lookahead
     frameNum = poc;
@@ -150,6 +261,11 @@ void Lowres::init(PicYuv *origPic, int poc)
 
     for (int i = 0; i < bframes + 2; i++)
         intraMbs[i] = 0;
+}
+
+void Lowres::init(PicYuv *origPic, int poc)
+{
+    reset(poc);
 
     /* downscale and generate 4 hpel planes for lookahead */
     primitives.frameInitLowres(origPic->m_picOrg[0],
@@ -162,4 +278,69 @@ void Lowres::init(PicYuv *origPic, int poc)
     extendPicBorder(lowresPlane[2], lumaStride, width, lines, origPic->m_lumaMarginX, origPic->m_lumaMarginY);
     extendPicBorder(lowresPlane[3], lumaStride, width, lines, origPic->m_lumaMarginX, origPic->m_lumaMarginY);
     fpelPlane[0] = lowresPlane[0];
+
+    if (coarse)
+    {
+        /* downscale the extended half resolution plane once more */
+        coarse->reset(poc);
+        primitives.frameInitLowres(lowresPlane[0],
+                                   coarse->lowresPlane[0], coarse->lowresPlane[1], coarse->lowresPlane[2], coarse->lowresPlane[3],
+                                   lumaStride, coarse->lumaStride, coarse->width, coarse->lines);
+
+        for (int i = 0; i < 4; i++)
+            extendPicBorder(coarse->lowresPlane[i], coarse->lumaStride, coarse->width, coarse->lines, origPic->m_lumaMarginX, origPic->m_lumaMarginY);
+        coarse->fpelPlane[0] = coarse->lowresPlane[0];
+    }
+
+    if (bSceneStats)
+        computeSceneStats(origPic);
+}
+
+/* Luma and chroma histograms plus the mean luma and the luma gradient of a
+ * grid of regions, compared by the lookahead to rule scenecuts in or out
+ * before estimating inter costs */
+void Lowres::computeSceneStats(PicYuv *origPic)
+{
+    const int histShift = X265_DEPTH - 5;
+    int srcWidth = origPic->m_picWidth / 2;
+    int srcLines = origPic->m_picHeight / 2;
+
+    memset(lumaHist, 0, sizeof(lumaHist));
+    memset(chromaHist, 0, sizeof(chromaHist));
+    memset(gridMean, 0, sizeof(gridMean));
+    memset(gridEdge, 0, sizeof(gridEdge));
+
+    for (int y = 0; y < srcLines; y++)
+    {
+        const pixel* src = lowresPlane[0] + y * lumaStride;
+        uint64_t* mean = gridMean + (y * GRID_SIZE / srcLines) * GRID_SIZE;
+        uint64_t* edge = gridEdge + (y * GRID_SIZE / srcLines) * GRID_SIZE;
+
+        for (int x = 0; x < srcWidth; x++)
+        {
+            int region = x * GRID_SIZE / srcWidth;
+            lumaHist[src[x] >> histShift]++;
+            mean[region] += src[x];
+            edge[region] += abs(src[x] - src[x - 1]) + abs(src[x] - src[x - lumaStride]);
+        }
+    }
+    histCount[0] = srcWidth * srcLines;
+    histCount[1] = 0;
+
+    if (origPic->m_picCsp == X265_CSP_I400)
+        return;
+
+    /* every other chroma sample in each direction */
+    int widthC = origPic->m_picWidth >> origPic->m_hChromaShift;
+    int heightC = origPic->m_picHeight >> origPic->m_vChromaShift;
+    for (int c = 0; c < 2; c++)
+    {
+        for (int y = 0; y < heightC; y += 2)
+        {
+            const pixel* src = origPic->m_picOrg[c + 1] + y * origPic->m_strideC;
+            for (int x = 0; x < widthC; x += 2)
+                chromaHist[c][src[x] >> histShift]++;
+        }
+    }
+    histCount[1] = ((widthC + 1) / 2) * ((heightC + 1) / 2);
 }
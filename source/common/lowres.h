@@ -32,6 +32,9 @@
 namespace X265_NS {
 // private namespace
 
+class Lock;
+struct WeightParam;
+
 struct ReferencePlanes
 {
     ReferencePlanes() { memset(this, 0, sizeof(ReferencePlanes)); }
@@ -103,6 +106,16 @@ struct ReferencePlanes
     }
 };
 
+/* the four lowres planes of a reference weighted by one set of weights,
+ * shared by all the lookahead threads searching against them. The weights
+ * are held in w[0] */
+struct WeightedLowres : public ReferencePlanes
+{
+    pixel*          buffer;
+    int             refCount;
+    WeightedLowres* next;
+};
+
 /* lowres buffers, sizes and strides */
 struct Lowres : public ReferencePlanes
 {
@@ -143,6 +156,7 @@ struct Lowres : public ReferencePlanes
     double*   qpAqOffset;      // AQ QP offset values for each 16x16 CU
     double*   qpCuTreeOffset;  // cuTree QP offset values for each 16x16 CU
     int*      invQscaleFactor; // qScale values for qp Aq Offsets
+    bool      bFinalQpOffsets; // offsets given by the application, cu-tree leaves them unchanged
     uint64_t  wp_ssd[3];       // This is different than SSDY, this is sum(pixel^2) - sum(pixel)^2 for entire frame
     uint64_t  wp_sum[3];
 
@@ -150,9 +164,37 @@ struct Lowres : public ReferencePlanes
     uint16_t* propagateCost;
     double    weightedCostDelta[X265_BFRAME_MAX + 2];
 
-    bool create(PicYuv *origPic, int _bframes, bool bAqEnabled);
+    /* quarter resolution copy, analysed first by a hierarchical lookahead */
+    Lowres*   coarse;
+
+    /* histogram scenecut pre-detection statistics */
+    enum { HIST_BINS = 32, GRID_SIZE = 4 };
+    bool      bSceneStats;
+    uint32_t  lumaHist[HIST_BINS];
+    uint32_t  chromaHist[2][HIST_BINS];
+    uint32_t  histCount[2];                        // luma and per chroma plane samples
+    uint64_t  gridMean[GRID_SIZE * GRID_SIZE];     // luma sum of each region
+    uint64_t  gridEdge[GRID_SIZE * GRID_SIZE];     // luma gradient sum of each region
+
+    /* weighted copies of the lowres planes in use by the lookahead, each is
+     * freed with its last reference */
+    WeightedLowres* weightedPlanes;
+    Lock*           weightedLock;
+
+    bool create(PicYuv *origPic, int _bframes, bool bAqEnabled, bool bCoarse, bool bSceneStats, int numaNode);
     void destroy();
     void init(PicYuv *origPic, int poc);
+
+    /* returns the planes weighted by wp, or NULL if they could not be
+     * allocated. Each acquired reference must be released */
+    ReferencePlanes* acquireWeighted(const WeightParam& wp);
+    void releaseWeighted(ReferencePlanes* ref);
+
+protected:
+
+    bool alloc(int srcWidth, int srcHeight, int marginX, int marginY, bool bAqEnabled, int numaNode);
+    void reset(int poc);
+    void computeSceneStats(PicYuv *origPic);
 };
 }
 
@@ -106,7 +106,11 @@ void x265_param_default(x265_param* param)
     /* Applying default values to all elements in the param structure */
     param->cpuid = X265_NS::cpu_detect();
     param->bEnableWavefront = 1;
+    param->maxSlices = 1;
+    param->maxSliceBytes = 0;
     param->frameNumThreads = 0;
+    param->bAdaptiveFrameThreads = 0;
+    param->bDeadline = 0;
 
     param->logLevel = X265_LOG_INFO;
     param->csvfn = NULL;
@@ -142,12 +146,18 @@ void x265_param_default(x265_param* param)
     param->keyframeMin = 0;
     param->keyframeMax = 250;
     param->bOpenGOP = 1;
+    param->bIntraRefresh = 0;
+    param->chunkStart = 0;
+    param->chunkEnd = 0;
     param->bframes = 4;
     param->lookaheadDepth = 20;
     param->bFrameAdaptive = X265_B_ADAPT_TRELLIS;
     param->bBPyramid = 1;
     param->scenecutThreshold = 40; /* Magic number pulled in from x264 */
+    param->bHistBasedSceneCut = 0;
     param->lookaheadSlices = 0;
+    param->bHierarchicalLookahead = 0;
+    param->bLookaheadOnly = 0;
 
     /* Intra Coding Tools */
     param->bEnableConstrainedIntra = 0;
@@ -172,6 +182,7 @@ void x265_param_default(x265_param* param)
     param->bEnableTSkipFast = 0;
     param->maxNumReferences = 3;
     param->bEnableTemporalMvp = 1;
+    param->bLowresMvSeed = 0;
 
     /* Loop Filter */
     param->bEnableLoopFilter = 1;
@@ -213,6 +224,7 @@ void x265_param_default(x265_param* param)
     param->rc.bStatRead = 0;
     param->rc.bStatWrite = 0;
     param->rc.statFileName = NULL;
+    param->rc.bStatBinary = 0;
     param->rc.complexityBlur = 20;
     param->rc.qblur = 0.5;
     param->rc.zoneCount = 0;
@@ -560,6 +572,8 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
         }
     }
     OPT("frame-threads") p->frameNumThreads = atoi(value);
+    OPT("adaptive-frame-threads") p->bAdaptiveFrameThreads = atobool(value);
+    OPT("deadline") p->bDeadline = atobool(value);
     OPT("pmode") p->bDistributeModeAnalysis = atobool(value);
     OPT("pme") p->bDistributeMotionEstimation = atobool(value);
     OPT2("level-idc", "level")
@@ -586,6 +600,8 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
     OPT("annexb") p->bAnnexB = atobool(value);
     OPT("repeat-headers") p->bRepeatHeaders = atobool(value);
     OPT("wpp") p->bEnableWavefront = atobool(value);
+    OPT("slices") p->maxSlices = atoi(value);
+    OPT("slice-max-bytes") p->maxSliceBytes = atoi(value);
     OPT("ctu") p->maxCUSize = (uint32_t)atoi(value);
     OPT("min-cu-size") p->minCUSize = (uint32_t)atoi(value);
     OPT("tu-intra-depth") p->tuQTMaxIntraDepth = (uint32_t)atoi(value);
@@ -597,6 +613,7 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
     OPT("amp") p->bEnableAMP = atobool(value);
     OPT("max-merge") p->maxNumMergeCand = (uint32_t)atoi(value);
     OPT("temporal-mvp") p->bEnableTemporalMvp = atobool(value);
+    OPT("lowres-mv-seed") p->bLowresMvSeed = atobool(value);
     OPT("early-skip") p->bEnableEarlySkip = atobool(value);
     OPT("rdpenalty") p->rdPenalty = atoi(value);
     OPT("tskip") p->bEnableTransformSkip = atobool(value);
@@ -608,7 +625,10 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
     OPT2("constrained-intra", "cip") p->bEnableConstrainedIntra = atobool(value);
     OPT("fast-intra") p->bEnableFastIntra = atobool(value);
     OPT("open-gop") p->bOpenGOP = atobool(value);
+    OPT("intra-refresh") p->bIntraRefresh = atobool(value);
     OPT("lookahead-slices") p->lookaheadSlices = atoi(value);
+    OPT("hierarchical-lookahead") p->bHierarchicalLookahead = atobool(value);
+    OPT("lookahead-only") p->bLookaheadOnly = atobool(value);
     OPT("scenecut")
     {
         p->scenecutThreshold = atobool(value);
@@ -618,9 +638,12 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
             p->scenecutThreshold = atoi(value);
         }
     }
+    OPT("hist-scenecut") p->bHistBasedSceneCut = atobool(value);
     OPT("temporal-layers") p->bEnableTemporalSubLayers = atobool(value);
     OPT("keyint") p->keyframeMax = atoi(value);
     OPT("min-keyint") p->keyframeMin = atoi(value);
+    OPT("chunk-start") p->chunkStart = atoi(value);
+    OPT("chunk-end") p->chunkEnd = atoi(value);
     OPT("rc-lookahead") p->lookaheadDepth = atoi(value);
     OPT("bframes") p->bframes = atoi(value);
     OPT("bframe-bias") p->bFrameBias = atoi(value);
@@ -848,6 +871,7 @@ int x265_param_parse(x265_param* p, const char* name, const char* value)
         p->rc.bStatRead = pass & 2;
     }
     OPT("stats") p->rc.statFileName = strdup(value);
+    OPT("binary-stats") p->rc.bStatBinary = atobool(value);
     OPT("scaling-list") p->scalingLists = strdup(value);
     OPT2("pools", "numa-pools") p->numaPools = strdup(value);
     OPT("lambda-file") p->rc.lambdaFileName = strdup(value);
@@ -1097,6 +1121,8 @@ int x265_check_params(x265_param* param)
     CHECK(param->psyRd < 0 || 2.0 < param->psyRd, "Psy-rd strength must be between 0 and 2.0");
     CHECK(param->psyRdoq < 0 || 50.0 < param->psyRdoq, "Psy-rdoq strength must be between 0 and 50.0");
     CHECK(param->bEnableWavefront < 0, "WaveFrontSynchro cannot be negative");
+    CHECK(param->maxSlices < 1, "Slice count must be 1 or greater");
+    CHECK(param->maxSliceBytes < 0, "Max slice segment size cannot be negative");
     CHECK((param->vui.aspectRatioIdc < 0
            || param->vui.aspectRatioIdc > 16)
           && param->vui.aspectRatioIdc != X265_EXTENDED_SAR,
@@ -1154,6 +1180,10 @@ int x265_check_params(x265_param* param)
           "Valid penalty for 32x32 intra TU in non-I slices. 0:disabled 1:RD-penalty 2:maximum");
     CHECK(param->keyframeMax < -1,
           "Invalid max IDR period in frames. value should be greater than -1");
+    CHECK(param->chunkStart < 0 || param->chunkEnd < 0,
+          "Chunk start and end frames can not be less than zero");
+    CHECK(param->chunkEnd && param->chunkEnd < param->chunkStart,
+          "Chunk end frame must not precede the chunk start frame");
     CHECK(param->decodedPictureHashSEI < 0 || param->decodedPictureHashSEI > 3,
           "Invalid hash option. Decoded Picture Hash SEI 0: disabled, 1: MD5, 2: CRC, 3: Checksum");
     CHECK(param->rc.vbvBufferSize < 0,
@@ -1319,11 +1349,15 @@ void x265_print_params(x265_param* param)
     TOOLOPT(param->bCULossless, "cu-lossless");
     TOOLOPT(param->bEnableSignHiding, "signhide");
     TOOLOPT(param->bEnableTemporalMvp, "tmvp");
+    TOOLOPT(param->bLowresMvSeed, "lowres-mv-seed");
     TOOLOPT(param->bEnableConstrainedIntra, "cip");
     TOOLOPT(param->bIntraInBFrames, "b-intra");
+    TOOLOPT(param->bIntraRefresh, "intra-refresh");
     TOOLOPT(param->bEnableFastIntra, "fast-intra");
     TOOLOPT(param->bEnableStrongIntraSmoothing, "strong-intra-smoothing");
     TOOLVAL(param->lookaheadSlices, "lslices=%d");
+    TOOLOPT(param->bHierarchicalLookahead, "hier-lookahead");
+    TOOLOPT(param->bHistBasedSceneCut, "hist-scenecut");
     if (param->bEnableLoopFilter)
     {
         if (param->deblockingFilterBetaOffset || param->deblockingFilterTCOffset)
@@ -1394,6 +1428,9 @@ char *x265_param2string(x265_param* p)
     s += sprintf(s, " fps=%u/%u", p->fpsNum, p->fpsDenom);
     s += sprintf(s, " bitdepth=%d", p->internalBitDepth);
     BOOL(p->bEnableWavefront, "wpp");
+    BOOL(p->bDeadline, "deadline");
+    s += sprintf(s, " slices=%d", p->maxSlices);
+    s += sprintf(s, " slice-max-bytes=%d", p->maxSliceBytes);
     s += sprintf(s, " ctu=%d", p->maxCUSize);
     s += sprintf(s, " min-cu-size=%d", p->minCUSize);
     s += sprintf(s, " max-tu-size=%d", p->maxTUSize);
@@ -1406,6 +1443,7 @@ char *x265_param2string(x265_param* p)
     BOOL(p->bEnableAMP, "amp");
     s += sprintf(s, " max-merge=%d", p->maxNumMergeCand);
     BOOL(p->bEnableTemporalMvp, "temporal-mvp");
+    BOOL(p->bLowresMvSeed, "lowres-mv-seed");
     BOOL(p->bEnableEarlySkip, "early-skip");
     s += sprintf(s, " rdpenalty=%d", p->rdPenalty);
     BOOL(p->bEnableTransformSkip, "tskip");
@@ -1416,13 +1454,19 @@ char *x265_param2string(x265_param* p)
     BOOL(p->bEnableConstrainedIntra, "constrained-intra");
     BOOL(p->bEnableFastIntra, "fast-intra");
     BOOL(p->bOpenGOP, "open-gop");
+    BOOL(p->bIntraRefresh, "intra-refresh");
     BOOL(p->bEnableTemporalSubLayers, "temporal-layers");
     s += sprintf(s, " interlace=%d", p->interlaceMode);
     s += sprintf(s, " keyint=%d", p->keyframeMax);
     s += sprintf(s, " min-keyint=%d", p->keyframeMin);
+    s += sprintf(s, " chunk-start=%d", p->chunkStart);
+    s += sprintf(s, " chunk-end=%d", p->chunkEnd);
     s += sprintf(s, " scenecut=%d", p->scenecutThreshold);
+    BOOL(p->bHistBasedSceneCut, "hist-scenecut");
     s += sprintf(s, " rc-lookahead=%d", p->lookaheadDepth);
     s += sprintf(s, " lookahead-slices=%d", p->lookaheadSlices);
+    BOOL(p->bHierarchicalLookahead, "hierarchical-lookahead");
+    BOOL(p->bLookaheadOnly, "lookahead-only");
     s += sprintf(s, " bframes=%d", p->bframes);
     s += sprintf(s, " bframe-bias=%d", p->bFrameBias);
     s += sprintf(s, " b-adapt=%d", p->bFrameAdaptive);
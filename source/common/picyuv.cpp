@@ -38,13 +38,15 @@ PicYuv::PicYuv()
     m_picOrg[1] = NULL;
     m_picOrg[2] = NULL;
 
+    m_numaNode = -1;
+
     m_cuOffsetY = NULL;
     m_cuOffsetC = NULL;
     m_buOffsetY = NULL;
     m_buOffsetC = NULL;
 }
 
-bool PicYuv::create(uint32_t picWidth, uint32_t picHeight, uint32_t picCsp)
+bool PicYuv::create(uint32_t picWidth, uint32_t picHeight, uint32_t picCsp, int numaNode)
 {
     m_picWidth  = picWidth;
     m_picHeight = picHeight;
@@ -65,9 +67,11 @@ bool PicYuv::create(uint32_t picWidth, uint32_t picHeight, uint32_t picCsp)
     m_strideC = ((numCuInWidth * g_maxCUSize) >> m_hChromaShift) + (m_chromaMarginX * 2);
     int maxHeight = numCuInHeight * g_maxCUSize;
 
-    CHECKED_MALLOC(m_picBuf[0], pixel, m_stride * (maxHeight + (m_lumaMarginY * 2)));
-    CHECKED_MALLOC(m_picBuf[1], pixel, m_strideC * ((maxHeight >> m_vChromaShift) + (m_chromaMarginY * 2)));
-    CHECKED_MALLOC(m_picBuf[2], pixel, m_strideC * ((maxHeight >> m_vChromaShift) + (m_chromaMarginY * 2)));
+    m_numaNode = numaNode;
+
+    CHECKED_MALLOC_NODE(m_picBuf[0], pixel, m_stride * (maxHeight + (m_lumaMarginY * 2)), numaNode);
+    CHECKED_MALLOC_NODE(m_picBuf[1], pixel, m_strideC * ((maxHeight >> m_vChromaShift) + (m_chromaMarginY * 2)), numaNode);
+    CHECKED_MALLOC_NODE(m_picBuf[2], pixel, m_strideC * ((maxHeight >> m_vChromaShift) + (m_chromaMarginY * 2)), numaNode);
 
     m_picOrg[0] = m_picBuf[0] + m_lumaMarginY   * m_stride  + m_lumaMarginX;
     m_picOrg[1] = m_picBuf[1] + m_chromaMarginY * m_strideC + m_chromaMarginX;
@@ -79,6 +83,19 @@ fail:
     return false;
 }
 
+/* count sampled pages of the three planes which reside on the given NUMA node
+ * versus other nodes. Returns false if page placement cannot be queried */
+bool PicYuv::getNumaPageUsage(int numaNode, uint64_t& localPages, uint64_t& remotePages) const
+{
+    uint32_t maxHeight = ((m_picHeight + g_maxCUSize - 1) / g_maxCUSize) * g_maxCUSize;
+    size_t lumaSize = sizeof(pixel) * m_stride * (maxHeight + (m_lumaMarginY * 2));
+    size_t chromaSize = sizeof(pixel) * m_strideC * ((maxHeight >> m_vChromaShift) + (m_chromaMarginY * 2));
+
+    return x265_numa_page_usage(m_picBuf[0], lumaSize, numaNode, localPages, remotePages) &&
+           x265_numa_page_usage(m_picBuf[1], chromaSize, numaNode, localPages, remotePages) &&
+           x265_numa_page_usage(m_picBuf[2], chromaSize, numaNode, localPages, remotePages);
+}
+
 /* the first picture allocated by the encoder will be asked to generate these
  * offset arrays. Once generated, they will be provided to all future PicYuv
  * allocated by the same encoder. */
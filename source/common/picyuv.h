@@ -60,14 +60,18 @@ public:
     uint32_t m_chromaMarginX;
     uint32_t m_chromaMarginY;
 
+    int      m_numaNode;    // NUMA node the planes are bound to, or -1
+
     PicYuv();
 
-    bool  create(uint32_t picWidth, uint32_t picHeight, uint32_t csp);
+    bool  create(uint32_t picWidth, uint32_t picHeight, uint32_t csp, int numaNode);
     bool  createOffsets(const SPS& sps);
     void  destroy();
 
     void  copyFromPicture(const x265_picture&, int padx, int pady);
 
+    bool  getNumaPageUsage(int numaNode, uint64_t& localPages, uint64_t& remotePages) const;
+
     intptr_t getChromaAddrOffset(uint32_t ctuAddr, uint32_t absPartIdx) const { return m_cuOffsetC[ctuAddr] + m_buOffsetC[absPartIdx]; }
 
     /* get pointer to CTU start address */
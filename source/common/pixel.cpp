@@ -961,6 +961,56 @@ static void estimateCUPropagateCost(int* dst, const uint16_t* propagateIn, const
         dst[i] = (int)(propagateAmount * propagateNum / propagateDenom + 0.5);
     }
 }
+
+/* Split the propagate amount of each block between the four blocks its motion
+ * vector points into. The offsets of the top-left block (in blocks) are
+ * written to offsets, blocks which do not use this list get zero shares */
+static void estimateCUPropagateList(int32_t* shares, int16_t* offsets, const int32_t* propagateAmount, const uint16_t* lowresCosts,
+                                    const int16_t* mvs, int bipredWeight, int list, int len)
+{
+    for (int i = 0; i < len; i++, shares += 4, offsets += 2, mvs += 2)
+    {
+        int32_t listsUsed = lowresCosts[i] >> 14;
+        int32_t amount = propagateAmount[i];
+
+        if (amount <= 0 || !((listsUsed >> list) & 1))
+        {
+            shares[0] = shares[1] = shares[2] = shares[3] = 0;
+            offsets[0] = offsets[1] = 0;
+            continue;
+        }
+
+        /* Apply bipred weighting. */
+        if (listsUsed == 3)
+            amount = (amount * bipredWeight + 32) >> 6;
+
+        int32_t x = mvs[0];
+        int32_t y = mvs[1];
+        offsets[0] = (int16_t)(x >> 5);
+        offsets[1] = (int16_t)(y >> 5);
+        x &= 31;
+        y &= 31;
+        shares[0] = (amount * (32 - y) * (32 - x) + 512) >> 10;
+        shares[1] = (amount * (32 - y) * x + 512) >> 10;
+        shares[2] = (amount * y * (32 - x) + 512) >> 10;
+        shares[3] = (amount * y * x + 512) >> 10;
+    }
+}
+
+static void cuTreeFinishOffsets(double* qpCuTreeOffset, const double* qpAqOffset, const int32_t* intraCosts, const int32_t* invQscales,
+                                const uint16_t* propagateCosts, int fpsFactor, const double* strength, const double* weightDelta, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        int intracost = (intraCosts[i] * invQscales[i] + 128) >> 8;
+        if (intracost)
+        {
+            int propagateCost = (propagateCosts[i] * fpsFactor + 128) >> 8;
+            double log2_ratio = X265_LOG2(intracost + propagateCost) - X265_LOG2(intracost) + *weightDelta;
+            qpCuTreeOffset[i] = qpAqOffset[i] - *strength * log2_ratio;
+        }
+    }
+}
 }  // end anonymous namespace
 
 namespace X265_NS {
@@ -1246,5 +1296,7 @@ void setupPixelPrimitives_c(EncoderPrimitives &p)
     p.planecopy_cp = planecopy_cp_c;
     p.planecopy_sp = planecopy_sp_c;
     p.propagateCost = estimateCUPropagateCost;
+    p.propagateList = estimateCUPropagateList;
+    p.cuTreeFinish = cuTreeFinishOffsets;
 }
 }
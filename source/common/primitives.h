@@ -185,6 +185,8 @@ typedef void (*planecopy_cp_t) (const uint8_t* src, intptr_t srcStride, pixel* d
 typedef void (*planecopy_sp_t) (const uint16_t* src, intptr_t srcStride, pixel* dst, intptr_t dstStride, int width, int height, int shift, uint16_t mask);
 
 typedef void (*cutree_propagate_cost) (int* dst, const uint16_t* propagateIn, const int32_t* intraCosts, const uint16_t* interCosts, const int32_t* invQscales, const double* fpsFactor, int len);
+typedef void (*cutree_propagate_list_t) (int32_t* shares, int16_t* offsets, const int32_t* propagateAmount, const uint16_t* lowresCosts, const int16_t* mvs, int bipredWeight, int list, int len);
+typedef void (*cutree_finish_t) (double* qpCuTreeOffset, const double* qpAqOffset, const int32_t* intraCosts, const int32_t* invQscales, const uint16_t* propagateCosts, int fpsFactor, const double* strength, const double* weightDelta, int len);
 
 typedef int (*scanPosLast_t)(const uint16_t *scan, const coeff_t *coeff, uint16_t *coeffSign, uint16_t *coeffFlag, uint8_t *coeffNum, int numSig, const uint16_t* scanCG4x4, const int trSize);
 typedef uint32_t (*findPosFirstLast_t)(const int16_t *dstCoeff, const intptr_t trSize, const uint16_t scanTbl[16]);
@@ -308,6 +310,8 @@ struct EncoderPrimitives
 
     downscale_t           frameInitLowres;
     cutree_propagate_cost propagateCost;
+    cutree_propagate_list_t propagateList;
+    cutree_finish_t       cuTreeFinish;
 
     extendCURowBorder_t   extendRowBorder;
     planecopy_cp_t        planecopy_cp;
@@ -258,6 +258,7 @@ struct PPS
     bool     bTransquantBypassEnabled;  // Indicates presence of cu_transquant_bypass_flag in CUs.
     bool     bTransformSkipEnabled;     // use param
     bool     bEntropyCodingSyncEnabled; // use param
+    bool     bDependentSliceSegmentsEnabled; // use param
     bool     bSignHideEnabled;          // use param
 
     bool     bDeblockingFilterControlPresent;
@@ -327,9 +328,14 @@ public:
     uint32_t    m_maxNumMergeCand; // use param
     uint32_t    m_endCUAddr;
 
+    int         m_pirStartCol;     // first CTU column coded intra by intra refresh
+    int         m_pirEndCol;       // CTU column following the last one coded intra by intra refresh
+    int         m_pirRefLimitX;    // max right edge of the motion compensated blocks of CUs left of m_pirStartCol
+
     Slice()
     {
         m_lastIDR = 0;
+        m_pirStartCol = m_pirEndCol = m_pirRefLimitX = 0;
         m_sLFaseFlag = true;
         m_numRefIdx[0] = m_numRefIdx[1] = 0;
         for (int i = 0; i < MAX_NUM_REF; i++)
@@ -54,6 +54,7 @@
 #define ATOMIC_INC(ptr)       __sync_add_and_fetch((volatile int32_t*)ptr, 1)
 #define ATOMIC_DEC(ptr)       __sync_add_and_fetch((volatile int32_t*)ptr, -1)
 #define ATOMIC_ADD(ptr, val)  __sync_fetch_and_add((volatile int32_t*)ptr, val)
+#define ATOMIC_CAS32(ptr, oldval, newval) __sync_val_compare_and_swap((volatile int32_t*)ptr, oldval, newval)
 #define GIVE_UP_TIME()        usleep(0)
 
 #elif defined(_MSC_VER)       /* Windows atomic intrinsics */
@@ -67,6 +68,7 @@
 #define ATOMIC_ADD(ptr, val)  InterlockedExchangeAdd((volatile LONG*)ptr, val)
 #define ATOMIC_OR(ptr, mask)  _InterlockedOr((volatile LONG*)ptr, (LONG)mask)
 #define ATOMIC_AND(ptr, mask) _InterlockedAnd((volatile LONG*)ptr, (LONG)mask)
+#define ATOMIC_CAS32(ptr, oldval, newval) InterlockedCompareExchange((volatile LONG*)ptr, newval, oldval)
 #define GIVE_UP_TIME()        Sleep(0)
 
 #endif // ifdef __GNUC__
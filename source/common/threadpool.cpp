@@ -52,6 +52,10 @@
 
 #endif
 
+/* locate a thread's bit within the multi-word pool bitmaps */
+#define BITMAP_WORD(id) ((id) / SLEEPBITMAP_BITS)
+#define BITMAP_BIT(id)  ((sleepbitmap_t)1 << ((id) % SLEEPBITMAP_BITS))
+
 #if MACOS
 #include <sys/param.h>
 #include <sys/sysctl.h>
@@ -71,6 +75,13 @@ private:
     int          m_id;
     Event        m_wakeEvent;
 
+    /* Deque of job providers known to have pending work. The owning worker
+     * pops the newest highest-priority entry, idle peers steal the oldest */
+    Lock         m_queueLock;
+    JobProvider* m_jobQueue[MAX_QUEUED_JOBS];
+    int          m_queueHead;
+    int          m_queueCount;
+
     WorkerThread& operator =(const WorkerThread&);
 
 public:
@@ -78,13 +89,101 @@ public:
     JobProvider*     m_curJobProvider;
     BondedTaskGroup* m_bondMaster;
 
-    WorkerThread(ThreadPool& pool, int id) : m_pool(pool), m_id(id) {}
+#if DETAILED_CU_STATS
+    WorkerStats      m_stats;
+#endif
+
+    WorkerThread(ThreadPool& pool, int id) : m_pool(pool), m_id(id), m_queueHead(0), m_queueCount(0) {}
     virtual ~WorkerThread() {}
 
     void threadMain();
     void awaken()           { m_wakeEvent.trigger(); }
+
+    bool hasQueuedJobs() const { return m_queueCount > 0; }
+    void pushJob(JobProvider& jp);
+    JobProvider* popJob();
+    JobProvider* stealJob();
 };
 
+void WorkerThread::pushJob(JobProvider& jp)
+{
+    m_queueLock.acquire();
+
+    /* a provider needs at most one ticket per deque, findJob() processes all
+     * of its available work */
+    for (int i = 0; i < m_queueCount; i++)
+    {
+        if (m_jobQueue[(m_queueHead + i) % MAX_QUEUED_JOBS] == &jp)
+        {
+            m_queueLock.release();
+            return;
+        }
+    }
+
+    if (m_queueCount < MAX_QUEUED_JOBS)
+    {
+        m_jobQueue[(m_queueHead + m_queueCount) % MAX_QUEUED_JOBS] = &jp;
+        m_queueCount++;
+        ATOMIC_INC(&m_pool.m_queuedJobCount);
+    }
+
+    m_queueLock.release();
+}
+
+JobProvider* WorkerThread::popJob()
+{
+    if (!m_queueCount)
+        return NULL;
+
+    m_queueLock.acquire();
+
+    /* take the newest entry with the highest priority (lowest rank) */
+    int best = -1;
+    int bestRank = MAX_INT;
+    for (int i = m_queueCount - 1; i >= 0; i--)
+    {
+        int rank = m_jobQueue[(m_queueHead + i) % MAX_QUEUED_JOBS]->schedulingRank();
+        if (rank < bestRank)
+        {
+            best = i;
+            bestRank = rank;
+        }
+    }
+
+    JobProvider* jp = NULL;
+    if (best >= 0)
+    {
+        jp = m_jobQueue[(m_queueHead + best) % MAX_QUEUED_JOBS];
+        for (int i = best; i < m_queueCount - 1; i++)
+            m_jobQueue[(m_queueHead + i) % MAX_QUEUED_JOBS] = m_jobQueue[(m_queueHead + i + 1) % MAX_QUEUED_JOBS];
+        m_queueCount--;
+        ATOMIC_DEC(&m_pool.m_queuedJobCount);
+    }
+
+    m_queueLock.release();
+    return jp;
+}
+
+JobProvider* WorkerThread::stealJob()
+{
+    if (!m_queueCount)
+        return NULL;
+
+    JobProvider* jp = NULL;
+
+    m_queueLock.acquire();
+    if (m_queueCount)
+    {
+        jp = m_jobQueue[m_queueHead];
+        m_queueHead = (m_queueHead + 1) % MAX_QUEUED_JOBS;
+        m_queueCount--;
+        ATOMIC_DEC(&m_pool.m_queuedJobCount);
+    }
+    m_queueLock.release();
+
+    return jp;
+}
+
 void WorkerThread::threadMain()
 {
     THREAD_NAME("Worker", m_id);
@@ -97,12 +196,13 @@ void WorkerThread::threadMain()
 
     m_pool.setCurrentThreadAffinity();
 
-    sleepbitmap_t idBit = (sleepbitmap_t)1 << m_id;
+    int idWord = BITMAP_WORD(m_id);
+    sleepbitmap_t idBit = BITMAP_BIT(m_id);
     m_curJobProvider = m_pool.m_jpTable[0];
     m_bondMaster = NULL;
 
-    SLEEPBITMAP_OR(&m_curJobProvider->m_ownerBitmap, idBit);
-    SLEEPBITMAP_OR(&m_pool.m_sleepBitmap, idBit);
+    SLEEPBITMAP_OR(&m_curJobProvider->m_ownerBitmap[idWord], idBit);
+    SLEEPBITMAP_OR(&m_pool.m_sleepBitmap[idWord], idBit);
     m_wakeEvent.wait();
 
     while (m_pool.m_isActive)
@@ -114,102 +214,263 @@ void WorkerThread::threadMain()
             m_bondMaster = NULL;
         }
 
+        /* start with the job provider which woke this thread (if any), then
+         * drain the local deque, then steal from peers */
+        JobProvider* jp = m_curJobProvider;
         do
         {
-            /* do pending work for current job provider */
-            m_curJobProvider->findJob(m_id);
-
-            /* if the current job provider still wants help, only switch to a
-             * higher priority provider (lower slice type). Else take the first
-             * available job provider with the highest priority */
-            int curPriority = (m_curJobProvider->m_helpWanted) ? m_curJobProvider->m_sliceType :
-                                                                 INVALID_SLICE_PRIORITY + 1;
-            int nextProvider = -1;
-            for (int i = 0; i < m_pool.m_numProviders; i++)
+            if (jp != m_curJobProvider)
             {
-                if (m_pool.m_jpTable[i]->m_helpWanted &&
-                    m_pool.m_jpTable[i]->m_sliceType < curPriority)
-                {
-                    nextProvider = i;
-                    curPriority = m_pool.m_jpTable[i]->m_sliceType;
-                }
+                SLEEPBITMAP_AND(&m_curJobProvider->m_ownerBitmap[idWord], ~idBit);
+                m_curJobProvider = jp;
+                SLEEPBITMAP_OR(&m_curJobProvider->m_ownerBitmap[idWord], idBit);
             }
-            if (nextProvider != -1 && m_curJobProvider != m_pool.m_jpTable[nextProvider])
+
+            jp->findJob(m_id);
+
+            /* the provider returns after each row so a higher priority
+             * provider may be selected; keep a ticket if it has more work */
+            if (jp->m_helpWanted)
+                pushJob(*jp);
+
+            /* while other frame encoders are blocked waiting for reconstructed
+             * rows, the providers they wait on are served before any deque */
+            jp = m_pool.m_blockedDependentCount ? m_pool.findCriticalJob() : NULL;
+            if (jp)
             {
-                SLEEPBITMAP_AND(&m_curJobProvider->m_ownerBitmap, ~idBit);
-                m_curJobProvider = m_pool.m_jpTable[nextProvider];
-                SLEEPBITMAP_OR(&m_curJobProvider->m_ownerBitmap, idBit);
+#if DETAILED_CU_STATS
+                m_stats.countCriticalJobs++;
+#endif
+            }
+            else if ((jp = popJob()) != NULL)
+            {
+#if DETAILED_CU_STATS
+                m_stats.countLocalJobs++;
+#endif
+            }
+            else
+            {
+                jp = m_pool.stealJob(m_id);
+#if DETAILED_CU_STATS
+                if (jp)
+                    m_stats.countStolenJobs++;
+                else
+                    m_stats.countFailedSteals++;
+#endif
             }
         }
-        while (m_curJobProvider->m_helpWanted);
+        while (jp);
 
         /* While the worker sleeps, a job-provider or bond-group may acquire this
          * worker's sleep bitmap bit. Once acquired, that thread may modify 
          * m_bondMaster or m_curJobProvider, then waken the thread */
-        SLEEPBITMAP_OR(&m_pool.m_sleepBitmap, idBit);
+        SLEEPBITMAP_OR(&m_pool.m_sleepBitmap[idWord], idBit);
+
+        /* a job ticket may have been queued after this worker last checked the
+         * deques but before it was marked idle. If the sleep bit can be
+         * reclaimed, go look for it. Else another thread has acquired this
+         * worker and is about to wake it */
+        if (m_pool.m_queuedJobCount && (SLEEPBITMAP_AND(&m_pool.m_sleepBitmap[idWord], ~idBit) & idBit))
+            continue;
+
+#if DETAILED_CU_STATS
+        int64_t startTime = x265_mdate();
         m_wakeEvent.wait();
+        m_stats.idleTime += x265_mdate() - startTime;
+        m_stats.countSleeps++;
+#else
+        m_wakeEvent.wait();
+#endif
+    }
+
+    SLEEPBITMAP_OR(&m_pool.m_sleepBitmap[idWord], idBit);
+}
+
+void JobProvider::addBlockedDependents(int count)
+{
+    ATOMIC_ADD(&m_blockedDependents, count);
+    ATOMIC_ADD(&m_pool->m_blockedDependentCount, count);
+    if (count > 0)
+        tryWakeOne();
+}
+
+void JobProvider::beginBlockedOn(JobProvider* provider)
+{
+    X265_CHECK(!m_blockedChainLength, "provider stalled twice\n");
+    m_blockedWeight = 1 + m_blockedDependents;
+
+    /* m_blockedOn of other providers is read without a lock; a link which is
+     * just being made or broken only costs a transiently stale weight */
+    for (JobProvider* jp = provider; jp && jp != this && m_blockedChainLength < X265_MAX_FRAME_THREADS; jp = jp->m_blockedOn)
+    {
+        bool bVisited = false;
+        for (int i = 0; i < m_blockedChainLength; i++)
+            bVisited |= m_blockedChain[i] == jp;
+        if (bVisited)
+            break;
+
+        m_blockedChain[m_blockedChainLength++] = jp;
+        jp->addBlockedDependents(m_blockedWeight);
     }
 
-    SLEEPBITMAP_OR(&m_pool.m_sleepBitmap, idBit);
+    m_blockedOn = provider;
+}
+
+void JobProvider::endBlockedOn()
+{
+    m_blockedOn = NULL;
+    for (int i = 0; i < m_blockedChainLength; i++)
+        m_blockedChain[i]->addBlockedDependents(-m_blockedWeight);
+    m_blockedChainLength = 0;
 }
 
 void JobProvider::tryWakeOne()
 {
-    int id = m_pool->tryAcquireSleepingThread(m_ownerBitmap, ALL_POOL_THREADS);
+    int id = m_pool->tryAcquireSleepingThread(m_ownerBitmap, true);
     if (id < 0)
     {
         m_helpWanted = true;
+        m_pool->enqueueJob(*this);
         return;
     }
 
     WorkerThread& worker = m_pool->m_workers[id];
     if (worker.m_curJobProvider != this) /* poaching */
     {
-        sleepbitmap_t bit = (sleepbitmap_t)1 << id;
-        SLEEPBITMAP_AND(&worker.m_curJobProvider->m_ownerBitmap, ~bit);
+        int word = BITMAP_WORD(id);
+        sleepbitmap_t bit = BITMAP_BIT(id);
+        SLEEPBITMAP_AND(&worker.m_curJobProvider->m_ownerBitmap[word], ~bit);
         worker.m_curJobProvider = this;
-        SLEEPBITMAP_OR(&worker.m_curJobProvider->m_ownerBitmap, bit);
+        SLEEPBITMAP_OR(&worker.m_curJobProvider->m_ownerBitmap[word], bit);
     }
     worker.awaken();
 }
 
-int ThreadPool::tryAcquireSleepingThread(sleepbitmap_t firstTryBitmap, sleepbitmap_t secondTryBitmap)
+/* Queue a job ticket for the provider in the deque of a worker which most
+ * recently worked for it (they are all busy). Idle workers steal it from there */
+void ThreadPool::enqueueJob(JobProvider& jp)
 {
-    unsigned long id;
+    int id = (jp.m_jpId < 0 ? 0 : jp.m_jpId) % m_numWorkers;
+    for (int w = 0; w < m_numWords; w++)
+    {
+        sleepbitmap_t owners = jp.m_ownerBitmap[w];
+        if (owners)
+        {
+            unsigned long bit;
+            SLEEPBITMAP_CTZ(bit, owners);
+            id = w * SLEEPBITMAP_BITS + (int)bit;
+            break;
+        }
+    }
 
-    sleepbitmap_t masked = m_sleepBitmap & firstTryBitmap;
-    while (masked)
+    m_workers[id].pushJob(jp);
+
+    /* a worker may have gone idle while the ticket was being queued */
+    int sleeper = tryAcquireSleepingThread(NULL, true);
+    if (sleeper >= 0)
+        m_workers[sleeper].awaken();
+}
+
+/* Steal the oldest job ticket of the nearest busy peer. All workers of a pool
+ * share one NUMA node, so stealing never crosses the node boundary */
+JobProvider* ThreadPool::stealJob(int thiefId)
+{
+    if (!m_queuedJobCount)
+        return NULL;
+
+    for (int i = 1; i < m_numWorkers; i++)
     {
-        SLEEPBITMAP_CTZ(id, masked);
+        JobProvider* jp = m_workers[(thiefId + i) % m_numWorkers].stealJob();
+        if (jp)
+            return jp;
+    }
 
-        sleepbitmap_t bit = (sleepbitmap_t)1 << id;
-        if (SLEEPBITMAP_AND(&m_sleepBitmap, ~bit) & bit)
-            return (int)id;
+    return NULL;
+}
 
-        masked = m_sleepBitmap & firstTryBitmap;
+/* Find the provider with pending work which the most frame encoders are
+ * blocked on, ties going to the lower slice type */
+JobProvider* ThreadPool::findCriticalJob()
+{
+    JobProvider* best = NULL;
+    int bestRank = MAX_INT;
+    for (int i = 0; i < m_numProviders; i++)
+    {
+        JobProvider* jp = m_jpTable[i];
+        if (jp->m_helpWanted && jp->m_blockedDependents > 0 && jp->schedulingRank() < bestRank)
+        {
+            best = jp;
+            bestRank = jp->schedulingRank();
+        }
     }
 
-    masked = m_sleepBitmap & secondTryBitmap;
+    return best;
+}
+
+#if DETAILED_CU_STATS
+void ThreadPool::getWorkerStats(WorkerStats& stats)
+{
+    for (int i = 0; i < m_numWorkers; i++)
+        stats.accumulate(m_workers[i].m_stats);
+}
+#endif
+
+/* Atomically claim one sleeping thread whose bit is set in both the sleep
+ * bitmap word and the mask. Returns the bit index or -1 */
+static int acquireSleepBit(sleepbitmap_t* sleepWord, sleepbitmap_t mask)
+{
+    unsigned long id;
+
+    sleepbitmap_t masked = *sleepWord & mask;
     while (masked)
     {
         SLEEPBITMAP_CTZ(id, masked);
 
         sleepbitmap_t bit = (sleepbitmap_t)1 << id;
-        if (SLEEPBITMAP_AND(&m_sleepBitmap, ~bit) & bit)
+        if (SLEEPBITMAP_AND(sleepWord, ~bit) & bit)
             return (int)id;
 
-        masked = m_sleepBitmap & secondTryBitmap;
+        masked = *sleepWord & mask;
+    }
+
+    return -1;
+}
+
+/* Try the threads of firstTryBitmap (if not NULL), then any thread of the
+ * pool if bTryAllThreads is true. Each bitmap word is claimed independently
+ * so pools larger than one word remain lock-free */
+int ThreadPool::tryAcquireSleepingThread(const sleepbitmap_t* firstTryBitmap, bool bTryAllThreads)
+{
+    if (firstTryBitmap)
+    {
+        for (int w = 0; w < m_numWords; w++)
+        {
+            int id = acquireSleepBit(&m_sleepBitmap[w], firstTryBitmap[w]);
+            if (id >= 0)
+                return w * SLEEPBITMAP_BITS + id;
+        }
+    }
+
+    if (bTryAllThreads)
+    {
+        for (int w = 0; w < m_numWords; w++)
+        {
+            int id = acquireSleepBit(&m_sleepBitmap[w], (sleepbitmap_t)-1);
+            if (id >= 0)
+                return w * SLEEPBITMAP_BITS + id;
+        }
     }
 
     return -1;
 }
 
-int ThreadPool::tryBondPeers(int maxPeers, sleepbitmap_t peerBitmap, BondedTaskGroup& master)
+/* If peerBitmap is NULL, any idle thread of the pool may be bonded */
+int ThreadPool::tryBondPeers(int maxPeers, const sleepbitmap_t* peerBitmap, BondedTaskGroup& master)
 {
     int bondCount = 0;
     do
     {
-        int id = tryAcquireSleepingThread(peerBitmap, 0);
+        int id = tryAcquireSleepingThread(peerBitmap, !peerBitmap);
         if (id < 0)
             return bondCount;
 
@@ -247,7 +508,7 @@ ThreadPool* ThreadPool::allocThreadPools(x265_param* p, int& numPools)
             cpusPerNode[X265_MIN(node, (UCHAR)MAX_NODE_NUM)]++;
         else
 #elif HAVE_LIBNUMA
-        if (bNumaSupport >= 0)
+        if (bNumaSupport && numa_node_of_cpu(i) >= 0)
             cpusPerNode[X265_MIN(numa_node_of_cpu(i), MAX_NODE_NUM)]++;
         else
 #endif
@@ -346,6 +607,7 @@ bool ThreadPool::create(int numThreads, int maxProviders, int node)
 
     m_numaNode = node;
     m_numWorkers = numThreads;
+    m_numWords = (numThreads + SLEEPBITMAP_BITS - 1) / SLEEPBITMAP_BITS;
 
     m_workers = X265_MALLOC(WorkerThread, numThreads);
     /* placement new initialization */
@@ -380,7 +642,7 @@ void ThreadPool::stopWorkers()
         m_isActive = false;
         for (int i = 0; i < m_numWorkers; i++)
         {
-            while (!(m_sleepBitmap & ((sleepbitmap_t)1 << i)))
+            while (!(m_sleepBitmap[BITMAP_WORD(i)] & BITMAP_BIT(i)))
                 GIVE_UP_TIME();
             m_workers[i].awaken();
             m_workers[i].stop();
@@ -40,9 +40,39 @@ typedef uint64_t sleepbitmap_t;
 typedef uint32_t sleepbitmap_t;
 #endif
 
-static const sleepbitmap_t ALL_POOL_THREADS = (sleepbitmap_t)-1;
-enum { MAX_POOL_THREADS = sizeof(sleepbitmap_t) * 8 };
+/* Pool thread bitmaps span multiple words so a single pool may have more
+ * worker threads than there are bits in a native atomic integer. Each word
+ * is updated with atomic intrinsics, so no bitmap operation requires a lock */
+enum { SLEEPBITMAP_BITS = sizeof(sleepbitmap_t) * 8 };
+enum { MAX_POOL_WORDS = 256 / SLEEPBITMAP_BITS };
+enum { MAX_POOL_THREADS = SLEEPBITMAP_BITS * MAX_POOL_WORDS };
 enum { INVALID_SLICE_PRIORITY = 10 }; // a value larger than any X265_TYPE_* macro
+enum { MAX_QUEUED_JOBS = (X265_MAX_FRAME_THREADS + 1) * 2 }; // per-worker job deque depth
+
+#if DETAILED_CU_STATS
+/* Scheduler counters of each worker thread, summed by ThreadPool::getWorkerStats() */
+struct WorkerStats
+{
+    uint64_t countLocalJobs;   // jobs taken from the worker's own deque
+    uint64_t countStolenJobs;  // jobs stolen from the deque of a peer
+    uint64_t countCriticalJobs;// jobs taken from providers other frames are blocked on
+    uint64_t countFailedSteals;// times a worker found no job in any deque
+    uint64_t countSleeps;      // times a worker went idle
+    int64_t  idleTime;         // time spent asleep (microseconds)
+
+    WorkerStats() { memset(this, 0, sizeof(*this)); }
+
+    void accumulate(const WorkerStats& other)
+    {
+        countLocalJobs += other.countLocalJobs;
+        countStolenJobs += other.countStolenJobs;
+        countCriticalJobs += other.countCriticalJobs;
+        countFailedSteals += other.countFailedSteals;
+        countSleeps += other.countSleeps;
+        idleTime += other.idleTime;
+    }
+};
+#endif
 
 // Frame level job providers. FrameEncoder and Lookahead derive from
 // this class and implement findJob()
@@ -51,28 +81,57 @@ class JobProvider
 public:
 
     ThreadPool*   m_pool;
-    sleepbitmap_t m_ownerBitmap;
+    sleepbitmap_t m_ownerBitmap[MAX_POOL_WORDS];
     int           m_jpId;
     int           m_sliceType;
+    int           m_blockedDependents; // frame encoders stalled on this provider's output, directly or through other stalled encoders
+    JobProvider*  m_blockedOn;         // provider this one is stalled on, or NULL
+    JobProvider*  m_blockedChain[X265_MAX_FRAME_THREADS]; // providers which m_blockedWeight was added to
+    int           m_blockedChainLength;
+    int           m_blockedWeight;
     bool          m_helpWanted;
     bool          m_isFrameEncoder; /* rather ugly hack, but nothing better presents itself */
 
     JobProvider()
         : m_pool(NULL)
-        , m_ownerBitmap(0)
         , m_jpId(-1)
         , m_sliceType(INVALID_SLICE_PRIORITY)
+        , m_blockedDependents(0)
+        , m_blockedOn(NULL)
+        , m_blockedChainLength(0)
+        , m_blockedWeight(0)
         , m_helpWanted(false)
         , m_isFrameEncoder(false)
-    {}
+    {
+        memset(m_ownerBitmap, 0, sizeof(m_ownerBitmap));
+    }
 
     virtual ~JobProvider() {}
 
     // Worker threads will call this method to perform work
     virtual void findJob(int workerThreadId) = 0;
 
+    // Scheduling rank, lower values are scheduled first. Providers which other
+    // frame encoders are blocked on outrank all others (critical path), then
+    // lower slice types (references) outrank higher slice types
+    int schedulingRank() const { return m_sliceType - m_blockedDependents * (INVALID_SLICE_PRIORITY + 1); }
+
+    // While the count is non-zero, workers of the pool prefer this provider's jobs
+    void addBlockedDependents(int count);
+
+    // Called by a frame encoder around a wait for reconstructed rows of the
+    // frame of provider. The weight, one plus the encoders stalled on this
+    // one, is added to provider and to each provider down the chain it is
+    // itself stalled on, and removed from exactly those once the wait ends.
+    // Frame encoders are reused, so a stale link may close a cycle; the walk
+    // stops at the first provider it has already visited
+    void beginBlockedOn(JobProvider* provider);
+    void endBlockedOn();
+
     // Will awaken one idle thread, preferring a thread which most recently
-    // performed work for this provider.
+    // performed work for this provider. If no thread is idle, a job ticket for
+    // this provider is queued in the deque of a busy worker, where it may be
+    // stolen by the first peer to run out of work.
     void tryWakeOne();
 };
 
@@ -80,9 +139,12 @@ class ThreadPool
 {
 public:
 
-    sleepbitmap_t m_sleepBitmap;
+    sleepbitmap_t m_sleepBitmap[MAX_POOL_WORDS];
+    int           m_queuedJobCount; // job tickets in all worker deques
+    int           m_blockedDependentCount; // sum of m_blockedDependents of all providers
     int           m_numProviders;
     int           m_numWorkers;
+    int           m_numWords;       // bitmap words in use, covering m_numWorkers
     int           m_numaNode;
     bool          m_isActive;
 
@@ -96,8 +158,14 @@ public:
     bool start();
     void stopWorkers();
     void setCurrentThreadAffinity();
-    int  tryAcquireSleepingThread(sleepbitmap_t firstTryBitmap, sleepbitmap_t secondTryBitmap);
-    int  tryBondPeers(int maxPeers, sleepbitmap_t peerBitmap, BondedTaskGroup& master);
+    int  tryAcquireSleepingThread(const sleepbitmap_t* firstTryBitmap, bool bTryAllThreads);
+    int  tryBondPeers(int maxPeers, const sleepbitmap_t* peerBitmap, BondedTaskGroup& master);
+    void enqueueJob(JobProvider& jp);
+    JobProvider* stealJob(int thiefId);
+    JobProvider* findCriticalJob();
+#if DETAILED_CU_STATS
+    void getWorkerStats(WorkerStats& stats);
+#endif
 
     static ThreadPool* allocThreadPools(x265_param* p, int& numPools);
 
@@ -147,7 +215,7 @@ public:
      * processTasks() method. */
     int tryBondPeers(ThreadPool& pool, int maxPeers)
     {
-        int count = pool.tryBondPeers(maxPeers, ALL_POOL_THREADS, *this);
+        int count = pool.tryBondPeers(maxPeers, NULL, *this);
         m_bondedPeerCount += count;
         return count;
     }
@@ -0,0 +1,200 @@
+/*****************************************************************************
+ * Copyright (C) 2015 x265 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at license @ x265.com.
+ *****************************************************************************/
+
+#include "common.h"
+#include "primitives.h"
+#include <xmmintrin.h> // SSE
+#include <smmintrin.h> // SSE4.1
+
+using namespace X265_NS;
+
+static void propagateList(int32_t* shares, int16_t* offsets, const int32_t* propagateAmount, const uint16_t* lowresCosts,
+                          const int16_t* mvs, int bipredWeight, int list, int len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c3 = _mm_set1_epi32(3);
+    const __m128i c31 = _mm_set1_epi32(31);
+    const __m128i c32 = _mm_set1_epi32(32);
+    const __m128i c512 = _mm_set1_epi32(512);
+    const __m128i lowHalf = _mm_set1_epi32(0xffff);
+    const __m128i listBit = _mm_set1_epi32(1 << list);
+    const __m128i weight = _mm_set1_epi32(bipredWeight);
+
+    int i = 0;
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128i amount = _mm_loadu_si128((const __m128i*)(propagateAmount + i));
+        __m128i used = _mm_srli_epi32(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(lowresCosts + i))), 14);
+        __m128i valid = _mm_and_si128(_mm_cmpgt_epi32(amount, zero), _mm_cmpeq_epi32(_mm_and_si128(used, listBit), listBit));
+
+        /* bipred weighting */
+        __m128i bipred = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(amount, weight), c32), 6);
+        amount = _mm_blendv_epi8(amount, bipred, _mm_cmpeq_epi32(used, c3));
+        amount = _mm_and_si128(amount, valid);
+
+        /* each 32bit lane holds one MV, x in the low half */
+        __m128i mv = _mm_loadu_si128((const __m128i*)(mvs + 2 * i));
+        __m128i x = _mm_srai_epi32(_mm_slli_epi32(mv, 16), 16);
+        __m128i y = _mm_srai_epi32(mv, 16);
+
+        __m128i offs = _mm_or_si128(_mm_and_si128(_mm_srai_epi32(x, 5), lowHalf), _mm_slli_epi32(_mm_srai_epi32(y, 5), 16));
+        _mm_storeu_si128((__m128i*)(offsets + 2 * i), _mm_and_si128(offs, valid));
+
+        x = _mm_and_si128(x, c31);
+        y = _mm_and_si128(y, c31);
+        __m128i x0 = _mm_sub_epi32(c32, x);
+        __m128i y0 = _mm_sub_epi32(c32, y);
+
+        /* the bilinear weights are at most 1024, 16bit products suffice */
+        __m128i s0 = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(amount, _mm_mullo_epi16(y0, x0)), c512), 10);
+        __m128i s1 = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(amount, _mm_mullo_epi16(y0, x)), c512), 10);
+        __m128i s2 = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(amount, _mm_mullo_epi16(y, x0)), c512), 10);
+        __m128i s3 = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(amount, _mm_mullo_epi16(y, x)), c512), 10);
+
+        /* transpose to four shares per block */
+        __m128i t0 = _mm_unpacklo_epi32(s0, s1);
+        __m128i t1 = _mm_unpacklo_epi32(s2, s3);
+        __m128i t2 = _mm_unpackhi_epi32(s0, s1);
+        __m128i t3 = _mm_unpackhi_epi32(s2, s3);
+        _mm_storeu_si128((__m128i*)(shares + 4 * i + 0), _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(shares + 4 * i + 4), _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(shares + 4 * i + 8), _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i*)(shares + 4 * i + 12), _mm_unpackhi_epi64(t2, t3));
+    }
+
+    for (; i < len; i++)
+    {
+        int32_t listsUsed = lowresCosts[i] >> 14;
+        int32_t amount = propagateAmount[i];
+        int32_t* s = shares + 4 * i;
+
+        if (amount <= 0 || !((listsUsed >> list) & 1))
+        {
+            s[0] = s[1] = s[2] = s[3] = 0;
+            offsets[2 * i] = offsets[2 * i + 1] = 0;
+            continue;
+        }
+
+        if (listsUsed == 3)
+            amount = (amount * bipredWeight + 32) >> 6;
+
+        int32_t x = mvs[2 * i];
+        int32_t y = mvs[2 * i + 1];
+        offsets[2 * i] = (int16_t)(x >> 5);
+        offsets[2 * i + 1] = (int16_t)(y >> 5);
+        x &= 31;
+        y &= 31;
+        s[0] = (amount * (32 - y) * (32 - x) + 512) >> 10;
+        s[1] = (amount * (32 - y) * x + 512) >> 10;
+        s[2] = (amount * y * (32 - x) + 512) >> 10;
+        s[3] = (amount * y * x + 512) >> 10;
+    }
+}
+
+/* log2 of two positive doubles; the mantissa is reduced to [sqrt(0.5), sqrt(2))
+ * and its log taken by the atanh series, accurate to about 1e-14 */
+static inline __m128d log2_pd(__m128d v)
+{
+    const __m128i mantMask = _mm_set1_epi64x(0x000FFFFFFFFFFFFFLL);
+    const __m128i one = _mm_set1_epi64x(0x3FF0000000000000LL);
+    const __m128d sqrt2 = _mm_set1_pd(1.4142135623730950488);
+
+    __m128i bits = _mm_castpd_si128(v);
+    __m128i exp = _mm_sub_epi32(_mm_srli_epi64(bits, 52), _mm_set1_epi32(1023));
+    __m128d e = _mm_cvtepi32_pd(_mm_shuffle_epi32(exp, _MM_SHUFFLE(3, 1, 2, 0)));
+    __m128d m = _mm_castsi128_pd(_mm_or_si128(_mm_and_si128(bits, mantMask), one));
+
+    __m128d big = _mm_cmpgt_pd(m, sqrt2);
+    m = _mm_blendv_pd(m, _mm_mul_pd(m, _mm_set1_pd(0.5)), big);
+    e = _mm_add_pd(e, _mm_and_pd(big, _mm_set1_pd(1.0)));
+
+    __m128d z = _mm_div_pd(_mm_sub_pd(m, _mm_set1_pd(1.0)), _mm_add_pd(m, _mm_set1_pd(1.0)));
+    __m128d z2 = _mm_mul_pd(z, z);
+    __m128d p = _mm_set1_pd(1.0 / 15);
+    p = _mm_add_pd(_mm_mul_pd(p, z2), _mm_set1_pd(1.0 / 13));
+    p = _mm_add_pd(_mm_mul_pd(p, z2), _mm_set1_pd(1.0 / 11));
+    p = _mm_add_pd(_mm_mul_pd(p, z2), _mm_set1_pd(1.0 / 9));
+    p = _mm_add_pd(_mm_mul_pd(p, z2), _mm_set1_pd(1.0 / 7));
+    p = _mm_add_pd(_mm_mul_pd(p, z2), _mm_set1_pd(1.0 / 5));
+    p = _mm_add_pd(_mm_mul_pd(p, z2), _mm_set1_pd(1.0 / 3));
+    p = _mm_add_pd(_mm_mul_pd(p, z2), _mm_set1_pd(1.0));
+
+    /* 2 * z * p / ln(2) */
+    return _mm_add_pd(e, _mm_mul_pd(_mm_mul_pd(z, p), _mm_set1_pd(2.8853900817779268147)));
+}
+
+static void cuTreeFinish(double* qpCuTreeOffset, const double* qpAqOffset, const int32_t* intraCosts, const int32_t* invQscales,
+                         const uint16_t* propagateCosts, int fpsFactor, const double* strength, const double* weightDelta, int len)
+{
+    const __m128i c128 = _mm_set1_epi32(128);
+    const __m128i fps = _mm_set1_epi32(fpsFactor);
+    const __m128d vStrength = _mm_set1_pd(*strength);
+    const __m128d vDelta = _mm_set1_pd(*weightDelta);
+
+    int i = 0;
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128i intra = _mm_loadu_si128((const __m128i*)(intraCosts + i));
+        __m128i invQ = _mm_loadu_si128((const __m128i*)(invQscales + i));
+        __m128i prop = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(propagateCosts + i)));
+
+        intra = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(intra, invQ), c128), 8);
+        prop = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(prop, fps), c128), 8);
+        __m128i sum = _mm_add_epi32(intra, prop);
+        __m128i zero = _mm_cmpeq_epi32(intra, _mm_setzero_si128());
+
+        for (int half = 0; half < 2; half++)
+        {
+            __m128d a = _mm_cvtepi32_pd(intra);
+            __m128d b = _mm_cvtepi32_pd(sum);
+            __m128d ratio = _mm_add_pd(_mm_sub_pd(log2_pd(b), log2_pd(a)), vDelta);
+            __m128d offset = _mm_sub_pd(_mm_loadu_pd(qpAqOffset + i + 2 * half), _mm_mul_pd(vStrength, ratio));
+
+            /* blocks without intra cost keep their offset */
+            __m128d keep = _mm_castsi128_pd(_mm_cvtepi32_epi64(zero));
+            offset = _mm_blendv_pd(offset, _mm_loadu_pd(qpCuTreeOffset + i + 2 * half), keep);
+            _mm_storeu_pd(qpCuTreeOffset + i + 2 * half, offset);
+
+            intra = _mm_srli_si128(intra, 8);
+            sum = _mm_srli_si128(sum, 8);
+            zero = _mm_srli_si128(zero, 8);
+        }
+    }
+
+    for (; i < len; i++)
+    {
+        int intracost = (intraCosts[i] * invQscales[i] + 128) >> 8;
+        if (intracost)
+        {
+            int propagateCost = (propagateCosts[i] * fpsFactor + 128) >> 8;
+            double log2_ratio = X265_LOG2(intracost + propagateCost) - X265_LOG2(intracost) + *weightDelta;
+            qpCuTreeOffset[i] = qpAqOffset[i] - *strength * log2_ratio;
+        }
+    }
+}
+
+namespace X265_NS {
+void setupIntrinsicCuTree_sse41(EncoderPrimitives &p)
+{
+    p.propagateList = propagateList;
+    p.cuTreeFinish = cuTreeFinish;
+}
+}
@@ -75,6 +75,7 @@ Analysis::Analysis()
     m_reuseInterDataCTU = NULL;
     m_reuseRef = NULL;
     m_reuseBestMergeCand = NULL;
+    m_bPirNoIntra = false;
 }
 
 bool Analysis::create(ThreadLocalData *tld)
@@ -148,13 +149,19 @@ Mode& Analysis::compressCTU(CUData& ctu, Frame& frame, const CUGeom& cuGeom, con
         {
             int numPredDir = m_slice->isInterP() ? 1 : 2;
             m_reuseInterDataCTU = (analysis_inter_data*)m_frame->m_analysisData.interData;
-            m_reuseRef = &m_reuseInterDataCTU->ref[ctu.m_cuAddr * X265_MAX_PRED_MODE_PER_CTU * numPredDir];
-            m_reuseBestMergeCand = &m_reuseInterDataCTU->bestMergeCand[ctu.m_cuAddr * CUGeom::MAX_GEOMS];
+            /* analysis scaled from another resolution has no reference or merge decisions */
+            m_reuseRef = m_reuseInterDataCTU->ref ? &m_reuseInterDataCTU->ref[ctu.m_cuAddr * X265_MAX_PRED_MODE_PER_CTU * numPredDir] : NULL;
+            m_reuseBestMergeCand = m_reuseInterDataCTU->bestMergeCand ? &m_reuseInterDataCTU->bestMergeCand[ctu.m_cuAddr * CUGeom::MAX_GEOMS] : NULL;
         }
     }
 
     ProfileCUScope(ctu, totalCTUTime, totalCTUs);
 
+    /* CTU columns of an intra refresh wave are coded intra */
+    uint32_t col = ctu.m_cuAddr % m_slice->m_sps->numCuInWidth;
+    bool bRefreshCTU = col >= (uint32_t)m_slice->m_pirStartCol && col < (uint32_t)m_slice->m_pirEndCol;
+    m_bPirNoIntra = m_slice->m_pirEndCol && col == (uint32_t)m_slice->m_pirEndCol;
+
     uint32_t zOrder = 0;
     if (m_slice->m_sliceType == I_SLICE)
     {
@@ -168,6 +175,8 @@ Mode& Analysis::compressCTU(CUData& ctu, Frame& frame, const CUGeom& cuGeom, con
             memcpy(&m_reuseIntraDataCTU->chromaModes[ctu.m_cuAddr * numPartition], bestCU->m_chromaIntraDir, sizeof(uint8_t) * numPartition);
         }
     }
+    else if (bRefreshCTU)
+        compressIntraCU(ctu, cuGeom, zOrder, qp);
     else
     {
         if (!m_param->rdLevel)
@@ -186,14 +195,13 @@ Mode& Analysis::compressCTU(CUData& ctu, Frame& frame, const CUGeom& cuGeom, con
         else if (m_param->rdLevel <= 4)
             compressInterCU_rd0_4(ctu, cuGeom, qp);
         else
-        {
             compressInterCU_rd5_6(ctu, cuGeom, zOrder, qp);
-            if (m_param->analysisMode == X265_ANALYSIS_SAVE && m_frame->m_analysisData.interData)
-            {
-                CUData* bestCU = &m_modeDepth[0].bestMode->cu;
-                memcpy(&m_reuseInterDataCTU->depth[ctu.m_cuAddr * numPartition], bestCU->m_cuDepth, sizeof(uint8_t) * numPartition);
-                memcpy(&m_reuseInterDataCTU->modes[ctu.m_cuAddr * numPartition], bestCU->m_predMode, sizeof(uint8_t) * numPartition);
-            }
+
+        if (m_param->analysisMode == X265_ANALYSIS_SAVE && m_frame->m_analysisData.interData)
+        {
+            CUData* bestCU = &m_modeDepth[0].bestMode->cu;
+            memcpy(&m_reuseInterDataCTU->depth[ctu.m_cuAddr * numPartition], bestCU->m_cuDepth, sizeof(uint8_t) * numPartition);
+            memcpy(&m_reuseInterDataCTU->modes[ctu.m_cuAddr * numPartition], bestCU->m_predMode, sizeof(uint8_t) * numPartition);
         }
     }
 
@@ -261,7 +269,7 @@ void Analysis::compressIntraCU(const CUData& parentCTU, const CUGeom& cuGeom, ui
                 addSplitFlagCost(*md.bestMode, cuGeom.depth);
 
             // increment zOrder offset to point to next best depth in sharedDepth buffer
-            zOrder += g_depthInc[g_maxCUDepth - 1][reuseDepth[zOrder]];
+            zOrder += cuGeom.numPartitions;
             mightSplit = false;
         }
     }
@@ -321,7 +329,7 @@ void Analysis::compressIntraCU(const CUData& parentCTU, const CUGeom& cuGeom, ui
             {
                 /* record the depth of this non-present sub-CU */
                 splitCU->setEmptyPart(childGeom, subPartIdx);
-                zOrder += g_depthInc[g_maxCUDepth - 1][nextDepth];
+                zOrder += childGeom.numPartitions;
             }
         }
         nextContext->store(splitPred->contexts);
@@ -377,6 +385,7 @@ void Analysis::processPmode(PMODE& pmode, Analysis& slave)
         slave.m_slice = m_slice;
         slave.m_frame = m_frame;
         slave.m_param = m_param;
+        slave.m_me.setSubpelRefine(m_param->subpelRefine);
         slave.setLambdaFromQP(md.pred[PRED_2Nx2N].cu, m_rdCost.m_qp);
         slave.invalidateContexts(0);
         slave.m_rqt[pmode.cuGeom.depth].cur.load(m_rqt[pmode.cuGeom.depth].cur);
@@ -508,7 +517,7 @@ void Analysis::compressInterCU_dist(const CUData& parentCTU, const CUGeom& cuGeo
     if (mightNotSplit && depth >= minDepth)
     {
         int bTryAmp = m_slice->m_sps->maxAMPDepth > depth;
-        int bTryIntra = m_slice->m_sliceType != B_SLICE || m_param->bIntraInBFrames;
+        int bTryIntra = (m_slice->m_sliceType != B_SLICE || m_param->bIntraInBFrames) && !m_bPirNoIntra;
 
         PMODE pmode(*this, cuGeom);
 
@@ -761,6 +770,23 @@ uint32_t Analysis::compressInterCU_rd0_4(const CUData& parentCTU, const CUGeom&
     bool earlyskip = false;
     bool splitIntra = true;
     uint32_t splitRefs[4] = { 0, 0, 0, 0 };
+    bool bReuseSkip = false;
+
+    /* Analysis scaled from another resolution has no reference indices to
+     * replay, its CU depths decide the recursion instead. A CU which was
+     * skipped at that depth only evaluates merge candidates */
+    if (m_param->analysisMode == X265_ANALYSIS_LOAD && m_reuseInterDataCTU && !m_reuseRef)
+    {
+        uint32_t reuseIdx = parentCTU.m_cuAddr * parentCTU.m_numPartitions + cuGeom.absPartIdx;
+        if (mightSplit && m_reuseInterDataCTU->depth[reuseIdx] > depth)
+            mightNotSplit = false;
+        else if (mightNotSplit && depth >= minDepth)
+        {
+            mightSplit = false;
+            bReuseSkip = m_reuseInterDataCTU->modes[reuseIdx] == MODE_SKIP;
+        }
+    }
+
     /* Step 1. Evaluate Merge/Skip candidates for likely early-outs */
     if (mightNotSplit && depth >= minDepth)
     {
@@ -769,7 +795,7 @@ uint32_t Analysis::compressInterCU_rd0_4(const CUData& parentCTU, const CUGeom&
         md.pred[PRED_SKIP].cu.initSubCU(parentCTU, cuGeom, qp);
         checkMerge2Nx2N_rd0_4(md.pred[PRED_SKIP], md.pred[PRED_MERGE], cuGeom);
         if (m_param->rdLevel)
-            earlyskip = m_param->bEnableEarlySkip && md.bestMode && md.bestMode->cu.isSkipped(0); // TODO: sa8d threshold per depth
+            earlyskip = (m_param->bEnableEarlySkip || bReuseSkip) && md.bestMode && md.bestMode->cu.isSkipped(0); // TODO: sa8d threshold per depth
     }
 
     bool bNoSplit = false;
@@ -941,7 +967,7 @@ uint32_t Analysis::compressInterCU_rd0_4(const CUData& parentCTU, const CUGeom&
                         bestInter = &md.pred[PRED_nRx2N];
                 }
             }
-            bool bTryIntra = m_slice->m_sliceType != B_SLICE || m_param->bIntraInBFrames;
+            bool bTryIntra = (m_slice->m_sliceType != B_SLICE || m_param->bIntraInBFrames) && !m_bPirNoIntra;
             if (m_param->rdLevel >= 3)
             {
                 /* Calculate RD cost of best inter option */
@@ -1163,7 +1189,7 @@ void Analysis::compressInterCU_rd5_6(const CUData& parentCTU, const CUGeom& cuGe
                 addSplitFlagCost(*md.bestMode, cuGeom.depth);
 
             // increment zOrder offset to point to next best depth in sharedDepth buffer
-            zOrder += g_depthInc[g_maxCUDepth - 1][reuseDepth[zOrder]];
+            zOrder += cuGeom.numPartitions;
 
             mightSplit = false;
             mightNotSplit = false;
@@ -1241,7 +1267,7 @@ void Analysis::compressInterCU_rd5_6(const CUData& parentCTU, const CUGeom& cuGe
                 }
             }
 
-            if (m_slice->m_sliceType != B_SLICE || m_param->bIntraInBFrames)
+            if ((m_slice->m_sliceType != B_SLICE || m_param->bIntraInBFrames) && !m_bPirNoIntra)
             {
                 md.pred[PRED_INTRA].cu.initSubCU(parentCTU, cuGeom, qp);
                 checkIntra(md.pred[PRED_INTRA], cuGeom, SIZE_2Nx2N, NULL, NULL);
@@ -1299,7 +1325,7 @@ void Analysis::compressInterCU_rd5_6(const CUData& parentCTU, const CUGeom& cuGe
             else
             {
                 splitCU->setEmptyPart(childGeom, subPartIdx);
-                zOrder += g_depthInc[g_maxCUDepth - 1][nextDepth];
+                zOrder += childGeom.numPartitions;
             }
         }
         nextContext->store(splitPred->contexts);
@@ -1358,6 +1384,9 @@ void Analysis::checkMerge2Nx2N_rd0_4(Mode& skip, Mode& merge, const CUGeom& cuGe
             candMvField[i][1].mv.y >= (m_param->searchRange + 1) * 4))
             continue;
 
+        if (m_slice->m_pirEndCol && candMvField[i][0].mv.x > refreshMaxMvX(tempPred->cu))
+            continue;
+
         tempPred->cu.m_mvpIdx[0][0] = (uint8_t)i; // merge candidate ID is stored in L0 MVP idx
         X265_CHECK(m_slice->m_sliceType == B_SLICE || !(candDir[i] & 0x10), " invalid merge for P slice\n");
         tempPred->cu.m_interDir[0] = candDir[i];
@@ -1457,7 +1486,7 @@ void Analysis::checkMerge2Nx2N_rd5_6(Mode& skip, Mode& merge, const CUGeom& cuGe
     bestPred->rdCost = MAX_INT64;
 
     uint32_t first = 0, last = numMergeCand;
-    if (isShareMergeCand)
+    if (isShareMergeCand && m_reuseBestMergeCand)
     {
         first = *m_reuseBestMergeCand;
         last = first + 1;
@@ -1470,6 +1499,9 @@ void Analysis::checkMerge2Nx2N_rd5_6(Mode& skip, Mode& merge, const CUGeom& cuGe
             candMvField[i][1].mv.y >= (m_param->searchRange + 1) * 4))
             continue;
 
+        if (m_slice->m_pirEndCol && candMvField[i][0].mv.x > refreshMaxMvX(tempPred->cu))
+            continue;
+
         /* the merge candidate list is packed with MV(0,0) ref 0 when it is not full */
         if (candDir[i] == 1 && !candMvField[i][0].mv.word && !candMvField[i][0].refIdx)
         {
@@ -1550,7 +1582,7 @@ void Analysis::checkMerge2Nx2N_rd5_6(Mode& skip, Mode& merge, const CUGeom& cuGe
         X265_CHECK(bestPred->ok(), "merge mode is not ok");
     }
 
-    if (m_param->analysisMode)
+    if (m_param->analysisMode && m_reuseBestMergeCand)
     {
         m_reuseBestMergeCand++;
         if (m_param->analysisMode == X265_ANALYSIS_SAVE)
@@ -1571,10 +1603,7 @@ void Analysis::checkInter_rd0_4(Mode& interMode, const CUGeom& cuGeom, PartSize
         {
             MotionData* bestME = interMode.bestME[part];
             for (int32_t i = 0; i < numPredDir; i++)
-            {
-                bestME[i].ref = *m_reuseRef;
-                m_reuseRef++;
-            }
+                bestME[i].ref = m_reuseRef ? *m_reuseRef++ : -1;
         }
     }
 
@@ -1619,10 +1648,7 @@ void Analysis::checkInter_rd5_6(Mode& interMode, const CUGeom& cuGeom, PartSize
         {
             MotionData* bestME = interMode.bestME[puIdx];
             for (int32_t i = 0; i < numPredDir; i++)
-            {
-                bestME[i].ref = *m_reuseRef;
-                m_reuseRef++;
-            }
+                bestME[i].ref = m_reuseRef ? *m_reuseRef++ : -1;
         }
     }
 
@@ -1886,6 +1912,123 @@ void Analysis::encodeResidue(const CUData& ctu, const CUGeom& cuGeom)
     cu.updatePic(cuGeom.depth);
 }
 
+Mode& Analysis::recodeCTU(CUData& ctu, Frame& frame, const CUGeom& cuGeom, const Entropy& initialContext)
+{
+    m_slice = ctu.m_slice;
+    m_frame = &frame;
+
+#if _DEBUG || CHECKED_BUILD
+    for (uint32_t i = 0; i <= g_maxCUDepth; i++)
+        for (uint32_t j = 0; j < MAX_PRED_TYPES; j++)
+            m_modeDepth[i].pred[j].invalidate();
+    invalidateContexts(0);
+#endif
+
+    int qp = setLambdaFromQP(ctu, m_slice->m_pps->bUseDQP ? calculateQpforCuSize(ctu, cuGeom) : m_slice->m_sliceQp);
+
+    m_rqt[0].cur.load(initialContext);
+    m_modeDepth[0].fencYuv.copyFromPicYuv(*m_frame->m_fencPic, ctu.m_cuAddr, 0);
+
+    ProfileCUScope(ctu, totalCTUTime, totalCTUs);
+
+    recodeCU(ctu, cuGeom, qp);
+
+    return *m_modeDepth[0].bestMode;
+}
+
+void Analysis::recodeCU(const CUData& parentCTU, const CUGeom& cuGeom, int32_t qp)
+{
+    uint32_t depth = cuGeom.depth;
+    ModeDepth& md = m_modeDepth[depth];
+
+    if (parentCTU.m_cuDepth[cuGeom.absPartIdx] > depth)
+    {
+        Mode* splitPred = &md.pred[PRED_SPLIT];
+        splitPred->initCosts();
+        CUData* splitCU = &splitPred->cu;
+        splitCU->initSubCU(parentCTU, cuGeom, qp);
+
+        uint32_t nextDepth = depth + 1;
+        ModeDepth& nd = m_modeDepth[nextDepth];
+        invalidateContexts(nextDepth);
+        Entropy* nextContext = &m_rqt[depth].cur;
+        int nextQP = qp;
+
+        for (uint32_t subPartIdx = 0; subPartIdx < 4; subPartIdx++)
+        {
+            const CUGeom& childGeom = *(&cuGeom + cuGeom.childOffset + subPartIdx);
+            if (childGeom.flags & CUGeom::PRESENT)
+            {
+                m_modeDepth[0].fencYuv.copyPartToYuv(nd.fencYuv, childGeom.absPartIdx);
+                m_rqt[nextDepth].cur.load(*nextContext);
+
+                if (m_slice->m_pps->bUseDQP && nextDepth <= m_slice->m_pps->maxCuDQPDepth)
+                    nextQP = setLambdaFromQP(parentCTU, calculateQpforCuSize(parentCTU, childGeom));
+
+                recodeCU(parentCTU, childGeom, nextQP);
+
+                splitCU->copyPartFrom(nd.bestMode->cu, childGeom, subPartIdx);
+                splitPred->addSubCosts(*nd.bestMode);
+                nd.bestMode->reconYuv.copyToPartYuv(splitPred->reconYuv, childGeom.numPartitions * subPartIdx);
+                nextContext = &nd.bestMode->contexts;
+            }
+            else
+                splitCU->setEmptyPart(childGeom, subPartIdx);
+        }
+        nextContext->store(splitPred->contexts);
+
+        if (cuGeom.flags & CUGeom::SPLIT_MANDATORY)
+            updateModeCost(*splitPred);
+        else
+            addSplitFlagCost(*splitPred, depth);
+
+        checkDQPForSplitPred(*splitPred, cuGeom);
+        md.bestMode = splitPred;
+    }
+    else
+    {
+        bool bIntra = parentCTU.isIntra(cuGeom.absPartIdx);
+        Mode& mode = bIntra ? md.pred[PRED_INTRA] : md.pred[PRED_2Nx2N];
+        CUData& cu = mode.cu;
+
+        /* initSubCU() provides the neighbor pointers, the decisions are then
+         * copied from the pic CU. The skip flag is cleared by copyFromPic() */
+        cu.initSubCU(parentCTU, cuGeom, qp);
+        cu.copyFromPic(parentCTU, cuGeom);
+        cu.setQPSubParts((int8_t)qp, 0, depth);
+
+        if (bIntra)
+            checkIntra(mode, cuGeom, (PartSize)cu.m_partSize[0], cu.m_lumaIntraDir, cu.m_chromaIntraDir);
+        else
+        {
+            mode.initCosts();
+            for (uint32_t puIdx = 0; puIdx < cu.getNumPartInter(); puIdx++)
+            {
+                PredictionUnit pu(cu, cuGeom, puIdx);
+                motionCompensation(cu, pu, mode.predYuv, true, true);
+            }
+
+            /* skipped CUs stay skipped, everything else may gain or lose its
+             * residual at the new QP */
+            m_quant.m_tqBypass = !!cu.m_tqBypass[0];
+            if (parentCTU.isSkipped(cuGeom.absPartIdx))
+                encodeResAndCalcRdSkipCU(mode);
+            else
+                encodeResAndCalcRdInterCU(mode, cuGeom);
+            m_quant.m_tqBypass = false;
+        }
+
+        if (!(cuGeom.flags & CUGeom::LEAF))
+            addSplitFlagCost(mode, depth);
+
+        md.bestMode = &mode;
+    }
+
+    X265_CHECK(md.bestMode->ok(), "best mode is not ok");
+    md.bestMode->cu.copyToPic(depth);
+    md.bestMode->reconYuv.copyToPicYuv(*m_frame->m_reconPic, parentCTU.m_cuAddr, cuGeom.absPartIdx);
+}
+
 void Analysis::addSplitFlagCost(Mode& mode, uint32_t depth)
 {
     if (m_param->rdLevel >= 3)
@@ -100,6 +100,10 @@ public:
 
     Mode& compressCTU(CUData& ctu, Frame& frame, const CUGeom& cuGeom, const Entropy& initialContext);
 
+    /* code the residual of a previously analyzed CTU again at the current QP,
+     * keeping its CU tree, prediction modes and motion vectors */
+    Mode& recodeCTU(CUData& ctu, Frame& frame, const CUGeom& cuGeom, const Entropy& initialContext);
+
 protected:
 
     /* Analysis data for load/save modes, keeps getting incremented as CTU analysis proceeds and data is consumed or read */
@@ -108,6 +112,10 @@ protected:
     int32_t*             m_reuseRef;
     uint32_t*            m_reuseBestMergeCand;
 
+    /* intra refresh: the CTU is right of the refresh columns, its intra CUs
+     * could predict unrefreshed pixels into them */
+    bool                 m_bPirNoIntra;
+
     /* full analysis for an I-slice CU */
     void compressIntraCU(const CUData& parentCTU, const CUGeom& cuGeom, uint32_t &zOrder, int32_t qp);
 
@@ -139,6 +147,9 @@ protected:
     /* generate residual and recon pixels for an entire CTU recursively (RD0) */
     void encodeResidue(const CUData& parentCTU, const CUGeom& cuGeom);
 
+    /* replay the mode decisions of the pic CU with a new residual, see recodeCTU() */
+    void recodeCU(const CUData& parentCTU, const CUGeom& cuGeom, int32_t qp);
+
     int calculateQpforCuSize(const CUData& ctu, const CUGeom& cuGeom);
 
     /* check whether current mode is the new best */
@@ -26,6 +26,7 @@
 #include "param.h"
 
 #include "encoder.h"
+#include "ladder.h"
 #include "entropy.h"
 #include "level.h"
 #include "nal.h"
@@ -62,7 +63,7 @@ extern "C" {
 namespace X265_NS {
 #endif
 
-x265_encoder *x265_encoder_open(x265_param *p)
+static Encoder* openEncoder(x265_param *p, Ladder *ladder)
 {
     if (!p)
         return NULL;
@@ -102,6 +103,7 @@ x265_encoder *x265_encoder_open(x265_param *p)
         goto fail;
 
     encoder = new Encoder;
+    encoder->m_ladder = ladder;
     if (!param->rc.bEnableSlowFirstPass)
         PARAM_NS::x265_param_apply_fastfirstpass(param);
 
@@ -136,6 +138,11 @@ fail:
     return NULL;
 }
 
+x265_encoder *x265_encoder_open(x265_param *p)
+{
+    return openEncoder(p, NULL);
+}
+
 int x265_encoder_headers(x265_encoder *enc, x265_nal **pp_nal, uint32_t *pi_nal)
 {
     if (pp_nal && enc)
@@ -176,6 +183,8 @@ int x265_encoder_reconfig(x265_encoder* enc, x265_param* param_in)
     else
     {
         encoder->m_reconfigured = true;
+        if (encoder->m_deadlineLevel)
+            encoder->updateDeadlineParam(encoder->m_deadlineLevel);
         x265_print_reconfigured_params(&save, encoder->m_latestParam);
     }
     return ret;
@@ -247,6 +256,88 @@ void x265_encoder_close(x265_encoder *enc)
     }
 }
 
+static void closeLadder(Ladder *ladder)
+{
+    ladder->destroy();
+    for (int i = 0; i < ladder->m_count; i++)
+        x265_encoder_close(ladder->m_rend[i].enc);
+    delete ladder;
+}
+
+x265_ladder *x265_ladder_open(x265_param **params, int count)
+{
+    if (!params || count < 1)
+        return NULL;
+
+    for (int i = 1; i < count; i++)
+    {
+        const x265_param* top = params[0];
+        const x265_param* p = params[i];
+        if (p->internalCsp != top->internalCsp || p->maxCUSize != top->maxCUSize || p->minCUSize != top->minCUSize ||
+            p->sourceWidth > top->sourceWidth || p->sourceHeight > top->sourceHeight)
+        {
+            x265_log(p, X265_LOG_ERROR, "ladder rendition %d must have the color space and CU sizes of the first rendition, and may not be larger\n", i);
+            return NULL;
+        }
+    }
+
+    Ladder* ladder = new Ladder;
+    if (!ladder->create(count))
+        goto fail;
+
+    for (int i = 0; i < count; i++)
+    {
+        x265_param param;
+        memcpy(&param, params[i], sizeof(x265_param));
+        param.analysisMode = i ? X265_ANALYSIS_LOAD : X265_ANALYSIS_SAVE;
+        if (i)
+        {
+            /* the slice types of the first rendition are forced on the others,
+             * their GOP limits must allow them */
+            const x265_param* top = ladder->m_rend[0].enc->m_param;
+            param.keyframeMax = top->keyframeMax;
+            param.keyframeMin = top->keyframeMin;
+            param.bOpenGOP = top->bOpenGOP;
+            param.bframes = top->bframes;
+            param.bBPyramid = top->bBPyramid;
+        }
+
+        Encoder* encoder = openEncoder(&param, ladder);
+        if (!encoder || !ladder->init(i, encoder, *params[i]))
+            goto fail;
+    }
+
+    return ladder;
+
+fail:
+    closeLadder(ladder);
+    return NULL;
+}
+
+x265_encoder *x265_ladder_encoder(x265_ladder *l, int rendition)
+{
+    Ladder *ladder = static_cast<Ladder*>(l);
+    if (!ladder || rendition < 0 || rendition >= ladder->m_count)
+        return NULL;
+
+    return ladder->m_rend[rendition].enc;
+}
+
+int x265_ladder_encode(x265_ladder *l, x265_nal **pp_nal, uint32_t *pi_nal, x265_picture **pic_in, x265_picture **pic_out)
+{
+    if (!l || !pp_nal || !pi_nal)
+        return -1;
+
+    Ladder *ladder = static_cast<Ladder*>(l);
+    return ladder->encode(pp_nal, pi_nal, pic_in, pic_out);
+}
+
+void x265_ladder_close(x265_ladder *l)
+{
+    if (l)
+        closeLadder(static_cast<Ladder*>(l));
+}
+
 void x265_cleanup(void)
 {
     if (!g_ctuSizeConfigured)
@@ -318,6 +409,10 @@ static const x265_api libapi =
     &x265_cleanup,
 
     sizeof(x265_frame_stats),
+    &x265_ladder_open,
+    &x265_ladder_encoder,
+    &x265_ladder_encode,
+    &x265_ladder_close,
 };
 
 typedef const x265_api* (*api_get_func)(int bitDepth);
@@ -94,7 +94,8 @@ void DPB::prepareEncode(Frame *newFrame)
 
     int pocCurr = slice->m_poc;
     int type = newFrame->m_lowres.sliceType;
-    bool bIsKeyFrame = newFrame->m_lowres.bKeyframe;
+    /* the first P frame of an intra refresh wave is a keyframe, but not IRAP */
+    bool bIsKeyFrame = newFrame->m_lowres.bKeyframe && IS_X265_TYPE_I(type);
 
     slice->m_nalUnitType = getNalUnitType(pocCurr, bIsKeyFrame);
     if (slice->m_nalUnitType == NAL_UNIT_CODED_SLICE_IDR_W_RADL)
@@ -161,7 +162,9 @@ void DPB::prepareEncode(Frame *newFrame)
         slice->m_colFromL0Flag = true;
         slice->m_colRefIdx = 0;
     }
-    slice->m_sLFaseFlag = (SLFASE_CONSTANT & (1 << (pocCurr % 31))) > 0;
+    /* with multiple slices, loop filters never cross slice boundaries so
+     * that each slice is decoded and filtered independently */
+    slice->m_sLFaseFlag = newFrame->m_param->maxSlices > 1 ? false : (SLFASE_CONSTANT & (1 << (pocCurr % 31))) > 0;
 
     /* Increment reference count of all motion-referenced frames to prevent them
      * from being recycled. These counts are decremented at the end of
@@ -36,6 +36,7 @@
 #include "ratecontrol.h"
 #include "dpb.h"
 #include "nal.h"
+#include "ladder.h"
 
 #include "x265.h"
 
@@ -45,8 +46,33 @@ const char g_sliceTypeToChar[] = {'B', 'P', 'I'};
 
 static const char* defaultAnalysisFileName = "x265_analysis.dat";
 
+/* upper bounds of the deadline levels; rd stays at 2 or above, lower RD
+ * levels disable tools which the stream headers may have signaled */
+static const struct
+{
+    int lookaheadShift;
+    int bFrameAdaptive;
+    int subpelRefine;
+    int rdLevel;
+} s_deadlineCaps[] =
+{
+    { 0, X265_B_ADAPT_TRELLIS, X265_MAX_SUBPEL_LEVEL, 6 },
+    { 0, X265_B_ADAPT_TRELLIS, 2, 3 },
+    { 1, X265_B_ADAPT_FAST,    1, 2 },
+    { 2, X265_B_ADAPT_FAST,    1, 2 },
+    { 3, X265_B_ADAPT_NONE,    1, 2 },
+};
+
 using namespace X265_NS;
 
+/* the offsets Analysis::calculateQpforCuSize() coded the picture with */
+static const double* codedQpOffsets(const Frame* frame, const x265_param* param)
+{
+    if (IS_REFERENCED(frame) && param->rc.cuTree)
+        return frame->m_lowres.qpCuTreeOffset;
+    return frame->m_lowres.qpAqOffset;
+}
+
 Encoder::Encoder()
 {
     m_aborted = false;
@@ -58,10 +84,12 @@ Encoder::Encoder()
     m_numChromaWPFrames = 0;
     m_numLumaWPBiFrames = 0;
     m_numChromaWPBiFrames = 0;
+    m_numVbvRestarts = 0;
     m_lookahead = NULL;
     m_rateControl = NULL;
     m_dpb = NULL;
     m_exportedPic = NULL;
+    m_numLookaheadRefs = 0;
     m_numDelayedPic = 0;
     m_outputCount = 0;
     m_param = NULL;
@@ -72,6 +100,37 @@ Encoder::Encoder()
     m_buOffsetC = NULL;
     m_threadPool = NULL;
     m_analysisFile = NULL;
+    m_ladder = NULL;
+    m_bNumaStats = false;
+    m_numaLocalPages = 0;
+    m_numaRemotePages = 0;
+    m_activeFrameThreads = 0;
+    m_numPoolWorkers = 0;
+    m_adaptFrameCount = 0;
+    m_adaptWindowStart = 0;
+    m_adaptWorkerTime = 0;
+    m_adaptCompressTime = 0;
+    m_adaptStallTime = 0;
+    m_adaptRowBlocks = 0;
+    m_activeFrameThreadsSum = 0;
+    m_deadlineLevel = 0;
+    m_frameDuration = 0;
+    m_deadlineCallStart = 0;
+    m_deadlineWindowStart = 0;
+    m_deadlineWindowBusy = 0;
+    m_deadlineWindowFrames = 0;
+    m_deadlineBacklog = 0;
+    m_deadlineHeadroom = 0;
+    for (int i = 0; i < DEADLINE_LEVELS; i++)
+    {
+        m_deadlineParam[i] = NULL;
+        m_deadlineFrames[i] = 0;
+    }
+    m_pirIncrement = 1;
+    m_pirPosition = 0;
+    m_pirEndCol = 0;
+    m_pirRecoveryCnt = 0;
+    m_framesSincePir = 0;
     for (int i = 0; i < X265_MAX_FRAME_THREADS; i++)
         m_frameEncoder[i] = NULL;
 
@@ -99,10 +158,18 @@ void Encoder::create()
         p->bEnableWavefront = 0;
     }
 
+    // Slices consist of whole CTU rows
+    if (p->maxSlices > rows)
+    {
+        x265_log(p, X265_LOG_WARNING, "Too few rows, --slices reduced to %d\n", rows);
+        p->maxSlices = rows;
+    }
+
     bool allowPools = !p->numaPools || strcmp(p->numaPools, "none");
 
-    // Trim the thread pool if --wpp, --pme, and --pmode are disabled
-    if (!p->bEnableWavefront && !p->bDistributeModeAnalysis && !p->bDistributeMotionEstimation && !p->lookaheadSlices)
+    // Trim the thread pool if --wpp, --pme, --pmode and --slices are disabled
+    if (!p->bEnableWavefront && !p->bDistributeModeAnalysis && !p->bDistributeMotionEstimation && !p->lookaheadSlices &&
+        p->maxSlices <= 1)
         allowPools = false;
 
     if (!p->frameNumThreads)
@@ -139,9 +206,15 @@ void Encoder::create()
         if (p->lookaheadSlices)
             x265_log(p, X265_LOG_WARNING, "No thread pool allocated, --lookahead-slices disabled\n");
 
+        if (p->bAdaptiveFrameThreads)
+            x265_log(p, X265_LOG_WARNING, "No thread pool allocated, --adaptive-frame-threads disabled\n");
+
         // disable all pool features if the thread pool is disabled or unusable.
         p->bEnableWavefront = p->bDistributeModeAnalysis = p->bDistributeMotionEstimation = p->lookaheadSlices = 0;
+        p->bAdaptiveFrameThreads = 0;
     }
+    else if (p->frameNumThreads == 1 || !p->bEnableWavefront)
+        p->bAdaptiveFrameThreads = 0;
 
     if (!p->bEnableWavefront && p->rc.vbvBufferSize)
     {
@@ -153,6 +226,8 @@ void Encoder::create()
     int len = 0;
     if (p->bEnableWavefront)
         len += sprintf(buf + len, "wpp(%d rows)", rows);
+    if (m_numPools && p->maxSlices > 1)
+        len += sprintf(buf + len, "%sslices(%d)", len ? "+" : "", p->maxSlices);
     if (p->bDistributeModeAnalysis)
         len += sprintf(buf + len, "%spmode", len ? "+" : "");
     if (p->bDistributeMotionEstimation)
@@ -160,7 +235,14 @@ void Encoder::create()
     if (!len)
         strcpy(buf, "none");
 
-    x265_log(p, X265_LOG_INFO, "frame threads / pool features       : %d / %s\n", p->frameNumThreads, buf);
+    if (p->bAdaptiveFrameThreads)
+        x265_log(p, X265_LOG_INFO, "frame threads / pool features       : 1..%d (adaptive) / %s\n", p->frameNumThreads, buf);
+    else
+        x265_log(p, X265_LOG_INFO, "frame threads / pool features       : %d / %s\n", p->frameNumThreads, buf);
+
+    m_activeFrameThreads = p->frameNumThreads;
+    for (int i = 0; i < m_numPools; i++)
+        m_numPoolWorkers += m_threadPool[i].m_numWorkers;
 
     for (int i = 0; i < m_param->frameNumThreads; i++)
     {
@@ -179,6 +261,8 @@ void Encoder::create()
         }
         for (int i = 0; i < m_numPools; i++)
             m_threadPool[i].start();
+
+        m_bNumaStats = ThreadPool::getNumaNodeCount() > 1;
     }
     else
     {
@@ -216,6 +300,15 @@ void Encoder::create()
 
     int numRows = (m_param->sourceHeight + g_maxCUSize - 1) / g_maxCUSize;
     int numCols = (m_param->sourceWidth  + g_maxCUSize - 1) / g_maxCUSize;
+
+    if (m_param->bIntraRefresh)
+    {
+        /* each wave completes within one keyframe interval */
+        m_pirIncrement = X265_MAX((double)numCols / m_param->keyframeMax, 1.0);
+        for (double pos = m_pirIncrement; (int)(pos + 0.5) < numCols; pos += m_pirIncrement)
+            m_pirRecoveryCnt++;
+    }
+
     for (int i = 0; i < m_param->frameNumThreads; i++)
     {
         if (!m_frameEncoder[i]->init(this, numRows, numCols))
@@ -238,7 +331,8 @@ void Encoder::create()
     if (!m_lookahead->create())
         m_aborted = true;
 
-    if (m_param->analysisMode)
+    /* a ladder passes analysis between its encoders in memory */
+    if (m_param->analysisMode && !m_ladder)
     {
         const char* name = m_param->analysisFileName;
         if (!name)
@@ -256,7 +350,24 @@ void Encoder::create()
 
     m_aborted |= parseLambdaFile(m_param);
 
+    if (m_param->bDeadline)
+    {
+        m_frameDuration = (int64_t)1000000 * m_param->fpsDenom / m_param->fpsNum;
+        for (int level = 1; level < DEADLINE_LEVELS; level++)
+        {
+            x265_param* lp = PARAM_NS::x265_param_alloc();
+            if (!lp)
+            {
+                m_aborted = true;
+                break;
+            }
+            m_deadlineParam[level] = lp;
+            updateDeadlineParam(level);
+        }
+    }
+
     m_encodeStartTime = x265_mdate();
+    m_adaptWindowStart = m_encodeStartTime;
 
     m_nalList.m_annexB = !!m_param->bAnnexB;
 }
@@ -291,6 +402,8 @@ void Encoder::destroy()
         ATOMIC_DEC(&m_exportedPic->m_countRefEncoders);
         m_exportedPic = NULL;
     }
+    for (int i = 0; i < m_numLookaheadRefs; i++)
+        m_dpb->m_freeList.pushBack(*m_lookaheadRefs[i]);
 
     for (int i = 0; i < m_param->frameNumThreads; i++)
     {
@@ -341,6 +454,8 @@ void Encoder::destroy()
     }
 
     PARAM_NS::x265_param_free(m_latestParam);
+    for (int i = 0; i < DEADLINE_LEVELS; i++)
+        PARAM_NS::x265_param_free(m_deadlineParam[i]);
 }
 
 void Encoder::updateVbvPlan(RateControl* rc)
@@ -384,6 +499,9 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
     if (m_aborted)
         return -1;
 
+    if (m_param->bDeadline)
+        m_deadlineCallStart = x265_mdate();
+
     if (m_exportedPic)
     {
         ATOMIC_DEC(&m_exportedPic->m_countRefEncoders);
@@ -391,6 +509,25 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
         m_dpb->recycleUnreferenced();
     }
 
+    /* the frames following a chunk are not encoded, the lookahead is flushed
+     * so the chunk ends with a closed GOP */
+    if (pic_in && m_param->chunkEnd && m_pocLast >= m_param->chunkEnd)
+        pic_in = NULL;
+
+    /* only a bounded pre-roll preceding a chunk passes through the lookahead,
+     * the pictures before it are counted and dropped. A second pass takes the
+     * slice types and CU-tree offsets of the chunk from the stats file, so it
+     * needs no pre-roll */
+    if (pic_in && m_param->chunkStart)
+    {
+        int preroll = m_param->rc.bStatRead ? 0 : X265_MIN(m_param->lookaheadDepth, m_param->keyframeMax);
+        if (m_pocLast + 1 < m_param->chunkStart - preroll)
+        {
+            m_pocLast++;
+            return 0;
+        }
+    }
+
     if (pic_in)
     {
         if (pic_in->colorSpace != m_param->internalCsp)
@@ -405,13 +542,18 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
                      pic_in->bitDepth);
             return -1;
         }
+        if (pic_in->quantOffsets && !m_param->rc.aqMode)
+        {
+            x265_log(m_param, X265_LOG_ERROR, "QP offset maps require adaptive quantization\n");
+            return -1;
+        }
 
         Frame *inFrame;
         if (m_dpb->m_freeList.empty())
         {
             inFrame = new Frame;
             x265_param* p = m_reconfigured? m_latestParam : m_param;
-            if (inFrame->create(p))
+            if (inFrame->create(p, m_numPools ? m_lookahead->m_pool->m_numaNode : -1))
             {
                 /* the first PicYuv created is asked to generate the CU and block unit offset
                  * arrays which are then shared with all subsequent PicYuv (orig and recon) 
@@ -462,13 +604,15 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
 
         inFrame->m_poc       = ++m_pocLast;
         inFrame->m_userData  = pic_in->userData;
+        inFrame->m_quantOffsets = pic_in->quantOffsets;
+        inFrame->m_quantOffsetsMode = pic_in->quantOffsetsMode;
         inFrame->m_pts       = pic_in->pts;
         inFrame->m_forceqp   = pic_in->forceqp;
         inFrame->m_param     = m_reconfigured ? m_latestParam : m_param;
 
-        if (m_pocLast == 0)
+        if (m_pocLast == m_param->chunkStart)
             m_firstPts = inFrame->m_pts;
-        if (m_bframeDelay && m_pocLast == m_bframeDelay)
+        if (m_bframeDelay && m_pocLast == m_param->chunkStart + m_bframeDelay)
             m_bframeDelayTime = inFrame->m_pts - m_firstPts;
 
         /* Encoder holds a reference count until stats collection is finished */
@@ -485,15 +629,17 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
         }
 
         /* Use the frame types from the first pass, if available */
-        int sliceType = (m_param->rc.bStatRead) ? m_rateControl->rateControlSliceType(inFrame->m_poc) : pic_in->sliceType;
+        int sliceType = (m_param->rc.bStatRead) ? m_rateControl->rateControlSliceType(inFrame->m_poc - m_param->chunkStart) : pic_in->sliceType;
 
         /* In analysisSave mode, x265_analysis_data is allocated in pic_in and inFrame points to this */
         /* Load analysis data before lookahead->addPicture, since sliceType has been decided */
         if (m_param->analysisMode == X265_ANALYSIS_LOAD)
         {
             x265_picture* inputPic = const_cast<x265_picture*>(pic_in);
-            /* readAnalysisFile reads analysis data for the frame and allocates memory based on slicetype */
-            readAnalysisFile(&inputPic->analysisData, inFrame->m_poc);
+            /* readAnalysisFile reads analysis data for the frame and allocates memory based on slicetype,
+             * a ladder has already attached the analysis of its highest rendition */
+            if (!m_ladder)
+                readAnalysisFile(&inputPic->analysisData, inFrame->m_poc);
             inFrame->m_analysisData.poc = inFrame->m_poc;
             inFrame->m_analysisData.sliceType = inputPic->analysisData.sliceType;
             inFrame->m_analysisData.numCUsInFrame = inputPic->analysisData.numCUsInFrame;
@@ -503,12 +649,19 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
             sliceType = inputPic->analysisData.sliceType;
         }
 
+        /* a chunk begins with an IDR, no later frame may reference the pre-roll */
+        if (m_param->chunkStart && inFrame->m_poc == m_param->chunkStart)
+            sliceType = X265_TYPE_IDR;
+
         m_lookahead->addPicture(*inFrame, sliceType);
         m_numDelayedPic++;
     }
     else
         m_lookahead->flush();
 
+    if (m_param->bLookaheadOnly)
+        return outputLookaheadPicture(pic_out);
+
     FrameEncoder *curEncoder = m_frameEncoder[m_curEncoder];
     m_curEncoder = (m_curEncoder + 1) % m_param->frameNumThreads;
     int ret = 0;
@@ -532,16 +685,29 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
             Slice *slice = outFrame->m_encData->m_slice;
             x265_frame_stats* frameData = NULL;
 
+            if (m_bNumaStats)
+                outFrame->m_reconPic->getNumaPageUsage(curEncoder->m_pool->m_numaNode, m_numaLocalPages, m_numaRemotePages);
+
             /* Free up pic_in->analysisData since it has already been used */
             if (m_param->analysisMode == X265_ANALYSIS_LOAD)
                 freeAnalysis(&outFrame->m_analysisData);
 
+            /* Pass the analysis to the lower renditions of the ladder and free */
+            if (m_param->analysisMode == X265_ANALYSIS_SAVE && m_ladder)
+            {
+                m_ladder->addAnalysis(outFrame->m_analysisData, outFrame->m_lowres.sliceType);
+                freeAnalysis(&outFrame->m_analysisData);
+            }
+
             if (pic_out)
             {
                 PicYuv *recpic = outFrame->m_reconPic;
                 pic_out->poc = slice->m_poc;
                 pic_out->bitDepth = X265_DEPTH;
                 pic_out->userData = outFrame->m_userData;
+                pic_out->quantOffsets = outFrame->m_quantOffsets;
+                pic_out->quantOffsetsMode = outFrame->m_quantOffsetsMode;
+                pic_out->qpOffsets = codedQpOffsets(outFrame, m_param);
                 pic_out->colorSpace = m_param->internalCsp;
                 frameData = &(pic_out->frameData);
 
@@ -569,7 +735,7 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
                 pic_out->stride[2] = (int)(recpic->m_strideC * sizeof(pixel));
 
                 /* Dump analysis data from pic_out to file in save mode and free */
-                if (m_param->analysisMode == X265_ANALYSIS_SAVE)
+                if (m_param->analysisMode == X265_ANALYSIS_SAVE && !m_ladder)
                 {
                     pic_out->analysisData.poc = pic_out->poc;
                     pic_out->analysisData.sliceType = pic_out->sliceType;
@@ -612,6 +778,12 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
 
             finishFrameStats(outFrame, curEncoder, curEncoder->m_accessUnitBits, frameData);
 
+            if (m_param->bAdaptiveFrameThreads)
+                adaptFrameThreads(curEncoder);
+
+            if (m_param->bDeadline)
+                adaptDeadline();
+
             /* Allow this frame to be recycled if no frame encoders are using it for reference */
             if (!pic_out)
             {
@@ -629,19 +801,47 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
         /* pop a single frame from decided list, then provide to frame encoder
          * curEncoder is guaranteed to be idle at this point */
         if (!pass)
+        {
             frameEnc = m_lookahead->getDecidedPicture();
+
+            /* the pre-roll preceding a chunk is not encoded. The chunk begins
+             * with an IDR, the lookahead no longer refers to the pre-roll once
+             * its first picture is decided */
+            while (frameEnc && frameEnc->m_poc < m_param->chunkStart)
+            {
+                retirePrerollPicture(frameEnc);
+                frameEnc = m_lookahead->getDecidedPicture();
+            }
+            if (frameEnc && m_numLookaheadRefs)
+            {
+                for (int i = 0; i < m_numLookaheadRefs; i++)
+                {
+                    ATOMIC_DEC(&m_lookaheadRefs[i]->m_countRefEncoders);
+                    m_dpb->m_freeList.pushBack(*m_lookaheadRefs[i]);
+                }
+                m_numLookaheadRefs = 0;
+            }
+        }
         if (frameEnc && !pass)
         {
-            /* give this frame a FrameData instance before encoding */
+            /* give this frame a FrameData instance before encoding. Prefer one
+             * whose recon picture is on the NUMA node of this frame encoder */
+            int numaNode = curEncoder->m_pool ? curEncoder->m_pool->m_numaNode : -1;
             if (m_dpb->m_picSymFreeList)
             {
-                frameEnc->m_encData = m_dpb->m_picSymFreeList;
-                m_dpb->m_picSymFreeList = m_dpb->m_picSymFreeList->m_freeListNext;
+                FrameData** link = &m_dpb->m_picSymFreeList;
+                while (*link && (*link)->m_reconPic->m_numaNode != numaNode)
+                    link = &(*link)->m_freeListNext;
+                if (!*link)
+                    link = &m_dpb->m_picSymFreeList;
+
+                frameEnc->m_encData = *link;
+                *link = (*link)->m_freeListNext;
                 frameEnc->reinit(m_sps);
             }
             else
             {
-                frameEnc->allocEncodeData(m_param, m_sps);
+                frameEnc->allocEncodeData(m_param, m_sps, numaNode);
                 Slice* slice = frameEnc->m_encData->m_slice;
                 slice->m_sps = &m_sps;
                 slice->m_pps = &m_pps;
@@ -654,16 +854,7 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
             }
 
             curEncoder->m_rce.encodeOrder = m_encodedFrameNum++;
-            if (m_bframeDelay)
-            {
-                int64_t *prevReorderedPts = m_prevReorderedPts;
-                frameEnc->m_dts = m_encodedFrameNum > m_bframeDelay
-                    ? prevReorderedPts[(m_encodedFrameNum - m_bframeDelay) % m_bframeDelay]
-                    : frameEnc->m_reorderedPts - m_bframeDelayTime;
-                prevReorderedPts[m_encodedFrameNum % m_bframeDelay] = frameEnc->m_reorderedPts;
-            }
-            else
-                frameEnc->m_dts = frameEnc->m_reorderedPts;
+            setFrameDts(frameEnc);
 
             /* Allocate analysis data before encode in save mode. This is allocated in frameEnc */
             if (m_param->analysisMode == X265_ANALYSIS_SAVE)
@@ -680,17 +871,26 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
                 allocAnalysis(analysis);
             }
 
+            if (m_param->bIntraRefresh)
+                updateIntraRefresh(frameEnc);
+
             /* determine references, setup RPS, etc */
             m_dpb->prepareEncode(frameEnc);
 
             if (m_param->rc.rateControlMode != X265_RC_CQP)
                 m_lookahead->getEstimatedPictureCost(frameEnc);
 
+            /* frames keep the params of the deadline level they started at */
+            if (m_deadlineLevel)
+                frameEnc->m_param = m_deadlineParam[m_deadlineLevel];
+
             /* Allow FrameEncoder::compressFrame() to start in the frame encoder thread */
             if (!curEncoder->startCompressFrame(frameEnc))
                 m_aborted = true;
         }
-        else if (m_encodedFrameNum)
+        else if (m_encodedFrameNum && !pic_in)
+            /* the lookahead may have no decision ready mid-stream, only a
+             * flush makes the frame count final */
             m_rateControl->setFinalFrameCount(m_encodedFrameNum);
     }
     while (m_bZeroLatency && ++pass < 2);
@@ -698,6 +898,155 @@ int Encoder::encode(const x265_picture* pic_in, x265_picture* pic_out)
     return ret;
 }
 
+/* the DTS of the picture just taken in encode order */
+void Encoder::setFrameDts(Frame* frame)
+{
+    if (m_bframeDelay)
+    {
+        int64_t *prevReorderedPts = m_prevReorderedPts;
+        frame->m_dts = m_encodedFrameNum > m_bframeDelay
+            ? prevReorderedPts[(m_encodedFrameNum - m_bframeDelay) % m_bframeDelay]
+            : frame->m_reorderedPts - m_bframeDelayTime;
+        prevReorderedPts[m_encodedFrameNum % m_bframeDelay] = frame->m_reorderedPts;
+    }
+    else
+        frame->m_dts = frame->m_reorderedPts;
+}
+
+/* In lookahead-only mode the decided pictures are not encoded. The costs of
+ * each one are estimated from the references the encoder would have chosen
+ * and written to the stats file, then the picture is returned without NALs
+ * or reconstructed planes */
+int Encoder::outputLookaheadPicture(x265_picture* pic_out)
+{
+    m_nalList.m_numNal = 0;
+    m_nalList.m_occupancy = 0;
+
+    Frame* frame = m_lookahead->getDecidedPicture();
+    while (frame && frame->m_poc < m_param->chunkStart)
+    {
+        retirePrerollPicture(frame);
+        frame = m_lookahead->getDecidedPicture();
+    }
+    if (!frame)
+        return m_aborted ? -1 : 0;
+
+    int type = frame->m_lowres.sliceType;
+    Frame* ref0;
+    Frame* ref1;
+    findLookaheadRefs(frame, ref0, ref1);
+
+    int encodeOrder = m_encodedFrameNum++;
+    setFrameDts(frame);
+
+    if (m_param->rc.rateControlMode != X265_RC_CQP)
+        m_lookahead->estimatePictureCost(frame, ref0, ref1);
+    if (!m_rateControl->writeLookaheadStats(frame, ref0, ref1, encodeOrder))
+    {
+        x265_log(m_param, X265_LOG_ERROR, "lookahead-only: stats file write failure\n");
+        m_aborted = true;
+    }
+
+    if (pic_out)
+    {
+        pic_out->poc = frame->m_poc;
+        pic_out->pts = frame->m_pts;
+        pic_out->dts = frame->m_dts;
+        pic_out->userData = frame->m_userData;
+        pic_out->quantOffsets = frame->m_quantOffsets;
+        pic_out->quantOffsetsMode = frame->m_quantOffsetsMode;
+        pic_out->qpOffsets = codedQpOffsets(frame, m_param);
+        pic_out->bitDepth = X265_DEPTH;
+        pic_out->colorSpace = m_param->internalCsp;
+        pic_out->sliceType = IS_X265_TYPE_I(type) ? (frame->m_lowres.bKeyframe ? X265_TYPE_IDR : X265_TYPE_I) :
+                             type == X265_TYPE_P ? X265_TYPE_P : X265_TYPE_B;
+        for (int i = 0; i < 3; i++)
+        {
+            pic_out->planes[i] = NULL;
+            pic_out->stride[i] = 0;
+        }
+
+        x265_frame_stats* frameStats = &pic_out->frameData;
+        memset(frameStats, 0, sizeof(*frameStats));
+        frameStats->poc = frame->m_poc;
+        frameStats->encoderOrder = encodeOrder;
+        frameStats->sliceType = IS_X265_TYPE_I(type) ? 'I' : type == X265_TYPE_P ? 'P' : type == X265_TYPE_BREF ? 'B' : 'b';
+        for (int i = 0; i < 16; i++)
+            frameStats->list0POC[i] = frameStats->list1POC[i] = -1;
+        frameStats->list0POC[0] = ref0 ? ref0->m_poc : -1;
+        frameStats->list1POC[0] = ref1 ? ref1->m_poc : -1;
+    }
+    m_analyzeAll.addBits(0);
+
+    retireLookaheadPicture(frame);
+
+    return m_aborted ? -1 : 1;
+}
+
+/* the references a picture which is not encoded is estimated from, the
+ * nearest held referenced pictures on each side */
+void Encoder::findLookaheadRefs(Frame* frame, Frame*& ref0, Frame*& ref1)
+{
+    int type = frame->m_lowres.sliceType;
+    ref0 = ref1 = NULL;
+    if (IS_X265_TYPE_I(type))
+        return;
+
+    for (int i = 0; i < m_numLookaheadRefs; i++)
+    {
+        Frame* ref = m_lookaheadRefs[i];
+        if (ref->m_poc < frame->m_poc && (!ref0 || ref->m_poc > ref0->m_poc))
+            ref0 = ref;
+        else if (IS_X265_TYPE_B(type) && ref->m_poc > frame->m_poc && (!ref1 || ref->m_poc < ref1->m_poc))
+            ref1 = ref;
+    }
+    X265_CHECK(ref0 && (ref1 || !IS_X265_TYPE_B(type)), "lookahead-only references missing\n");
+}
+
+/* release a picture which left the lookahead without being encoded. A
+ * referenced picture is held until no later picture may predict from it */
+void Encoder::retireLookaheadPicture(Frame* frame)
+{
+    if (IS_REFERENCED(frame))
+    {
+        if (m_numLookaheadRefs == MAX_LOOKAHEAD_REFS)
+        {
+            int oldest = 0;
+            for (int i = 1; i < m_numLookaheadRefs; i++)
+                if (m_lookaheadRefs[i]->m_poc < m_lookaheadRefs[oldest]->m_poc)
+                    oldest = i;
+            Frame* released = m_lookaheadRefs[oldest];
+            m_lookaheadRefs[oldest] = m_lookaheadRefs[--m_numLookaheadRefs];
+            ATOMIC_DEC(&released->m_countRefEncoders);
+            m_dpb->m_freeList.pushBack(*released);
+        }
+        m_lookaheadRefs[m_numLookaheadRefs++] = frame;
+    }
+    else
+    {
+        ATOMIC_DEC(&frame->m_countRefEncoders);
+        m_dpb->m_freeList.pushBack(*frame);
+    }
+    m_numDelayedPic--;
+}
+
+/* a picture of the pre-roll preceding a chunk only passes through the
+ * lookahead. Its cost is estimated for rate control, which continues from
+ * the complexity of the pre-roll as a single encode would, but it is neither
+ * encoded, written to the stats file nor reported */
+void Encoder::retirePrerollPicture(Frame* frame)
+{
+    if (m_param->rc.rateControlMode != X265_RC_CQP)
+    {
+        Frame* ref0;
+        Frame* ref1;
+        findLookaheadRefs(frame, ref0, ref1);
+        m_lookahead->estimatePictureCost(frame, ref0, ref1);
+        m_rateControl->prerollPicture(frame);
+    }
+    retireLookaheadPicture(frame);
+}
+
 int Encoder::reconfigureParam(x265_param* encParam, x265_param* param)
 {
     encParam->maxNumReferences = param->maxNumReferences; // never uses more refs than specified in stream headers
@@ -798,6 +1147,9 @@ void Encoder::printSummary()
             (float)100.0 * m_numLumaWPBiFrames / m_analyzeB.m_numPics,
             (float)100.0 * m_numChromaWPBiFrames / m_analyzeB.m_numPics);
     }
+    if (m_param->rc.vbvBufferSize > 0 && m_param->rc.vbvMaxBitrate > 0 && m_analyzeAll.m_numPics)
+        x265_log(m_param, X265_LOG_INFO, "VBV encode restarts: %d, %.2f per frame\n",
+                 m_numVbvRestarts, (double)m_numVbvRestarts / m_analyzeAll.m_numPics);
     int pWithB = 0;
     for (int i = 0; i <= m_param->bframes; i++)
         pWithB += m_lookahead->m_histogram[i];
@@ -844,6 +1196,23 @@ void Encoder::printSummary()
     else
         general_log(m_param, NULL, X265_LOG_INFO, "\nencoded 0 frames\n");
 
+    if (m_param->bAdaptiveFrameThreads && m_analyzeAll.m_numPics)
+        x265_log(m_param, X265_LOG_INFO, "frame threads: %.2lf frames compressed concurrently on average, %d at end of encode\n",
+                 (double)m_activeFrameThreadsSum / m_analyzeAll.m_numPics, m_activeFrameThreads);
+
+    if (m_param->bDeadline && m_analyzeAll.m_numPics)
+    {
+        char buf[128];
+        int len = 0;
+        for (int i = 0; i < DEADLINE_LEVELS; i++)
+            len += sprintf(buf + len, " %.1lf%%", 100.0 * m_deadlineFrames[i] / m_analyzeAll.m_numPics);
+        x265_log(m_param, X265_LOG_INFO, "deadline: frames output at levels 0..%d:%s\n", DEADLINE_LEVELS - 1, buf);
+    }
+
+    if (m_numaLocalPages + m_numaRemotePages)
+        x265_log(m_param, X265_LOG_INFO, "NUMA: %.2lf%% of sampled recon pages local to their frame encoder's node (" X265_LL " local, " X265_LL " remote)\n",
+                 100.0 * m_numaLocalPages / (m_numaLocalPages + m_numaRemotePages), m_numaLocalPages, m_numaRemotePages);
+
 #if DETAILED_CU_STATS
     /* Summarize stats from all frame encoders */
     CUStats cuStats;
@@ -857,11 +1226,11 @@ void Encoder::printSummary()
     for (int i = 0; i < m_numPools; i++)
         totalWorkerCount += m_threadPool[i].m_numWorkers;
 
-    int64_t  batchElapsedTime, coopSliceElapsedTime;
-    uint64_t batchCount, coopSliceCount;
-    m_lookahead->getWorkerStats(batchElapsedTime, batchCount, coopSliceElapsedTime, coopSliceCount);
+    int64_t  searchElapsedTime, estimateElapsedTime;
+    uint64_t searchCount, estimateCount;
+    m_lookahead->getWorkerStats(searchElapsedTime, searchCount, estimateElapsedTime, estimateCount);
     int64_t lookaheadWorkerTime = m_lookahead->m_slicetypeDecideElapsedTime + m_lookahead->m_preLookaheadElapsedTime +
-                                  batchElapsedTime + coopSliceElapsedTime;
+                                  searchElapsedTime + estimateElapsedTime;
 
     int64_t totalWorkerTime = cuStats.totalCTUTime + cuStats.loopFilterElapsedTime + cuStats.pmodeTime +
                               cuStats.pmeTime + lookaheadWorkerTime + cuStats.weightAnalyzeTime;
@@ -909,6 +1278,16 @@ void Encoder::printSummary()
                      100.0 * cuStats.skippedMotionReferences[2] / cuStats.totalMotionReferences[2],
                      100.0 * cuStats.skippedMotionReferences[3] / cuStats.totalMotionReferences[3]);
     }
+    if (cuStats.countNarrowedSearches && cuStats.countFullSearches)
+    {
+        /* estimate the time the narrowed searches would have taken at full range */
+        double fullAvg = (double)cuStats.fullSearchTime / cuStats.countFullSearches;
+        double narrowedAvg = (double)cuStats.narrowedSearchTime / cuStats.countNarrowedSearches;
+        double saved = X265_MAX(fullAvg - narrowedAvg, 0.0) * cuStats.countNarrowedSearches;
+        x265_log(m_param, X265_LOG_INFO, "CU: %%%05.2lf motion searches narrowed by lowres MVs, saving an estimated %%%05.2lf of search time\n",
+                 100.0 * cuStats.countNarrowedSearches / (cuStats.countNarrowedSearches + cuStats.countFullSearches),
+                 100.0 * saved / (cuStats.fullSearchTime + cuStats.narrowedSearchTime + saved));
+    }
     x265_log(m_param, X265_LOG_INFO, "CU: %%%05.2lf time spent in intra analysis, averaging %.3lf Intra PUs per CTU\n",
              100.0 * cuStats.intraAnalysisElapsedTime / totalWorkerTime,
              (double)cuStats.countIntraAnalysis / cuStats.totalCTUs);
@@ -988,6 +1367,23 @@ void Encoder::printSummary()
                  (double)totalWorkerTime / elapsedEncodeTime,
                  100.0 * totalWorkerTime / (elapsedEncodeTime * totalWorkerCount));
 
+    if (m_threadPool)
+    {
+        WorkerStats workerStats;
+        for (int i = 0; i < m_numPools; i++)
+            m_threadPool[i].getWorkerStats(workerStats);
+
+        uint64_t queuedJobs = workerStats.countLocalJobs + workerStats.countStolenJobs;
+        if (queuedJobs)
+            x265_log(m_param, X265_LOG_INFO, "CU: " X265_LL " queued jobs, %%%05.2lf stolen from peer workers, " X265_LL " failed steal attempts\n",
+                     queuedJobs, 100.0 * workerStats.countStolenJobs / queuedJobs, workerStats.countFailedSteals);
+        if (workerStats.countCriticalJobs)
+            x265_log(m_param, X265_LOG_INFO, "CU: " X265_LL " jobs prioritized because other frame encoders were blocked on them\n",
+                     workerStats.countCriticalJobs);
+        x265_log(m_param, X265_LOG_INFO, "CU: workers slept " X265_LL " times, %%%05.2lf of worker time idle\n",
+                 workerStats.countSleeps, 100.0 * workerStats.idleTime / (elapsedEncodeTime * totalWorkerCount));
+    }
+
 #undef ELAPSED_SEC
 #undef ELAPSED_MSEC
 #endif
@@ -1077,6 +1473,8 @@ void Encoder::finishFrameStats(Frame* curFrame, FrameEncoder *curEncoder, uint64
     FrameData& curEncData = *curFrame->m_encData;
     Slice* slice = curEncData.m_slice;
 
+    m_numVbvRestarts += curEncoder->m_countVbvRestarts;
+
     //===== add bits, psnr and ssim =====
     m_analyzeAll.addBits(bits);
     m_analyzeAll.addQP(curEncData.m_avgQpAq);
@@ -1163,9 +1561,180 @@ void Encoder::finishFrameStats(Frame* curFrame, FrameEncoder *curEncoder, uint64
         else
             frameStats->avgWPP = 1;
         frameStats->countRowBlocks = curEncoder->m_countRowBlocks;
+        frameStats->countVbvRestarts = curEncoder->m_countVbvRestarts;
     }
 }
 
+/* Adjust the number of frames admitted to CTU compression concurrently, once
+ * per window of output frames. If the pool workers were under-utilized,
+ * admit another frame. If the workers were saturated but the compressing
+ * frames often had no active worker (stalled on reference rows) or their
+ * workers kept abandoning rows on top-right dependencies, then the extra
+ * frames are only adding reference lag and one less frame is admitted */
+void Encoder::adaptFrameThreads(FrameEncoder *curEncoder)
+{
+    m_activeFrameThreadsSum += m_activeFrameThreads;
+    m_adaptFrameCount++;
+    m_adaptWorkerTime += curEncoder->m_totalWorkerElapsedTime;
+    m_adaptCompressTime += curEncoder->m_endCompressTime - curEncoder->m_row0WaitTime;
+    m_adaptStallTime += curEncoder->m_totalNoWorkerTime;
+    m_adaptRowBlocks += curEncoder->m_countRowBlocks;
+
+    if (m_adaptFrameCount < X265_MAX(m_param->frameNumThreads, 4))
+        return;
+
+    int64_t now = x265_mdate();
+    double utilization = (double)m_adaptWorkerTime / (X265_MAX(now - m_adaptWindowStart, 1) * m_numPoolWorkers);
+    double stall = m_adaptCompressTime > 0 ? (double)m_adaptStallTime / m_adaptCompressTime : 0;
+    double rowBlocks = (double)m_adaptRowBlocks / (m_adaptFrameCount * curEncoder->m_numRows);
+
+    int active = m_activeFrameThreads;
+    if (utilization < 0.8 && active < m_param->frameNumThreads)
+        active++;
+    else if (utilization > 0.9 && (stall > 0.25 || rowBlocks > 1.0) && active > 1)
+        active--;
+
+    if (active != m_activeFrameThreads)
+    {
+        x265_log(m_param, X265_LOG_DEBUG, "frame threads: %d -> %d active, utilization %.0f%%, stall %.0f%%, %.2f row blocks/row\n",
+                 m_activeFrameThreads, active, 100.0 * utilization, 100.0 * stall, rowBlocks);
+        m_activeFrameThreads = active;
+        m_retiredFrames.poke(); /* re-evaluate admission of waiting frames */
+    }
+
+    m_adaptFrameCount = 0;
+    m_adaptWindowStart = now;
+    m_adaptWorkerTime = m_adaptCompressTime = m_adaptStallTime = 0;
+    m_adaptRowBlocks = 0;
+}
+
+/* Once per second of output, compare the time taken to produce the output
+ * frames against their duration. The time beyond the frame budget is carried
+ * over as a backlog; while the encode is more than a frame behind and still
+ * losing ground, it steps down a deadline level each window. When the backlog is cleared and two windows in a row
+ * used less than three quarters of their budget, it steps back up a level */
+void Encoder::adaptDeadline()
+{
+    int64_t now = x265_mdate();
+
+    m_deadlineFrames[m_deadlineLevel]++;
+    if (!m_deadlineWindowStart)
+    {
+        /* the first output ends the lookahead and frame thread fill */
+        m_deadlineWindowStart = now;
+        return;
+    }
+
+    m_deadlineWindowBusy += now - m_deadlineCallStart;
+    m_deadlineWindowFrames++;
+    if (now - m_deadlineWindowStart < 1000000)
+        return;
+
+    int64_t budget = m_deadlineWindowFrames * m_frameDuration;
+    double load = (double)m_deadlineWindowBusy / budget;
+    m_deadlineBacklog = X265_MAX(m_deadlineBacklog + m_deadlineWindowBusy - budget, 0);
+
+    int level = m_deadlineLevel;
+    if (m_deadlineBacklog > m_frameDuration && load > 1.0)
+    {
+        m_deadlineHeadroom = 0;
+        if (level < DEADLINE_LEVELS - 1)
+            level++;
+    }
+    else if (!m_deadlineBacklog && load < 0.75)
+    {
+        if (++m_deadlineHeadroom >= 2 && level)
+        {
+            level--;
+            m_deadlineHeadroom = 0;
+        }
+    }
+    else
+        m_deadlineHeadroom = 0;
+
+    x265_log(m_param, X265_LOG_DEBUG, "deadline: %d frames in %.2lfs used %.0lf%% of their budget, %.1lf ms behind, level %d\n",
+             m_deadlineWindowFrames, (double)(now - m_deadlineWindowStart) / 1000000, 100.0 * load,
+             (double)m_deadlineBacklog / 1000, level);
+
+    if (level != m_deadlineLevel)
+    {
+        if (level)
+            updateDeadlineParam(level);
+        const x265_param* p = level ? m_deadlineParam[level] : m_param;
+        x265_log(m_param, X265_LOG_INFO, "deadline: %.0lf%% of frame budget used, %.1lf ms behind, level %d -> %d: rc-lookahead %d b-adapt %d subme %d rd %d\n",
+                 100.0 * load, (double)m_deadlineBacklog / 1000, m_deadlineLevel, level,
+                 p->lookaheadDepth, p->bFrameAdaptive, p->subpelRefine, p->rdLevel);
+        m_lookahead->setDecisionLimits(p->lookaheadDepth, p->bFrameAdaptive);
+        m_deadlineLevel = level;
+    }
+
+    m_deadlineWindowStart = now;
+    m_deadlineWindowBusy = 0;
+    m_deadlineWindowFrames = 0;
+}
+
+/* the params of a deadline level are the latest params, reconfigured or not,
+ * capped to the level. They are rebuilt whenever the level is entered and
+ * when a reconfigure lands, so no reconfigured option is lost while degraded */
+void Encoder::updateDeadlineParam(int level)
+{
+    const x265_param* src = m_reconfigured ? m_latestParam : m_param;
+    x265_param* lp = m_deadlineParam[level];
+    memcpy(lp, src, sizeof(x265_param));
+
+    /* the b-frame count is never adapted, the lookahead keeps room for a mini-GOP */
+    int depth = src->lookaheadDepth >> s_deadlineCaps[level].lookaheadShift;
+    lp->lookaheadDepth = X265_MAX(depth, X265_MIN(src->bframes + 1, src->lookaheadDepth));
+    lp->bFrameAdaptive = X265_MIN(lp->bFrameAdaptive, s_deadlineCaps[level].bFrameAdaptive);
+    lp->subpelRefine = X265_MIN(lp->subpelRefine, s_deadlineCaps[level].subpelRefine);
+    lp->rdLevel = X265_MIN(lp->rdLevel, s_deadlineCaps[level].rdLevel);
+    if (lp->rdLevel < 3)
+        lp->bCULossless = lp->bEnableTransformSkip = 0;
+}
+
+/* Periodic intra refresh replaces the keyframes which the lookahead would have
+ * placed every keyframeMax frames. Each refresh wave codes columns of CTUs as
+ * intra in successive P frames, left to right. The last column refreshed by
+ * the previous frame was deblocked against unrefreshed pixels, so every frame
+ * refreshes it again and the CUs left of it may only reference pixels left of
+ * a margin in the previous frame */
+void Encoder::updateIntraRefresh(Frame* frame)
+{
+    Slice* slice = frame->m_encData->m_slice;
+    int numCols = (int)m_sps.numCuInWidth;
+
+    slice->m_pirStartCol = slice->m_pirEndCol = 0;
+    slice->m_pirRefLimitX = 0;
+
+    if (IS_X265_TYPE_I(frame->m_lowres.sliceType))
+    {
+        /* the whole picture is refreshed */
+        m_framesSincePir = 0;
+        m_pirEndCol = 0;
+        return;
+    }
+
+    if (++m_framesSincePir >= m_param->keyframeMax)
+    {
+        /* start a new wave, this frame is the recovery point */
+        m_framesSincePir = 0;
+        m_pirPosition = 0;
+        m_pirEndCol = 0;
+        frame->m_lowres.bKeyframe = true;
+    }
+    else if (!m_pirEndCol || m_pirEndCol == numCols)
+        return; /* no wave in progress */
+
+    m_pirPosition += m_pirIncrement;
+    slice->m_pirStartCol = X265_MAX(m_pirEndCol - 1, 0);
+    slice->m_pirEndCol = X265_MIN((int)(m_pirPosition + 0.5), numCols);
+
+    /* margin for the deblocking and SAO of the previous frame's refresh
+     * boundary and for the interpolation filter taps */
+    slice->m_pirRefLimitX = m_pirEndCol * (int)g_maxCUSize - 8;
+    m_pirEndCol = slice->m_pirEndCol;
+}
+
 #if defined(_MSC_VER)
 #pragma warning(disable: 4800) // forcing int to bool
 #pragma warning(disable: 4127) // conditional expression is constant
@@ -1373,6 +1942,7 @@ void Encoder::initPPS(PPS *pps)
     pps->deblockingFilterTcOffsetDiv2 = m_param->deblockingFilterTCOffset;
 
     pps->bEntropyCodingSyncEnabled = m_param->bEnableWavefront;
+    pps->bDependentSliceSegmentsEnabled = m_param->maxSliceBytes > 0;
 }
 
 void Encoder::configure(x265_param *p)
@@ -1414,6 +1984,37 @@ void Encoder::configure(x265_param *p)
     }
     p->keyframeMin = X265_MAX(1, X265_MIN(p->keyframeMin, p->keyframeMax / 2 + 1));
 
+    if (p->bIntraRefresh)
+    {
+        if (p->keyframeMax == 1)
+        {
+            x265_log(p, X265_LOG_WARNING, "--intra-refresh disabled, requires --keyint greater than 1\n");
+            p->bIntraRefresh = 0;
+        }
+        else if (p->analysisMode)
+        {
+            x265_log(p, X265_LOG_WARNING, "Analysis load/save options incompatible with --intra-refresh, disabling intra refresh\n");
+            p->bIntraRefresh = 0;
+        }
+        else
+        {
+            /* the refreshed area of each P frame may only be predicted from the
+             * refreshed area of the previous frame. Intra blocks must not
+             * predict from inter blocks and merge candidates must not inherit
+             * motion from unrefreshed collocated blocks */
+            p->bframes = 0;
+            p->maxNumReferences = 1;
+            p->bEnableTemporalMvp = 0;
+            p->bEnableConstrainedIntra = 1;
+        }
+    }
+
+    if ((p->chunkStart || p->chunkEnd) && p->analysisMode)
+    {
+        x265_log(p, X265_LOG_WARNING, "Analysis load/save options incompatible with chunked encoding, disabling chunks\n");
+        p->chunkStart = p->chunkEnd = 0;
+    }
+
     if (!p->bframes)
         p->bBPyramid = 0;
     if (!p->rdoqLevel)
@@ -1479,6 +2080,27 @@ void Encoder::configure(x265_param *p)
         p->rc.cuTree = 0;
     }
 
+    if (p->bLookaheadOnly)
+    {
+        if (p->rc.bStatRead || p->analysisMode)
+        {
+            x265_log(p, X265_LOG_WARNING, "--lookahead-only disabled, incompatible with reading stats and analysis load/save\n");
+            p->bLookaheadOnly = 0;
+        }
+        else
+        {
+            /* the lookahead statistics are the only output */
+            p->rc.bStatWrite = 1;
+            p->rc.bStatBinary = 1;
+        }
+    }
+
+    if (p->bHierarchicalLookahead && (p->lookaheadDepth == 0 || p->rc.bStatRead))
+    {
+        x265_log(p, X265_LOG_WARNING, "--hierarchical-lookahead disabled, requires lookahead frame type decisions\n");
+        p->bHierarchicalLookahead = 0;
+    }
+
     if (p->maxTUSize > p->maxCUSize)
     {
         x265_log(p, X265_LOG_WARNING, "Max TU size should be less than or equal to max CU size, setting max TU size = %d\n", p->maxCUSize);
@@ -1656,14 +2278,16 @@ void Encoder::freeAnalysis(x265_analysis_data* analysis)
         X265_FREE(((analysis_intra_data*)analysis->intraData)->partSizes);
         X265_FREE(((analysis_intra_data*)analysis->intraData)->chromaModes);
         X265_FREE(analysis->intraData);
+        analysis->intraData = NULL;
     }
-    else
+    else if (analysis->interData)
     {
         X265_FREE(((analysis_inter_data*)analysis->interData)->ref);
         X265_FREE(((analysis_inter_data*)analysis->interData)->depth);
         X265_FREE(((analysis_inter_data*)analysis->interData)->modes);
         X265_FREE(((analysis_inter_data*)analysis->interData)->bestMergeCand);
         X265_FREE(analysis->interData);
+        analysis->interData = NULL;
     }
 }
 
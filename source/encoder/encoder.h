@@ -25,6 +25,7 @@
 #define X265_ENCODER_H
 
 #include "common.h"
+#include "threading.h"
 #include "slice.h"
 #include "scalinglist.h"
 #include "x265.h"
@@ -67,6 +68,7 @@ struct EncStats
 
 class FrameEncoder;
 class DPB;
+class Ladder;
 class Lookahead;
 class RateControl;
 class ThreadPool;
@@ -90,6 +92,12 @@ public:
 
     Frame*             m_exportedPic;
 
+    /* lookahead-only mode and the pre-roll of a chunk; the latest referenced
+     * pictures, the later pictures are estimated from the nearest of them */
+    enum { MAX_LOOKAHEAD_REFS = 3 };
+    Frame*             m_lookaheadRefs[MAX_LOOKAHEAD_REFS];
+    int                m_numLookaheadRefs;
+
     int                m_numPools;
     int                m_curEncoder;
 
@@ -107,12 +115,56 @@ public:
     EncStats           m_analyzeB;
     int64_t            m_encodeStartTime;
 
+    /* sampled placement of reconstructed picture pages relative to the NUMA
+     * node of the frame encoder which reconstructed them */
+    bool               m_bNumaStats;
+    uint64_t           m_numaLocalPages;
+    uint64_t           m_numaRemotePages;
+
+    /* adaptive frame threading; frames are admitted to CTU compression in
+     * encode order while fewer than m_activeFrameThreads earlier frames are
+     * still compressing */
+    ThreadSafeInteger  m_retiredFrames;      // count of frames which finished CTU compression
+    volatile int       m_activeFrameThreads; // frames allowed to compress concurrently
+    int                m_numPoolWorkers;
+    int                m_adaptFrameCount;    // frames measured in the current window
+    int64_t            m_adaptWindowStart;
+    int64_t            m_adaptWorkerTime;    // sum of CTU compression time of measured frames
+    int64_t            m_adaptCompressTime;  // sum of admission-to-completion time of measured frames
+    int64_t            m_adaptStallTime;     // sum of time measured frames had no active worker
+    int                m_adaptRowBlocks;
+    uint64_t           m_activeFrameThreadsSum; // for average reported in summary
+
+    /* deadline mode; while output falls behind the frame rate the encode
+     * steps down levels of reduced lookahead and analysis depth */
+    enum { DEADLINE_LEVELS = 5 };
+    x265_param*        m_deadlineParam[DEADLINE_LEVELS]; // params of each level, [0] is unused
+    int                m_deadlineLevel;
+    int64_t            m_frameDuration;      // microseconds per frame at the configured frame rate
+    int64_t            m_deadlineCallStart;  // start of the current encode() call
+    int64_t            m_deadlineWindowStart;
+    int64_t            m_deadlineWindowBusy; // time to produce the output frames of the window
+    int                m_deadlineWindowFrames;
+    int64_t            m_deadlineBacklog;    // busy time beyond the frame budget, carried over windows
+    int                m_deadlineHeadroom;   // consecutive windows with spare time
+    uint32_t           m_deadlineFrames[DEADLINE_LEVELS]; // output frames at each level, for summary
+
+    /* periodic intra refresh; a wave of intra CTU columns sweeps left to right
+     * across successive P frames */
+    double             m_pirIncrement;       // CTU columns the wave advances per frame
+    double             m_pirPosition;        // CTU column reached by the current wave
+    int                m_pirEndCol;          // end of the refreshed columns of the previous frame
+    int                m_pirRecoveryCnt;     // frames after a wave start until the wave completes
+    int                m_framesSincePir;     // frames since the last keyframe or wave start
+
     // weighted prediction
     int                m_numLumaWPFrames;    // number of P frames with weighted luma reference
     int                m_numChromaWPFrames;  // number of P frames with weighted chroma reference
     int                m_numLumaWPBiFrames;  // number of B frames with weighted luma reference
     int                m_numChromaWPBiFrames; // number of B frames with weighted chroma reference
+    int                m_numVbvRestarts;     // number of mid-frame VBV encode restarts
     FILE*              m_analysisFile;
+    Ladder*            m_ladder;           // ladder which shares the analysis of this encoder, or NULL
     int                m_conformanceMode;
     VPS                m_vps;
     SPS                m_sps;
@@ -166,6 +218,24 @@ public:
 
     void finishFrameStats(Frame* pic, FrameEncoder *curEncoder, uint64_t bits, x265_frame_stats* frameStats);
 
+    void adaptFrameThreads(FrameEncoder *curEncoder);
+
+    void adaptDeadline();
+
+    void updateDeadlineParam(int level);
+
+    void updateIntraRefresh(Frame* frame);
+
+    int  outputLookaheadPicture(x265_picture* pic_out);
+
+    void findLookaheadRefs(Frame* frame, Frame*& ref0, Frame*& ref1);
+
+    void retireLookaheadPicture(Frame* frame);
+
+    void retirePrerollPicture(Frame* frame);
+
+    void setFrameDts(Frame* frame);
+
 protected:
 
     void initVPS(VPS *vps);
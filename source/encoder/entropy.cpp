@@ -144,7 +144,7 @@ void Entropy::codePPS(const PPS& pps)
 {
     WRITE_UVLC(0,                          "pps_pic_parameter_set_id");
     WRITE_UVLC(0,                          "pps_seq_parameter_set_id");
-    WRITE_FLAG(0,                          "dependent_slice_segments_enabled_flag");
+    WRITE_FLAG(pps.bDependentSliceSegmentsEnabled, "dependent_slice_segments_enabled_flag");
     WRITE_FLAG(0,                          "output_flag_present_flag");
     WRITE_CODE(0, 3,                       "num_extra_slice_header_bits");
     WRITE_FLAG(pps.bSignHideEnabled,       "sign_data_hiding_flag");
@@ -391,15 +391,29 @@ void Entropy::codeAUD(const Slice& slice)
     WRITE_CODE(picType, 3, "pic_type");
 }
 
-void Entropy::codeSliceHeader(const Slice& slice, FrameData& encData)
+void Entropy::codeSliceHeader(const Slice& slice, FrameData& encData, uint32_t sliceAddr, bool bDependentSegment)
 {
-    WRITE_FLAG(1, "first_slice_segment_in_pic_flag");
+    WRITE_FLAG(!sliceAddr, "first_slice_segment_in_pic_flag");
     if (slice.getRapPicFlag())
         WRITE_FLAG(0, "no_output_of_prior_pics_flag");
 
     WRITE_UVLC(0, "slice_pic_parameter_set_id");
 
-    /* x265 does not use dependent slices, so always write all this data */
+    if (sliceAddr)
+    {
+        if (slice.m_pps->bDependentSliceSegmentsEnabled)
+            WRITE_FLAG(bDependentSegment, "dependent_slice_segment_flag");
+
+        /* Ceil(Log2(PicSizeInCtbsY)) bits */
+        uint32_t addrBits = 0;
+        while ((1U << addrBits) < slice.m_sps->numCUsInFrame)
+            addrBits++;
+        WRITE_CODE(sliceAddr, addrBits, "slice_segment_address");
+    }
+
+    /* the remaining slice header is inferred for dependent slice segments */
+    if (bDependentSegment)
+        return;
 
     WRITE_UVLC(slice.m_sliceType, "slice_type");
 
@@ -488,7 +502,7 @@ void Entropy::codeSliceHeader(const Slice& slice, FrameData& encData)
 }
 
 /** write wavefront substreams sizes for the slice header */
-void Entropy::codeSliceHeaderWPPEntryPoints(const Slice& slice, const uint32_t *substreamSizes, uint32_t maxOffset)
+void Entropy::codeSliceHeaderWPPEntryPoints(const uint32_t *substreamSizes, uint32_t numSubstreams, uint32_t maxOffset)
 {
     uint32_t offsetLen = 1;
     while (maxOffset >= (1U << offsetLen))
@@ -497,7 +511,7 @@ void Entropy::codeSliceHeaderWPPEntryPoints(const Slice& slice, const uint32_t *
         X265_CHECK(offsetLen < 32, "offsetLen is too large\n");
     }
 
-    uint32_t numRows = slice.m_sps->numCuInHeight - 1;
+    uint32_t numRows = numSubstreams - 1;
     WRITE_UVLC(numRows, "num_entry_point_offsets");
     if (numRows > 0)
         WRITE_UVLC(offsetLen - 1, "offset_len_minus1");
@@ -676,7 +690,7 @@ void Entropy::finishCU(const CUData& ctu, uint32_t absPartIdx, uint32_t depth, b
     if (granularityBoundary)
     {
         // Encode slice finish
-        bool bTerminateSlice = false;
+        bool bTerminateSlice = ctu.m_bLastCuInSlice;
         if (cuAddr + (NUM_4x4_PARTITIONS >> (depth << 1)) == realEndAddress)
             bTerminateSlice = true;
 
@@ -46,6 +46,7 @@ FrameEncoder::FrameEncoder()
     m_slicetypeWaitTime = 0;
     m_activeWorkerCount = 0;
     m_completionCount = 0;
+    m_rowsCompletedInOrder = 0;
     m_bAllRowsStop = false;
     m_vbvResetTriggerRow = -1;
     m_outStreams = NULL;
@@ -53,6 +54,11 @@ FrameEncoder::FrameEncoder()
     m_nr = NULL;
     m_tld = NULL;
     m_rows = NULL;
+    m_sliceBaseRow = NULL;
+    m_segments = NULL;
+    m_numSegments = NULL;
+    m_numSlices = 1;
+    m_bParallelRows = false;
     m_top = NULL;
     m_param = NULL;
     m_frame = NULL;
@@ -84,6 +90,9 @@ void FrameEncoder::destroy()
 
     delete[] m_rows;
     delete[] m_outStreams;
+    X265_FREE(m_sliceBaseRow);
+    X265_FREE(m_segments);
+    X265_FREE(m_numSegments);
     X265_FREE(m_cuGeoms);
     X265_FREE(m_ctuGeomMap);
     X265_FREE(m_substreamSizes);
@@ -110,6 +119,22 @@ bool FrameEncoder::init(Encoder *top, int numRows, int numCols)
     m_rows = new CTURow[m_numRows];
     bool ok = !!m_numRows;
 
+    /* slices are groups of whole CTU rows, of nearly equal size */
+    m_numSlices = X265_MIN((uint32_t)m_param->maxSlices, m_numRows);
+    m_sliceBaseRow = X265_MALLOC(uint32_t, m_numSlices + 1);
+    m_segments = X265_MALLOC(SliceSegment, m_numRows * m_numCols);
+    m_numSegments = X265_MALLOC(uint32_t, m_numSlices);
+    if (m_sliceBaseRow && m_segments && m_numSegments)
+    {
+        for (uint32_t sliceId = 0; sliceId <= m_numSlices; sliceId++)
+            m_sliceBaseRow[sliceId] = sliceId * m_numRows / m_numSlices;
+        for (uint32_t sliceId = 0; sliceId < m_numSlices; sliceId++)
+            for (uint32_t row = m_sliceBaseRow[sliceId]; row < m_sliceBaseRow[sliceId + 1]; row++)
+                m_rows[row].sliceId = sliceId;
+    }
+    else
+        ok = false;
+
     /* determine full motion search range */
     int range  = m_param->searchRange;       /* fpel search */
     range += !!(m_param->searchMethod < 2);  /* diamond/hex range check lag */
@@ -126,6 +151,10 @@ bool FrameEncoder::init(Encoder *top, int numRows, int numCols)
 
     m_frameFilter.init(top, this, numRows);
 
+    /* without WPP the rows of one slice are compressed serially, but multiple
+     * slices may still be compressed in parallel by the worker threads */
+    m_bParallelRows = m_param->bEnableWavefront || (m_pool && m_numSlices > 1);
+
     // initialize HRD parameters of SPS
     if (m_param->bEmitHRDSEI || !!m_param->interlaceMode)
     {
@@ -302,10 +331,12 @@ void FrameEncoder::compressFrame()
     m_totalWorkerElapsedTime = 0;
     m_totalNoWorkerTime = 0;
     m_countRowBlocks = 0;
+    m_countVbvRestarts = 0;
     m_allRowsAvailableTime = 0;
     m_stallStartTime = 0;
 
     m_completionCount = 0;
+    m_rowsCompletedInOrder = 0;
     m_bAllRowsStop = false;
     m_vbvResetTriggerRow = -1;
 
@@ -357,12 +388,13 @@ void FrameEncoder::compressFrame()
             WeightParam *w = NULL;
             if ((bUseWeightP || bUseWeightB) && slice->m_weightPredTable[l][ref][0].bPresentFlag)
                 w = slice->m_weightPredTable[l][ref];
-            m_mref[l][ref].init(slice->m_refPicList[l][ref]->m_reconPic, w, *m_param);
+            m_mref[l][ref].init(slice->m_refPicList[l][ref]->m_reconPic, w, *m_param, m_pool ? m_pool->m_numaNode : -1);
         }
     }
 
     /* Get the QP for this frame from rate control. This call may block until
-     * frames ahead of it in encode order have called rateControlEnd() */
+     * frames ahead of it in encode order have called rateControlEnd(), or only
+     * rateControlStart() when RC ordering is decoupled */
     int qp = m_top->m_rateControl->rateControlStart(m_frame, &m_rce, m_top);
     m_rce.newQp = qp;
 
@@ -381,14 +413,18 @@ void FrameEncoder::compressFrame()
     for (uint32_t i = 0; i < m_numRows; i++)
         m_rows[i].init(m_initSliceContext);
 
-    uint32_t numSubstreams = m_param->bEnableWavefront ? slice->m_sps->numCuInHeight : 1;
+    /* The row coders write the final bitstream while the CTUs are compressed
+     * unless SAO parameters must first be decided or slices must be split
+     * into segments by size. Then encodeSlice() does it afterwards */
+    bool bDeferredCoding = m_param->bEnableSAO || m_param->maxSliceBytes;
+    uint32_t numSubstreams = m_param->bEnableWavefront ? slice->m_sps->numCuInHeight : m_numSlices;
     if (!m_outStreams)
     {
         m_outStreams = new Bitstream[numSubstreams];
         m_substreamSizes = X265_MALLOC(uint32_t, numSubstreams);
-        if (!m_param->bEnableSAO)
-            for (uint32_t i = 0; i < numSubstreams; i++)
-                m_rows[i].rowGoOnCoder.setBitstream(&m_outStreams[i]);
+        if (!bDeferredCoding)
+            for (uint32_t i = 0; i < m_numRows; i++)
+                m_rows[i].rowGoOnCoder.setBitstream(&m_outStreams[substreamIndex(i)]);
     }
     else
         for (uint32_t i = 0; i < numSubstreams; i++)
@@ -426,9 +462,10 @@ void FrameEncoder::compressFrame()
         // implicitly discarded after a random access seek regardless of the value of
         // m_recoveryPocCnt. Our encoder does not use references prior to the most recent CRA,
         // so all pictures following the CRA in POC order are guaranteed to be displayable,
-        // so m_recoveryPocCnt is always 0.
+        // so m_recoveryPocCnt is 0 for intra pictures. The P picture which starts an intra
+        // refresh wave is only a recovery point once the wave has refreshed every column.
         SEIRecoveryPoint sei_recovery_point;
-        sei_recovery_point.m_recoveryPocCnt = 0;
+        sei_recovery_point.m_recoveryPocCnt = slice->m_sliceType == I_SLICE ? 0 : m_top->m_pirRecoveryCnt;
         sei_recovery_point.m_exactMatchingFlag = true;
         sei_recovery_point.m_brokenLinkFlag = false;
 
@@ -478,8 +515,11 @@ void FrameEncoder::compressFrame()
      * tune RateControl parameters for other frames.
      * Hence, for these modes, update m_startEndOrder and unlock RC for previous threads waiting in
      * RateControlEnd here, after the slicecontexts are initialized. For the rest - ABR
-     * and VBV, unlock only after rateControlUpdateStats of this frame is called */
-    if (m_param->rc.rateControlMode != X265_RC_ABR && !m_top->m_rateControl->m_isVbv)
+     * and VBV, unlock only after rateControlUpdateStats of this frame is called.
+     * With decoupled RC ordering only the next rateControlStart waits on this */
+    if (m_top->m_rateControl->m_bDecoupledOrder)
+        m_top->m_rateControl->m_startOrder.incr();
+    else if (m_param->rc.rateControlMode != X265_RC_ABR && !m_top->m_rateControl->m_isVbv)
     {
         m_top->m_rateControl->m_startEndOrder.incr();
 
@@ -487,12 +527,22 @@ void FrameEncoder::compressFrame()
             m_top->m_rateControl->m_startEndOrder.incr(); // faked rateControlEnd calls for negative frames
     }
 
+    /* With adaptive frame threading, wait until fewer than the active count
+     * of earlier frames are still compressing CTUs. This happens after
+     * rateControlStart() so the RC ordering, which is based on the allocated
+     * number of frame encoders, is unaffected */
+    if (m_param->bAdaptiveFrameThreads)
+    {
+        int retired = m_top->m_retiredFrames.get();
+        while (m_rce.encodeOrder - retired >= m_top->m_activeFrameThreads)
+            retired = m_top->m_retiredFrames.waitForChange(retired);
+    }
+
     /* Analyze CTU rows, most of the hard work is done here.  Frame is
      * compressed in a wave-front pattern if WPP is enabled. Row based loop
      * filters runs behind the CTU compression and reconstruction */
 
-    m_rows[0].active = true;
-    if (m_param->bEnableWavefront)
+    if (m_bParallelRows)
     {
         for (uint32_t row = 0; row < m_numRows; row++)
         {
@@ -503,9 +553,7 @@ void FrameEncoder::compressFrame()
                 {
                     Frame *refpic = slice->m_refPicList[l][ref];
 
-                    uint32_t reconRowCount = refpic->m_reconRowCount.get();
-                    while ((reconRowCount != m_numRows) && (reconRowCount < row + m_refLagRows))
-                        reconRowCount = refpic->m_reconRowCount.waitForChange(reconRowCount);
+                    waitForReferenceRows(refpic, row + m_refLagRows);
 
                     if ((bUseWeightP || bUseWeightB) && m_mref[l][ref].isWeighted)
                         m_mref[l][ref].applyWeight(row + m_refLagRows, m_numRows);
@@ -513,10 +561,14 @@ void FrameEncoder::compressFrame()
             }
 
             enableRowEncoder(row); /* clear external dependency for this row */
-            if (!row)
+            if (row == m_sliceBaseRow[m_rows[row].sliceId])
             {
-                m_row0WaitTime = x265_mdate();
-                enqueueRowEncoder(0); /* clear internal dependency, start wavefront */
+                if (!row)
+                    m_row0WaitTime = x265_mdate();
+
+                /* clear internal dependency, start the wavefront of this slice */
+                m_rows[row].active = true;
+                enqueueRowEncoder(row);
             }
             tryWakeOne();
         }
@@ -542,9 +594,7 @@ void FrameEncoder::compressFrame()
                     {
                         Frame *refpic = slice->m_refPicList[list][ref];
 
-                        uint32_t reconRowCount = refpic->m_reconRowCount.get();
-                        while ((reconRowCount != m_numRows) && (reconRowCount < i + m_refLagRows))
-                            reconRowCount = refpic->m_reconRowCount.waitForChange(reconRowCount);
+                        waitForReferenceRows(refpic, i + m_refLagRows);
 
                         if ((bUseWeightP || bUseWeightB) && m_mref[l][ref].isWeighted)
                             m_mref[list][ref].applyWeight(i + m_refLagRows, m_numRows);
@@ -564,6 +614,9 @@ void FrameEncoder::compressFrame()
         }
     }
 
+    if (m_param->bAdaptiveFrameThreads)
+        m_top->m_retiredFrames.incr();
+
     if (m_param->rc.bStatWrite)
     {
         int totalI = 0, totalP = 0, totalSkip = 0;
@@ -584,25 +637,62 @@ void FrameEncoder::compressFrame()
         m_frame->m_encData->m_frameStats.percent8x8Skip  = (double)totalSkip / totalCuCount;
     }
 
-    m_bs.resetBits();
+    if (bDeferredCoding)
+    {
+        /* finish encode of each slice, the slices are independent so several
+         * of them may be coded by bonded worker threads */
+        SliceCoder sliceCoder(*this);
+        sliceCoder.m_jobTotal = m_numSlices;
+        if (m_pool && m_numSlices > 1)
+            sliceCoder.tryBondPeers(*this, m_numSlices - 1);
+        sliceCoder.processTasks(-1);
+        sliceCoder.waitForExit();
+    }
+    else
+    {
+        for (uint32_t sliceId = 0; sliceId < m_numSlices; sliceId++)
+        {
+            SliceSegment& seg = m_segments[m_sliceBaseRow[sliceId] * m_numCols];
+            seg.firstCUAddr = m_sliceBaseRow[sliceId] * m_numCols;
+            seg.streamStart = 0;
+            m_numSegments[sliceId] = 1;
+        }
+    }
+
+    /* emit one slice NAL per slice segment */
     m_entropyCoder.load(m_initSliceContext);
-    m_entropyCoder.setBitstream(&m_bs);
-    m_entropyCoder.codeSliceHeader(*slice, *m_frame->m_encData);
+    for (uint32_t sliceId = 0; sliceId < m_numSlices; sliceId++)
+    {
+        const SliceSegment* segments = m_segments + m_sliceBaseRow[sliceId] * m_numCols;
+        for (uint32_t i = 0; i < m_numSegments[sliceId]; i++)
+        {
+            bool bLastSegment = i + 1 == m_numSegments[sliceId];
+            uint32_t endCUAddr = bLastSegment ? m_sliceBaseRow[sliceId + 1] * m_numCols : segments[i + 1].firstCUAddr;
+            uint32_t firstStream = substreamIndex(segments[i].firstCUAddr / m_numCols);
+            uint32_t lastStream = substreamIndex((endCUAddr - 1) / m_numCols);
 
-    // finish encode of each CTU row, only required when SAO is enabled
-    if (m_param->bEnableSAO)
-        encodeSlice();
+            /* the next segment may begin part way through our last substream */
+            uint32_t streamEnd = MAX_UINT;
+            if (!bLastSegment && substreamIndex(endCUAddr / m_numCols) == lastStream)
+                streamEnd = segments[i + 1].streamStart;
 
-    // serialize each row, record final lengths in slice header
-    uint32_t maxStreamSize = m_nalList.serializeSubstreams(m_substreamSizes, numSubstreams, m_outStreams);
+            m_bs.resetBits();
+            m_entropyCoder.setBitstream(&m_bs);
+            m_entropyCoder.codeSliceHeader(*slice, *m_frame->m_encData, segments[i].firstCUAddr, i > 0);
+
+            // serialize each row, record final lengths in slice header
+            uint32_t numStreams = lastStream - firstStream + 1;
+            uint32_t maxStreamSize = m_nalList.serializeSubstreams(m_substreamSizes, numStreams, m_outStreams + firstStream,
+                                                                   segments[i].streamStart, streamEnd);
 
-    // complete the slice header by writing WPP row-starts
-    m_entropyCoder.setBitstream(&m_bs);
-    if (slice->m_pps->bEntropyCodingSyncEnabled)
-        m_entropyCoder.codeSliceHeaderWPPEntryPoints(*slice, m_substreamSizes, maxStreamSize);
-    m_bs.writeByteAlignment();
+            // complete the slice header by writing WPP row-starts
+            if (slice->m_pps->bEntropyCodingSyncEnabled)
+                m_entropyCoder.codeSliceHeaderWPPEntryPoints(m_substreamSizes, numStreams, maxStreamSize);
+            m_bs.writeByteAlignment();
 
-    m_nalList.serialize(slice->m_nalUnitType, m_bs);
+            m_nalList.serialize(slice->m_nalUnitType, m_bs);
+        }
+    }
 
     if (m_param->decodedPictureHashSEI)
     {
@@ -706,73 +796,208 @@ void FrameEncoder::compressFrame()
     m_endFrameTime = x265_mdate();
 }
 
-void FrameEncoder::encodeSlice()
+void FrameEncoder::waitForReferenceRows(Frame* refpic, uint32_t rows)
 {
-    Slice* slice = m_frame->m_encData->m_slice;
-    const uint32_t widthInLCUs = slice->m_sps->numCuInWidth;
-    const uint32_t lastCUAddr = (slice->m_endCUAddr + NUM_4x4_PARTITIONS - 1) / NUM_4x4_PARTITIONS;
-    const uint32_t numSubstreams = m_param->bEnableWavefront ? slice->m_sps->numCuInHeight : 1;
+    uint32_t reconRowCount = refpic->m_reconRowCount.get();
+    if ((reconRowCount == m_numRows) || (reconRowCount >= rows))
+        return;
+
+    /* While this frame is stalled, the frame encoder reconstructing the
+     * reference is on the critical path. Raise its scheduling priority by one
+     * plus the number of frame encoders which are in turn stalled on this one,
+     * along with every frame encoder the reference's encoder is stalled on */
+    JobProvider* refProvider = m_pool ? refpic->m_encData->m_jobProvider : NULL;
+    if (refProvider)
+        beginBlockedOn(refProvider);
+
+    while ((reconRowCount != m_numRows) && (reconRowCount < rows))
+        reconRowCount = refpic->m_reconRowCount.waitForChange(reconRowCount);
+
+    if (refProvider)
+        endBlockedOn();
+}
 
-    SAOParam* saoParam = slice->m_sps->bUseSAO ? m_frame->m_encData->m_saoParam : NULL;
-    for (uint32_t cuAddr = 0; cuAddr < lastCUAddr; cuAddr++)
+void FrameEncoder::SliceCoder::processTasks(int /* workerThreadId */)
+{
+    m_lock.acquire();
+    while (m_jobAcquired < m_jobTotal)
     {
-        uint32_t col = cuAddr % widthInLCUs;
-        uint32_t lin = cuAddr / widthInLCUs;
-        uint32_t subStrm = lin % numSubstreams;
-        CUData* ctu = m_frame->m_encData->getPicCTU(cuAddr);
+        uint32_t sliceId = m_jobAcquired++;
+        m_lock.release();
 
-        m_entropyCoder.setBitstream(&m_outStreams[subStrm]);
+        master.encodeSlice(sliceId);
 
-        // Synchronize cabac probabilities with upper-right CTU if it's available and we're at the start of a line.
-        if (m_param->bEnableWavefront && !col && lin)
-        {
-            m_entropyCoder.copyState(m_initSliceContext);
-            m_entropyCoder.loadContexts(m_rows[lin - 1].bufferedEntropy);
-        }
+        m_lock.acquire();
+    }
+    m_lock.release();
+}
 
-        if (saoParam)
+/* final coding (bitstream generation) of one slice, splitting it into
+ * dependent slice segments if their size is limited */
+void FrameEncoder::encodeSlice(uint32_t sliceId)
+{
+    FrameData& encData = *m_frame->m_encData;
+    Slice* slice = encData.m_slice;
+    const uint32_t firstCUAddr = m_sliceBaseRow[sliceId] * m_numCols;
+    const uint32_t endCUAddr = m_sliceBaseRow[sliceId + 1] * m_numCols;
+    SliceSegment* segments = m_segments + firstCUAddr;
+    uint32_t numSegments = 1;
+
+    /* the CTUs of this slice have all been compressed, so the row coder of
+     * its first row is free to be reused */
+    Entropy& coder = m_rows[m_sliceBaseRow[sliceId]].rowGoOnCoder;
+    coder.load(m_initSliceContext);
+
+    segments[0].firstCUAddr = firstCUAddr;
+    segments[0].streamStart = 0;
+
+    if (!m_param->maxSliceBytes)
+    {
+        for (uint32_t cuAddr = firstCUAddr; cuAddr < endCUAddr; cuAddr++)
+            encodeSliceCTU(coder, cuAddr);
+    }
+    else
+    {
+        /* measure the segment overhead which is not CTU data; the NAL header,
+         * slice header and its alignment. The WPP entry points are counted
+         * as 4 bytes per substream after the first */
+        Entropy headerCoder;
+        Bitstream header;
+        headerCoder.setBitstream(&header);
+        headerCoder.codeSliceHeader(*slice, encData, firstCUAddr, false);
+        const uint32_t sliceHeaderBytes = 2 + header.getNumberOfWrittenBits() / 8 + 1;
+        header.resetBits();
+        headerCoder.codeSliceHeader(*slice, encData, endCUAddr - 1, true);
+        const uint32_t segmentHeaderBytes = 2 + header.getNumberOfWrittenBits() / 8 + 1;
+
+        /* coder states before the previous and the current CTU, so the
+         * previous CTU can be coded again to end the segment when the current
+         * CTU does not fit within it */
+        Entropy prevCheckpoint, curCheckpoint;
+        uint32_t prevStream = 0, prevStreamBytes = 0;
+        uint32_t curStream = 0, curStreamBytes = 0;
+
+        uint32_t segFirstCUAddr = firstCUAddr;
+        uint32_t headerBytes = sliceHeaderBytes;
+        bool bNewSegment = false;
+
+        for (uint32_t cuAddr = firstCUAddr; cuAddr < endCUAddr;)
         {
-            if (saoParam->bSaoFlag[0] || saoParam->bSaoFlag[1])
+            uint32_t row = cuAddr / m_numCols;
+            uint32_t col = cuAddr % m_numCols;
+            uint32_t stream = substreamIndex(row);
+            CUData* ctu = encData.getPicCTU(cuAddr);
+
+            if (bNewSegment)
             {
-                int mergeLeft = col && saoParam->ctuParam[0][cuAddr].mergeMode == SAO_MERGE_LEFT;
-                int mergeUp = lin && saoParam->ctuParam[0][cuAddr].mergeMode == SAO_MERGE_UP;
-                if (col)
-                    m_entropyCoder.codeSaoMerge(mergeLeft);
-                if (lin && !mergeLeft)
-                    m_entropyCoder.codeSaoMerge(mergeUp);
-                if (!mergeLeft && !mergeUp)
-                {
-                    if (saoParam->bSaoFlag[0])
-                        m_entropyCoder.codeSaoOffset(saoParam->ctuParam[0][cuAddr], 0);
-                    if (saoParam->bSaoFlag[1])
-                    {
-                        m_entropyCoder.codeSaoOffset(saoParam->ctuParam[1][cuAddr], 1);
-                        m_entropyCoder.codeSaoOffset(saoParam->ctuParam[2][cuAddr], 2);
-                    }
-                }
+                segments[numSegments].firstCUAddr = cuAddr;
+                segments[numSegments].streamStart = m_outStreams[stream].getNumberOfWrittenBytes();
+                numSegments++;
+                segFirstCUAddr = cuAddr;
+                headerBytes = segmentHeaderBytes;
+                bNewSegment = false;
+
+                /* a dependent segment continues the contexts of the previous
+                 * segment but restarts the arithmetic coder */
+                coder.copyState(m_initSliceContext);
             }
-            else
+
+            /* with WPP, a segment which begins part way through a CTU row
+             * must also end with that row */
+            if (m_param->bEnableWavefront && col == m_numCols - 1 && segFirstCUAddr % m_numCols)
+                ctu->m_bLastCuInSlice = true;
+
+            prevCheckpoint.load(curCheckpoint);
+            prevStream = curStream;
+            prevStreamBytes = curStreamBytes;
+            curCheckpoint.load(coder);
+            curStream = stream;
+            curStreamBytes = m_outStreams[stream].getNumberOfWrittenBytes();
+
+            encodeSliceCTU(coder, cuAddr);
+
+            /* conservative size of the segment NAL if it ended with this CTU */
+            uint32_t firstStream = substreamIndex(segFirstCUAddr / m_numCols);
+            uint32_t segmentBytes = headerBytes + coder.m_numBufferedBytes + 4 - segments[numSegments - 1].streamStart;
+            for (uint32_t s = firstStream; s <= stream; s++)
+                segmentBytes += m_outStreams[s].getNumberOfWrittenBytes() + (s > firstStream ? 4 : 0);
+
+            if (segmentBytes > (uint32_t)m_param->maxSliceBytes && cuAddr > segFirstCUAddr)
             {
-                for (int i = 0; i < 3; i++)
-                    saoParam->ctuParam[i][cuAddr].reset();
+                /* remove this CTU and end the segment with the previous one */
+                m_outStreams[curStream].truncate(curStreamBytes);
+                m_outStreams[prevStream].truncate(prevStreamBytes);
+                coder.load(prevCheckpoint);
+                encData.getPicCTU(cuAddr - 1)->m_bLastCuInSlice = true;
+                encodeSliceCTU(coder, cuAddr - 1);
+                bNewSegment = true;
+                continue;
             }
+
+            bNewSegment = ctu->m_bLastCuInSlice;
+            cuAddr++;
         }
+    }
 
-        // final coding (bitstream generation) for this CU
-        m_entropyCoder.encodeCTU(*ctu, m_cuGeoms[m_ctuGeomMap[cuAddr]]);
+    m_numSegments[sliceId] = numSegments;
+    coder.setBitstream(NULL);
+}
 
-        if (m_param->bEnableWavefront)
-        {
-            if (col == 1)
-                // Store probabilities of second CTU in line into buffer
-                m_rows[lin].bufferedEntropy.loadContexts(m_entropyCoder);
+void FrameEncoder::encodeSliceCTU(Entropy& coder, uint32_t cuAddr)
+{
+    const uint32_t widthInLCUs = m_numCols;
+    uint32_t col = cuAddr % widthInLCUs;
+    uint32_t lin = cuAddr / widthInLCUs;
+    uint32_t sliceFirstRow = m_sliceBaseRow[m_rows[lin].sliceId];
+    CUData* ctu = m_frame->m_encData->getPicCTU(cuAddr);
+    SAOParam* saoParam = m_frame->m_encData->m_slice->m_sps->bUseSAO ? m_frame->m_encData->m_saoParam : NULL;
+
+    coder.setBitstream(&m_outStreams[substreamIndex(lin)]);
+
+    // Synchronize cabac probabilities with upper-right CTU if it's available and we're at the start of a line.
+    if (m_param->bEnableWavefront && !col && lin != sliceFirstRow)
+    {
+        coder.copyState(m_initSliceContext);
+        coder.loadContexts(m_rows[lin - 1].bufferedEntropy);
+    }
 
-            if (col == widthInLCUs - 1)
-                m_entropyCoder.finishSlice();
+    if (saoParam)
+    {
+        if (saoParam->bSaoFlag[0] || saoParam->bSaoFlag[1])
+        {
+            int mergeLeft = col && saoParam->ctuParam[0][cuAddr].mergeMode == SAO_MERGE_LEFT;
+            int mergeUp = lin != sliceFirstRow && saoParam->ctuParam[0][cuAddr].mergeMode == SAO_MERGE_UP;
+            if (col)
+                coder.codeSaoMerge(mergeLeft);
+            if (lin != sliceFirstRow && !mergeLeft)
+                coder.codeSaoMerge(mergeUp);
+            if (!mergeLeft && !mergeUp)
+            {
+                if (saoParam->bSaoFlag[0])
+                    coder.codeSaoOffset(saoParam->ctuParam[0][cuAddr], 0);
+                if (saoParam->bSaoFlag[1])
+                {
+                    coder.codeSaoOffset(saoParam->ctuParam[1][cuAddr], 1);
+                    coder.codeSaoOffset(saoParam->ctuParam[2][cuAddr], 2);
+                }
+            }
+        }
+        else
+        {
+            for (int i = 0; i < 3; i++)
+                saoParam->ctuParam[i][cuAddr].reset();
         }
     }
-    if (!m_param->bEnableWavefront)
-        m_entropyCoder.finishSlice();
+
+    // final coding (bitstream generation) for this CU
+    coder.encodeCTU(*ctu, m_cuGeoms[m_ctuGeomMap[cuAddr]]);
+
+    if (m_param->bEnableWavefront && col == 1)
+        // Store probabilities of second CTU in line into buffer
+        m_rows[lin].bufferedEntropy.loadContexts(coder);
+
+    if (ctu->m_bLastCuInSlice || (m_param->bEnableWavefront && col == widthInLCUs - 1))
+        coder.finishSlice();
 }
 
 void FrameEncoder::processRow(int row, int threadId)
@@ -808,7 +1033,8 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
     CTURow& curRow = m_rows[row];
 
     tld.analysis.m_param = m_param;
-    if (m_param->bEnableWavefront)
+    tld.analysis.m_me.setSubpelRefine(m_param->subpelRefine); /* may be reduced by the deadline mode */
+    if (m_bParallelRows)
     {
         ScopedLock self(curRow.lock);
         if (!curRow.active)
@@ -828,9 +1054,12 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
         curRow.busy = true;
     }
 
+    const uint32_t sliceFirstRow = m_sliceBaseRow[curRow.sliceId];
+    const uint32_t sliceLastRow = m_sliceBaseRow[curRow.sliceId + 1] - 1;
+
     /* When WPP is enabled, every row has its own row coder instance. Otherwise
-     * they share row 0 */
-    Entropy& rowCoder = m_param->bEnableWavefront ? m_rows[row].rowGoOnCoder : m_rows[0].rowGoOnCoder;
+     * the rows of each slice share the coder of the first row of the slice */
+    Entropy& rowCoder = m_param->bEnableWavefront ? m_rows[row].rowGoOnCoder : m_rows[sliceFirstRow].rowGoOnCoder;
     FrameData& curEncData = *m_frame->m_encData;
     Slice *slice = curEncData.m_slice;
 
@@ -852,18 +1081,21 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
         uint32_t col = curRow.completed;
         const uint32_t cuAddr = lineStartCUAddr + col;
         CUData* ctu = curEncData.getPicCTU(cuAddr);
-        ctu->initCTU(*m_frame, cuAddr, slice->m_sliceQp);
+        bool bRecode = col < curRow.reuseCount;
+        if (!bRecode)
+            ctu->initCTU(*m_frame, cuAddr, slice->m_sliceQp, row == sliceFirstRow, row == sliceLastRow,
+                         row == sliceLastRow && col == numCols - 1);
 
         if (bIsVbv)
         {
-            if (!row)
+            if (row == sliceFirstRow)
             {
                 curEncData.m_rowStat[row].diagQp = curEncData.m_avgQpRc;
                 curEncData.m_rowStat[row].diagQpScale = x265_qp2qScale(curEncData.m_avgQpRc);
             }
 
             FrameData::RCStatCU& cuStat = curEncData.m_cuStat[cuAddr];
-            if (row >= col && row && m_vbvResetTriggerRow != intRow)
+            if (row >= col && row != sliceFirstRow && m_vbvResetTriggerRow != intRow)
                 cuStat.baseQp = curEncData.m_cuStat[cuAddr - numCols + 1].baseQp;
             else
                 cuStat.baseQp = curEncData.m_rowStat[row].diagQp;
@@ -891,7 +1123,7 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
         else
             curEncData.m_cuStat[cuAddr].baseQp = curEncData.m_avgQpRc;
 
-        if (m_param->bEnableWavefront && !col && row)
+        if (m_param->bEnableWavefront && !col && row != sliceFirstRow)
         {
             // Load SBAC coder context from previous row and initialize row state.
             rowCoder.copyState(m_initSliceContext);
@@ -899,7 +1131,8 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
         }
 
         // Does all the CU analysis, returns best top level mode decision
-        Mode& best = tld.analysis.compressCTU(*ctu, *m_frame, m_cuGeoms[m_ctuGeomMap[cuAddr]], rowCoder);
+        Mode& best = bRecode ? tld.analysis.recodeCTU(*ctu, *m_frame, m_cuGeoms[m_ctuGeomMap[cuAddr]], rowCoder) :
+                               tld.analysis.compressCTU(*ctu, *m_frame, m_cuGeoms[m_ctuGeomMap[cuAddr]], rowCoder);
 
         // take a sample of the current active worker count
         ATOMIC_ADD(&m_totalActiveWorkerCount, m_activeWorkerCount);
@@ -963,11 +1196,16 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
                 curEncData.m_rowStat[row].diagQp = qpBase;
                 curEncData.m_rowStat[row].diagQpScale =  x265_qp2qScale(qpBase);
 
-                if (reEncode < 0)
+                /* a restart would also stop the rows of the following slices,
+                 * which are not waiting on this one. Just let the new QP apply
+                 * to the remainder of the slice */
+                if (reEncode < 0 && m_numSlices == 1)
                 {
                     x265_log(m_param, X265_LOG_DEBUG, "POC %d row %d - encode restart required for VBV, to %.2f from %.2f\n",
                              m_frame->m_poc, row, qpBase, curEncData.m_cuStat[cuAddr].baseQp);
 
+                    m_countVbvRestarts++;
+
                     // prevent the WaveFront::findJob() method from providing new jobs
                     m_vbvResetTriggerRow = row;
                     m_bAllRowsStop = true;
@@ -1009,6 +1247,12 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
                             while (bRowBusy);
                         }
 
+                        /* the CUs coded so far keep their mode decisions. Their
+                         * merge and MV predictors reference only CUs above and
+                         * left of them, which the wavefront guarantees are kept
+                         * as well */
+                        stopRow.reuseCount = X265_MAX(stopRow.reuseCount, stopRow.completed);
+
                         m_outStreams[r].resetBits();
                         stopRow.completed = 0;
                         memset(&stopRow.rowStats, 0, sizeof(stopRow.rowStats));
@@ -1029,7 +1273,7 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
         if (m_param->bEnableSAO && m_param->bSaoNonDeblocked)
             m_frameFilter.m_sao.calcSaoStatsCu_BeforeDblk(m_frame, col, row);
 
-        if (m_param->bEnableWavefront && curRow.completed >= 2 && row < m_numRows - 1 &&
+        if (m_param->bEnableWavefront && curRow.completed >= 2 && row < sliceLastRow &&
             (!m_bAllRowsStop || intRow + 1 < m_vbvResetTriggerRow))
         {
             /* activate next row */
@@ -1045,7 +1289,7 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
 
         ScopedLock self(curRow.lock);
         if ((m_bAllRowsStop && intRow > m_vbvResetTriggerRow) ||
-            (row > 0 && curRow.completed < numCols - 1 && m_rows[row - 1].completed < m_rows[row].completed + 2))
+            (row > sliceFirstRow && curRow.completed < numCols - 1 && m_rows[row - 1].completed < m_rows[row].completed + 2))
         {
             curRow.active = false;
             curRow.busy = false;
@@ -1083,28 +1327,50 @@ void FrameEncoder::processRowEncoder(int intRow, ThreadLocalData& tld)
         }
     }
 
-    /* flush row bitstream (if WPP and no SAO) or flush frame if no WPP and no SAO */
-    if (!m_param->bEnableSAO && (m_param->bEnableWavefront || row == m_numRows - 1))
+    /* flush row bitstream (if WPP) or slice bitstream (if no WPP), unless the
+     * final bitstream is deferred to encodeSlice() */
+    if (!m_param->bEnableSAO && !m_param->maxSliceBytes && (m_param->bEnableWavefront || row == sliceLastRow))
         rowCoder.finishSlice();
 
-    if (m_param->bEnableWavefront)
+    if (!m_param->bEnableWavefront && m_bParallelRows && row < sliceLastRow)
     {
-        /* trigger row-wise loop filters */
-        if (row >= m_filterRowDelay)
+        /* without WPP the rows of a slice are compressed in order */
+        ScopedLock below(m_rows[row + 1].lock);
+        m_rows[row + 1].active = true;
+        enqueueRowEncoder(row + 1);
+        tryWakeOne();
+    }
+
+    if (m_bParallelRows)
+    {
+        /* trigger row-wise loop filters. With slices the rows do not complete
+         * in order, so a filter row is only enabled once every row above the
+         * row it waits for is compressed */
+        ScopedLock rowOrder(m_rowOrderLock);
+        uint32_t delay = X265_MIN(m_filterRowDelay, m_numRows);
+        uint32_t prevCount = m_rowsCompletedInOrder;
+        while (m_rowsCompletedInOrder < m_numRows && m_rows[m_rowsCompletedInOrder].completed == numCols)
+            m_rowsCompletedInOrder++;
+
+        for (uint32_t r = prevCount; r < m_rowsCompletedInOrder; r++)
         {
-            enableRowFilter(row - m_filterRowDelay);
+            if (r >= delay)
+            {
+                enableRowFilter(r - delay);
 
-            /* NOTE: Activate filter if first row (row 0) */
-            if (row == m_filterRowDelay)
-                enqueueRowFilter(0);
-            tryWakeOne();
+                /* NOTE: Activate filter if first row (row 0) */
+                if (r == delay)
+                    enqueueRowFilter(0);
+            }
         }
-        if (row == m_numRows - 1)
+        if (prevCount < m_numRows && m_rowsCompletedInOrder == m_numRows)
         {
-            for (uint32_t i = m_numRows - m_filterRowDelay; i < m_numRows; i++)
+            for (uint32_t i = m_numRows - delay; i < m_numRows; i++)
                 enableRowFilter(i);
-            tryWakeOne();
+            if (delay == m_numRows)
+                enqueueRowFilter(0);
         }
+        tryWakeOne();
     }
 
     tld.analysis.m_param = NULL;
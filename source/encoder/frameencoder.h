@@ -97,17 +97,33 @@ struct CTURow
     /* count of completed CUs in this row */
     volatile uint32_t completed;
 
+    /* count of CUs at the start of this row whose mode decisions survived a
+     * VBV restart. They are recoded at the new QP without a new analysis */
+    uint32_t          reuseCount;
+
+    /* index of the slice which contains this row, constant for the encode */
+    uint32_t          sliceId;
+
     /* called at the start of each frame to initialize state */
     void init(Entropy& initContext)
     {
         active = false;
         busy = false;
         completed = 0;
+        reuseCount = 0;
         memset(&rowStats, 0, sizeof(rowStats));
         rowGoOnCoder.load(initContext);
     }
 };
 
+/* the first CTU of a slice segment, and the offset of its data within the
+ * substream of its CTU row */
+struct SliceSegment
+{
+    uint32_t firstCUAddr;
+    uint32_t streamStart;
+};
+
 // Manages the wave-front processing of a single encoding frame
 class FrameEncoder : public WaveFront, public Thread
 {
@@ -136,14 +152,21 @@ public:
     volatile bool            m_bAllRowsStop;
     volatile int             m_completionCount;
     volatile int             m_vbvResetTriggerRow;
+    uint32_t                 m_rowsCompletedInOrder; // count of leading CTU rows which are all compressed
+    Lock                     m_rowOrderLock;         // protects m_rowsCompletedInOrder
 
     uint32_t                 m_numRows;
     uint32_t                 m_numCols;
     uint32_t                 m_filterRowDelay;
     uint32_t                 m_filterRowDelayCus;
     uint32_t                 m_refLagRows;
+    uint32_t                 m_numSlices;
+    bool                     m_bParallelRows;  // CTU rows are compressed by worker threads (WPP or multiple slices)
 
     CTURow*                  m_rows;
+    uint32_t*                m_sliceBaseRow;   // first CTU row of each slice, followed by m_numRows
+    SliceSegment*            m_segments;       // segments of each slice, starting at the index of its first CTU
+    uint32_t*                m_numSegments;    // count of segments in each slice
     RateControlEntry         m_rce;
     SEIDecodedPictureHash    m_seiReconPictureDigest;
 
@@ -162,6 +185,7 @@ public:
     volatile int             m_totalActiveWorkerCount;   // sum of m_activeWorkerCount sampled at end of each CTU
     volatile int             m_activeWorkerCountSamples; // count of times m_activeWorkerCount was sampled (think vbv restarts)
     volatile int             m_countRowBlocks;           // count of workers forced to abandon a row because of top dependency
+    int                      m_countVbvRestarts;         // count of mid-frame VBV encode restarts
     int64_t                  m_startCompressTime;        // timestamp when frame encoder is given a frame
     int64_t                  m_row0WaitTime;             // timestamp when row 0 is allowed to start
     int64_t                  m_allRowsAvailableTime;     // timestamp when all reference dependencies are resolved
@@ -209,6 +233,21 @@ public:
         WeightAnalysis operator=(const WeightAnalysis&);
     };
 
+    class SliceCoder : public BondedTaskGroup
+    {
+    public:
+
+        FrameEncoder& master;
+
+        SliceCoder(FrameEncoder& fe) : master(fe) {}
+
+        void processTasks(int workerThreadId);
+
+    protected:
+
+        SliceCoder operator=(const SliceCoder&);
+    };
+
 protected:
 
     bool initializeGeoms();
@@ -216,8 +255,16 @@ protected:
     /* analyze / compress frame, can be run in parallel within reference constraints */
     void compressFrame();
 
-    /* called by compressFrame to generate final per-row bitstreams */
-    void encodeSlice();
+    /* called by compressFrame to generate the final bitstreams of one slice,
+     * splitting it into slice segments if maxSliceBytes is set */
+    void encodeSlice(uint32_t sliceId);
+    void encodeSliceCTU(Entropy& coder, uint32_t cuAddr);
+
+    /* index of the bitstream which holds the CTUs of the given row */
+    uint32_t substreamIndex(uint32_t row) const { return m_param->bEnableWavefront ? row : m_rows[row].sliceId; }
+
+    /* blocks until the reference picture has reconstructed the given number of rows */
+    void waitForReferenceRows(Frame* refpic, uint32_t rows);
 
     void threadMain();
     int  collectCTUStatistics(const CUData& ctu, uint32_t* qtreeInterCnt, uint32_t* qtreeIntraCnt, uint32_t* qtreeSkipCnt);
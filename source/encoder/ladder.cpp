@@ -0,0 +1,430 @@
+/*****************************************************************************
+ * Copyright (C) 2015 x265 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at license @ x265.com.
+ *****************************************************************************/
+
+#include "common.h"
+#include "cudata.h"
+
+#include "encoder.h"
+#include "ladder.h"
+
+using namespace X265_NS;
+
+namespace {
+
+/* encode one picture of one rendition, as x265_encoder_encode() does */
+int encodePicture(Encoder* enc, x265_nal*& nal, uint32_t& numNal, x265_picture* pic_in, x265_picture* pic_out)
+{
+    int numEncoded;
+    do
+    {
+        numEncoded = enc->encode(pic_in, pic_out);
+    }
+    while (numEncoded == 0 && !pic_in && enc->m_numDelayedPic);
+
+    if (pic_in)
+    {
+        pic_in->analysisData.intraData = NULL;
+        pic_in->analysisData.interData = NULL;
+    }
+
+    if (numEncoded > 0)
+    {
+        nal = &enc->m_nalList.m_nal[0];
+        numNal = enc->m_nalList.m_numNal;
+    }
+    else
+        numNal = 0;
+
+    return numEncoded;
+}
+
+/* decide the CU depths of a lower rendition CTU; a CU is split when the
+ * majority of its 4x4 blocks want a smaller CU. This follows the recursion
+ * of compressIntraCU() so the depths are a valid reuse quadtree */
+void scaleDepth(const CUGeom& cuGeom, const uint8_t* wantDepth, uint8_t* depth)
+{
+    /* blocks outside of the picture are never read, they are given the
+     * depth of their CU so every block of the CTU belongs to one CU */
+    if (!(cuGeom.flags & CUGeom::PRESENT))
+    {
+        memset(depth + cuGeom.absPartIdx, cuGeom.depth, cuGeom.numPartitions);
+        return;
+    }
+
+    bool bSplit = !!(cuGeom.flags & CUGeom::SPLIT_MANDATORY);
+    if (!bSplit && !(cuGeom.flags & CUGeom::LEAF))
+    {
+        uint32_t deeper = 0;
+        for (uint32_t i = cuGeom.absPartIdx; i < cuGeom.absPartIdx + cuGeom.numPartitions; i++)
+            deeper += wantDepth[i] > cuGeom.depth;
+        bSplit = deeper * 2 > cuGeom.numPartitions;
+    }
+
+    if (bSplit)
+    {
+        for (uint32_t subPartIdx = 0; subPartIdx < 4; subPartIdx++)
+            scaleDepth(*(&cuGeom + cuGeom.childOffset + subPartIdx), wantDepth, depth);
+    }
+    else
+        memset(depth + cuGeom.absPartIdx, cuGeom.depth, cuGeom.numPartitions);
+}
+
+}
+
+Ladder::Ladder()
+{
+    m_rend = NULL;
+    m_count = 0;
+    m_aborted = false;
+}
+
+bool Ladder::create(int count)
+{
+    m_rend = X265_MALLOC(Rendition, count);
+    if (!m_rend)
+        return false;
+
+    memset(m_rend, 0, sizeof(Rendition) * count);
+    m_count = count;
+    return true;
+}
+
+bool Ladder::init(int rendition, Encoder* enc, const x265_param& srcParam)
+{
+    Rendition& r = m_rend[rendition];
+    r.enc = enc;
+    r.pocLast = -1;
+    r.srcWidth = srcParam.sourceWidth;
+    r.srcHeight = srcParam.sourceHeight;
+    if (!rendition)
+        return true;
+
+    const Encoder* top = m_rend[0].enc;
+    const x265_param& p = *enc->m_param;
+    uint32_t topWidth = top->m_param->sourceWidth;
+    uint32_t topHeight = top->m_param->sourceHeight;
+    uint32_t width = p.sourceWidth;
+    uint32_t height = p.sourceHeight;
+    uint32_t widthInCU = enc->m_sps.numCuInWidth;
+    uint32_t numCUs = widthInCU * enc->m_sps.numCuInHeight;
+
+    /* the CU depth offset is the downscale ratio rounded to a power of two */
+    r.depthShift = 0;
+    while (r.depthShift < g_maxCUDepth && (uint64_t)width * (2000 << r.depthShift) <= (uint64_t)topWidth * 1414)
+        r.depthShift++;
+    r.bIntraNxN = enc->m_sps.quadtreeTULog2MinSize < 3;
+
+    uint32_t widthRem = width & (g_maxCUSize - 1);
+    uint32_t heightRem = height & (g_maxCUSize - 1);
+    CUData::calcCTUGeoms(g_maxCUSize, g_maxCUSize, g_maxCUSize, p.minCUSize, r.cuGeoms[0]);
+    CUData::calcCTUGeoms(widthRem ? widthRem : g_maxCUSize, g_maxCUSize, g_maxCUSize, p.minCUSize, r.cuGeoms[1]);
+    CUData::calcCTUGeoms(g_maxCUSize, heightRem ? heightRem : g_maxCUSize, g_maxCUSize, p.minCUSize, r.cuGeoms[2]);
+    CUData::calcCTUGeoms(widthRem ? widthRem : g_maxCUSize, heightRem ? heightRem : g_maxCUSize, g_maxCUSize, p.minCUSize, r.cuGeoms[3]);
+
+    /* map the center of each 4x4 block to the collocated block of the highest rendition */
+    CHECKED_MALLOC(r.partMap, uint32_t, numCUs * NUM_4x4_PARTITIONS);
+    for (uint32_t cuAddr = 0; cuAddr < numCUs; cuAddr++)
+    {
+        uint32_t ctuX = (cuAddr % widthInCU) << g_maxLog2CUSize;
+        uint32_t ctuY = (cuAddr / widthInCU) << g_maxLog2CUSize;
+        for (uint32_t i = 0; i < NUM_4x4_PARTITIONS; i++)
+        {
+            uint32_t x = X265_MIN((ctuX + g_zscanToPelX[i] + 2) * topWidth / width, topWidth - 1);
+            uint32_t y = X265_MIN((ctuY + g_zscanToPelY[i] + 2) * topHeight / height, topHeight - 1);
+            uint32_t topAddr = (y >> g_maxLog2CUSize) * top->m_sps.numCuInWidth + (x >> g_maxLog2CUSize);
+            uint32_t raster = ((y & (g_maxCUSize - 1)) >> 2) * (g_maxCUSize >> 2) + ((x & (g_maxCUSize - 1)) >> 2);
+            r.partMap[cuAddr * NUM_4x4_PARTITIONS + i] = topAddr * NUM_4x4_PARTITIONS + g_rasterToZscan[raster];
+        }
+    }
+
+    return true;
+
+fail:
+    return false;
+}
+
+void Ladder::destroy()
+{
+    for (int i = 0; i < m_count; i++)
+    {
+        Rendition& r = m_rend[i];
+        while (r.head)
+        {
+            LadderPic* lp = r.head;
+            r.head = lp->next;
+            /* pictures not yet analysed have no analysis allocated */
+            r.enc->freeAnalysis(&lp->analysis);
+            freePicture(lp);
+        }
+        X265_FREE(r.partMap);
+        r.partMap = NULL;
+    }
+}
+
+Ladder::~Ladder()
+{
+    X265_FREE(m_rend);
+}
+
+bool Ladder::queuePicture(Rendition& r, const x265_picture& pic)
+{
+    const x265_cli_csp& csp = x265_cli_csps[pic.colorSpace];
+    int bytes = pic.bitDepth > 8 ? 2 : 1;
+    size_t planeSize[3];
+    size_t total = 0;
+    for (int i = 0; i < csp.planes; i++)
+    {
+        planeSize[i] = (size_t)(r.srcWidth >> csp.width[i]) * bytes * (r.srcHeight >> csp.height[i]);
+        total += planeSize[i];
+    }
+
+    LadderPic* lp = X265_MALLOC(LadderPic, 1);
+    uint8_t* buf = X265_MALLOC(uint8_t, total);
+    if (!lp || !buf)
+    {
+        X265_FREE(lp);
+        X265_FREE(buf);
+        x265_log(r.enc->m_param, X265_LOG_ERROR, "unable to queue ladder input picture\n");
+        return false;
+    }
+
+    memcpy(&lp->pic, &pic, sizeof(x265_picture));
+    memset(&lp->pic.analysisData, 0, sizeof(x265_analysis_data));
+    memset(&lp->analysis, 0, sizeof(x265_analysis_data));
+    lp->analysis.poc = ++r.pocLast;
+    lp->next = NULL;
+    lp->bReady = false;
+
+    for (int i = 0; i < csp.planes; i++)
+    {
+        int rowBytes = (r.srcWidth >> csp.width[i]) * bytes;
+        const uint8_t* src = (const uint8_t*)pic.planes[i];
+        lp->pic.planes[i] = buf;
+        lp->pic.stride[i] = rowBytes;
+        for (int y = 0; y < (r.srcHeight >> csp.height[i]); y++, src += pic.stride[i], buf += rowBytes)
+            memcpy(buf, src, rowBytes);
+    }
+
+    if (r.tail)
+        r.tail->next = lp;
+    else
+        r.head = lp;
+    r.tail = lp;
+    return true;
+}
+
+void Ladder::freePicture(LadderPic* lp)
+{
+    /* the plane buffer was allocated as one block */
+    X265_FREE(lp->pic.planes[0]);
+    X265_FREE(lp);
+}
+
+void Ladder::addAnalysis(const x265_analysis_data& analysis, int sliceType)
+{
+    for (int i = 1; i < m_count; i++)
+    {
+        LadderPic* lp = m_rend[i].head;
+        while (lp && lp->analysis.poc != analysis.poc)
+            lp = lp->next;
+        if (!lp)
+            continue;
+
+        if (!scaleAnalysis(m_rend[i], analysis, sliceType, lp->analysis))
+        {
+            m_aborted = true;
+            return;
+        }
+        lp->bReady = true;
+    }
+}
+
+bool Ladder::scaleAnalysis(Rendition& r, const x265_analysis_data& top, int sliceType, x265_analysis_data& out)
+{
+    const Encoder* enc = r.enc;
+    uint32_t widthInCU = enc->m_sps.numCuInWidth;
+    uint32_t heightInCU = enc->m_sps.numCuInHeight;
+    uint32_t numParts = NUM_4x4_PARTITIONS;
+    uint32_t size = widthInCU * heightInCU * numParts;
+    bool bIntra = IS_X265_TYPE_I(sliceType);
+
+    out.sliceType = sliceType;
+    out.numCUsInFrame = widthInCU * heightInCU;
+    out.numPartitions = numParts;
+
+    analysis_intra_data* intraData = NULL;
+    analysis_inter_data* interData = NULL;
+    const uint8_t* topDepth;
+    uint8_t* depth;
+    if (bIntra)
+    {
+        CHECKED_MALLOC_ZERO(intraData, analysis_intra_data, 1);
+        out.intraData = intraData;
+        CHECKED_MALLOC_ZERO(intraData->depth, uint8_t, size);
+        CHECKED_MALLOC(intraData->modes, uint8_t, size);
+        CHECKED_MALLOC(intraData->partSizes, char, size);
+        CHECKED_MALLOC(intraData->chromaModes, uint8_t, size);
+        topDepth = ((analysis_intra_data*)top.intraData)->depth;
+        depth = intraData->depth;
+    }
+    else
+    {
+        /* reference indices and merge candidates are recorded in the order of
+         * the searches of the highest rendition, not by position, so they
+         * cannot be scaled. Only CU depths and skip decisions are passed */
+        CHECKED_MALLOC_ZERO(interData, analysis_inter_data, 1);
+        out.interData = interData;
+        CHECKED_MALLOC_ZERO(interData->depth, uint8_t, size);
+        CHECKED_MALLOC(interData->modes, uint8_t, size);
+        topDepth = ((analysis_inter_data*)top.interData)->depth;
+        depth = interData->depth;
+    }
+
+    for (uint32_t cuAddr = 0; cuAddr < out.numCUsInFrame; cuAddr++)
+    {
+        const uint32_t* map = &r.partMap[cuAddr * numParts];
+        uint32_t geom = ((cuAddr % widthInCU) == widthInCU - 1 ? 1 : 0) + (cuAddr / widthInCU == heightInCU - 1 ? 2 : 0);
+        uint8_t wantDepth[MAX_NUM_PARTITIONS];
+        for (uint32_t i = 0; i < numParts; i++)
+            wantDepth[i] = (uint8_t)X265_MIN(topDepth[map[i]] + r.depthShift, g_maxCUDepth);
+
+        uint8_t* ctuDepth = depth + cuAddr * numParts;
+        scaleDepth(r.cuGeoms[geom][0], wantDepth, ctuDepth);
+
+        /* the modes of each CU are taken from the collocated center block */
+        for (uint32_t i = 0; i < numParts;)
+        {
+            uint32_t cuParts = numParts >> (2 * ctuDepth[i]);
+            uint32_t center = map[i + 3 * (cuParts >> 2)];
+            uint32_t ctuIdx = cuAddr * numParts + i;
+            if (bIntra)
+            {
+                const analysis_intra_data* topIntra = (const analysis_intra_data*)top.intraData;
+                bool bNxN = r.bIntraNxN && g_maxLog2CUSize - ctuDepth[i] == 3 && topIntra->partSizes[center] == SIZE_NxN;
+                for (uint32_t j = 0; j < cuParts; j++)
+                {
+                    uint32_t src = bNxN ? map[i + j] : center;
+                    intraData->modes[ctuIdx + j] = topIntra->modes[src];
+                    intraData->chromaModes[ctuIdx + j] = topIntra->chromaModes[src];
+                    intraData->partSizes[ctuIdx + j] = bNxN ? SIZE_NxN : SIZE_2Nx2N;
+                }
+            }
+            else
+            {
+                /* a CU is a skip candidate when all of its area was skipped */
+                const analysis_inter_data* topInter = (const analysis_inter_data*)top.interData;
+                bool bSkip = true;
+                for (uint32_t j = 0; j < cuParts && bSkip; j++)
+                    bSkip = topInter->modes[map[i + j]] == MODE_SKIP;
+                memset(&interData->modes[ctuIdx], bSkip ? MODE_SKIP : MODE_INTER, cuParts);
+            }
+            i += cuParts;
+        }
+    }
+
+    return true;
+
+fail:
+    r.enc->freeAnalysis(&out);
+    return false;
+}
+
+int Ladder::encode(x265_nal** pp_nal, uint32_t* pi_nal, x265_picture** pic_in, x265_picture** pic_out)
+{
+    if (m_aborted)
+        return -1;
+
+    /* queue the lower rendition pictures first, the highest rendition may
+     * output the analysis of this picture before it returns */
+    if (pic_in)
+    {
+        for (int i = 0; i < m_count; i++)
+        {
+            if (!pic_in[i])
+            {
+                x265_log(m_rend[i].enc->m_param, X265_LOG_ERROR, "ladder input picture of rendition %d is missing\n", i);
+                return -1;
+            }
+        }
+
+        for (int i = 1; i < m_count; i++)
+        {
+            if (!queuePicture(m_rend[i], *pic_in[i]))
+            {
+                m_aborted = true;
+                return -1;
+            }
+        }
+    }
+
+    int numOutput = 0;
+    for (int i = 0; i < m_count; i++)
+    {
+        Rendition& r = m_rend[i];
+        x265_picture* out = pic_out ? pic_out[i] : NULL;
+        int ret = 0;
+
+        pi_nal[i] = 0;
+        if (!i)
+        {
+            if (!r.bFlushing || r.enc->m_numDelayedPic)
+                ret = encodePicture(r.enc, pp_nal[i], pi_nal[i], pic_in ? pic_in[0] : NULL, out);
+            r.bFlushing = !pic_in;
+        }
+        else
+        {
+            /* a lower rendition is given one analysed picture per call, unless
+             * the ladder is flushing, then it is fed until it outputs a picture */
+            do
+            {
+                LadderPic* lp = r.head;
+                if (lp && lp->bReady)
+                {
+                    r.head = lp->next;
+                    if (!r.head)
+                        r.tail = NULL;
+                    lp->pic.analysisData = lp->analysis;
+                    ret = encodePicture(r.enc, pp_nal[i], pi_nal[i], &lp->pic, out);
+                    freePicture(lp);
+                }
+                else if (!lp && m_rend[0].bFlushing && !m_rend[0].enc->m_numDelayedPic)
+                {
+                    if (r.enc->m_numDelayedPic || !r.bFlushing)
+                        ret = encodePicture(r.enc, pp_nal[i], pi_nal[i], NULL, out);
+                    r.bFlushing = true;
+                    break;
+                }
+                else
+                    break;
+            }
+            while (!ret && !pic_in);
+        }
+
+        if (ret < 0 || m_aborted)
+        {
+            m_aborted = true;
+            return -1;
+        }
+        numOutput += ret;
+    }
+
+    return numOutput;
+}
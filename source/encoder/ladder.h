@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * Copyright (C) 2015 x265 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at license @ x265.com.
+ *****************************************************************************/
+
+#ifndef X265_LADDER_H
+#define X265_LADDER_H
+
+#include "common.h"
+#include "cudata.h"
+#include "x265.h"
+
+struct x265_ladder {};
+
+namespace X265_NS {
+// private namespace
+
+class Encoder;
+
+/* A ladder of encoders (renditions) over one input sequence. The highest
+ * rendition runs in analysis save mode, its analysis never leaves memory.
+ * The input pictures of the lower renditions are queued until the highest
+ * rendition has encoded the same picture, then they are encoded in analysis
+ * load mode with its slice type and with its CU decisions scaled to their
+ * own resolution */
+class Ladder : public x265_ladder
+{
+public:
+
+    /* a queued input picture of a lower rendition */
+    struct LadderPic
+    {
+        x265_picture       pic;
+        x265_analysis_data analysis;
+        LadderPic*         next;
+        bool               bReady;   // analysis of the highest rendition is attached
+    };
+
+    struct Rendition
+    {
+        Encoder*   enc;
+        LadderPic* head;
+        LadderPic* tail;
+        int        pocLast;          // POC of the last queued input picture
+        bool       bFlushing;
+
+        int        srcWidth;         // input picture dimensions
+        int        srcHeight;
+        uint32_t   depthShift;       // CU depth offset from the highest rendition
+        bool       bIntraNxN;        // 8x8 intra CUs may be split into 4x4 PUs
+        uint32_t*  partMap;          // collocated 4x4 partition of the highest rendition
+        CUGeom     cuGeoms[4][CUGeom::MAX_GEOMS]; // interior, right, bottom, and corner CTUs
+    };
+
+    Rendition* m_rend;
+    int        m_count;
+    bool       m_aborted;
+
+    Ladder();
+    ~Ladder();
+
+    bool create(int count);
+    bool init(int rendition, Encoder* enc, const x265_param& srcParam);
+    void destroy();                  // before the encoders are closed
+
+    int  encode(x265_nal** pp_nal, uint32_t* pi_nal, x265_picture** pic_in, x265_picture** pic_out);
+
+    /* called by the highest rendition with the analysis of each output picture */
+    void addAnalysis(const x265_analysis_data& analysis, int sliceType);
+
+protected:
+
+    bool queuePicture(Rendition& r, const x265_picture& pic);
+    void freePicture(LadderPic* lp);
+    bool scaleAnalysis(Rendition& r, const x265_analysis_data& top, int sliceType, x265_analysis_data& out);
+};
+}
+
+#endif // ifndef X265_LADDER_H
@@ -70,6 +70,7 @@ public:
     static void initScales();
     static int hpelIterationCount(int subme);
     void init(int method, int refine, int csp);
+    void setSubpelRefine(int refine) { subpelRefine = refine; }
 
     /* Methods called at slice setup */
 
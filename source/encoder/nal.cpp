@@ -29,6 +29,7 @@ using namespace X265_NS;
 
 NALList::NALList()
     : m_numNal(0)
+    , m_nalAllocCount(0)
     , m_buffer(NULL)
     , m_occupancy(0)
     , m_allocSize(0)
@@ -36,7 +37,11 @@ NALList::NALList()
     , m_extraOccupancy(0)
     , m_extraAllocSize(0)
     , m_annexB(true)
-{}
+{
+    m_nal = X265_MALLOC(x265_nal, MIN_NAL_UNITS);
+    if (m_nal)
+        m_nalAllocCount = MIN_NAL_UNITS;
+}
 
 void NALList::takeContents(NALList& other)
 {
@@ -46,9 +51,14 @@ void NALList::takeContents(NALList& other)
     m_allocSize = other.m_allocSize;
     m_occupancy = other.m_occupancy;
 
-    /* copy packet data */
+    /* swap packet arrays, the other list may have grown theirs */
+    x265_nal* nal = m_nal;
+    uint32_t nalAllocCount = m_nalAllocCount;
+    m_nal = other.m_nal;
+    m_nalAllocCount = other.m_nalAllocCount;
     m_numNal = other.m_numNal;
-    memcpy(m_nal, other.m_nal, sizeof(x265_nal) * m_numNal);
+    other.m_nal = nal;
+    other.m_nalAllocCount = nalAllocCount;
 
     /* reset other list, re-allocate their buffer with same size */
     other.m_numNal = 0;
@@ -65,6 +75,25 @@ void NALList::serialize(NalUnitType nalUnitType, const Bitstream& bs)
     if (!bpayload)
         return;
 
+    if (m_numNal == m_nalAllocCount)
+    {
+        /* many slice segments per access unit may exceed the initial count */
+        uint32_t allocCount = X265_MAX(2 * m_nalAllocCount, (uint32_t)MIN_NAL_UNITS);
+        x265_nal* temp = X265_MALLOC(x265_nal, allocCount);
+        if (temp)
+        {
+            memcpy(temp, m_nal, sizeof(x265_nal) * m_numNal);
+            X265_FREE(m_nal);
+            m_nal = temp;
+            m_nalAllocCount = allocCount;
+        }
+        else
+        {
+            x265_log(NULL, X265_LOG_ERROR, "Unable to realloc NAL unit array\n");
+            return;
+        }
+    }
+
     uint32_t nextSize = m_occupancy + sizeof(startCodePrefix) + 2 + payloadSize + (payloadSize >> 1) + m_extraOccupancy;
     if (nextSize > m_allocSize)
     {
@@ -162,8 +191,6 @@ void NALList::serialize(NalUnitType nalUnitType, const Bitstream& bs)
 
     m_occupancy += bytes;
 
-    X265_CHECK(m_numNal < (uint32_t)MAX_NAL_UNITS, "NAL count overflow\n");
-
     x265_nal& nal = m_nal[m_numNal++];
     nal.type = nalUnitType;
     nal.sizeBytes = bytes;
@@ -172,7 +199,8 @@ void NALList::serialize(NalUnitType nalUnitType, const Bitstream& bs)
 
 /* concatenate and escape WPP sub-streams, return escaped row lengths.
  * These streams will be appended to the next serialized NAL */
-uint32_t NALList::serializeSubstreams(uint32_t* streamSizeBytes, uint32_t streamCount, const Bitstream* streams)
+uint32_t NALList::serializeSubstreams(uint32_t* streamSizeBytes, uint32_t streamCount, const Bitstream* streams,
+                                      uint32_t firstStreamStart, uint32_t lastStreamEnd)
 {
     uint32_t maxStreamSize = 0;
     uint32_t estSize = 0;
@@ -201,13 +229,16 @@ uint32_t NALList::serializeSubstreams(uint32_t* streamSizeBytes, uint32_t stream
     for (uint32_t s = 0; s < streamCount; s++)
     {
         const Bitstream& stream = streams[s];
+        uint32_t inStart = s ? 0 : firstStreamStart;
         uint32_t inSize = stream.getNumberOfWrittenBytes();
+        if (s == streamCount - 1)
+            inSize = X265_MIN(inSize, lastStreamEnd);
         const uint8_t *inBytes = stream.getFIFO();
         uint32_t prevBufSize = bytes;
 
         if (inBytes)
         {
-            for (uint32_t i = 0; i < inSize; i++)
+            for (uint32_t i = inStart; i < inSize; i++)
             {
                 if (bytes >= 2 && !out[bytes - 2] && !out[bytes - 1] && inBytes[i] <= 0x03)
                 {
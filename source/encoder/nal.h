@@ -34,12 +34,13 @@ class Bitstream;
 
 class NALList
 {
-    static const int MAX_NAL_UNITS = 16;
+    static const int MIN_NAL_UNITS = 16;
 
 public:
 
-    x265_nal    m_nal[MAX_NAL_UNITS];
+    x265_nal*   m_nal;
     uint32_t    m_numNal;
+    uint32_t    m_nalAllocCount;
 
     uint8_t*    m_buffer;
     uint32_t    m_occupancy;
@@ -51,13 +52,17 @@ public:
     bool        m_annexB;
 
     NALList();
-    ~NALList() { X265_FREE(m_buffer); X265_FREE(m_extraBuffer); }
+    ~NALList() { X265_FREE(m_nal); X265_FREE(m_buffer); X265_FREE(m_extraBuffer); }
 
     void takeContents(NALList& other);
 
     void serialize(NalUnitType nalUnitType, const Bitstream& bs);
 
-    uint32_t serializeSubstreams(uint32_t* streamSizeBytes, uint32_t streamCount, const Bitstream* streams);
+    /* firstStreamStart and lastStreamEnd restrict the byte range taken from
+     * the first and the last stream, for slice segments which begin or end
+     * part way through a substream */
+    uint32_t serializeSubstreams(uint32_t* streamSizeBytes, uint32_t streamCount, const Bitstream* streams,
+                                 uint32_t firstStreamStart = 0, uint32_t lastStreamEnd = MAX_UINT);
 };
 
 }
@@ -49,7 +49,7 @@ namespace {
 {\
     bErr = 0;\
     p = strstr(opts, opt "=");\
-    char* q = strstr(opts, "no-"opt);\
+    const char* q = strstr(opts, "no-"opt);\
     if (p && sscanf(p, opt "=%d" , &i) && param_val != i)\
         bErr = 1;\
     else if (!param_val && !q && !p)\
@@ -105,6 +105,22 @@ inline void reduceFraction(int* n, int* d)
     *d /= b;
 }
 
+/* the frame type of the stats files */
+inline uint8_t statsFrameType(int sliceType, int poc, bool bOpenGOP, bool bReferenced)
+{
+    return sliceType == I_SLICE ? (poc > 0 && bOpenGOP ? 'i' : 'I')
+        : sliceType == P_SLICE ? 'P'
+        : bReferenced ? 'B' : 'b';
+}
+
+/* b0 and b1 are the distances of the frame to its references */
+inline void setLookaheadCosts(StatsFileRecord& rec, const Lowres& lowres, int b0, int b1)
+{
+    rec.intraCost = lowres.costEst[0][0];
+    rec.lowresCost = lowres.costEst[b0][b1];
+    rec.satdCost = lowres.satdCost;
+}
+
 inline char *strcatFilename(const char *input, const char *suffix)
 {
     char *output = X265_MALLOC(char, strlen(input) + strlen(suffix) + 1);
@@ -118,6 +134,19 @@ inline char *strcatFilename(const char *input, const char *suffix)
     return output;
 }
 
+/* binary stats files are recognized by their magic, anything else is parsed
+ * as text stats */
+bool isBinaryStatsFile(const char *fileName)
+{
+    char magic[8];
+    FILE *fh = fopen(fileName, "rb");
+    if (!fh)
+        return false;
+    bool bBinary = fread(magic, 1, sizeof(magic), fh) == sizeof(magic) && !memcmp(magic, X265_STATS_MAGIC, sizeof(magic));
+    fclose(fh);
+    return bBinary;
+}
+
 inline double qScale2bits(RateControlEntry *rce, double qScale)
 {
     if (qScale < 0.1)
@@ -178,6 +207,7 @@ RateControl::RateControl(x265_param& p)
     m_rateFactorMaxDecrement = 0;
     m_fps = (double)m_param->fpsNum / m_param->fpsDenom;
     m_startEndOrder.set(0);
+    m_startOrder.set(0);
     m_bTerminated = false;
     m_finalFrameCount = 0;
     m_numEntries = 0;
@@ -215,6 +245,13 @@ RateControl::RateControl(x265_param& p)
     m_lastAbrResetPoc = -1;
     m_statFileOut = NULL;
     m_cutreeStatFileOut = m_cutreeStatFileIn = NULL;
+    m_statsMap = NULL;
+    m_statsMapSize = 0;
+    m_statsIndex = NULL;
+    m_statsOutIndex = NULL;
+    m_statsOutFrames = m_statsOutAlloc = 0;
+    m_statFileOutSize = 0;
+    m_statsOptionsSize = 0;
     m_rce2Pass = NULL;
     m_lastBsliceSatdCost = 0;
 
@@ -259,6 +296,7 @@ RateControl::RateControl(x265_param& p)
         m_param->rc.vbvMaxBitrate = 0;
     }
     m_isVbv = m_param->rc.vbvMaxBitrate > 0 && m_param->rc.vbvBufferSize > 0;
+    m_bDecoupledOrder = m_param->rc.rateControlMode != X265_RC_ABR && !m_isVbv && !m_param->rc.bStatRead;
     if (m_param->bEmitHRDSEI && !m_isVbv)
     {
         x265_log(m_param, X265_LOG_WARNING, "NAL HRD parameters require VBV parameters, ignored\n");
@@ -341,6 +379,8 @@ bool RateControl::init(const SPS& sps)
 
     m_totalBits = 0;
     m_encodedBits = 0;
+    m_inFlightRowBits = 0;
+    m_inFlightExpectedBits = 0;
     m_framesDone = 0;
     m_residualCost = 0;
     m_partialResidualCost = 0;
@@ -383,6 +423,17 @@ bool RateControl::init(const SPS& sps)
         m_pred[1].coeff = 0.75;
         m_pred[0].coeff = m_pred[3].coeff = 0.50;
     }
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            m_rowPreds[i][j].coeff = 0.25;
+            m_rowPreds[i][j].count = 1.0;
+            m_rowPreds[i][j].decay = 0.5;
+            m_rowPreds[i][j].offset = 0.0;
+        }
+        m_rowPredSeq[i] = 0;
+    }
     if (!m_statFileOut && (m_param->rc.bStatWrite || m_param->rc.bStatRead))
     {
         /* If the user hasn't defined the stat filename, use the default value */
@@ -390,7 +441,19 @@ bool RateControl::init(const SPS& sps)
         if (!fileName)
             fileName = s_defaultStatFileName;
         /* Load stat file and init 2pass algo */
-        if (m_param->rc.bStatRead)
+        if (m_param->rc.bStatRead && isBinaryStatsFile(fileName))
+        {
+            m_expectedBitsSum = 0;
+            if (!loadBinaryStats(fileName))
+                return false;
+
+            if (m_param->rc.rateControlMode == X265_RC_ABR)
+            {
+                if (!initPass2())
+                    return false;
+            }
+        }
+        else if (m_param->rc.bStatRead)
         {
             m_expectedBitsSum = 0;
             char *p, *statsIn, *statsBuf;
@@ -418,56 +481,16 @@ bool RateControl::init(const SPS& sps)
                 x265_log(m_param, X265_LOG_ERROR,"options list in stats file not valid\n");
                 return false;
             }
+            statsIn = strchr(statsBuf, '\n');
+            if (!statsIn)
             {
-                int i, j;
-                uint32_t k , l;
-                bool bErr = false;
-                char *opts = statsBuf;
-                statsIn = strchr(statsBuf, '\n');
-                if (!statsIn)
-                {
-                    x265_log(m_param, X265_LOG_ERROR, "Malformed stats file\n");
-                    return false;
-                }
-                *statsIn = '\0';
-                statsIn++;
-                if (sscanf(opts, "#options: %dx%d", &i, &j) != 2)
-                {
-                    x265_log(m_param, X265_LOG_ERROR, "Resolution specified in stats file not valid\n");
-                    return false;
-                }
-                if ((p = strstr(opts, " fps=")) == 0 || sscanf(p, " fps=%u/%u", &k, &l) != 2)
-                {
-                    x265_log(m_param, X265_LOG_ERROR, "fps specified in stats file not valid\n");
-                    return false;
-                }
-                if (k != m_param->fpsNum || l != m_param->fpsDenom)
-                {
-                    x265_log(m_param, X265_LOG_ERROR, "fps mismatch with 1st pass (%u/%u vs %u/%u)\n",
-                              m_param->fpsNum, m_param->fpsDenom, k, l);
-                    return false;
-                }
-                CMP_OPT_FIRST_PASS("bitdepth", m_param->internalBitDepth);
-                CMP_OPT_FIRST_PASS("weightp", m_param->bEnableWeightedPred);
-                CMP_OPT_FIRST_PASS("bframes", m_param->bframes);
-                CMP_OPT_FIRST_PASS("b-pyramid", m_param->bBPyramid);
-                CMP_OPT_FIRST_PASS("open-gop", m_param->bOpenGOP);
-                CMP_OPT_FIRST_PASS("keyint", m_param->keyframeMax);
-                CMP_OPT_FIRST_PASS("scenecut", m_param->scenecutThreshold);
-
-                if ((p = strstr(opts, "b-adapt=")) != 0 && sscanf(p, "b-adapt=%d", &i) && i >= X265_B_ADAPT_NONE && i <= X265_B_ADAPT_TRELLIS)
-                {
-                    m_param->bFrameAdaptive = i;
-                }
-                else if (m_param->bframes)
-                {
-                    x265_log(m_param, X265_LOG_ERROR, "b-adapt method specified in stats file not valid\n");
-                    return false;
-                }
-
-                if ((p = strstr(opts, "rc-lookahead=")) != 0 && sscanf(p, "rc-lookahead=%d", &i))
-                    m_param->lookaheadDepth = i;
+                x265_log(m_param, X265_LOG_ERROR, "Malformed stats file\n");
+                return false;
             }
+            *statsIn = '\0';
+            statsIn++;
+            if (!checkFirstPassOptions(statsBuf + 9))
+                return false;
             /* find number of pics */
             p = statsIn;
             int numEntries;
@@ -479,34 +502,9 @@ bool RateControl::init(const SPS& sps)
                 return false;
             }
             m_numEntries = numEntries;
-
-            if (m_param->totalFrames < m_numEntries && m_param->totalFrames > 0)
-            {
-                x265_log(m_param, X265_LOG_WARNING, "2nd pass has fewer frames than 1st pass (%d vs %d)\n",
-                         m_param->totalFrames, m_numEntries);
-            }
-            if (m_param->totalFrames > m_numEntries)
-            {
-                x265_log(m_param, X265_LOG_ERROR, "2nd pass has more frames than 1st pass (%d vs %d)\n",
-                         m_param->totalFrames, m_numEntries);
+            if (!allocPass2Entries())
                 return false;
-            }
 
-            m_rce2Pass = X265_MALLOC(RateControlEntry, m_numEntries);
-            if (!m_rce2Pass)
-            {
-                 x265_log(m_param, X265_LOG_ERROR, "Rce Entries for 2 pass cannot be allocated\n");
-                 return false;
-            }
-            /* init all to skipped p frames */
-            for (int i = 0; i < m_numEntries; i++)
-            {
-                RateControlEntry *rce = &m_rce2Pass[i];
-                rce->sliceType = P_SLICE;
-                rce->qScale = rce->newQScale = x265_qp2qScale(20);
-                rce->miscBits = m_ncu + 10;
-                rce->newQp = 0;
-            }
             /* read stats */
             p = statsIn;
             double totalQpAq = 0;
@@ -577,10 +575,40 @@ bool RateControl::init(const SPS& sps)
                 return false;
             }
             p = x265_param2string(m_param);
-            if (p)
-                fprintf(m_statFileOut, "#options: %s\n", p);
-            X265_FREE(p);
-            if (m_param->rc.cuTree && !m_param->rc.bStatRead)
+            if (m_param->rc.bStatBinary)
+            {
+                /* the header is rewritten with the final counts and offsets
+                 * once the encode completes */
+                StatsFileHeader header;
+                memset(&header, 0, sizeof(header));
+                size_t optionsSize = p ? strlen(p) + 1 : 0;
+                size_t padding = (8 - (sizeof(header) + optionsSize) % 8) % 8;
+                static const char zeros[8] = { 0 };
+                bool bError = !p || fwrite(&header, sizeof(header), 1, m_statFileOut) != 1 ||
+                              fwrite(p, 1, optionsSize, m_statFileOut) != optionsSize ||
+                              fwrite(zeros, 1, padding, m_statFileOut) != padding;
+                X265_FREE(p);
+                if (bError)
+                {
+                    x265_log(m_param, X265_LOG_ERROR, "can't write stats file\n");
+                    return false;
+                }
+                m_statsOptionsSize = (uint32_t)optionsSize;
+                m_statFileOutSize = sizeof(header) + optionsSize + padding;
+                m_statsOutAlloc = X265_MAX(m_param->totalFrames, 256);
+                m_statsOutIndex = X265_MALLOC(uint64_t, m_statsOutAlloc);
+                if (!m_statsOutIndex)
+                    return false;
+                memset(m_statsOutIndex, 0, sizeof(uint64_t) * m_statsOutAlloc);
+            }
+            else
+            {
+                if (p)
+                    fprintf(m_statFileOut, "#options: %s\n", p);
+                X265_FREE(p);
+            }
+            /* binary stats carry the CU-tree offsets themselves */
+            if (m_param->rc.cuTree && !m_param->rc.bStatRead && !m_param->rc.bStatBinary)
             {
                 statFileTmpname = strcatFilename(fileName, ".cutree.temp");
                 if (!statFileTmpname)
@@ -605,6 +633,304 @@ bool RateControl::init(const SPS& sps)
     return true;
 }
 
+/* check whether 1st pass options were compatible with current options */
+bool RateControl::checkFirstPassOptions(const char* opts)
+{
+    int i, j;
+    uint32_t k , l;
+    bool bErr = false;
+    const char *p;
+
+    if (sscanf(opts, " %dx%d", &i, &j) != 2)
+    {
+        x265_log(m_param, X265_LOG_ERROR, "Resolution specified in stats file not valid\n");
+        return false;
+    }
+    if ((p = strstr(opts, " fps=")) == 0 || sscanf(p, " fps=%u/%u", &k, &l) != 2)
+    {
+        x265_log(m_param, X265_LOG_ERROR, "fps specified in stats file not valid\n");
+        return false;
+    }
+    if (k != m_param->fpsNum || l != m_param->fpsDenom)
+    {
+        x265_log(m_param, X265_LOG_ERROR, "fps mismatch with 1st pass (%u/%u vs %u/%u)\n",
+                  m_param->fpsNum, m_param->fpsDenom, k, l);
+        return false;
+    }
+    CMP_OPT_FIRST_PASS("bitdepth", m_param->internalBitDepth);
+    CMP_OPT_FIRST_PASS("weightp", m_param->bEnableWeightedPred);
+    CMP_OPT_FIRST_PASS("bframes", m_param->bframes);
+    CMP_OPT_FIRST_PASS("b-pyramid", m_param->bBPyramid);
+    CMP_OPT_FIRST_PASS("open-gop", m_param->bOpenGOP);
+    CMP_OPT_FIRST_PASS("keyint", m_param->keyframeMax);
+    CMP_OPT_FIRST_PASS("scenecut", m_param->scenecutThreshold);
+
+    if ((p = strstr(opts, "b-adapt=")) != 0 && sscanf(p, "b-adapt=%d", &i) && i >= X265_B_ADAPT_NONE && i <= X265_B_ADAPT_TRELLIS)
+    {
+        m_param->bFrameAdaptive = i;
+    }
+    else if (m_param->bframes)
+    {
+        x265_log(m_param, X265_LOG_ERROR, "b-adapt method specified in stats file not valid\n");
+        return false;
+    }
+
+    if ((p = strstr(opts, "rc-lookahead=")) != 0 && sscanf(p, "rc-lookahead=%d", &i))
+        m_param->lookaheadDepth = i;
+
+    return true;
+}
+
+/* allocate m_numEntries rate control entries for the 2nd pass */
+bool RateControl::allocPass2Entries()
+{
+    if (m_param->totalFrames < m_numEntries && m_param->totalFrames > 0)
+    {
+        x265_log(m_param, X265_LOG_WARNING, "2nd pass has fewer frames than 1st pass (%d vs %d)\n",
+                 m_param->totalFrames, m_numEntries);
+    }
+    if (m_param->totalFrames > m_numEntries)
+    {
+        x265_log(m_param, X265_LOG_ERROR, "2nd pass has more frames than 1st pass (%d vs %d)\n",
+                 m_param->totalFrames, m_numEntries);
+        return false;
+    }
+
+    m_rce2Pass = X265_MALLOC(RateControlEntry, m_numEntries);
+    if (!m_rce2Pass)
+    {
+         x265_log(m_param, X265_LOG_ERROR, "Rce Entries for 2 pass cannot be allocated\n");
+         return false;
+    }
+    /* init all to skipped p frames */
+    for (int i = 0; i < m_numEntries; i++)
+    {
+        RateControlEntry *rce = &m_rce2Pass[i];
+        rce->sliceType = P_SLICE;
+        rce->qScale = rce->newQScale = x265_qp2qScale(20);
+        rce->miscBits = m_ncu + 10;
+        rce->newQp = 0;
+    }
+    return true;
+}
+
+/* map the binary stats of the previous pass. The frame records need no
+ * parsing and the CU-tree offsets are read in place by cuTreeReadFor2Pass() */
+bool RateControl::loadBinaryStats(const char* fileName)
+{
+    m_statsMap = (uint8_t*)x265_map_file(fileName, m_statsMapSize);
+    if (!m_statsMap)
+        return false;
+
+    const StatsFileHeader& header = *(const StatsFileHeader*)m_statsMap;
+    uint64_t size = m_statsMapSize;
+    if (size < sizeof(header) || header.version != X265_STATS_VERSION || header.recordSize != sizeof(StatsFileRecord) ||
+        !header.optionsSize || header.optionsOffset > size || header.optionsSize > size - header.optionsOffset ||
+        m_statsMap[header.optionsOffset + header.optionsSize - 1] || header.indexOffset % 8 ||
+        header.indexOffset > size || header.numFrames > (size - header.indexOffset) / sizeof(uint64_t))
+    {
+        x265_log(m_param, X265_LOG_ERROR, "binary stats file is damaged or of an unsupported version\n");
+        return false;
+    }
+    if (!header.numFrames)
+    {
+        x265_log(m_param, X265_LOG_ERROR, "empty stats file\n");
+        return false;
+    }
+    if (m_param->rc.cuTree && header.ncu != (uint32_t)m_ncu)
+    {
+        x265_log(m_param, X265_LOG_ERROR, "stats file has no CU-tree offsets for this resolution\n");
+        return false;
+    }
+
+    if (!checkFirstPassOptions((const char*)m_statsMap + header.optionsOffset))
+        return false;
+
+    m_numEntries = header.numFrames;
+    if (!allocPass2Entries())
+        return false;
+
+    m_statsIndex = (const uint64_t*)(m_statsMap + header.indexOffset);
+    uint64_t cutreeSize = (uint64_t)m_ncu * sizeof(uint16_t);
+    for (int i = 0; i < m_numEntries; i++)
+    {
+        RateControlEntry *rce = &m_rce2Pass[i];
+
+        /* the records of frames the previous pass did not complete are
+         * missing, such a file can't drive this pass */
+        uint64_t offset = m_statsIndex[i];
+        if (!offset || offset % 8 || offset > size - sizeof(StatsFileRecord))
+        {
+            x265_log(m_param, X265_LOG_ERROR, "stats file has no record of frame %d\n", i);
+            return false;
+        }
+        const StatsFileRecord& rec = *(const StatsFileRecord*)(m_statsMap + offset);
+        if (rec.poc != i || (rec.cutreeOffset && (rec.cutreeOffset % 2 || rec.cutreeOffset > size - cutreeSize)))
+        {
+            x265_log(m_param, X265_LOG_ERROR, "statistics are damaged at frame %d\n", i);
+            return false;
+        }
+
+        rce->keptAsRef = rec.type != 'b' && rec.type != 'p';
+        if (rec.type == 'I' || rec.type == 'i')
+            rce->sliceType = I_SLICE;
+        else if (rec.type == 'P' || rec.type == 'p')
+            rce->sliceType = P_SLICE;
+        else if (rec.type == 'B' || rec.type == 'b')
+            rce->sliceType = B_SLICE;
+        else
+        {
+            x265_log(m_param, X265_LOG_ERROR, "statistics are damaged at frame %d\n", i);
+            return false;
+        }
+        rce->qScale = x265_qp2qScale(rec.qpRc);
+        rce->coeffBits = rec.coeffBits;
+        rce->mvBits = rec.mvBits;
+        rce->miscBits = rec.miscBits;
+        rce->iCuCount = rec.iCuCount;
+        rce->pCuCount = rec.pCuCount;
+        rce->skipCuCount = rec.skipCuCount;
+    }
+    return true;
+}
+
+/* append the index of the frame records of this pass and complete the
+ * header of the binary stats file */
+bool RateControl::writeBinaryStatsIndex()
+{
+    StatsFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, X265_STATS_MAGIC, sizeof(header.magic));
+    header.version = X265_STATS_VERSION;
+    header.recordSize = sizeof(StatsFileRecord);
+    header.numFrames = m_statsOutFrames;
+    header.ncu = m_param->rc.cuTree ? m_ncu : 0;
+    header.optionsOffset = sizeof(header);
+    header.optionsSize = m_statsOptionsSize;
+    header.indexOffset = m_statFileOutSize;
+
+    return fwrite(m_statsOutIndex, sizeof(uint64_t), m_statsOutFrames, m_statFileOut) == (size_t)m_statsOutFrames &&
+           !fseek(m_statFileOut, 0, SEEK_SET) &&
+           fwrite(&header, sizeof(header), 1, m_statFileOut) == 1;
+}
+
+/* append a frame record to the stats file of this pass, along with the
+ * CU-tree offsets of referenced frames */
+bool RateControl::writeStatsRecord(Frame* curFrame, const StatsFileRecord& rec, int sliceType)
+{
+    if (m_statsOutIndex)
+    {
+        X265_CHECK(rec.poc >= 0, "stats record of a frame before the chunk\n");
+        if (rec.poc >= m_statsOutAlloc)
+        {
+            int alloc = X265_MAX(m_statsOutAlloc * 2, rec.poc + 1);
+            uint64_t* grown = X265_MALLOC(uint64_t, alloc);
+            if (!grown)
+                return false;
+            memcpy(grown, m_statsOutIndex, sizeof(uint64_t) * m_statsOutAlloc);
+            memset(grown + m_statsOutAlloc, 0, sizeof(uint64_t) * (alloc - m_statsOutAlloc));
+            X265_FREE(m_statsOutIndex);
+            m_statsOutIndex = grown;
+            m_statsOutAlloc = alloc;
+        }
+
+        /* the CU-tree offsets are also written in multi-pass mode, so
+         * each binary stats file is complete */
+        bool bCuTree = m_param->rc.cuTree && IS_REFERENCED(curFrame);
+        StatsFileRecord out = rec;
+        out.cutreeOffset = bCuTree ? m_statFileOutSize + sizeof(out) : 0;
+        if (fwrite(&out, sizeof(out), 1, m_statFileOut) != 1)
+            return false;
+        m_statsOutIndex[rec.poc] = m_statFileOutSize;
+        m_statsOutFrames = X265_MAX(m_statsOutFrames, rec.poc + 1);
+        m_statFileOutSize += sizeof(out);
+        if (bCuTree)
+        {
+            static const char zeros[8] = { 0 };
+            size_t padding = (8 - m_ncu * sizeof(uint16_t) % 8) % 8;
+            for (int i = 0; i < m_ncu; i++)
+                m_cuTreeStats.qpBuffer[0][i] = (uint16_t)(curFrame->m_lowres.qpCuTreeOffset[i] * 256.0);
+            if (fwrite(m_cuTreeStats.qpBuffer[0], sizeof(uint16_t), m_ncu, m_statFileOut) < (size_t)m_ncu ||
+                fwrite(zeros, 1, padding, m_statFileOut) != padding)
+                return false;
+            m_statFileOutSize += m_ncu * sizeof(uint16_t) + padding;
+        }
+        return true;
+    }
+
+    if (fprintf(m_statFileOut,
+                "in:%d out:%d type:%c q:%.2f q-aq:%.2f tex:%d mv:%d misc:%d icu:%.2f pcu:%.2f scu:%.2f ;\n",
+                rec.poc, rec.encodeOrder, rec.type, rec.qpRc, rec.qpAq,
+                rec.coeffBits, rec.mvBits, rec.miscBits,
+                rec.iCuCount, rec.pCuCount, rec.skipCuCount) < 0)
+        return false;
+    /* Don't re-write the data in multi-pass mode. */
+    if (m_param->rc.cuTree && IS_REFERENCED(curFrame) && !m_param->rc.bStatRead)
+    {
+        uint8_t type = (uint8_t)sliceType;
+        for (int i = 0; i < m_ncu; i++)
+            m_cuTreeStats.qpBuffer[0][i] = (uint16_t)(curFrame->m_lowres.qpCuTreeOffset[i] * 256.0);
+        if (fwrite(&type, 1, 1, m_cutreeStatFileOut) < 1)
+            return false;
+        if (fwrite(m_cuTreeStats.qpBuffer[0], sizeof(uint16_t), m_ncu, m_cutreeStatFileOut) < (size_t)m_ncu)
+            return false;
+    }
+    return true;
+}
+
+/* Write the stats of a frame which was only analysed by the lookahead. ref0
+ * and ref1 are the references its costs were estimated from, NULL for an I
+ * or a P frame. The bits are predicted from the lookahead cost at the initial
+ * QP of the slice type, the next pass depends only on their relation */
+bool RateControl::writeLookaheadStats(Frame* curFrame, const Frame* ref0, const Frame* ref1, int encodeOrder)
+{
+    Lowres& lowres = curFrame->m_lowres;
+    int sliceType = IS_X265_TYPE_I(lowres.sliceType) ? I_SLICE : lowres.sliceType == X265_TYPE_P ? P_SLICE : B_SLICE;
+    int b0 = ref0 ? curFrame->m_poc - ref0->m_poc : 0;
+    int b1 = ref1 ? ref1->m_poc - curFrame->m_poc : 0;
+
+    double qp = m_param->rc.rateControlMode == X265_RC_CQP ? m_param->rc.qp : x265_qScale2qp(m_lastQScaleFor[P_SLICE]);
+    if (sliceType == I_SLICE)
+        qp -= m_ipOffset;
+    else if (sliceType == B_SLICE)
+        qp += m_pbOffset;
+
+    StatsFileRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.poc = curFrame->m_poc - m_param->chunkStart;
+    rec.encodeOrder = encodeOrder;
+    rec.type = statsFrameType(sliceType, rec.poc, !!m_param->bOpenGOP, IS_REFERENCED(curFrame));
+    rec.qpRc = rec.qpAq = qp;
+    setLookaheadCosts(rec, lowres, b0, b1);
+    if (rec.satdCost > 0)
+    {
+        Predictor* pred = &m_pred[getPredictorType(lowres.sliceType, sliceType)];
+        rec.coeffBits = (int32_t)predictSize(pred, x265_qp2qScale(qp), (double)(rec.satdCost >> (X265_DEPTH - 8)));
+    }
+    rec.iCuCount = sliceType == I_SLICE ? m_ncu : sliceType == P_SLICE ? lowres.intraMbs[b0] : 0;
+    rec.pCuCount = m_ncu - rec.iCuCount;
+
+    /* the record is appended as the picture leaves the lookahead, only the
+     * index is written when the encoder is closed */
+    return writeStatsRecord(curFrame, rec, sliceType);
+}
+
+/* the pictures of the pre-roll preceding a chunk are not encoded. The
+ * lookahead cost of each one that is not a B picture enters the short-term
+ * complexity, as it would have in a single encode, so the first pictures of
+ * the chunk are not quantized from their own complexity alone */
+void RateControl::prerollPicture(Frame* curFrame)
+{
+    if (!m_isAbr || IS_X265_TYPE_B(curFrame->m_lowres.sliceType))
+        return;
+
+    double satd = (double)(curFrame->m_lowres.satdCost >> (X265_DEPTH - 8));
+    m_shortTermCplxSum *= 0.5;
+    m_shortTermCplxCount *= 0.5;
+    m_shortTermCplxSum += satd / (CLIP_DURATION(m_frameDuration) / BASE_FRAME_DURATION);
+    m_shortTermCplxCount++;
+}
+
 void RateControl::initHRD(SPS& sps)
 {
     int vbvBufferSize = m_param->rc.vbvBufferSize * 1000;
@@ -933,16 +1259,17 @@ int RateControl::rateControlSliceType(int frameNum)
 
 int RateControl::rateControlStart(Frame* curFrame, RateControlEntry* rce, Encoder* enc)
 {
-    int orderValue = m_startEndOrder.get();
-    int startOrdinal = rce->encodeOrder * 2;
+    ThreadSafeInteger& order = m_bDecoupledOrder ? m_startOrder : m_startEndOrder;
+    int orderValue = order.get();
+    int startOrdinal = m_bDecoupledOrder ? rce->encodeOrder : rce->encodeOrder * 2;
 
     while (orderValue < startOrdinal && !m_bTerminated)
-        orderValue = m_startEndOrder.waitForChange(orderValue);
+        orderValue = order.waitForChange(orderValue);
 
     if (!curFrame)
     {
         // faked rateControlStart calls when the encoder is flushing
-        m_startEndOrder.incr();
+        order.incr();
         return 0;
     }
 
@@ -956,8 +1283,10 @@ int RateControl::rateControlStart(Frame* curFrame, RateControlEntry* rce, Encode
     rce->poc = m_curSlice->m_poc;
     if (m_param->rc.bStatRead)
     {
-        X265_CHECK(rce->poc >= 0 && rce->poc < m_numEntries, "bad encode ordinal\n");
-        copyRceData(rce, &m_rce2Pass[rce->poc]);
+        /* the stats of a chunk are numbered from its first picture */
+        int frameNum = rce->poc - m_param->chunkStart;
+        X265_CHECK(frameNum >= 0 && frameNum < m_numEntries, "bad encode ordinal\n");
+        copyRceData(rce, &m_rce2Pass[frameNum]);
     }
     rce->isActive = true;
     if (m_sliceType == B_SLICE)
@@ -982,11 +1311,13 @@ int RateControl::rateControlStart(Frame* curFrame, RateControlEntry* rce, Encode
                     rce->rowPreds[i][j].decay = 0.5;
                     rce->rowPreds[i][j].offset = 0.0;
                 }
+                rce->rowPredSeq[i] = 0;
             }
         }
+        adoptRowPredictors(rce, m_sliceType);
         rce->rowPred[0] = &rce->rowPreds[m_sliceType][0];
         rce->rowPred[1] = &rce->rowPreds[m_sliceType][1];
-        m_predictedBits = m_totalBits;
+        m_predictedBits = m_totalBits - m_inFlightRowBits;
         updateVbvPlan(enc);
         rce->bufferFill = m_bufferFill;
 
@@ -1080,11 +1411,13 @@ int RateControl::rateControlStart(Frame* curFrame, RateControlEntry* rce, Encode
         {
             rce->qpNoVbv = rce->qpaRc;
             m_lastQScaleFor[m_sliceType] = x265_qp2qScale(rce->qpaRc);
-            if (rce->poc == 0)
+            if (rce->poc == m_param->chunkStart)
                  m_lastQScaleFor[P_SLICE] = m_lastQScaleFor[m_sliceType] * fabs(m_param->rc.ipFactor);
             rce->frameSizePlanned = predictSize(&m_pred[m_predType], m_qp, (double)m_currentSatd);
         }
     }
+    if (m_2pass)
+        m_inFlightExpectedBits += qScale2bits(rce, x265_qp2qScale(m_qp));
     m_framesDone++;
 
     return m_qp;
@@ -1241,9 +1574,38 @@ bool RateControl::fixUnderflow(int t0, int t1, double adjustment, double qscaleM
 
 bool RateControl::cuTreeReadFor2Pass(Frame* frame)
 {
-    uint8_t sliceTypeActual = (uint8_t)m_rce2Pass[frame->m_poc].sliceType;
+    int index = frame->m_poc - m_param->chunkStart;
+    /* rateControlSliceType() reports the frames beyond the previous pass
+     * and falls back to constant QP */
+    if (index >= m_numEntries)
+        return true;
 
-    if (m_rce2Pass[frame->m_poc].keptAsRef)
+    if (m_statsIndex)
+    {
+        /* binary stats, read the offsets in place. Only the frames kept as
+         * reference by the previous pass have them */
+        const StatsFileRecord& rec = *(const StatsFileRecord*)(m_statsMap + m_statsIndex[index]);
+        if (!rec.cutreeOffset != !m_rce2Pass[index].keptAsRef)
+        {
+            x265_log(m_param, X265_LOG_ERROR, "CU-tree offsets of frame %d don't match its frametype %c.\n", index, rec.type);
+            return false;
+        }
+        if (rec.cutreeOffset)
+        {
+            const uint16_t* qpBuffer = (const uint16_t*)(m_statsMap + rec.cutreeOffset);
+            for (int i = 0; i < m_ncu; i++)
+            {
+                int16_t qpFix8 = qpBuffer[i];
+                frame->m_lowres.qpCuTreeOffset[i] = (double)(qpFix8) / 256.0;
+                frame->m_lowres.invQscaleFactor[i] = x265_exp2fix8(frame->m_lowres.qpCuTreeOffset[i]);
+            }
+        }
+        return true;
+    }
+
+    uint8_t sliceTypeActual = (uint8_t)m_rce2Pass[index].sliceType;
+
+    if (m_rce2Pass[index].keptAsRef)
     {
         /* TODO: We don't need pre-lookahead to measure AQ offsets, but there is currently
          * no way to signal this */
@@ -1424,11 +1786,8 @@ double RateControl::rateEstimateQscale(Frame* curFrame, RateControlEntry *rce)
             int64_t diff;
             if (!m_isVbv)
             {
-                m_predictedBits = m_totalBits;
-                if (rce->encodeOrder < m_param->frameNumThreads)
-                    m_predictedBits += (int64_t)(rce->encodeOrder * m_bitrate / m_fps);
-                else
-                    m_predictedBits += (int64_t)(m_param->frameNumThreads * m_bitrate / m_fps);
+                /* frames still being encoded count at their planned size */
+                m_predictedBits = m_totalBits - m_inFlightRowBits + (int64_t)m_inFlightExpectedBits;
             }
             /* Adjust ABR buffer based on distance to the end of the video. */
             if (m_numEntries > rce->encodeOrder)
@@ -1447,7 +1806,7 @@ double RateControl::rateEstimateQscale(Frame* curFrame, RateControlEntry *rce)
                  * achieved and expected bitrate so far */
                 double curTime = (double)rce->encodeOrder / m_numEntries;
                 double w = x265_clip3(0.0, 1.0, curTime * 100);
-                q *= pow((double)m_totalBits / m_expectedBitsSum, w);
+                q *= pow((double)(m_totalBits - m_inFlightRowBits) / m_expectedBitsSum, w);
             }
             rce->qpNoVbv = x265_qScale2qp(q);
             if (m_isVbv)
@@ -1552,7 +1911,7 @@ double RateControl::rateEstimateQscale(Frame* curFrame, RateControlEntry *rce)
                 q = x265_clip3(lqmin, lqmax, q);
         }
         m_lastQScaleFor[m_sliceType] = q;
-        if ((m_curSlice->m_poc == 0 || m_lastQScaleFor[P_SLICE] < q) && !(m_2pass && !m_isVbv))
+        if ((m_curSlice->m_poc == m_param->chunkStart || m_lastQScaleFor[P_SLICE] < q) && !(m_2pass && !m_isVbv))
             m_lastQScaleFor[P_SLICE] = q * fabs(m_param->rc.ipFactor);
 
         if (m_2pass && m_isVbv)
@@ -1613,6 +1972,8 @@ void RateControl::rateControlUpdateStats(RateControlEntry* rce)
 
     m_cplxrSum += rce->rowCplxrSum;
     m_totalBits += rce->rowTotalBits;
+    if (m_2pass)
+        m_inFlightRowBits += rce->rowTotalBits;
 
     /* do not allow the next frame to enter rateControlStart() until this
      * frame has updated its mid-frame statistics */
@@ -1918,8 +2279,9 @@ int RateControl::rowDiagonalVbvRateControl(Frame* curFrame, uint32_t row, RateCo
         encodedBits += curEncData.m_rowStat[0].encodedBits;
     }
     rowSatdCost >>= X265_DEPTH - 8;
+    int sliceType = curEncData.m_slice->m_sliceType;
     updatePredictor(rce->rowPred[0], qScaleVbv, (double)rowSatdCost, encodedBits);
-    if (curEncData.m_slice->m_sliceType == P_SLICE)
+    if (sliceType == P_SLICE)
     {
         Frame* refFrame = curEncData.m_slice->m_refPicList[0][0];
         if (qpVbv < refFrame->m_encData->m_rowStat[row].diagQp)
@@ -1931,6 +2293,7 @@ int RateControl::rowDiagonalVbvRateControl(Frame* curFrame, uint32_t row, RateCo
             updatePredictor(rce->rowPred[1], qScaleVbv, (double)intraRowSatdCost, encodedBits);
         }
     }
+    publishRowPredictors(rce, sliceType);
 
     int canReencodeRow = 1;
     /* tweak quality based on difference from predicted size */
@@ -1964,7 +2327,7 @@ int RateControl::rowDiagonalVbvRateControl(Frame* curFrame, uint32_t row, RateCo
         if (encodedBitsSoFar < 0.05f * rce->frameSizePlanned)
             qpMax = qpAbsoluteMax = prevRowQp;
 
-        if (rce->sliceType != I_SLICE || (m_param->rc.bStrictCbr && rce->poc > 0))
+        if (rce->sliceType != I_SLICE || (m_param->rc.bStrictCbr && rce->poc > m_param->chunkStart))
             rcTol *= 0.5;
 
         if (!m_isCbr)
@@ -2114,6 +2477,39 @@ void RateControl::updatePredictor(Predictor *p, double q, double var, double bit
     p->offset += new_offset;
 }
 
+/* Start a frame from the shared row predictors of the slice type if another
+ * frame published since this encoder last synced. Adopting mid-frame would
+ * discard what the frame learned from its own rows. Never blocks: if a publish
+ * is in progress the frame keeps its own predictors */
+void RateControl::adoptRowPredictors(RateControlEntry* rce, int sliceType)
+{
+    int seq = ATOMIC_ADD(&m_rowPredSeq[sliceType], 0);
+    if (seq == rce->rowPredSeq[sliceType] || (seq & 1))
+        return;
+
+    Predictor preds[2];
+    memcpy(preds, m_rowPreds[sliceType], sizeof(preds));
+    if (ATOMIC_ADD(&m_rowPredSeq[sliceType], 0) != seq)
+        return; /* torn by a publish */
+
+    memcpy(rce->rowPreds[sliceType], preds, sizeof(preds));
+    rce->rowPredSeq[sliceType] = seq;
+}
+
+/* Publish the row predictors of a frame each time they have learned from a
+ * row. This only succeeds if no other frame published since this one synced,
+ * so fresher coefficients are never overwritten; the loser of a race picks
+ * them up at the start of its next frame instead */
+void RateControl::publishRowPredictors(RateControlEntry* rce, int sliceType)
+{
+    int seq = rce->rowPredSeq[sliceType];
+    if ((seq & 1) || ATOMIC_CAS32(&m_rowPredSeq[sliceType], seq, seq + 1) != seq)
+        return;
+
+    memcpy(m_rowPreds[sliceType], rce->rowPreds[sliceType], sizeof(m_rowPreds[sliceType]));
+    rce->rowPredSeq[sliceType] = ATOMIC_INC(&m_rowPredSeq[sliceType]);
+}
+
 void RateControl::updateVbv(int64_t bits, RateControlEntry* rce)
 {
     int predType = rce->sliceType;
@@ -2137,14 +2533,20 @@ void RateControl::updateVbv(int64_t bits, RateControlEntry* rce)
 int RateControl::rateControlEnd(Frame* curFrame, int64_t bits, RateControlEntry* rce)
 {
     int orderValue = m_startEndOrder.get();
-    int endOrdinal = (rce->encodeOrder + m_param->frameNumThreads) * 2 - 1;
+    int endOrdinal = m_bDecoupledOrder ? rce->encodeOrder : (rce->encodeOrder + m_param->frameNumThreads) * 2 - 1;
     while (orderValue < endOrdinal && !m_bTerminated)
     {
-        /* no more frames are being encoded, so fake the start event if we would
-         * have blocked on it. Note that this does not enforce rateControlEnd()
-         * ordering during flush, but this has no impact on the outputs */
-        if (m_finalFrameCount && orderValue >= 2 * m_finalFrameCount)
-            break;
+        /* no more frames are being encoded, so the last ends only wait for
+         * each other: the count then holds all the starts, the faked ends and
+         * the ends of the earlier frames. They stay in order since the stats
+         * files of the next pass are read in encode order */
+        if (!m_bDecoupledOrder && m_finalFrameCount)
+        {
+            int flushOrdinal = m_finalFrameCount + X265_MIN(m_finalFrameCount, m_param->frameNumThreads - 1) + rce->encodeOrder;
+            endOrdinal = X265_MIN(endOrdinal, flushOrdinal);
+            if (orderValue >= endOrdinal)
+                break;
+        }
         orderValue = m_startEndOrder.waitForChange(orderValue);
     }
 
@@ -2198,31 +2600,26 @@ int RateControl::rateControlEnd(Frame* curFrame, int64_t bits, RateControlEntry*
     // Write frame stats into the stats file if 2 pass is enabled.
     if (m_param->rc.bStatWrite)
     {
-        char cType = rce->sliceType == I_SLICE ? (rce->poc > 0 && m_param->bOpenGOP ? 'i' : 'I')
-            : rce->sliceType == P_SLICE ? 'P'
-            : IS_REFERENCED(curFrame) ? 'B' : 'b';
-        if (fprintf(m_statFileOut,
-                    "in:%d out:%d type:%c q:%.2f q-aq:%.2f tex:%d mv:%d misc:%d icu:%.2f pcu:%.2f scu:%.2f ;\n",
-                    rce->poc, rce->encodeOrder,
-                    cType, curEncData.m_avgQpRc, curEncData.m_avgQpAq,
-                    curFrame->m_encData->m_frameStats.coeffBits,
-                    curFrame->m_encData->m_frameStats.mvBits,
-                    curFrame->m_encData->m_frameStats.miscBits,
-                    curFrame->m_encData->m_frameStats.percent8x8Intra * m_ncu,
-                    curFrame->m_encData->m_frameStats.percent8x8Inter * m_ncu,
-                    curFrame->m_encData->m_frameStats.percent8x8Skip  * m_ncu) < 0)
+        StatsFileRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.poc = rce->poc - m_param->chunkStart;
+        rec.encodeOrder = rce->encodeOrder;
+        rec.type = statsFrameType(rce->sliceType, rec.poc, !!m_param->bOpenGOP, IS_REFERENCED(curFrame));
+        rec.qpRc = curEncData.m_avgQpRc;
+        rec.qpAq = curEncData.m_avgQpAq;
+        rec.coeffBits = curFrame->m_encData->m_frameStats.coeffBits;
+        rec.mvBits = curFrame->m_encData->m_frameStats.mvBits;
+        rec.miscBits = curFrame->m_encData->m_frameStats.miscBits;
+        rec.iCuCount = curFrame->m_encData->m_frameStats.percent8x8Intra * m_ncu;
+        rec.pCuCount = curFrame->m_encData->m_frameStats.percent8x8Inter * m_ncu;
+        rec.skipCuCount = curFrame->m_encData->m_frameStats.percent8x8Skip * m_ncu;
+
+        int b0 = rce->sliceType == I_SLICE ? 0 : rce->poc - slice->m_refPOCList[0][0];
+        int b1 = rce->sliceType == B_SLICE ? slice->m_refPOCList[1][0] - rce->poc : 0;
+        setLookaheadCosts(rec, curFrame->m_lowres, b0, b1);
+
+        if (!writeStatsRecord(curFrame, rec, rce->sliceType))
             goto writeFailure;
-        /* Don't re-write the data in multi-pass mode. */
-        if (m_param->rc.cuTree && IS_REFERENCED(curFrame) && !m_param->rc.bStatRead)
-        {
-            uint8_t sliceType = (uint8_t)rce->sliceType;
-            for (int i = 0; i < m_ncu; i++)
-                    m_cuTreeStats.qpBuffer[0][i] = (uint16_t)(curFrame->m_lowres.qpCuTreeOffset[i] * 256.0);
-            if (fwrite(&sliceType, 1, 1, m_cutreeStatFileOut) < 1)
-                goto writeFailure;
-            if (fwrite(m_cuTreeStats.qpBuffer[0], sizeof(uint16_t), m_ncu, m_cutreeStatFileOut) < (size_t)m_ncu)
-                goto writeFailure;
-        }
     }
     if (m_isAbr && !m_isAbrReset)
     {
@@ -2260,14 +2657,18 @@ int RateControl::rateControlEnd(Frame* curFrame, int64_t bits, RateControlEntry*
         m_wantedBitsWindow += m_frameDuration * m_bitrate;
         m_totalBits += bits - rce->rowTotalBits;
         m_encodedBits += actualBits;
-        int pos = m_sliderPos - m_param->frameNumThreads;
+        /* the slider belongs to the starts, which may run ahead of this frame */
+        int pos = m_bDecoupledOrder ? rce->encodeOrder : m_sliderPos - m_param->frameNumThreads;
         if (pos >= 0)
             m_encodedBitsWindow[pos % s_slidingWindowFrames] = actualBits;
     }
 
     if (m_2pass)
     {
-        m_expectedBitsSum += qScale2bits(rce, x265_qp2qScale(rce->newQp));
+        double expectedBits = qScale2bits(rce, x265_qp2qScale(rce->newQp));
+        m_expectedBitsSum += expectedBits;
+        m_inFlightExpectedBits -= expectedBits;
+        m_inFlightRowBits -= rce->rowTotalBits;
         m_totalBits += bits - rce->rowTotalBits;
     }
 
@@ -2280,7 +2681,7 @@ int RateControl::rateControlEnd(Frame* curFrame, int64_t bits, RateControlEntry*
             const VUI *vui = &curEncData.m_slice->m_sps->vuiParameters;
             const HRDInfo *hrd = &vui->hrdParameters;
             const TimingInfo *time = &vui->timingInfo;
-            if (!curFrame->m_poc)
+            if (curFrame->m_poc == m_param->chunkStart)
             {
                 // first access unit initializes the HRD
                 rce->hrdTiming->cpbInitialAT = 0;
@@ -2302,7 +2703,7 @@ int RateControl::rateControlEnd(Frame* curFrame, int64_t bits, RateControlEntry*
         }
     }
     rce->isActive = false;
-    // Allow rateControlStart of next frame only when rateControlEnd of previous frame is over
+    // Allow the next rateControlEnd, and with strict ordering the next rateControlStart
     m_startEndOrder.incr();
     return 0;
 
@@ -2332,6 +2733,7 @@ void RateControl::terminate()
     m_bTerminated = true;
     /* unblock waiting threads */
     m_startEndOrder.poke();
+    m_startOrder.poke();
 }
 
 void RateControl::destroy()
@@ -2340,6 +2742,15 @@ void RateControl::destroy()
     if (!fileName)
         fileName = s_defaultStatFileName;
 
+    /* unmap the input first, it may be replaced by the output */
+    x265_unmap_file(m_statsMap, m_statsMapSize);
+    m_statsMap = NULL;
+    m_statsIndex = NULL;
+
+    if (m_statsOutIndex && !writeBinaryStatsIndex())
+        x265_log(m_param, X265_LOG_ERROR, "failed to write the index of the stats file\n");
+    X265_FREE(m_statsOutIndex);
+
     if (m_statFileOut)
     {
         fclose(m_statFileOut);
@@ -62,10 +62,56 @@ struct HRDTiming
     double cpbRemovalTime;
 };
 
+/* Binary multi-pass stats file (--binary-stats). A header is followed by
+ * the options string of the pass, then by one fixed size record per frame,
+ * appended as each frame completes and followed by the CU-tree QP offsets of
+ * the frame if it is referenced. An index of the file offsets of the records
+ * in display order is written at the end, so the record of frame N is found
+ * at index[N]. All fields are in the native byte order and every record is
+ * aligned to 8 bytes. The next pass maps the file into memory instead of
+ * parsing it. A --lookahead-only pass writes the same file with bits
+ * estimated from the lookahead costs */
+#define X265_STATS_MAGIC   "X265STAT"
+#define X265_STATS_VERSION 6
+
+struct StatsFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t recordSize;    /* sizeof(StatsFileRecord) */
+    uint32_t numFrames;
+    uint32_t ncu;           /* CU-tree offsets per referenced frame, 0 without CU-tree */
+    uint32_t optionsSize;   /* including the terminating NUL */
+    uint32_t reserved;
+    uint64_t optionsOffset;
+    uint64_t indexOffset;   /* numFrames record offsets */
+};
+
+struct StatsFileRecord
+{
+    int32_t  poc;
+    int32_t  encodeOrder;
+    uint8_t  type;          /* I, i, P, B or b as in the text stats */
+    uint8_t  reserved[3];
+    int32_t  coeffBits;
+    int32_t  mvBits;
+    int32_t  miscBits;
+    double   qpRc;
+    double   qpAq;
+    double   iCuCount;
+    double   pCuCount;
+    double   skipCuCount;
+    uint64_t cutreeOffset;  /* ncu 8.8 fixed point QP offsets, 0 if not referenced */
+    int64_t  intraCost;     /* lowres costs, -1 if they were not estimated: intra, */
+    int64_t  lowresCost;    /* from the references of the frame */
+    int64_t  satdCost;      /* and weighted by the AQ and CU-tree offsets (not with constant QP) */
+};
+
 struct RateControlEntry
 {
     Predictor  rowPreds[3][2];
     Predictor* rowPred[2];
+    int        rowPredSeq[3];  /* sequence of the shared row predictors last synced into rowPreds */
 
     int64_t lastSatd;      /* Contains the picture cost of the previous frame, required for resetAbr and VBV */
     int64_t leadingNoBSatd;
@@ -141,6 +187,13 @@ public:
     double m_rateFactorMaxDecrement; /* don't allow RF below (this value). */
 
     Predictor m_pred[4];       /* Slice predictors to preidct bits for each Slice type - I,P,Bref and B */
+
+    /* Row predictors of VBV shared by the frame encoders, so each frame starts
+     * predicting its rows with the coefficients of the rows completed last, in
+     * any frame. m_rowPredSeq is odd while a frame is publishing, see
+     * publishRowPredictors() */
+    Predictor    m_rowPreds[3][2];
+    volatile int m_rowPredSeq[3];
     int64_t m_leadingNoBSatd;
     int     m_predType;       /* Type of slice predictors to be used - depends on the slice type */
     double  m_ipOffset;
@@ -187,6 +240,14 @@ public:
      * rceUpdate 12
      * rceEnd    11 */
     ThreadSafeInteger m_startEndOrder;
+
+    /* CQP and CRF without VBV never feed the bits of a finished frame back
+     * into the QP of a later one, so starts and ends are only ordered among
+     * themselves: m_startOrder counts the starts and m_startEndOrder the ends.
+     * A frame's bit accounting is reconciled whenever it completes, without
+     * holding back the starts of the frames behind it */
+    bool    m_bDecoupledOrder;
+    ThreadSafeInteger m_startOrder;
     int     m_finalFrameCount;   /* set when encoder begins flushing */
     bool    m_bTerminated;       /* set true when encoder is closing */
 
@@ -201,8 +262,18 @@ public:
     FILE*   m_statFileOut;
     FILE*   m_cutreeStatFileOut;
     FILE*   m_cutreeStatFileIn;
+    uint8_t* m_statsMap;               /* binary stats of the previous pass, mapped read-only */
+    size_t  m_statsMapSize;
+    const uint64_t* m_statsIndex;      /* offsets of the frame records in m_statsMap */
+    uint64_t* m_statsOutIndex;         /* offsets of the frame records of this pass, by frame */
+    int     m_statsOutFrames;
+    int     m_statsOutAlloc;
+    uint64_t m_statFileOutSize;        /* bytes written to m_statFileOut */
+    uint32_t m_statsOptionsSize;
     double  m_lastAccumPNorm;
     double  m_expectedBitsSum;   /* sum of qscale2bits after rceq, ratefactor, and overflow, only includes finished frames */
+    double  m_inFlightExpectedBits; /* expected bits of the frames being encoded */
+    int64_t m_inFlightRowBits;   /* bits of the first rows of frames being encoded, already in m_totalBits */
     int64_t m_predictedBits;
     RateControlEntry* m_rce2Pass;
 
@@ -229,6 +300,8 @@ public:
     int  rateControlSliceType(int frameNum);
     bool cuTreeReadFor2Pass(Frame* curFrame);
     void hrdFullness(SEIBufferingPeriod* sei);
+    bool writeLookaheadStats(Frame* curFrame, const Frame* ref0, const Frame* ref1, int encodeOrder);
+    void prerollPicture(Frame* curFrame);
 
 protected:
 
@@ -251,12 +324,19 @@ protected:
     int    getPredictorType(int lowresSliceType, int sliceType);
     void   updateVbv(int64_t bits, RateControlEntry* rce);
     void   updatePredictor(Predictor *p, double q, double var, double bits);
+    void   adoptRowPredictors(RateControlEntry* rce, int sliceType);
+    void   publishRowPredictors(RateControlEntry* rce, int sliceType);
     double clipQscale(Frame* pic, RateControlEntry* rce, double q);
     void   updateVbvPlan(Encoder* enc);
     double predictSize(Predictor *p, double q, double var);
     void   checkAndResetABR(RateControlEntry* rce, bool isFrameDone);
     double predictRowsSizeSum(Frame* pic, RateControlEntry* rce, double qpm, int32_t& encodedBits);
     bool   initPass2();
+    bool   checkFirstPassOptions(const char* opts);
+    bool   allocPass2Entries();
+    bool   loadBinaryStats(const char* fileName);
+    bool   writeBinaryStatsIndex();
+    bool   writeStatsRecord(Frame* curFrame, const StatsFileRecord& rec, int sliceType);
     double getDiffLimitedQScale(RateControlEntry *rce, double q);
     double countExpectedBits();
     bool   vbv2Pass(uint64_t allAvailableBits);
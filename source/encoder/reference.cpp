@@ -45,7 +45,7 @@ MotionReference::~MotionReference()
     X265_FREE(weightBuffer[2]);
 }
 
-int MotionReference::init(PicYuv* recPic, WeightParam *wp, const x265_param& p)
+int MotionReference::init(PicYuv* recPic, WeightParam *wp, const x265_param& p, int numaNode)
 {
     reconPic = recPic;
     numWeightedRows = 0;
@@ -83,7 +83,7 @@ int MotionReference::init(PicYuv* recPic, WeightParam *wp, const x265_param& p)
                 if (!weightBuffer[c])
                 {
                     size_t padheight = (numCUinHeight * cuHeight) + marginY * 2;
-                    weightBuffer[c] = X265_MALLOC(pixel, stride * padheight);
+                    weightBuffer[c] = (pixel*)x265_malloc_node(sizeof(pixel) * stride * padheight, numaNode);
                     if (!weightBuffer[c])
                         return -1;
                 }
@@ -40,7 +40,7 @@ public:
 
     MotionReference();
     ~MotionReference();
-    int  init(PicYuv*, WeightParam* wp, const x265_param& p);
+    int  init(PicYuv*, WeightParam* wp, const x265_param& p, int numaNode);
     void applyWeight(int rows, int numRows);
 
     pixel*  weightBuffer[3];
@@ -266,6 +266,10 @@ void SAO::processSaoCu(int addr, int typeIdx, int plane)
     ctuWidth  = rpelx - lpelx;
     ctuHeight = bpely - tpely;
 
+    /* edge offsets are not applied across picture or slice boundaries */
+    bool bTopEdge    = !tpely || cu->m_bFirstRowInSlice;
+    bool bBottomEdge = bpely == picHeight || cu->m_bLastRowInSlice;
+
     int startX;
     int startY;
     int endX;
@@ -354,9 +358,9 @@ void SAO::processSaoCu(int addr, int typeIdx, int plane)
     }
     case SAO_EO_1: // dir: |
     {
-        startY = !tpely;
-        endY   = (bpely == picHeight) ? ctuHeight - 1 : ctuHeight;
-        if (!tpely)
+        startY = bTopEdge;
+        endY   = bBottomEdge ? ctuHeight - 1 : ctuHeight;
+        if (bTopEdge)
             rec += stride;
 
         if (ctuWidth & 15)
@@ -399,10 +403,10 @@ void SAO::processSaoCu(int addr, int typeIdx, int plane)
         startX = !lpelx;
         endX   = (rpelx == picWidth) ? ctuWidth - 1 : ctuWidth;
 
-        startY = !tpely;
-        endY   = (bpely == picHeight) ? ctuHeight - 1 : ctuHeight;
+        startY = bTopEdge;
+        endY   = bBottomEdge ? ctuHeight - 1 : ctuHeight;
 
-        if (!tpely)
+        if (bTopEdge)
             rec += stride;
 
         if (!(ctuWidth & 15))
@@ -468,10 +472,10 @@ void SAO::processSaoCu(int addr, int typeIdx, int plane)
         startX = !lpelx;
         endX   = (rpelx == picWidth) ? ctuWidth - 1 : ctuWidth;
 
-        startY = !tpely;
-        endY   = (bpely == picHeight) ? ctuHeight - 1 : ctuHeight;
+        startY = bTopEdge;
+        endY   = bBottomEdge ? ctuHeight - 1 : ctuHeight;
 
-        if (!tpely)
+        if (bTopEdge)
             rec += stride;
 
         if (ctuWidth & 15)
@@ -583,15 +587,13 @@ void SAO::processSaoUnitRow(SaoCtuParam* ctuParam, int idxY, int plane)
         ctuHeight >>= m_vChromaShift;
     }
 
-    if (!idxY)
-    {
-        pixel* rec = m_frame->m_reconPic->m_picOrg[plane];
-        memcpy(m_tmpU1[plane], rec, sizeof(pixel) * picWidth);
-    }
-
     int addr = idxY * m_numCuInWidth;
     pixel* rec = plane ? m_frame->m_reconPic->getChromaAddr(plane, addr) : m_frame->m_reconPic->getLumaAddr(addr);
 
+    /* rows at the top of the picture or of a slice have no line above */
+    if (!idxY || m_frame->m_encData->getPicCTU(addr)->m_bFirstRowInSlice)
+        memcpy(m_tmpU1[plane], rec, sizeof(pixel) * picWidth);
+
     for (int i = 0; i < ctuHeight + 1; i++)
     {
         m_tmpL1[i] = rec[0];
@@ -1112,7 +1114,7 @@ void SAO::rdoSaoUnitRow(SAOParam* saoParam, int idxY)
     SaoCtuParam mergeSaoParam[NUM_MERGE_MODE][2];
     double mergeDist[NUM_MERGE_MODE];
     bool allowMerge[2]; // left, up
-    allowMerge[1] = (idxY > 0);
+    allowMerge[1] = (idxY > 0) && !m_frame->m_encData->getPicCTU(idxY * m_numCuInWidth)->m_bFirstRowInSlice;
 
     for (int idxX = 0; idxX < m_numCuInWidth; idxX++)
     {
@@ -1833,6 +1833,10 @@ uint32_t Search::mergeEstimation(CUData& cu, const CUGeom& cuGeom, const Predict
              candMvField[mergeCand][1].mv.y >= (m_param->searchRange + 1) * 4))
             continue;
 
+        /* Prevent refreshed CUs from using unrefreshed reference pixels */
+        if (m_slice->m_pirEndCol && candMvField[mergeCand][0].mv.x > refreshMaxMvX(cu))
+            continue;
+
         cu.m_mv[0][pu.puAbsPartIdx] = candMvField[mergeCand][0].mv;
         cu.m_refIdx[0][pu.puAbsPartIdx] = (int8_t)candMvField[mergeCand][0].refIdx;
         cu.m_mv[1][pu.puAbsPartIdx] = candMvField[mergeCand][1].mv;
@@ -1884,6 +1888,103 @@ MV Search::getLowresMV(const CUData& cu, const PredictionUnit& pu, int list, int
     return mvs[idx] << 1; /* scale up lowres mv */
 }
 
+/* gather lookahead motion vectors under the current PU as motion candidates:
+ * the PU center and, for large PUs, the centers of two diagonal quadrants.
+ * Reference distances lookahead did not search use vectors scaled from the
+ * nearest searched distance. If the unscaled vectors all agree with the MVP,
+ * merange is reduced. Returns the number of candidates written to mvc */
+int Search::getLowresMvc(const CUData& cu, const PredictionUnit& pu, int list, int ref, const MV& mvp, MV* mvc, int& merange)
+{
+    const Lowres& lowres = m_frame->m_lowres;
+    int refPoc = m_slice->m_refPicList[list][ref]->m_poc;
+    int diffPoc = abs(m_slice->m_poc - refPoc);
+
+    /* lookahead searches past references in L0 and future references in L1 */
+    int lowresList = refPoc > m_slice->m_poc;
+
+    int dist = 0;
+    for (int d = 1; d <= lowres.bframes + 1; d++)
+    {
+        if (lowres.lowresMvs[lowresList][d - 1][0].x != 0x7FFF && (!dist || abs(d - diffPoc) < abs(dist - diffPoc)))
+            dist = d;
+    }
+    if (!dist)
+        return 0;
+
+    const MV* mvs = lowres.lowresMvs[lowresList][dist - 1];
+    int puX = cu.m_cuPelX + g_zscanToPelX[pu.puAbsPartIdx];
+    int puY = cu.m_cuPelY + g_zscanToPelY[pu.puAbsPartIdx];
+    int pos[MAX_LOWRES_MVC][2] =
+    {
+        { puX + pu.width / 2,     puY + pu.height / 2 },
+        { puX + pu.width / 4,     puY + pu.height / 4 },
+        { puX + pu.width * 3 / 4, puY + pu.height * 3 / 4 }
+    };
+    int numPos = pu.width > 16 || pu.height > 16 ? MAX_LOWRES_MVC : 1;
+
+    int numMvc = 0;
+    int spread = 0;
+    for (int i = 0; i < numPos; i++)
+    {
+        uint32_t blockX = X265_MIN((uint32_t)pos[i][0] >> 4, lowres.maxBlocksInRow - 1);
+        uint32_t blockY = X265_MIN((uint32_t)pos[i][1] >> 4, lowres.maxBlocksInCol - 1);
+        MV lmv = mvs[blockY * lowres.maxBlocksInRow + blockX] << 1; /* scale up lowres mv */
+        if (dist != diffPoc)
+        {
+            lmv.x = (int16_t)(lmv.x * diffPoc / dist);
+            lmv.y = (int16_t)(lmv.y * diffPoc / dist);
+        }
+
+        spread = X265_MAX(spread, X265_MAX(abs(lmv.x - mvp.x), abs(lmv.y - mvp.y)));
+
+        bool bDuplicate = !lmv.notZero() || lmv == mvp;
+        for (int j = 0; j < numMvc && !bDuplicate; j++)
+            bDuplicate = lmv == mvc[j];
+        if (!bDuplicate)
+            mvc[numMvc++] = lmv;
+    }
+
+    /* spread is in quarter pels; narrow the search when lookahead and AMVP
+     * agree within one full pel, and less so within four full pels */
+    if (dist == diffPoc)
+    {
+        if (spread <= 4)
+            merange = X265_MIN(merange, X265_MAX(merange >> 2, 4));
+        else if (spread <= 16)
+            merange = X265_MIN(merange, X265_MAX(merange >> 1, 8));
+    }
+
+    return numMvc;
+}
+
+/* full pel and subpel motion search of the current PU against one reference,
+ * with mvc holding numMvc candidates and room for the lowres candidates */
+int Search::searchRef(const CUData& cu, const PredictionUnit& pu, int list, int ref, const MV& mvp, MV* mvc, int numMvc, MV& outmv)
+{
+    int merange = m_param->searchRange;
+
+    if (m_param->bLowresMvSeed)
+        numMvc += getLowresMvc(cu, pu, list, ref, mvp, mvc + numMvc, merange);
+    else
+    {
+        MV lmv = getLowresMV(cu, pu, list, ref);
+        if (lmv.notZero())
+            mvc[numMvc++] = lmv;
+    }
+
+    MV mvmin, mvmax;
+    setSearchRange(cu, mvp, merange, mvmin, mvmax);
+
+    if (merange < m_param->searchRange)
+    {
+        ProfileCUScope(cu, narrowedSearchTime, countNarrowedSearches);
+        return m_me.motionEstimate(&m_slice->m_mref[list][ref], mvmin, mvmax, mvp, numMvc, mvc, merange, outmv);
+    }
+
+    ProfileCUScope(cu, fullSearchTime, countFullSearches);
+    return m_me.motionEstimate(&m_slice->m_mref[list][ref], mvmin, mvmax, mvp, numMvc, mvc, merange, outmv);
+}
+
 /* Pick between the two AMVP candidates which is the best one to use as
  * MVP for the motion search, based on SAD cost */
 int Search::selectMVP(const CUData& cu, const PredictionUnit& pu, const MV amvp[AMVP_NUM_CANDS], int list, int ref)
@@ -1945,6 +2046,7 @@ void Search::processPME(PME& pme, Search& slave)
         slave.m_slice = m_slice;
         slave.m_frame = m_frame;
         slave.m_param = m_param;
+        slave.m_me.setSubpelRefine(m_param->subpelRefine);
         slave.setLambdaFromQP(pme.mode.cu, m_rdCost.m_qp);
         slave.m_me.setSourcePU(*pme.mode.fencYuv, pme.pu.ctuAddr, pme.pu.cuAbsPartIdx, pme.pu.puAbsPartIdx, pme.pu.width, pme.pu.height);
     }
@@ -1973,21 +2075,15 @@ void Search::singleMotionEstimation(Search& master, Mode& interMode, const Predi
 
     MotionData* bestME = interMode.bestME[part];
 
-    // 12 mv candidates including lowresMV
-    MV  mvc[(MD_ABOVE_LEFT + 1) * 2 + 2];
+    // 13 mv candidates including lowres MVs
+    MV  mvc[(MD_ABOVE_LEFT + 1) * 2 + MAX_LOWRES_MVC];
     int numMvc = interMode.cu.getPMV(interMode.interNeighbours, list, ref, interMode.amvpCand[list][ref], mvc);
 
     const MV* amvp = interMode.amvpCand[list][ref];
     int mvpIdx = selectMVP(interMode.cu, pu, amvp, list, ref);
-    MV mvmin, mvmax, outmv, mvp = amvp[mvpIdx];
+    MV outmv, mvp = amvp[mvpIdx];
 
-    MV lmv = getLowresMV(interMode.cu, pu, list, ref);
-    if (lmv.notZero())
-        mvc[numMvc++] = lmv;
-
-    setSearchRange(interMode.cu, mvp, m_param->searchRange, mvmin, mvmax);
-
-    int satdCost = m_me.motionEstimate(&m_slice->m_mref[list][ref], mvmin, mvmax, mvp, numMvc, mvc, m_param->searchRange, outmv);
+    int satdCost = searchRef(interMode.cu, pu, list, ref, mvp, mvc, numMvc, outmv);
 
     /* Get total cost of partition, but only include MV bit cost once */
     bits += m_me.bitcost(outmv);
@@ -2018,8 +2114,8 @@ void Search::predInterSearch(Mode& interMode, const CUGeom& cuGeom, bool bChroma
     CUData& cu = interMode.cu;
     Yuv* predYuv = &interMode.predYuv;
 
-    // 12 mv candidates including lowresMV
-    MV mvc[(MD_ABOVE_LEFT + 1) * 2 + 2];
+    // 13 mv candidates including lowres MVs
+    MV mvc[(MD_ABOVE_LEFT + 1) * 2 + MAX_LOWRES_MVC];
 
     const Slice *slice = m_slice;
     int numPart     = cu.getNumPartInter();
@@ -2066,14 +2162,9 @@ void Search::predInterSearch(Mode& interMode, const CUGeom& cuGeom, bool bChroma
 
                 const MV* amvp = interMode.amvpCand[list][ref];
                 int mvpIdx = selectMVP(cu, pu, amvp, list, ref);
-                MV mvmin, mvmax, outmv, mvp = amvp[mvpIdx];
-
-                MV lmv = getLowresMV(cu, pu, list, ref);
-                if (lmv.notZero())
-                    mvc[numMvc++] = lmv;
+                MV outmv, mvp = amvp[mvpIdx];
 
-                setSearchRange(cu, mvp, m_param->searchRange, mvmin, mvmax);
-                int satdCost = m_me.motionEstimate(&slice->m_mref[list][ref], mvmin, mvmax, mvp, numMvc, mvc, m_param->searchRange, outmv);
+                int satdCost = searchRef(cu, pu, list, ref, mvp, mvc, numMvc, outmv);
 
                 /* Get total cost of partition, but only include MV bit cost once */
                 bits += m_me.bitcost(outmv);
@@ -2137,14 +2228,9 @@ void Search::predInterSearch(Mode& interMode, const CUGeom& cuGeom, bool bChroma
 
                     const MV* amvp = interMode.amvpCand[list][ref];
                     int mvpIdx = selectMVP(cu, pu, amvp, list, ref);
-                    MV mvmin, mvmax, outmv, mvp = amvp[mvpIdx];
+                    MV outmv, mvp = amvp[mvpIdx];
 
-                    MV lmv = getLowresMV(cu, pu, list, ref);
-                    if (lmv.notZero())
-                        mvc[numMvc++] = lmv;
-
-                    setSearchRange(cu, mvp, m_param->searchRange, mvmin, mvmax);
-                    int satdCost = m_me.motionEstimate(&slice->m_mref[list][ref], mvmin, mvmax, mvp, numMvc, mvc, m_param->searchRange, outmv);
+                    int satdCost = searchRef(cu, pu, list, ref, mvp, mvc, numMvc, outmv);
 
                     /* Get total cost of partition, but only include MV bit cost once */
                     bits += m_me.bitcost(outmv);
@@ -2437,6 +2523,25 @@ void Search::setSearchRange(const CUData& cu, const MV& mvp, int merange, MV& mv
     /* conditional clipping for frame parallelism */
     mvmin.y = X265_MIN(mvmin.y, (int16_t)m_refLagPixels);
     mvmax.y = X265_MIN(mvmax.y, (int16_t)m_refLagPixels);
+
+    /* CUs already refreshed by intra refresh may not reference the unrefreshed
+     * area of the previous frame; leave room for the subpel refine steps */
+    if (m_slice->m_pirEndCol)
+    {
+        int maxX = (refreshMaxMvX(cu) >> 2) - 2 - MotionEstimate::hpelIterationCount(m_param->subpelRefine) / 2;
+        mvmax.x = (int16_t)X265_MAX(X265_MIN(mvmax.x, maxX), -(1 << 15) + 1);
+        mvmin.x = X265_MIN(mvmin.x, mvmax.x);
+    }
+}
+
+/* largest horizontal quarter-pel MV a CU may use while an intra refresh wave
+ * is in progress */
+int Search::refreshMaxMvX(const CUData& cu) const
+{
+    if (cu.m_cuPelX >= (uint32_t)m_slice->m_pirStartCol * g_maxCUSize)
+        return MAX_INT;
+
+    return (m_slice->m_pirRefLimitX - (int)(cu.m_cuPelX + (1 << cu.m_log2CUSize[0]))) << 2;
 }
 
 /* Note: this function overwrites the RD cost variables of interMode, but leaves the sa8d cost unharmed */
@@ -178,6 +178,8 @@ struct CUStats
     int64_t  interRDOElapsedTime[NUM_CU_DEPTH]; // elapsed worker time in inter RDO per CU depth
     int64_t  intraAnalysisElapsedTime;          // elapsed worker time in intra sa8d analysis
     int64_t  motionEstimationElapsedTime;       // elapsed worker time in predInterSearch()
+    int64_t  fullSearchTime;                    // elapsed worker time in motion searches of full range
+    int64_t  narrowedSearchTime;                // elapsed worker time in motion searches narrowed by lowres MVs
     int64_t  loopFilterElapsedTime;             // elapsed worker time in deblock and SAO and PSNR/SSIM
     int64_t  pmeTime;                           // elapsed worker time processing ME slave jobs
     int64_t  pmeBlockTime;                      // elapsed worker time blocked for pme batch completion
@@ -195,6 +197,8 @@ struct CUStats
     uint64_t countInterRDO[NUM_CU_DEPTH];
     uint64_t countIntraAnalysis;
     uint64_t countMotionEstimate;
+    uint64_t countFullSearches;
+    uint64_t countNarrowedSearches;
     uint64_t countLoopFilter;
     uint64_t countPMETasks;
     uint64_t countPMEMasters;
@@ -226,6 +230,8 @@ struct CUStats
 
         intraAnalysisElapsedTime += other.intraAnalysisElapsedTime;
         motionEstimationElapsedTime += other.motionEstimationElapsedTime;
+        fullSearchTime += other.fullSearchTime;
+        narrowedSearchTime += other.narrowedSearchTime;
         loopFilterElapsedTime += other.loopFilterElapsedTime;
         pmeTime += other.pmeTime;
         pmeBlockTime += other.pmeBlockTime;
@@ -236,6 +242,8 @@ struct CUStats
 
         countIntraAnalysis += other.countIntraAnalysis;
         countMotionEstimate += other.countMotionEstimate;
+        countFullSearches += other.countFullSearches;
+        countNarrowedSearches += other.countNarrowedSearches;
         countLoopFilter += other.countLoopFilter;
         countPMETasks += other.countPMETasks;
         countPMEMasters += other.countPMEMasters;
@@ -328,7 +336,11 @@ public:
     void checkDQP(Mode& mode, const CUGeom& cuGeom);
     void checkDQPForSplitPred(Mode& mode, const CUGeom& cuGeom);
 
+    enum { MAX_LOWRES_MVC = 3 }; // lookahead MV candidates per motion search
+
     MV getLowresMV(const CUData& cu, const PredictionUnit& pu, int list, int ref);
+    int getLowresMvc(const CUData& cu, const PredictionUnit& pu, int list, int ref, const MV& mvp, MV* mvc, int& merange);
+    int searchRef(const CUData& cu, const PredictionUnit& pu, int list, int ref, const MV& mvp, MV* mvc, int numMvc, MV& outmv);
 
     class PME : public BondedTaskGroup
     {
@@ -410,6 +422,7 @@ protected:
     int       selectMVP(const CUData& cu, const PredictionUnit& pu, const MV amvp[AMVP_NUM_CANDS], int list, int ref);
     const MV& checkBestMVP(const MV amvpCand[2], const MV& mv, int& mvpIdx, uint32_t& outBits, uint32_t& outCost) const;
     void     setSearchRange(const CUData& cu, const MV& mvp, int merange, MV& mvmin, MV& mvmax) const;
+    int      refreshMaxMvX(const CUData& cu) const;
     uint32_t mergeEstimation(CUData& cu, const CUGeom& cuGeom, const PredictionUnit& pu, int puIdx, MergeData& m);
     static void getBlkBits(PartSize cuMode, bool bPSlice, int puIdx, uint32_t lastMode, uint32_t blockBit[3]);
 
@@ -106,17 +106,48 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
     int blockXY = 0;
     int blockX = 0, blockY = 0;
     double strength = 0.f;
-    if (param->rc.aqMode == X265_AQ_NONE || param->rc.aqStrength == 0)
+
+    /* under a pass reading stats, the cu-tree offsets of a referenced picture
+     * were read by cuTreeReadFor2Pass(). They are relative to the AQ offsets
+     * of the previous pass, computed again below, and are rebased onto the map */
+    bool bRebaseCuTree = curFrame->m_quantOffsets && curFrame->m_quantOffsetsMode == X265_QPMAP_AQ &&
+                         param->rc.bStatRead && param->rc.cuTree && IS_REFERENCED(curFrame);
+
+    if (curFrame->m_quantOffsets && !bRebaseCuTree)
+    {
+        /* the application chose the offsets, the variance is only needed
+         * for weighted prediction */
+        int cuCount = widthInCU * heightInCU;
+        const double* qpMap = curFrame->m_quantOffsets;
+
+        for (int cuxy = 0; cuxy < cuCount; cuxy++)
+        {
+            curFrame->m_lowres.qpAqOffset[cuxy] = qpMap[cuxy];
+            curFrame->m_lowres.qpCuTreeOffset[cuxy] = qpMap[cuxy];
+            curFrame->m_lowres.invQscaleFactor[cuxy] = x265_exp2fix8(qpMap[cuxy]);
+        }
+
+        if (param->bEnableWeightedPred || param->bEnableWeightedBiPred)
+        {
+            for (blockY = 0; blockY < maxRow; blockY += 16)
+                for (blockX = 0; blockX < maxCol; blockX += 16)
+                    acEnergyCu(curFrame, blockX, blockY, param->internalCsp);
+        }
+    }
+    else if (param->rc.aqMode == X265_AQ_NONE || param->rc.aqStrength == 0)
     {
         /* Need to init it anyways for CU tree */
         int cuCount = widthInCU * heightInCU;
 
         if (param->rc.aqMode && param->rc.aqStrength == 0)
         {
-            memset(curFrame->m_lowres.qpCuTreeOffset, 0, cuCount * sizeof(double));
             memset(curFrame->m_lowres.qpAqOffset, 0, cuCount * sizeof(double));
-            for (int cuxy = 0; cuxy < cuCount; cuxy++)
-                curFrame->m_lowres.invQscaleFactor[cuxy] = 256;
+            if (!bRebaseCuTree)
+            {
+                memset(curFrame->m_lowres.qpCuTreeOffset, 0, cuCount * sizeof(double));
+                for (int cuxy = 0; cuxy < cuCount; cuxy++)
+                    curFrame->m_lowres.invQscaleFactor[cuxy] = 256;
+            }
         }
 
         /* Need variance data for weighted prediction */
@@ -140,7 +171,7 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
                 {
                     uint32_t energy = acEnergyCu(curFrame, blockX, blockY, param->internalCsp);
                     qp_adj = pow(energy + 1, 0.1);
-                    curFrame->m_lowres.qpCuTreeOffset[blockXY] = qp_adj;
+                    curFrame->m_lowres.qpAqOffset[blockXY] = qp_adj;
                     avg_adj += qp_adj;
                     avg_adj_pow2 += qp_adj * qp_adj;
                     blockXY++;
@@ -162,7 +193,7 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
             {
                 if (param->rc.aqMode == X265_AQ_AUTO_VARIANCE)
                 {
-                    qp_adj = curFrame->m_lowres.qpCuTreeOffset[blockXY];
+                    qp_adj = curFrame->m_lowres.qpAqOffset[blockXY];
                     qp_adj = strength * (qp_adj - avg_adj);
                 }
                 else
@@ -171,13 +202,29 @@ void LookaheadTLD::calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param)
                     qp_adj = strength * (X265_LOG2(X265_MAX(energy, 1)) - (14.427f + 2 * (X265_DEPTH - 8)));
                 }
                 curFrame->m_lowres.qpAqOffset[blockXY] = qp_adj;
-                curFrame->m_lowres.qpCuTreeOffset[blockXY] = qp_adj;
-                curFrame->m_lowres.invQscaleFactor[blockXY] = x265_exp2fix8(qp_adj);
+                if (!bRebaseCuTree)
+                {
+                    curFrame->m_lowres.qpCuTreeOffset[blockXY] = qp_adj;
+                    curFrame->m_lowres.invQscaleFactor[blockXY] = x265_exp2fix8(qp_adj);
+                }
                 blockXY++;
             }
         }
     }
 
+    if (bRebaseCuTree)
+    {
+        int cuCount = widthInCU * heightInCU;
+        const double* qpMap = curFrame->m_quantOffsets;
+
+        for (int cuxy = 0; cuxy < cuCount; cuxy++)
+        {
+            curFrame->m_lowres.qpCuTreeOffset[cuxy] += qpMap[cuxy] - curFrame->m_lowres.qpAqOffset[cuxy];
+            curFrame->m_lowres.qpAqOffset[cuxy] = qpMap[cuxy];
+            curFrame->m_lowres.invQscaleFactor[cuxy] = x265_exp2fix8(curFrame->m_lowres.qpCuTreeOffset[cuxy]);
+        }
+    }
+
     if (param->bEnableWeightedPred || param->bEnableWeightedBiPred)
     {
         int hShift = CHROMA_H_SHIFT(param->internalCsp);
@@ -319,9 +366,9 @@ uint32_t LookaheadTLD::weightCostLuma(Lowres& fenc, Lowres& ref, WeightParam& wp
         int correction = IF_INTERNAL_PREC - X265_DEPTH; // intermediate interpolation depth
         int widthHeight = (int)stride;
 
-        primitives.weight_pp(ref.buffer[0], wbuffer[0], stride, widthHeight, paddedLines,
+        primitives.weight_pp(ref.buffer[0], wbuffer, stride, widthHeight, paddedLines,
             scale, round << correction, denom + correction, offset);
-        src = weightedRef.fpelPlane[0];
+        src = wbuffer + (ref.fpelPlane[0] - ref.buffer[0]);
     }
 
     uint32_t cost = 0;
@@ -340,44 +387,23 @@ uint32_t LookaheadTLD::weightCostLuma(Lowres& fenc, Lowres& ref, WeightParam& wp
     return cost;
 }
 
-bool LookaheadTLD::allocWeightedRef(Lowres& fenc)
-{
-    intptr_t planesize = fenc.buffer[1] - fenc.buffer[0];
-    intptr_t padoffset = fenc.lowresPlane[0] - fenc.buffer[0];
-    paddedLines = (int)(planesize / fenc.lumaStride);
-
-    wbuffer[0] = X265_MALLOC(pixel, 4 * planesize);
-    if (wbuffer[0])
-    {
-        wbuffer[1] = wbuffer[0] + planesize;
-        wbuffer[2] = wbuffer[1] + planesize;
-        wbuffer[3] = wbuffer[2] + planesize;
-    }
-    else
-        return false;
-
-    for (int i = 0; i < 4; i++)
-        weightedRef.lowresPlane[i] = wbuffer[i] + padoffset;
-
-    weightedRef.fpelPlane[0] = weightedRef.lowresPlane[0];
-    weightedRef.lumaStride = fenc.lumaStride;
-    weightedRef.isLowres = true;
-    weightedRef.isWeighted = false;
-
-    return true;
-}
-
-void LookaheadTLD::weightsAnalyse(Lowres& fenc, Lowres& ref)
+/* find the weights of ref which best predict fenc, outWp.bPresentFlag is
+ * false if weighting is not worthwhile */
+void LookaheadTLD::weightsAnalyse(Lowres& fenc, Lowres& ref, WeightParam& outWp)
 {
     static const float epsilon = 1.f / 128.f;
     int deltaIndex = fenc.frameNum - ref.frameNum;
 
     WeightParam wp;
     wp.bPresentFlag = false;
+    outWp.bPresentFlag = false;
 
-    if (!wbuffer[0])
+    if (!wbuffer)
     {
-        if (!allocWeightedRef(fenc))
+        intptr_t planesize = fenc.buffer[1] - fenc.buffer[0];
+        paddedLines = (int)(planesize / fenc.lumaStride);
+        wbuffer = X265_MALLOC(pixel, planesize);
+        if (!wbuffer)
             return;
     }
 
@@ -435,24 +461,10 @@ void LookaheadTLD::weightsAnalyse(Lowres& fenc, Lowres& ref)
         return;
     else
     {
-        SET_WEIGHT(wp, true, minscale, mindenom, minoff);
+        SET_WEIGHT(outWp, true, minscale, mindenom, minoff);
 
         // set weighted delta cost
         fenc.weightedCostDelta[deltaIndex] = minscore / origscore;
-
-        int offset = wp.inputOffset << (X265_DEPTH - 8);
-        int scale = wp.inputWeight;
-        int denom = wp.log2WeightDenom;
-        int round = denom ? 1 << (denom - 1) : 0;
-        int correction = IF_INTERNAL_PREC - X265_DEPTH; // intermediate interpolation depth
-        intptr_t stride = ref.lumaStride;
-        int widthHeight = (int)stride;
-
-        for (int i = 0; i < 4; i++)
-            primitives.weight_pp(ref.buffer[i], wbuffer[i], stride, widthHeight, paddedLines,
-            scale, round << correction, denom + correction, offset);
-
-        weightedRef.isWeighted = true;
     }
 }
 
@@ -462,11 +474,14 @@ Lookahead::Lookahead(x265_param *param, ThreadPool* pool)
     m_pool  = pool;
 
     m_lastNonB = NULL;
-    m_scratch  = NULL;
     m_tld      = NULL;
     m_filled   = false;
     m_outputSignalRequired = false;
     m_isActive = true;
+    m_preNext  = NULL;
+    m_preInFlight = 0;
+    m_coarse   = NULL;
+    resetMiniGopCosts();
 
     m_8x8Height = ((m_param->sourceHeight / 2) + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS;
     m_8x8Width = ((m_param->sourceWidth / 2) + X265_LOWRES_CU_SIZE - 1) >> X265_LOWRES_CU_BITS;
@@ -475,6 +490,8 @@ Lookahead::Lookahead(x265_param *param, ThreadPool* pool)
     m_lastKeyframe = -m_param->keyframeMax;
     m_sliceTypeBusy = false;
     m_fullQueueSize = X265_MAX(1, m_param->lookaheadDepth);
+    m_lookaheadDepth = m_nextLookaheadDepth = m_param->lookaheadDepth;
+    m_bFrameAdaptive = m_nextBFrameAdaptive = m_param->bFrameAdaptive;
     m_bAdaptiveQuant = m_param->rc.aqMode || m_param->bEnableWeightedPred || m_param->bEnableWeightedBiPred;
 
     /* If we have a thread pool and are using --b-adapt 2, it is generally
@@ -521,17 +538,17 @@ Lookahead::Lookahead(x265_param *param, ThreadPool* pool)
 }
 
 #if DETAILED_CU_STATS
-void Lookahead::getWorkerStats(int64_t& batchElapsedTime, uint64_t& batchCount, int64_t& coopSliceElapsedTime, uint64_t& coopSliceCount)
+void Lookahead::getWorkerStats(int64_t& searchElapsedTime, uint64_t& searchCount, int64_t& estimateElapsedTime, uint64_t& estimateCount)
 {
-    batchElapsedTime = coopSliceElapsedTime = 0;
-    coopSliceCount = batchCount = 0;
+    searchElapsedTime = estimateElapsedTime = 0;
+    estimateCount = searchCount = 0;
     int tldCount = m_pool ? m_pool->m_numWorkers : 1;
     for (int i = 0; i < tldCount; i++)
     {
-        batchElapsedTime += m_tld[i].batchElapsedTime;
-        coopSliceElapsedTime += m_tld[i].coopSliceElapsedTime;
-        batchCount += m_tld[i].countBatches;
-        coopSliceCount += m_tld[i].countCoopSlices;
+        searchElapsedTime += m_tld[i].searchElapsedTime;
+        estimateElapsedTime += m_tld[i].estimateElapsedTime;
+        searchCount += m_tld[i].countSearches;
+        estimateCount += m_tld[i].countEstimates;
     }
 }
 #endif
@@ -541,10 +558,30 @@ bool Lookahead::create()
     int numTLD = 1 + (m_pool ? m_pool->m_numWorkers : 0);
     m_tld = new LookaheadTLD[numTLD];
     for (int i = 0; i < numTLD; i++)
-        m_tld[i].init(m_8x8Width, m_8x8Height, m_8x8Blocks);
-    m_scratch = X265_MALLOC(int, m_tld[0].widthInCU);
+        if (!m_tld[i].init(m_8x8Width, m_8x8Height, m_8x8Blocks))
+            return false;
+
+    if (m_param->bHierarchicalLookahead)
+    {
+        /* a second lookahead which only estimates costs, configured for the
+         * quarter resolution copies of the lowres frames */
+        x265_param* coarseParam = X265_MALLOC(x265_param, 1);
+        if (!coarseParam)
+            return false;
+        memcpy(coarseParam, m_param, sizeof(x265_param));
+        coarseParam->sourceWidth = m_8x8Width * X265_LOWRES_CU_SIZE;
+        coarseParam->sourceHeight = m_8x8Height * X265_LOWRES_CU_SIZE;
+        coarseParam->bEnableWeightedPred = coarseParam->bEnableWeightedBiPred = 0;
+        coarseParam->lookaheadSlices = 0;
+        coarseParam->bHierarchicalLookahead = 0;
+        coarseParam->bHistBasedSceneCut = 0;
+
+        m_coarse = new Lookahead(coarseParam, m_pool);
+        if (!m_coarse->create())
+            return false;
+    }
 
-    return m_tld && m_scratch;
+    return true;
 }
 
 void Lookahead::stopJobs()
@@ -558,6 +595,16 @@ void Lookahead::stopJobs()
 
         if (wait)
             m_outputSignal.wait();
+
+        /* pictures in pre-analysis are still owned by the input queue */
+        m_inputLock.acquire();
+        while (m_preInFlight)
+        {
+            m_inputLock.release();
+            m_preDone.wait();
+            m_inputLock.acquire();
+        }
+        m_inputLock.release();
     }
 }
 
@@ -578,15 +625,22 @@ void Lookahead::destroy()
         delete curFrame;
     }
 
-    X265_FREE(m_scratch);
-
     delete [] m_tld;
+
+    if (m_coarse)
+    {
+        m_coarse->destroy();
+        X265_FREE(m_coarse->m_param);
+        delete m_coarse;
+    }
 }
 
 /* The synchronization of slicetypeDecide is managed here.  The findJob() method
  * polls the occupancy of the input queue. If the queue is
  * full, it will run slicetypeDecide() and output a mini-gop of frames to the
- * output queue. If the flush() method has been called (implying no new pictures
+ * output queue. Otherwise worker threads pre-analyse the queued pictures in
+ * input order, so the lowres data slicetypeDecide() needs is generally ready
+ * before it starts. If the flush() method has been called (implying no new pictures
  * will be received) then the input queue is considered full if it has even one
  * picture left. getDecidedPicture() removes pictures from the output queue and
  * only blocks as a last resort. It does not start removing pictures until
@@ -615,11 +669,22 @@ void Lookahead::addPicture(Frame& curFrame, int sliceType)
 
     m_inputLock.acquire();
     m_inputQueue.pushBack(curFrame);
-    if (m_pool && m_inputQueue.size() >= m_fullQueueSize)
+    if (!m_preNext)
+        m_preNext = &curFrame;
+    if (m_pool)
         tryWakeOne();
     m_inputLock.release();
 }
 
+/* Called by API thread. The input queue still fills to the configured
+ * rc-lookahead, only the searches of the decisions are limited */
+void Lookahead::setDecisionLimits(int lookaheadDepth, int bFrameAdaptive)
+{
+    ScopedLock lock(m_inputLock);
+    m_nextLookaheadDepth = X265_MIN(lookaheadDepth, m_param->lookaheadDepth);
+    m_nextBFrameAdaptive = X265_MIN(bFrameAdaptive, m_param->bFrameAdaptive);
+}
+
 /* Called by API thread */
 void Lookahead::flush()
 {
@@ -628,17 +693,41 @@ void Lookahead::flush()
     m_filled = true;
 }
 
-void Lookahead::findJob(int /*workerThreadID*/)
+void Lookahead::findJob(int workerThreadID)
 {
+    Frame* preFrame = NULL;
     bool doDecide;
 
     m_inputLock.acquire();
     if (m_inputQueue.size() >= m_fullQueueSize && !m_sliceTypeBusy && m_isActive)
         doDecide = m_sliceTypeBusy = true;
     else
-        doDecide = m_helpWanted = false;
+    {
+        doDecide = false;
+
+        /* no decision is due, pre-analyse the next queued picture */
+        if (m_preNext && m_isActive && workerThreadID >= 0)
+        {
+            preFrame = m_preNext;
+            m_preNext = m_preNext->m_next;
+            m_preInFlight++;
+        }
+        m_helpWanted = m_preNext && m_isActive;
+    }
     m_inputLock.release();
 
+    if (preFrame)
+    {
+        preAnalyse(preFrame, workerThreadID);
+
+        m_inputLock.acquire();
+        preFrame->m_lowresInit = true;
+        m_preInFlight--;
+        m_inputLock.release();
+        m_preDone.trigger();
+        return;
+    }
+
     if (!doDecide)
         return;
 
@@ -689,39 +778,57 @@ Frame* Lookahead::getDecidedPicture()
  * picture and all the references are established */
 void Lookahead::getEstimatedPictureCost(Frame *curFrame)
 {
-    Lowres *frames[X265_LOOKAHEAD_MAX];
-
-    // POC distances to each reference
     Slice *slice = curFrame->m_encData->m_slice;
-    int p0 = 0, p1, b;
-    int poc = slice->m_poc;
-    int l0poc = slice->m_refPOCList[0][0];
-    int l1poc = slice->m_refPOCList[1][0];
 
     switch (slice->m_sliceType)
     {
     case I_SLICE:
-        frames[p0] = &curFrame->m_lowres;
-        b = p1 = 0;
+        estimatePictureCost(curFrame, NULL, NULL);
         break;
 
     case P_SLICE:
-        b = p1 = poc - l0poc;
-        frames[p0] = &slice->m_refPicList[0][0]->m_lowres;
-        frames[b] = &curFrame->m_lowres;
+        estimatePictureCost(curFrame, slice->m_refPicList[0][0], NULL);
         break;
 
     case B_SLICE:
-        b = poc - l0poc;
-        p1 = b + l1poc - poc;
-        frames[p0] = &slice->m_refPicList[0][0]->m_lowres;
-        frames[b] = &curFrame->m_lowres;
-        frames[p1] = &slice->m_refPicList[1][0]->m_lowres;
+        estimatePictureCost(curFrame, slice->m_refPicList[0][0], slice->m_refPicList[1][0]);
         break;
 
     default:
         return;
     }
+}
+
+/* The estimated SATD cost of a picture predicted from ref0 and ref1, both
+ * NULL for an I picture and ref1 NULL for a P picture. The row costs for
+ * VBV are only aggregated for pictures which are encoded */
+void Lookahead::estimatePictureCost(Frame *curFrame, Frame *ref0, Frame *ref1)
+{
+    Lowres *frames[X265_LOOKAHEAD_MAX];
+
+    // POC distances to each reference
+    int p0 = 0, p1, b;
+    int poc = curFrame->m_poc;
+
+    if (!ref0)
+    {
+        frames[p0] = &curFrame->m_lowres;
+        b = p1 = 0;
+    }
+    else if (!ref1)
+    {
+        b = p1 = poc - ref0->m_poc;
+        frames[p0] = &ref0->m_lowres;
+        frames[b] = &curFrame->m_lowres;
+    }
+    else
+    {
+        b = poc - ref0->m_poc;
+        p1 = b + ref1->m_poc - poc;
+        frames[p0] = &ref0->m_lowres;
+        frames[b] = &curFrame->m_lowres;
+        frames[p1] = &ref1->m_lowres;
+    }
 
     X265_CHECK(curFrame->m_lowres.costEst[b - p0][p1 - b] > 0, "Slice cost not estimated\n")
 
@@ -733,7 +840,7 @@ void Lookahead::getEstimatedPictureCost(Frame *curFrame)
     else
         curFrame->m_lowres.satdCost = curFrame->m_lowres.costEst[b - p0][p1 - b];
 
-    if (m_param->rc.vbvBufferSize && m_param->rc.vbvMaxBitrate)
+    if (m_param->rc.vbvBufferSize && m_param->rc.vbvMaxBitrate && curFrame->m_encData)
     {
         /* aggregate lowres row satds to CTU resolution */
         curFrame->m_lowres.lowresCostForRc = curFrame->m_lowres.lowresCosts[b - p0][p1 - b];
@@ -773,26 +880,36 @@ void Lookahead::getEstimatedPictureCost(Frame *curFrame)
     }
 }
 
+void Lookahead::preAnalyse(Frame* curFrame, int tldIdx)
+{
+    ProfileLookaheadTime(m_preLookaheadElapsedTime, m_countPreLookahead);
+    ProfileScopeEvent(prelookahead);
+
+    LookaheadTLD& tld = m_tld[tldIdx];
+
+    curFrame->m_lowres.init(curFrame->m_fencPic, curFrame->m_poc);
+    curFrame->m_lowres.bFinalQpOffsets = curFrame->m_quantOffsets && curFrame->m_quantOffsetsMode == X265_QPMAP_FINAL;
+    if (m_param->rc.bStatRead && m_param->rc.cuTree && IS_REFERENCED(curFrame) && !curFrame->m_quantOffsets)
+        /* cu-tree offsets were read from stats file */;
+    else if (m_bAdaptiveQuant)
+        tld.calcAdaptiveQuantFrame(curFrame, m_param);
+    tld.lowresIntraEstimate(curFrame->m_lowres);
+    if (m_coarse)
+        m_coarse->m_tld[tldIdx].lowresIntraEstimate(*curFrame->m_lowres.coarse);
+}
+
 void PreLookaheadGroup::processTasks(int workerThreadID)
 {
     if (workerThreadID < 0)
         workerThreadID = m_lookahead.m_pool ? m_lookahead.m_pool->m_numWorkers : 0;
-    LookaheadTLD& tld = m_lookahead.m_tld[workerThreadID];
 
     m_lock.acquire();
     while (m_jobAcquired < m_jobTotal)
     {
         Frame* preFrame = m_preframes[m_jobAcquired++];
-        ProfileLookaheadTime(m_lookahead.m_preLookaheadElapsedTime, m_lookahead.m_countPreLookahead);
-        ProfileScopeEvent(prelookahead);
         m_lock.release();
 
-        preFrame->m_lowres.init(preFrame->m_fencPic, preFrame->m_poc);
-        if (m_lookahead.m_param->rc.bStatRead && m_lookahead.m_param->rc.cuTree && IS_REFERENCED(preFrame))
-            /* cu-tree offsets were read from stats file */;
-        else if (m_lookahead.m_bAdaptiveQuant)
-            tld.calcAdaptiveQuantFrame(preFrame, m_lookahead.m_param);
-        tld.lowresIntraEstimate(preFrame->m_lowres);
+        m_lookahead.preAnalyse(preFrame, workerThreadID);
         preFrame->m_lowresInit = true;
 
         m_lock.acquire();
@@ -807,14 +924,32 @@ void Lookahead::slicetypeDecide()
 
     Lowres* frames[X265_LOOKAHEAD_MAX + X265_BFRAME_MAX + 4];
     Frame*  list[X265_BFRAME_MAX + 4];
+    Frame*  running[X265_LOOKAHEAD_MAX];
+    int     numRunning = 0;
     memset(frames, 0, sizeof(frames));
     memset(list, 0, sizeof(list));
-    int maxSearch = X265_MIN(m_param->lookaheadDepth, X265_LOOKAHEAD_MAX);
-    maxSearch = X265_MAX(1, maxSearch);
+    int maxSearch;
 
     {
         ScopedLock lock(m_inputLock);
 
+        if (m_bFrameAdaptive != m_nextBFrameAdaptive)
+        {
+            /* the memoized trellis costs go stale while another b-adapt decides */
+            resetMiniGopCosts();
+            if (m_coarse)
+                m_coarse->resetMiniGopCosts();
+        }
+        m_lookaheadDepth = m_nextLookaheadDepth;
+        m_bFrameAdaptive = m_nextBFrameAdaptive;
+        if (m_coarse)
+        {
+            m_coarse->m_lookaheadDepth = m_lookaheadDepth;
+            m_coarse->m_bFrameAdaptive = m_bFrameAdaptive;
+        }
+        maxSearch = X265_MIN(m_lookaheadDepth, X265_LOOKAHEAD_MAX);
+        maxSearch = X265_MAX(1, maxSearch);
+
         Frame *curFrame = m_inputQueue.first();
         int j;
         for (j = 0; j < m_param->bframes + 2; j++)
@@ -824,6 +959,9 @@ void Lookahead::slicetypeDecide()
             curFrame = curFrame->m_next;
         }
 
+        /* pictures before m_preNext were claimed by worker threads, claim
+         * the rest of the search window for the bonded task group */
+        bool bClaim = false;
         curFrame = m_inputQueue.first();
         frames[0] = m_lastNonB;
         for (j = 0; j < maxSearch; j++)
@@ -831,11 +969,17 @@ void Lookahead::slicetypeDecide()
             if (!curFrame) break;
             frames[j + 1] = &curFrame->m_lowres;
 
-            if (!curFrame->m_lowresInit)
+            if (curFrame == m_preNext)
+                bClaim = true;
+            if (bClaim)
                 pre.m_preframes[pre.m_jobTotal++] = curFrame;
+            else if (!curFrame->m_lowresInit)
+                running[numRunning++] = curFrame;
 
             curFrame = curFrame->m_next;
         }
+        if (bClaim)
+            m_preNext = curFrame;
 
         maxSearch = j;
     }
@@ -849,8 +993,21 @@ void Lookahead::slicetypeDecide()
         pre.waitForExit();
     }
 
+    /* wait for the pre-analysis jobs still running on worker threads */
+    for (int i = 0; i < numRunning; i++)
+    {
+        m_inputLock.acquire();
+        while (!running[i]->m_lowresInit)
+        {
+            m_inputLock.release();
+            m_preDone.wait();
+            m_inputLock.acquire();
+        }
+        m_inputLock.release();
+    }
+
     if (m_lastNonB && !m_param->rc.bStatRead &&
-        ((m_param->bFrameAdaptive && m_param->bframes) ||
+        ((m_bFrameAdaptive && m_param->bframes) ||
          m_param->rc.cuTree || m_param->scenecutThreshold ||
          (m_param->lookaheadDepth && m_param->rc.vbvBufferSize)))
     {
@@ -879,7 +1036,7 @@ void Lookahead::slicetypeDecide()
                      frm.sliceType, m_param->maxNumReferences);
         }
 
-        if (/* (!param->intraRefresh || frm.frameNum == 0) && */ frm.frameNum - m_lastKeyframe >= m_param->keyframeMax)
+        if ((!m_param->bIntraRefresh || frm.frameNum == 0) && frm.frameNum - m_lastKeyframe >= m_param->keyframeMax)
         {
             if (frm.sliceType == X265_TYPE_AUTO || frm.sliceType == X265_TYPE_I)
                 frm.sliceType = m_param->bOpenGOP && m_lastKeyframe >= 0 ? X265_TYPE_I : X265_TYPE_IDR;
@@ -1136,10 +1293,84 @@ int64_t Lookahead::vbvFrameCost(Lowres **frames, int p0, int p1, int b)
     return cost;
 }
 
+/* pre-calculate the motion searches and frame cost estimates of the b-adapt
+ * trellis using worker threads bonded to the thread running slicetypeDecide */
+void Lookahead::estimateBatch(Lowres **frames, int numFrames)
+{
+    /* queue all motion searches, each with the frame cost estimate of its
+     * own distance */
+    CostEstimateGroup estGroup(*this, frames);
+    for (int b = 2; b < numFrames; b++)
+    {
+        for (int i = 1; i <= m_param->bframes + 1; i++)
+        {
+            int p0 = b - i;
+            if (p0 < 0)
+                continue;
+
+            /* Skip search if already done */
+            if (frames[b]->lowresMvs[0][i - 1][0].x != 0x7FFF)
+                continue;
+
+            /* perform search to p1 at same distance, if possible */
+            int p1 = b + i;
+            if (p1 >= numFrames || frames[b]->lowresMvs[1][i - 1][0].x != 0x7FFF)
+                p1 = b;
+
+            estGroup.add(p0, p1, b);
+        }
+    }
+    /* auto-disable after the first batch if pool is small */
+    m_bBatchMotionSearch &= m_pool->m_numWorkers >= 4;
+
+    if (m_bBatchFrameCosts)
+    {
+        /* queue all frame cost estimates whose motion searches are done or
+         * queued above; each one runs as soon as its searches are done */
+        for (int b = 2; b < numFrames; b++)
+        {
+            for (int i = 1; i <= m_param->bframes + 1; i++)
+            {
+                if (b < i)
+                    continue;
+
+                /* only measure frame cost in this pass if motion searches
+                 * are already done or queued */
+                if (frames[b]->lowresMvs[0][i - 1][0].x == 0x7FFF)
+                    continue;
+
+                int p0 = b - i;
+
+                for (int j = 0; j <= m_param->bframes; j++)
+                {
+                    int p1 = b + j;
+                    if (p1 >= numFrames)
+                        break;
+
+                    /* ensure P1 search is done or queued */
+                    if (j && frames[b]->lowresMvs[1][j - 1][0].x == 0x7FFF)
+                        continue;
+
+                    /* ensure frame cost is not done or queued */
+                    if (frames[b]->costEst[i][j] >= 0)
+                        continue;
+
+                    estGroup.add(p0, p1, b);
+                }
+            }
+        }
+
+        /* auto-disable after the first batch if the pool is not large */
+        m_bBatchFrameCosts &= m_pool->m_numWorkers > 12;
+    }
+
+    estGroup.finishBatch();
+}
+
 void Lookahead::slicetypeAnalyse(Lowres **frames, bool bKeyframe)
 {
     int numFrames, origNumFrames, keyintLimit, framecnt;
-    int maxSearch = X265_MIN(m_param->lookaheadDepth, X265_LOOKAHEAD_MAX);
+    int maxSearch = X265_MIN(m_lookaheadDepth, X265_LOOKAHEAD_MAX);
     int cuCount = m_8x8Blocks;
     int resetStart;
     bool bIsVbvLookahead = m_param->rc.vbvBufferSize && m_param->lookaheadDepth;
@@ -1154,7 +1385,27 @@ void Lookahead::slicetypeAnalyse(Lowres **frames, bool bKeyframe)
 
     if (!framecnt)
     {
-        if (m_param->rc.cuTree)
+        if (m_param->analysisMode == X265_ANALYSIS_LOAD && (m_param->rc.cuTree || bIsVbvLookahead))
+        {
+            /* all frame types were given by the analysis; plan cu-tree and the
+             * VBV lookahead over the given types up to the next keyframe */
+            int types[X265_LOOKAHEAD_MAX + 1];
+            int numGiven = 0;
+            while (numGiven < maxSearch && frames[numGiven + 1] && !IS_X265_TYPE_I(frames[numGiven + 1]->sliceType))
+            {
+                numGiven++;
+                types[numGiven] = frames[numGiven]->sliceType;
+                if (types[numGiven] == X265_TYPE_BREF)
+                    frames[numGiven]->sliceType = X265_TYPE_B;
+            }
+            if (m_param->rc.cuTree)
+                cuTree(frames, numGiven, bKeyframe);
+            if (bIsVbvLookahead && numGiven)
+                vbvLookahead(frames, numGiven, bKeyframe);
+            for (int j = 1; j <= numGiven; j++)
+                frames[j]->sliceType = types[j];
+        }
+        else if (m_param->rc.cuTree)
             cuTree(frames, 0, bKeyframe);
         return;
     }
@@ -1162,7 +1413,7 @@ void Lookahead::slicetypeAnalyse(Lowres **frames, bool bKeyframe)
     frames[framecnt + 1] = NULL;
 
     keyintLimit = m_param->keyframeMax - frames[0]->frameNum + m_lastKeyframe - 1;
-    origNumFrames = numFrames = X265_MIN(framecnt, keyintLimit);
+    origNumFrames = numFrames = m_param->bIntraRefresh ? framecnt : X265_MIN(framecnt, keyintLimit);
 
     if (bIsVbvLookahead)
         numFrames = framecnt;
@@ -1174,106 +1425,64 @@ void Lookahead::slicetypeAnalyse(Lowres **frames, bool bKeyframe)
         return;
     }
 
-    if (m_bBatchMotionSearch)
+    Lowres* coarse[X265_LOOKAHEAD_MAX + 2];
+    if (m_coarse)
     {
-        /* pre-calculate all motion searches, using many worker threads */
-        CostEstimateGroup estGroup(*this, frames);
-        for (int b = 2; b < numFrames; b++)
-        {
-            for (int i = 1; i <= m_param->bframes + 1; i++)
-            {
-                int p0 = b - i;
-                if (p0 < 0)
-                    continue;
-
-                /* Skip search if already done */
-                if (frames[b]->lowresMvs[0][i - 1][0].x != 0x7FFF)
-                    continue;
-
-                /* perform search to p1 at same distance, if possible */
-                int p1 = b + i;
-                if (p1 >= numFrames || frames[b]->lowresMvs[1][i - 1][0].x != 0x7FFF)
-                    p1 = b;
-
-                estGroup.add(p0, p1, b);
-            }
-        }
-        /* auto-disable after the first batch if pool is small */
-        m_bBatchMotionSearch &= m_pool->m_numWorkers >= 4;
-        estGroup.finishBatch();
-
-        if (m_bBatchFrameCosts)
-        {
-            /* pre-calculate all frame cost estimates, using many worker threads */
-            for (int b = 2; b < numFrames; b++)
-            {
-                for (int i = 1; i <= m_param->bframes + 1; i++)
-                {
-                    if (b < i)
-                        continue;
-
-                    /* only measure frame cost in this pass if motion searches
-                     * are already done */
-                    if (frames[b]->lowresMvs[0][i - 1][0].x == 0x7FFF)
-                        continue;
-
-                    int p0 = b - i;
-
-                    for (int j = 0; j <= m_param->bframes; j++)
-                    {
-                        int p1 = b + j;
-                        if (p1 >= numFrames)
-                            break;
-
-                        /* ensure P1 search is done */
-                        if (j && frames[b]->lowresMvs[1][j - 1][0].x == 0x7FFF)
-                            continue;
-
-                        /* ensure frame cost is not done */
-                        if (frames[b]->costEst[i][j] >= 0)
-                            continue;
-
-                        estGroup.add(p0, p1, b);
-                    }
-                }
-            }
-
-            /* auto-disable after the first batch if the pool is not large */
-            m_bBatchFrameCosts &= m_pool->m_numWorkers > 12;
-            estGroup.finishBatch();
-        }
+        /* the frame type decisions are estimated at quarter resolution */
+        for (int j = 0; j <= framecnt; j++)
+            coarse[j] = frames[j]->coarse;
+        coarse[framecnt + 1] = NULL;
+        m_coarse->m_lastKeyframe = m_lastKeyframe;
+
+        if (m_coarse->m_bBatchMotionSearch && m_bFrameAdaptive == X265_B_ADAPT_TRELLIS)
+            m_coarse->estimateBatch(coarse, numFrames);
     }
+    else if (m_bBatchMotionSearch && m_bFrameAdaptive == X265_B_ADAPT_TRELLIS)
+        estimateBatch(frames, numFrames);
 
     int numBFrames = 0;
     int numAnalyzed = numFrames;
     if (m_param->scenecutThreshold && scenecut(frames, 0, 1, true, origNumFrames, maxSearch))
     {
         frames[1]->sliceType = X265_TYPE_I;
+        resetMiniGopCosts();
+        if (m_coarse)
+            m_coarse->resetMiniGopCosts();
         return;
     }
 
     if (m_param->bframes)
     {
-        if (m_param->bFrameAdaptive == X265_B_ADAPT_TRELLIS)
+        if (m_bFrameAdaptive == X265_B_ADAPT_TRELLIS)
         {
             if (numFrames > 1)
             {
-                char best_paths[X265_BFRAME_MAX + 1][X265_LOOKAHEAD_MAX + 1] = { "", "P" };
+                char best_paths[X265_BFRAME_MAX + 1][X265_LOOKAHEAD_MAX + 1] = { "" };
+                int64_t best_costs[X265_BFRAME_MAX + 1] = { 0 };
                 int best_path_index = numFrames % (X265_BFRAME_MAX + 1);
 
                 /* Perform the frame type analysis. */
-                for (int j = 2; j <= numFrames; j++)
-                    slicetypePath(frames, j, best_paths);
+                for (int j = 1; j <= numFrames; j++)
+                {
+                    if (m_coarse)
+                        m_coarse->slicetypePath(coarse, j, best_paths, best_costs);
+                    else
+                        slicetypePath(frames, j, best_paths, best_costs);
+                }
 
                 numBFrames = (int)strspn(best_paths[best_path_index], "B");
 
+                /* re-decide the first mini-GOP at half resolution */
+                if (m_coarse)
+                    numBFrames = refineMiniGop(frames, coarse, numFrames, best_paths[best_path_index]);
+
                 /* Load the results of the analysis into the frame types. */
                 for (int j = 1; j < numFrames; j++)
                     frames[j]->sliceType = best_paths[best_path_index][j - 1] == 'B' ? X265_TYPE_B : X265_TYPE_P;
             }
             frames[numFrames]->sliceType = X265_TYPE_P;
         }
-        else if (m_param->bFrameAdaptive == X265_B_ADAPT_FAST)
+        else if (m_bFrameAdaptive == X265_B_ADAPT_FAST)
         {
             CostEstimateGroup estGroup(*this, frames);
 
@@ -1357,11 +1566,13 @@ void Lookahead::slicetypeAnalyse(Lowres **frames, bool bKeyframe)
     if (m_param->rc.cuTree)
         cuTree(frames, X265_MIN(numFrames, m_param->keyframeMax), bKeyframe);
 
-    // if (!param->bIntraRefresh)
-    for (int j = keyintLimit + 1; j <= numFrames; j += m_param->keyframeMax)
+    if (!m_param->bIntraRefresh)
     {
-        frames[j]->sliceType = X265_TYPE_I;
-        resetStart = X265_MIN(resetStart, j + 1);
+        for (int j = keyintLimit + 1; j <= numFrames; j += m_param->keyframeMax)
+        {
+            frames[j]->sliceType = X265_TYPE_I;
+            resetStart = X265_MIN(resetStart, j + 1);
+        }
     }
 
     if (bIsVbvLookahead)
@@ -1372,14 +1583,71 @@ void Lookahead::slicetypeAnalyse(Lowres **frames, bool bKeyframe)
         frames[j]->sliceType = X265_TYPE_AUTO;
 }
 
+/* The first mini-GOP of the quarter resolution path and its neighbouring
+ * lengths are each completed by a quarter resolution path search over the
+ * frames after them, then the complete candidate paths are measured at half
+ * resolution. Most of these half resolution estimates are needed again by
+ * cu-tree and the quarter resolution estimates are already cached. */
+int Lookahead::refineMiniGop(Lowres **frames, Lowres **coarse, int numFrames, char *path)
+{
+    int numBFrames = (int)strspn(path, "B");
+    int minB = X265_MAX(numBFrames - 1, 0);
+    int maxB = X265_MIN(X265_MIN(numBFrames + 1, m_param->bframes), numFrames - 1);
+    char best[X265_LOOKAHEAD_MAX + 1];
+    int64_t bestCost = 1LL << 62;
+
+    strcpy(best, path);
+    for (int n = minB; n <= maxB; n++)
+    {
+        char cand[X265_LOOKAHEAD_MAX + 1];
+        memset(cand, 'B', n);
+        cand[n] = 'P';
+        if (n == numBFrames)
+            strcpy(cand + n + 1, path + n + 1);
+        else
+        {
+            int rest = numFrames - n - 1;
+            char paths[X265_BFRAME_MAX + 1][X265_LOOKAHEAD_MAX + 1] = { "" };
+            int64_t costs[X265_BFRAME_MAX + 1] = { 0 };
+            for (int j = 1; j <= rest; j++)
+                m_coarse->slicetypePath(coarse + n + 1, j, paths, costs);
+            strcpy(cand + n + 1, paths[rest % (X265_BFRAME_MAX + 1)]);
+        }
+
+        int64_t cost = slicetypePathCost(frames, cand, bestCost);
+        if (cost < bestCost)
+        {
+            bestCost = cost;
+            strcpy(best, cand);
+        }
+    }
+
+    strcpy(path, best);
+    return (int)strspn(path, "B");
+}
+
 bool Lookahead::scenecut(Lowres **frames, int p0, int p1, bool bRealScenecut, int numFrames, int maxSearch)
 {
+    if (m_coarse)
+    {
+        /* flash detection and the scenecut check run at quarter resolution,
+         * a scenecut found there is confirmed at half resolution */
+        Lowres* coarse[X265_LOOKAHEAD_MAX + 2];
+        for (int j = 0; j <= X265_MAX(numFrames, p1); j++)
+            coarse[j] = frames[j]->coarse;
+
+        m_coarse->m_lastKeyframe = m_lastKeyframe;
+        if (!m_coarse->scenecut(coarse, p0, p1, bRealScenecut, numFrames, maxSearch))
+            return false;
+        return scenecutInternal(frames, p0, p1, bRealScenecut);
+    }
+
     /* Only do analysis during a normal scenecut check. */
     if (bRealScenecut && m_param->bframes)
     {
         int origmaxp1 = p0 + 1;
         /* Look ahead to avoid coding short flashes as scenecuts. */
-        if (m_param->bFrameAdaptive == X265_B_ADAPT_TRELLIS)
+        if (m_bFrameAdaptive == X265_B_ADAPT_TRELLIS)
             /* Don't analyse any more frames than the trellis would have covered. */
             origmaxp1 += m_param->bframes;
         else
@@ -1420,11 +1688,6 @@ bool Lookahead::scenecutInternal(Lowres **frames, int p0, int p1, bool bRealScen
 {
     Lowres *frame = frames[p1];
 
-    CostEstimateGroup estGroup(*this, frames);
-    estGroup.singleCost(p0, p1, p1);
-
-    int64_t icost = frame->costEst[0][0];
-    int64_t pcost = frame->costEst[p1 - p0][0];
     int gopSize = frame->frameNum - m_lastKeyframe;
     float threshMax = (float)(m_param->scenecutThreshold / 100.0);
 
@@ -1446,6 +1709,29 @@ bool Lookahead::scenecutInternal(Lowres **frames, int p0, int p1, bool bRealScen
             / (m_param->keyframeMax - m_param->keyframeMin);
     }
 
+    if (m_param->bHistBasedSceneCut)
+    {
+        int hist = scenecutHistogram(frames[p0], frame);
+        if (hist < 0)
+            return false;
+
+        /* a clear scene change is only taken where the bias allows for
+         * some inter prediction of the new scene */
+        if (hist > 0 && bias >= threshMin)
+        {
+            if (bRealScenecut)
+                x265_log(m_param, X265_LOG_DEBUG, "scene cut at %d by histogram, bias:%.4f gop:%d\n",
+                         frame->frameNum, bias, gopSize);
+            return true;
+        }
+    }
+
+    CostEstimateGroup estGroup(*this, frames);
+    estGroup.singleCost(p0, p1, p1);
+
+    int64_t icost = frame->costEst[0][0];
+    int64_t pcost = frame->costEst[p1 - p0][0];
+
     bool res = pcost >= (1.0 - bias) * icost;
     if (res && bRealScenecut)
     {
@@ -1457,7 +1743,45 @@ bool Lookahead::scenecutInternal(Lowres **frames, int p0, int p1, bool bRealScen
     return res;
 }
 
-void Lookahead::slicetypePath(Lowres **frames, int length, char(*best_paths)[X265_LOOKAHEAD_MAX + 1])
+/* Returns -1 when f1 clearly continues the scene of f0, 1 when it clearly
+ * starts a new one and 0 when the inter cost has to decide. The luma and
+ * chroma histogram distances are the fraction of samples which changed bin,
+ * the region distances catch scenes with similar histograms. */
+int Lookahead::scenecutHistogram(Lowres *f0, Lowres *f1)
+{
+    const int numRegions = Lowres::GRID_SIZE * Lowres::GRID_SIZE;
+    uint32_t lumaDiff = 0, chromaDiff[2] = { 0, 0 };
+    for (int i = 0; i < Lowres::HIST_BINS; i++)
+    {
+        lumaDiff += abs((int)f0->lumaHist[i] - (int)f1->lumaHist[i]);
+        chromaDiff[0] += abs((int)f0->chromaHist[0][i] - (int)f1->chromaHist[0][i]);
+        chromaDiff[1] += abs((int)f0->chromaHist[1][i] - (int)f1->chromaHist[1][i]);
+    }
+    double luma = (double)lumaDiff / (2 * f0->histCount[0]);
+    double chroma = f0->histCount[1] ? (double)X265_MAX(chromaDiff[0], chromaDiff[1]) / (2 * f0->histCount[1]) : 0;
+
+    uint64_t edgeDiff = 0, edgeSum = 0, meanDiff = 0;
+    for (int i = 0; i < numRegions; i++)
+    {
+        /* region sums of large high bit depth frames exceed the range of int */
+        edgeDiff += X265_MAX(f0->gridEdge[i], f1->gridEdge[i]) - X265_MIN(f0->gridEdge[i], f1->gridEdge[i]);
+        edgeSum += f0->gridEdge[i] + f1->gridEdge[i];
+        meanDiff = X265_MAX(meanDiff, X265_MAX(f0->gridMean[i], f1->gridMean[i]) - X265_MIN(f0->gridMean[i], f1->gridMean[i]));
+    }
+    double edge = edgeSum ? (double)edgeDiff / edgeSum : 0;
+    double mean = (double)meanDiff * numRegions / (f0->histCount[0] * (double)((1 << X265_DEPTH) - 1));
+
+    if (luma < 0.05 && chroma < 0.05 && edge < 0.08 && mean < 0.03)
+        return -1;
+    if (luma > 0.5 && edge > 0.25)
+        return 1;
+    return 0;
+}
+
+/* The best path of each length is the best path of a shorter length followed
+ * by one mini-GOP, so the cost of a candidate path is the cost of that best
+ * path plus the cost of the trailing mini-GOP. */
+void Lookahead::slicetypePath(Lowres **frames, int length, char(*best_paths)[X265_LOOKAHEAD_MAX + 1], int64_t *best_costs)
 {
     char paths[2][X265_LOOKAHEAD_MAX + 1];
     int num_paths = X265_MIN(m_param->bframes + 1, length);
@@ -1469,12 +1793,16 @@ void Lookahead::slicetypePath(Lowres **frames, int length, char(*best_paths)[X26
     {
         /* Add suffixes to the current path */
         int len = length - (path + 1);
+        int64_t prefixCost = best_costs[len % (X265_BFRAME_MAX + 1)];
+        if (prefixCost >= best_cost)
+            continue;
+
         memcpy(paths[idx], best_paths[len % (X265_BFRAME_MAX + 1)], len);
         memset(paths[idx] + len, 'B', path);
         strcpy(paths[idx] + len + path, "P");
 
         /* Calculate the actual cost of the current path */
-        int64_t cost = slicetypePathCost(frames, paths[idx], best_cost);
+        int64_t cost = prefixCost + miniGopCost(frames, len, length, best_cost - prefixCost);
         if (cost < best_cost)
         {
             best_cost = cost;
@@ -1484,6 +1812,7 @@ void Lookahead::slicetypePath(Lowres **frames, int length, char(*best_paths)[X26
 
     /* Store the best path. */
     memcpy(best_paths[length % (X265_BFRAME_MAX + 1)], paths[idx ^ 1], length);
+    best_costs[length % (X265_BFRAME_MAX + 1)] = best_cost;
 }
 
 int64_t Lookahead::slicetypePathCost(Lowres **frames, char *path, int64_t threshold)
@@ -1492,8 +1821,6 @@ int64_t Lookahead::slicetypePathCost(Lowres **frames, char *path, int64_t thresh
     int loc = 1;
     int cur_p = 0;
 
-    CostEstimateGroup estGroup(*this, frames);
-
     path--; /* Since the 1st path element is really the second frame */
     while (path[loc])
     {
@@ -1502,30 +1829,12 @@ int64_t Lookahead::slicetypePathCost(Lowres **frames, char *path, int64_t thresh
         while (path[next_p] != 'P')
             next_p++;
 
-        /* Add the cost of the P-frame found above */
-        cost += estGroup.singleCost(cur_p, next_p, next_p);
+        cost += miniGopCost(frames, cur_p, next_p, threshold - cost);
 
         /* Early terminate if the cost we have found is larger than the best path cost so far */
         if (cost > threshold)
             break;
 
-        if (m_param->bBPyramid && next_p - cur_p > 2)
-        {
-            int middle = cur_p + (next_p - cur_p) / 2;
-            cost += estGroup.singleCost(cur_p, next_p, middle);
-
-            for (int next_b = loc; next_b < middle && cost < threshold; next_b++)
-                cost += estGroup.singleCost(cur_p, middle, next_b);
-
-            for (int next_b = middle + 1; next_b < next_p && cost < threshold; next_b++)
-                cost += estGroup.singleCost(middle, next_p, next_b);
-        }
-        else
-        {
-            for (int next_b = loc; next_b < next_p && cost < threshold; next_b++)
-                cost += estGroup.singleCost(cur_p, next_p, next_b);
-        }
-
         loc = next_p + 1;
         cur_p = next_p;
     }
@@ -1533,13 +1842,65 @@ int64_t Lookahead::slicetypePathCost(Lowres **frames, char *path, int64_t thresh
     return cost;
 }
 
-void Lookahead::cuTree(Lowres **frames, int numframes, bool bIntra)
+/* Cost of the P frame p1 and the B frames between p0 and p1. The estimate
+ * stops early, and is not kept, once it exceeds the threshold */
+int64_t Lookahead::miniGopCost(Lowres **frames, int p0, int p1, int64_t threshold)
 {
-    int idx = !bIntra;
-    int lastnonb, curnonb = 1;
-    int bframes = 0;
+    MiniGopCost& memo = m_miniGopCost[frames[p0]->frameNum % (X265_LOOKAHEAD_MAX + 1)];
+    if (memo.frameNum == frames[p0]->frameNum && memo.cost[p1 - p0 - 1] >= 0)
+        return memo.cost[p1 - p0 - 1];
 
-    x265_emms();
+    CostEstimateGroup estGroup(*this, frames);
+
+    /* Add the cost of the P-frame */
+    int64_t cost = estGroup.singleCost(p0, p1, p1);
+    if (cost > threshold)
+        return cost;
+
+    int b;
+    if (m_param->bBPyramid && p1 - p0 > 2)
+    {
+        int middle = p0 + (p1 - p0) / 2;
+        cost += estGroup.singleCost(p0, p1, middle);
+
+        for (b = p0 + 1; b < middle && cost < threshold; b++)
+            cost += estGroup.singleCost(p0, middle, b);
+        if (b < middle)
+            return cost;
+
+        for (b = middle + 1; b < p1 && cost < threshold; b++)
+            cost += estGroup.singleCost(middle, p1, b);
+    }
+    else
+    {
+        for (b = p0 + 1; b < p1 && cost < threshold; b++)
+            cost += estGroup.singleCost(p0, p1, b);
+    }
+    if (b < p1)
+        return cost;
+
+    if (memo.frameNum != frames[p0]->frameNum)
+    {
+        memo.frameNum = frames[p0]->frameNum;
+        memset(memo.cost, -1, sizeof(memo.cost));
+    }
+    memo.cost[p1 - p0 - 1] = cost;
+    return cost;
+}
+
+void Lookahead::resetMiniGopCosts()
+{
+    for (int i = 0; i <= X265_LOOKAHEAD_MAX; i++)
+        m_miniGopCost[i].frameNum = -1;
+}
+
+void Lookahead::cuTree(Lowres **frames, int numframes, bool bIntra)
+{
+    int idx = !bIntra;
+    int lastnonb, curnonb = 1;
+    int bframes = 0;
+
+    x265_emms();
     double totalDuration = 0.0;
     for (int j = 0; j <= numframes; j++)
         totalDuration += (double)m_param->fpsDenom / m_param->fpsNum;
@@ -1549,6 +1910,13 @@ void Lookahead::cuTree(Lowres **frames, int numframes, bool bIntra)
     int i = numframes;
     int cuCount = m_8x8Width * m_8x8Height;
 
+    /* no propagation is needed when the application fixed every offset */
+    bool bAllFinal = true;
+    for (int j = 0; j <= numframes && bAllFinal; j++)
+        bAllFinal = frames[j]->bFinalQpOffsets;
+    if (bAllFinal)
+        return;
+
     while (i > 0 && frames[i]->sliceType == X265_TYPE_B)
         i--;
 
@@ -1636,129 +2004,175 @@ void Lookahead::cuTree(Lowres **frames, int numframes, bool bIntra)
 
 void Lookahead::estimateCUPropagate(Lowres **frames, double averageDuration, int p0, int p1, int b, int referenced)
 {
-    uint16_t *refCosts[2] = { frames[p0]->propagateCost, frames[p1]->propagateCost };
-    int32_t distScaleFactor = (((b - p0) << 8) + ((p1 - p0) >> 1)) / (p1 - p0);
-    int32_t bipredWeight = m_param->bEnableWeightedBiPred ? 64 - (distScaleFactor >> 2) : 32;
-    int32_t bipredWeights[2] = { bipredWeight, 64 - bipredWeight };
-    int listDist[2] = { b - p0 - 1, p1 - b - 1 };
+    CuTreeGroup group(*this, frames);
+    group.propagate(averageDuration, p0, p1, b, !!referenced);
 
-    memset(m_scratch, 0, m_8x8Width * sizeof(int));
+    if (m_param->rc.vbvBufferSize && m_param->lookaheadDepth && referenced)
+        cuTreeFinish(frames[b], averageDuration, b == p1 ? b - p0 : 0);
+}
 
-    uint16_t *propagateCost = frames[b]->propagateCost;
+void Lookahead::cuTreeFinish(Lowres *frame, double averageDuration, int ref0Distance)
+{
+    if (frame->bFinalQpOffsets)
+        return;
+
+    int fpsFactor = (int)(CLIP_DURATION(averageDuration) / CLIP_DURATION((double)m_param->fpsDenom / m_param->fpsNum) * 256);
+    double weightdelta = 0.0;
+
+    if (ref0Distance && frame->weightedCostDelta[ref0Distance - 1] > 0)
+        weightdelta = (1.0 - frame->weightedCostDelta[ref0Distance - 1]);
+
+    /* Allow the strength to be adjusted via qcompress, since the two concepts
+     * are very similar. */
+
+    int cuCount = m_8x8Width * m_8x8Height;
+    double strength = 5.0 * (1.0 - m_param->rc.qCompress);
+
+    primitives.cuTreeFinish(frame->qpCuTreeOffset, frame->qpAqOffset, frame->intraCost, frame->invQscaleFactor,
+                            frame->propagateCost, fpsFactor, &strength, &weightdelta, cuCount);
+}
+
+void CuTreeGroup::propagate(double averageDuration, int p0, int p1, int b, bool referenced)
+{
+    x265_param* param = m_lookahead.m_param;
+    int widthInCU = m_lookahead.m_8x8Width;
+    int heightInCU = m_lookahead.m_8x8Height;
+
+    int32_t distScaleFactor = (((b - p0) << 8) + ((p1 - p0) >> 1)) / (p1 - p0);
+    m_bipredWeight = param->bEnableWeightedBiPred ? 64 - (distScaleFactor >> 2) : 32;
+    m_p0 = p0;
+    m_p1 = p1;
+    m_b = b;
+    m_referenced = referenced;
 
     x265_emms();
-    double fpsFactor = CLIP_DURATION((double)m_param->fpsDenom / m_param->fpsNum) / CLIP_DURATION(averageDuration);
+    m_fpsFactor = CLIP_DURATION((double)param->fpsDenom / param->fpsNum) / CLIP_DURATION(averageDuration);
 
     /* For non-referred frames the source costs are always zero, so just memset one row and re-use it. */
     if (!referenced)
-        memset(frames[b]->propagateCost, 0, m_8x8Width * sizeof(uint16_t));
+        memset(m_frames[b]->propagateCost, 0, widthInCU * sizeof(uint16_t));
 
-    int32_t strideInCU = m_8x8Width;
-    for (uint16_t blocky = 0; blocky < m_8x8Height; blocky++)
+    /* A band writes the rows of the references its MVs point into, at most
+     * maxOffset rows above or below the band. Bands at least twice that high
+     * can't collide with the next band but one. */
+    int maxOffset = 0;
+    if (m_lookahead.m_pool && heightInCU >= 4 * MIN_BAND_HEIGHT)
     {
-        int cuIndex = blocky * strideInCU;
-        primitives.propagateCost(m_scratch, propagateCost,
-                                 frames[b]->intraCost + cuIndex, frames[b]->lowresCosts[b - p0][p1 - b] + cuIndex,
-                                 frames[b]->invQscaleFactor + cuIndex, &fpsFactor, m_8x8Width);
-
-        if (referenced)
-            propagateCost += m_8x8Width;
-
-        for (uint16_t blockx = 0; blockx < m_8x8Width; blockx++, cuIndex++)
+        int cuCount = widthInCU * heightInCU;
+        const MV* mvs[2] = { b > p0 ? m_frames[b]->lowresMvs[0][b - p0 - 1] : NULL,
+                             p1 > b ? m_frames[b]->lowresMvs[1][p1 - b - 1] : NULL };
+        for (int list = 0; list < 2; list++)
         {
-            int32_t propagate_amount = m_scratch[blockx];
-            /* Don't propagate for an intra block. */
-            if (propagate_amount > 0)
-            {
-                /* Access width-2 bitfield. */
-                int32_t lists_used = frames[b]->lowresCosts[b - p0][p1 - b][cuIndex] >> LOWRES_COST_SHIFT;
-                /* Follow the MVs to the previous frame(s). */
-                for (uint16_t list = 0; list < 2; list++)
-                {
-                    if ((lists_used >> list) & 1)
-                    {
-#define CLIP_ADD(s, x) (s) = (uint16_t)X265_MIN((s) + (x), (1 << 16) - 1)
-                        int32_t listamount = propagate_amount;
-                        /* Apply bipred weighting. */
-                        if (lists_used == 3)
-                            listamount = (listamount * bipredWeights[list] + 32) >> 6;
-
-                        MV *mvs = frames[b]->lowresMvs[list][listDist[list]];
-
-                        /* Early termination for simple case of mv0. */
-                        if (!mvs[cuIndex].word)
-                        {
-                            CLIP_ADD(refCosts[list][cuIndex], listamount);
-                            continue;
-                        }
-
-                        int32_t x = mvs[cuIndex].x;
-                        int32_t y = mvs[cuIndex].y;
-                        int32_t cux = (x >> 5) + blockx;
-                        int32_t cuy = (y >> 5) + blocky;
-                        int32_t idx0 = cux + cuy * strideInCU;
-                        int32_t idx1 = idx0 + 1;
-                        int32_t idx2 = idx0 + strideInCU;
-                        int32_t idx3 = idx0 + strideInCU + 1;
-                        x &= 31;
-                        y &= 31;
-                        int32_t idx0weight = (32 - y) * (32 - x);
-                        int32_t idx1weight = (32 - y) * x;
-                        int32_t idx2weight = y * (32 - x);
-                        int32_t idx3weight = y * x;
-
-                        /* We could just clip the MVs, but pixels that lie outside the frame probably shouldn't
-                         * be counted. */
-                        if (cux < m_8x8Width - 1 && cuy < m_8x8Height - 1 && cux >= 0 && cuy >= 0)
-                        {
-                            CLIP_ADD(refCosts[list][idx0], (listamount * idx0weight + 512) >> 10);
-                            CLIP_ADD(refCosts[list][idx1], (listamount * idx1weight + 512) >> 10);
-                            CLIP_ADD(refCosts[list][idx2], (listamount * idx2weight + 512) >> 10);
-                            CLIP_ADD(refCosts[list][idx3], (listamount * idx3weight + 512) >> 10);
-                        }
-                        else /* Check offsets individually */
-                        {
-                            if (cux < m_8x8Width && cuy < m_8x8Height && cux >= 0 && cuy >= 0)
-                                CLIP_ADD(refCosts[list][idx0], (listamount * idx0weight + 512) >> 10);
-                            if (cux + 1 < m_8x8Width && cuy < m_8x8Height && cux + 1 >= 0 && cuy >= 0)
-                                CLIP_ADD(refCosts[list][idx1], (listamount * idx1weight + 512) >> 10);
-                            if (cux < m_8x8Width && cuy + 1 < m_8x8Height && cux >= 0 && cuy + 1 >= 0)
-                                CLIP_ADD(refCosts[list][idx2], (listamount * idx2weight + 512) >> 10);
-                            if (cux + 1 < m_8x8Width && cuy + 1 < m_8x8Height && cux + 1 >= 0 && cuy + 1 >= 0)
-                                CLIP_ADD(refCosts[list][idx3], (listamount * idx3weight + 512) >> 10);
-                        }
-                    }
-                }
-            }
+            if (!mvs[list])
+                continue;
+            for (int i = 0; i < cuCount; i++)
+                maxOffset = X265_MAX(maxOffset, abs(mvs[list][i].y >> 5));
         }
+        m_bandHeight = X265_MAX(2 * (maxOffset + 1), MIN_BAND_HEIGHT);
     }
+    else
+        m_bandHeight = heightInCU;
 
-    if (m_param->rc.vbvBufferSize && m_param->lookaheadDepth && referenced)
-        cuTreeFinish(frames[b], averageDuration, b == p1 ? b - p0 : 0);
+    int numBands = (heightInCU + m_bandHeight - 1) / m_bandHeight;
+    if (numBands < 4)
+    {
+        int tldIdx = m_lookahead.m_pool ? m_lookahead.m_pool->m_numWorkers : 0;
+        propagateRows(m_lookahead.m_tld[tldIdx], 0, heightInCU);
+        return;
+    }
+
+    for (m_parity = 0; m_parity < 2; m_parity++)
+    {
+        m_jobTotal = (numBands + 1 - m_parity) / 2;
+        m_jobAcquired = 0;
+        tryBondPeers(*m_lookahead.m_pool, m_jobTotal - 1);
+        processTasks(-1);
+        waitForExit();
+    }
 }
 
-void Lookahead::cuTreeFinish(Lowres *frame, double averageDuration, int ref0Distance)
+void CuTreeGroup::processTasks(int workerThreadID)
 {
-    int fpsFactor = (int)(CLIP_DURATION(averageDuration) / CLIP_DURATION((double)m_param->fpsDenom / m_param->fpsNum) * 256);
-    double weightdelta = 0.0;
+    if (workerThreadID < 0)
+        workerThreadID = m_lookahead.m_pool ? m_lookahead.m_pool->m_numWorkers : 0;
+    LookaheadTLD& tld = m_lookahead.m_tld[workerThreadID];
 
-    if (ref0Distance && frame->weightedCostDelta[ref0Distance - 1] > 0)
-        weightdelta = (1.0 - frame->weightedCostDelta[ref0Distance - 1]);
+    m_lock.acquire();
+    while (m_jobAcquired < m_jobTotal)
+    {
+        int band = 2 * m_jobAcquired++ + m_parity;
+        m_lock.release();
 
-    /* Allow the strength to be adjusted via qcompress, since the two concepts
-     * are very similar. */
+        int rowStart = band * m_bandHeight;
+        propagateRows(tld, rowStart, X265_MIN(rowStart + m_bandHeight, m_lookahead.m_8x8Height));
 
-    int cuCount = m_8x8Width * m_8x8Height;
-    double strength = 5.0 * (1.0 - m_param->rc.qCompress);
+        m_lock.acquire();
+    }
+    m_lock.release();
+}
 
-    for (int cuIndex = 0; cuIndex < cuCount; cuIndex++)
+void CuTreeGroup::propagateRows(LookaheadTLD& tld, int rowStart, int rowEnd)
+{
+    Lowres* fenc = m_frames[m_b];
+    uint16_t *refCosts[2] = { m_frames[m_p0]->propagateCost, m_frames[m_p1]->propagateCost };
+    int listDist[2] = { m_b - m_p0 - 1, m_p1 - m_b - 1 };
+    int32_t bipredWeights[2] = { m_bipredWeight, 64 - m_bipredWeight };
+    uint16_t* lowresCosts = fenc->lowresCosts[m_b - m_p0][m_p1 - m_b];
+    int widthInCU = m_lookahead.m_8x8Width;
+    int heightInCU = m_lookahead.m_8x8Height;
+
+    for (int blocky = rowStart; blocky < rowEnd; blocky++)
     {
-        int intracost = (frame->intraCost[cuIndex] * frame->invQscaleFactor[cuIndex] + 128) >> 8;
-        if (intracost)
+        int cuIndex = blocky * widthInCU;
+        const uint16_t* propagateIn = fenc->propagateCost + (m_referenced ? cuIndex : 0);
+        primitives.propagateCost(tld.propagateAmount, propagateIn, fenc->intraCost + cuIndex, lowresCosts + cuIndex,
+                                 fenc->invQscaleFactor + cuIndex, &m_fpsFactor, widthInCU);
+
+        /* Follow the MVs to the previous frame(s). */
+        for (int list = 0; list < 2; list++)
         {
-            int propagateCost = (frame->propagateCost[cuIndex] * fpsFactor + 128) >> 8;
-            double log2_ratio = X265_LOG2(intracost + propagateCost) - X265_LOG2(intracost) + weightdelta;
-            frame->qpCuTreeOffset[cuIndex] = frame->qpAqOffset[cuIndex] - strength * log2_ratio;
+            /* Intra blocks and blocks not using this list get zero shares. */
+            if ((list ? m_p1 : m_p0) == m_b)
+                continue;
+
+            const MV* mvs = fenc->lowresMvs[list][listDist[list]] + cuIndex;
+            primitives.propagateList(tld.propagateShares, tld.propagateOffsets, tld.propagateAmount, lowresCosts + cuIndex,
+                                     (const int16_t*)mvs, bipredWeights[list], list, widthInCU);
+
+#define CLIP_ADD(s, x) (s) = (uint16_t)X265_MIN((s) + (x), (1 << 16) - 1)
+            uint16_t* ref = refCosts[list];
+            for (int blockx = 0; blockx < widthInCU; blockx++)
+            {
+                const int32_t* shares = tld.propagateShares + 4 * blockx;
+                if (!(shares[0] | shares[1] | shares[2] | shares[3]))
+                    continue;
+
+                int32_t cux = tld.propagateOffsets[2 * blockx] + blockx;
+                int32_t cuy = tld.propagateOffsets[2 * blockx + 1] + blocky;
+                int32_t idx0 = cux + cuy * widthInCU;
+
+                /* We could just clip the MVs, but pixels that lie outside the frame probably shouldn't
+                 * be counted. */
+                if (cux < widthInCU - 1 && cuy < heightInCU - 1 && cux >= 0 && cuy >= 0)
+                {
+                    CLIP_ADD(ref[idx0], shares[0]);
+                    CLIP_ADD(ref[idx0 + 1], shares[1]);
+                    CLIP_ADD(ref[idx0 + widthInCU], shares[2]);
+                    CLIP_ADD(ref[idx0 + widthInCU + 1], shares[3]);
+                }
+                else /* Check offsets individually */
+                {
+                    if (cux < widthInCU && cuy < heightInCU && cux >= 0 && cuy >= 0)
+                        CLIP_ADD(ref[idx0], shares[0]);
+                    if (cux + 1 < widthInCU && cuy < heightInCU && cux + 1 >= 0 && cuy >= 0)
+                        CLIP_ADD(ref[idx0 + 1], shares[1]);
+                    if (cux < widthInCU && cuy + 1 < heightInCU && cux >= 0 && cuy + 1 >= 0)
+                        CLIP_ADD(ref[idx0 + widthInCU], shares[2]);
+                    if (cux + 1 < widthInCU && cuy + 1 < heightInCU && cux + 1 >= 0 && cuy + 1 >= 0)
+                        CLIP_ADD(ref[idx0 + widthInCU + 1], shares[3]);
+                }
+            }
+#undef CLIP_ADD
         }
     }
 }
@@ -1798,33 +2212,241 @@ int64_t Lookahead::frameCostRecalculate(Lowres** frames, int p0, int p1, int b)
 }
 
 
+CostEstimateGroup::CostEstimateGroup(Lookahead& l, Lowres** f) : m_lookahead(l), m_frames(f)
+{
+    m_jobs = m_inlineJobs;
+    m_numJobs = 0;
+    m_maxJobs = INLINE_JOBS;
+    m_readyHead = m_readyTail = -1;
+}
+
+CostEstimateGroup::~CostEstimateGroup()
+{
+    if (m_jobs != m_inlineJobs)
+        X265_FREE(m_jobs);
+}
+
 int64_t CostEstimateGroup::singleCost(int p0, int p1, int b, bool intraPenalty)
 {
-    LookaheadTLD& tld = m_lookahead.m_tld[m_lookahead.m_pool ? m_lookahead.m_pool->m_numWorkers : 0];
-    return estimateFrameCost(tld, p0, p1, b, intraPenalty);
+    Lowres* fenc = m_frames[b];
+
+    if (fenc->costEst[b - p0][p1 - b] < 0 || fenc->rowSatds[b - p0][p1 - b][0] == -1)
+    {
+        add(p0, p1, b);
+        finishBatch();
+    }
+
+    int64_t score = fenc->costEst[b - p0][p1 - b];
+
+    if (intraPenalty)
+        // arbitrary penalty for I-blocks after B-frames
+        score += score * fenc->intraMbs[b - p0] / (m_lookahead.m_8x8Blocks * 8);
+
+    return score;
+}
+
+/* make room for count more jobs; if the job array can't grow, the queued
+ * estimates are completed to free it */
+bool CostEstimateGroup::reserveJobs(int count)
+{
+    if (m_numJobs + count <= m_maxJobs)
+        return true;
+
+    int maxJobs = m_maxJobs * 2;
+    Job* jobs = X265_MALLOC(Job, maxJobs);
+    if (jobs)
+    {
+        memcpy(jobs, m_jobs, sizeof(Job) * m_numJobs);
+        if (m_jobs != m_inlineJobs)
+            X265_FREE(m_jobs);
+        m_jobs = jobs;
+        m_maxJobs = maxJobs;
+        return true;
+    }
+
+    finishBatch();
+    return m_numJobs + count <= m_maxJobs;
+}
+
+int CostEstimateGroup::newJob(JobType type, int p0, int p1, int b)
+{
+    int idx = m_numJobs++;
+    Job& job = m_jobs[idx];
+
+    job.type = type;
+    job.p0 = p0;
+    job.b = b;
+    job.p1 = p1;
+    job.waiting = 0;
+    job.firstDependent = -1;
+    job.nextDependent[0] = job.nextDependent[1] = -1;
+    job.numRanges = type == JOB_WEIGHTS ? 1 : m_lookahead.m_numCoopSlices;
+    job.nextRange = 0;
+    job.rangesDone = 0;
+    job.nextReady = -1;
+    job.wp.bPresentFlag = false;
+    job.wref = NULL;
+    job.costEst = job.costEstAq = 0;
+    job.intraMbs = 0;
+
+    return idx;
+}
+
+void CostEstimateGroup::addDependent(int prereq, int job, int list)
+{
+    m_jobs[job].nextDependent[list] = m_jobs[prereq].firstDependent;
+    m_jobs[prereq].firstDependent = job;
+    m_jobs[job].waiting++;
+}
+
+/* returns the job of the motion search of b against p0 (p1 == b) or p1
+ * (p0 == b), or -1 if lookahead has done it already. Until the search is
+ * done, the first MV of a queued search is 0x7FFE and its first cost is the
+ * index of the job */
+int CostEstimateGroup::addSearch(int p0, int p1, int b)
+{
+    int list = p0 == b;
+    int listDist = list ? p1 - b - 1 : b - p0 - 1;
+    MV* mvs = m_frames[b]->lowresMvs[list][listDist];
+    int32_t* costs = m_frames[b]->lowresMvCosts[list][listDist];
+
+    if (mvs[0].x == 0x7FFE)
+    {
+        X265_CHECK(costs[0] >= 0 && costs[0] < m_numJobs && m_jobs[costs[0]].type == JOB_SEARCH &&
+                   m_jobs[costs[0]].p0 == p0 && m_jobs[costs[0]].p1 == p1, "motion search batch duplication\n");
+        return costs[0];
+    }
+    if (mvs[0].x != 0x7FFF)
+        return -1;
+
+    int search = newJob(JOB_SEARCH, p0, p1, b);
+    mvs[0].x = 0x7FFE;
+    costs[0] = search;
+    if (!list && m_lookahead.m_param->bEnableWeightedPred)
+        addDependent(newJob(JOB_WEIGHTS, p0, p1, b), search, 0);
+
+    return search;
 }
 
 void CostEstimateGroup::add(int p0, int p1, int b)
 {
-    X265_CHECK(m_batchMode || !m_jobTotal, "single CostEstimateGroup instance cannot mix batch modes\n");
-    m_batchMode = true;
+    Lowres* fenc = m_frames[b];
 
-    Estimate& e = m_estimates[m_jobTotal++];
-    e.p0 = p0;
-    e.p1 = p1;
-    e.b = b;
+    X265_CHECK(p0 != b, "I frame estimates should always be pre-calculated\n");
 
-    if (m_jobTotal == MAX_BATCH_SIZE)
-        finishBatch();
+    /* done, or queued already */
+    if (fenc->costEst[b - p0][p1 - b] >= 0)
+        return;
+
+    if (!reserveJobs(4))
+        return;
+
+    int search[2];
+    search[0] = addSearch(p0, b, b);
+    search[1] = p1 > b ? addSearch(b, p1, b) : -1;
+
+    int estimate = newJob(JOB_ESTIMATE, p0, p1, b);
+    for (int list = 0; list < 2; list++)
+    {
+        if (search[list] >= 0)
+            addDependent(search[list], estimate, list);
+    }
+
+    fenc->costEst[b - p0][p1 - b] = 0;
+    fenc->costEstAq[b - p0][p1 - b] = 0;
+}
+
+void CostEstimateGroup::pushReady(int job)
+{
+    if (m_readyTail >= 0)
+        m_jobs[m_readyTail].nextReady = job;
+    else
+        m_readyHead = job;
+    m_readyTail = job;
+}
+
+/* called with m_lock held when the last range of a job is done; returns
+ * true if other jobs became ready */
+bool CostEstimateGroup::completeJob(int idx)
+{
+    Job& job = m_jobs[idx];
+
+    if (job.type == JOB_ESTIMATE)
+    {
+        Lowres* fenc = m_frames[job.b];
+        int p0 = job.p0, p1 = job.p1, b = job.b;
+
+        int64_t score = job.costEst;
+        if (b != p1)
+            score = score * 100 / (130 + m_lookahead.m_param->bFrameBias);
+        else
+            fenc->intraMbs[b - p0] += job.intraMbs;
+
+        fenc->costEst[b - p0][p1 - b] = score;
+        fenc->costEstAq[b - p0][p1 - b] = job.costEstAq;
+        return false;
+    }
+
+    if (job.type == JOB_SEARCH && job.wref)
+    {
+        m_frames[job.p0]->releaseWeighted(job.wref);
+        job.wref = NULL;
+    }
+
+    bool bReady = false;
+    int list = job.p0 == job.b;
+    for (int dep = job.firstDependent; dep >= 0; dep = m_jobs[dep].nextDependent[list])
+    {
+        if (job.type == JOB_WEIGHTS)
+            m_jobs[dep].wref = job.wref;
+        if (!--m_jobs[dep].waiting)
+        {
+            pushReady(dep);
+            bReady = true;
+        }
+    }
+
+    return bReady;
 }
 
 void CostEstimateGroup::finishBatch()
 {
-    if (m_lookahead.m_pool)
-        tryBondPeers(*m_lookahead.m_pool, m_jobTotal);
+    if (!m_numJobs)
+        return;
+
+    /* queue the searches ahead of the estimates, they take longest */
+    bool bParallel = false;
+    int numReady = 0;
+    m_jobTotal = m_jobAcquired = 0;
+    m_readyHead = m_readyTail = -1;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < m_numJobs; i++)
+        {
+            Job& job = m_jobs[i];
+            if ((job.type == JOB_ESTIMATE) != (pass == 1))
+                continue;
+
+            m_jobTotal += job.numRanges;
+            bParallel |= job.type != JOB_ESTIMATE || job.p1 > job.b;
+            if (!job.waiting)
+            {
+                pushReady(i);
+                numReady += job.numRanges;
+            }
+        }
+    }
+
+    /* estimates which only gather the costs of finished searches are not
+     * worth waking workers for */
+    if (m_lookahead.m_pool && bParallel && m_jobTotal > 1)
+        tryBondPeers(*m_lookahead.m_pool, X265_MAX(numReady - 1, 1));
     processTasks(-1);
     waitForExit();
+
+    m_numJobs = 0;
     m_jobTotal = m_jobAcquired = 0;
+    m_readyHead = m_readyTail = -1;
 }
 
 void CostEstimateGroup::processTasks(int workerThreadID)
@@ -1838,143 +2460,166 @@ void CostEstimateGroup::processTasks(int workerThreadID)
     m_lock.acquire();
     while (m_jobAcquired < m_jobTotal)
     {
-        int i = m_jobAcquired++;
-        m_lock.release();
+        if (m_readyHead < 0)
+        {
+            /* the remaining ranges wait for jobs in progress */
+            int readyCount = m_readyCount.get();
+            m_lock.release();
+            m_readyCount.waitForChange(readyCount);
+            m_lock.acquire();
+            continue;
+        }
 
-        if (m_batchMode)
+        int idx = m_readyHead;
+        Job& job = m_jobs[idx];
+        int range = job.nextRange++;
+        if (job.nextRange == job.numRanges)
         {
-            ProfileLookaheadTime(tld.batchElapsedTime, tld.countBatches);
-            ProfileScopeEvent(estCostSingle);
+            m_readyHead = job.nextReady;
+            if (m_readyHead < 0)
+                m_readyTail = -1;
+        }
+        m_jobAcquired++;
+        m_lock.release();
 
-            Estimate& e = m_estimates[i];
-            estimateFrameCost(tld, e.p0, e.p1, e.b, false);
+        int firstY = m_lookahead.m_numRowsPerSlice * range;
+        int lastY = (range == job.numRanges - 1) ? m_lookahead.m_8x8Height - 1 : m_lookahead.m_numRowsPerSlice * (range + 1) - 1;
+
+        if (job.type == JOB_WEIGHTS)
+        {
+            ProfileLookaheadTime(tld.searchElapsedTime, tld.countSearches);
+            tld.weightsAnalyse(*m_frames[job.b], *m_frames[job.p0], job.wp);
+            if (job.wp.bPresentFlag)
+                job.wref = m_frames[job.p0]->acquireWeighted(job.wp);
+        }
+        else if (job.type == JOB_SEARCH)
+        {
+            ProfileLookaheadTime(tld.searchElapsedTime, tld.countSearches);
+            ProfileScopeEvent(estCostSearch);
+            searchRows(tld, job, firstY, lastY);
         }
         else
         {
-            ProfileLookaheadTime(tld.coopSliceElapsedTime, tld.countCoopSlices);
-            ProfileScopeEvent(estCostCoop);
-
-            X265_CHECK(i < MAX_COOP_SLICES, "impossible number of coop slices\n");
-
-            int firstY = m_lookahead.m_numRowsPerSlice * i;
-            int lastY = (i == m_jobTotal - 1) ? m_lookahead.m_8x8Height - 1 : m_lookahead.m_numRowsPerSlice * (i + 1) - 1;
-
-            bool lastRow = true;
-            for (int cuY = lastY; cuY >= firstY; cuY--)
-            {
-                m_frames[m_coop.b]->rowSatds[m_coop.b - m_coop.p0][m_coop.p1 - m_coop.b][cuY] = 0;
-
-                for (int cuX = m_lookahead.m_8x8Width - 1; cuX >= 0; cuX--)
-                    estimateCUCost(tld, cuX, cuY, m_coop.p0, m_coop.p1, m_coop.b, m_coop.bDoSearch, lastRow, i);
-
-                lastRow = false;
-            }
+            ProfileLookaheadTime(tld.estimateElapsedTime, tld.countEstimates);
+            ProfileScopeEvent(estCostRows);
+            estimateRows(tld, job, firstY, lastY);
         }
 
         m_lock.acquire();
+        if (++job.rangesDone == job.numRanges && completeJob(idx))
+            m_readyCount.incr();
     }
     m_lock.release();
 }
 
-int64_t CostEstimateGroup::estimateFrameCost(LookaheadTLD& tld, int p0, int p1, int b, bool bIntraPenalty)
+/* motion search of rows firstY to lastY of b against one reference, bottom
+ * row first; the MVs of the neighbours right and below are the candidates */
+void CostEstimateGroup::searchRows(LookaheadTLD& tld, const Job& job, int firstY, int lastY)
 {
-    Lowres*     fenc  = m_frames[b];
-    x265_param* param = m_lookahead.m_param;
-    int64_t     score = 0;
+    Lowres* fenc = m_frames[job.b];
+    int list = job.p0 == job.b;
+    int listDist = list ? job.p1 - job.b - 1 : job.b - job.p0 - 1;
+    Lowres* ref = m_frames[list ? job.p1 : job.p0];
 
-    if (fenc->costEst[b - p0][p1 - b] >= 0 && fenc->rowSatds[b - p0][p1 - b][0] != -1)
-        score = fenc->costEst[b - p0][p1 - b];
-    else
-    {
-        X265_CHECK(p0 != b, "I frame estimates should always be pre-calculated\n");
-
-        bool bDoSearch[2];
-        bDoSearch[0] = p0 < b && fenc->lowresMvs[0][b - p0 - 1][0].x == 0x7FFF;
-        bDoSearch[1] = p1 > b && fenc->lowresMvs[1][p1 - b - 1][0].x == 0x7FFF;
-
-#if CHECKED_BUILD
-        X265_CHECK(!(p0 < b && fenc->lowresMvs[0][b - p0 - 1][0].x == 0x7FFE), "motion search batch duplication L0\n");
-        X265_CHECK(!(p1 > b && fenc->lowresMvs[1][p1 - b - 1][0].x == 0x7FFE), "motion search batch duplication L1\n");
-        if (bDoSearch[0]) fenc->lowresMvs[0][b - p0 - 1][0].x = 0x7FFE;
-        if (bDoSearch[1]) fenc->lowresMvs[1][p1 - b - 1][0].x = 0x7FFE;
-#endif
+    ReferencePlanes* fref = job.wref ? job.wref : ref;
 
-        tld.weightedRef.isWeighted = false;
-        if (param->bEnableWeightedPred && bDoSearch[0])
-            tld.weightsAnalyse(*m_frames[b], *m_frames[p0]);
+    const int widthInCU = m_lookahead.m_8x8Width;
+    const int heightInCU = m_lookahead.m_8x8Height;
+    const int cuSize = X265_LOWRES_CU_SIZE;
+    const MV* coarseMVs = fenc->coarse && fenc->coarse->lowresMvs[list][listDist][0].x != 0x7FFF ? fenc->coarse->lowresMvs[list][listDist] : NULL;
 
-        fenc->costEst[b - p0][p1 - b] = 0;
-        fenc->costEstAq[b - p0][p1 - b] = 0;
+    for (int cuY = lastY; cuY >= firstY; cuY--)
+    {
+        bool lastRow = cuY == lastY;
 
-        if (!m_batchMode && m_lookahead.m_numCoopSlices > 1 && ((p1 > b) || bDoSearch[0] || bDoSearch[1]))
+        for (int cuX = widthInCU - 1; cuX >= 0; cuX--)
         {
-            /* Use cooperative mode if a thread pool is available and the cost estimate is
-             * going to need motion searches or bidir measurements */
-
-            memset(&m_slice, 0, sizeof(Slice) * m_lookahead.m_numCoopSlices);
-
-            m_lock.acquire();
-            X265_CHECK(!m_batchMode, "single CostEstimateGroup instance cannot mix batch modes\n");
-            m_coop.p0 = p0;
-            m_coop.p1 = p1;
-            m_coop.b = b;
-            m_coop.bDoSearch[0] = bDoSearch[0];
-            m_coop.bDoSearch[1] = bDoSearch[1];
-            m_jobTotal = m_lookahead.m_numCoopSlices;
-            m_jobAcquired = 0;
-            m_lock.release();
-
-            tryBondPeers(*m_lookahead.m_pool, m_jobTotal);
+            const int cuXY = cuX + cuY * widthInCU;
+            const intptr_t pelOffset = cuSize * cuX + cuSize * cuY * fenc->lumaStride;
+            tld.me.setSourcePU(fenc->lowresPlane[0], fenc->lumaStride, pelOffset, cuSize, cuSize);
 
-            processTasks(-1);
+            // establish search bounds that don't cross extended frame boundaries
+            MV mvmin, mvmax;
+            mvmin.x = (int16_t)(-cuX * cuSize - 8);
+            mvmin.y = (int16_t)(-cuY * cuSize - 8);
+            mvmax.x = (int16_t)((widthInCU - cuX - 1) * cuSize + 8);
+            mvmax.y = (int16_t)((heightInCU - cuY - 1) * cuSize + 8);
 
-            waitForExit();
+            int numc = 0;
+            MV mvc[5], mvp;
+            MV* fencMV = &fenc->lowresMvs[list][listDist][cuXY];
 
-            for (int i = 0; i < m_lookahead.m_numCoopSlices; i++)
+            /* Reverse-order MV prediction */
+#define MVC(mv) mvc[numc++] = mv;
+            if (cuX < widthInCU - 1)
+                MVC(fencMV[1]);
+            if (!lastRow)
             {
-                fenc->costEst[b - p0][p1 - b] += m_slice[i].costEst;
-                fenc->costEstAq[b - p0][p1 - b] += m_slice[i].costEstAq;
-                if (p1 == b)
-                    fenc->intraMbs[b - p0] += m_slice[i].intraMbs;
+                MVC(fencMV[widthInCU]);
+                if (cuX > 0)
+                    MVC(fencMV[widthInCU - 1]);
+                if (cuX < widthInCU - 1)
+                    MVC(fencMV[widthInCU + 1]);
             }
-        }
-        else
-        {
-            bool lastRow = true;
-            for (int cuY = m_lookahead.m_8x8Height - 1; cuY >= 0; cuY--)
+            if (coarseMVs)
             {
-                fenc->rowSatds[b - p0][p1 - b][cuY] = 0;
+                /* collocated quarter resolution vector, at half resolution scale */
+                MVC(coarseMVs[(cuX >> 1) + (cuY >> 1) * fenc->coarse->maxBlocksInRow] << 1);
+            }
+#undef MVC
 
-                for (int cuX = m_lookahead.m_8x8Width - 1; cuX >= 0; cuX--)
-                    estimateCUCost(tld, cuX, cuY, p0, p1, b, bDoSearch, lastRow, -1);
+            if (!numc)
+                mvp = 0;
+            else
+            {
+                ALIGN_VAR_32(pixel, subpelbuf[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
+                int mvpcost = MotionEstimate::COST_MAX;
 
-                lastRow = false;
+                /* measure SATD cost of each neighbor MV (estimating merge analysis)
+                 * and use the lowest cost MV as MVP (estimating AMVP). Since all
+                 * mvc[] candidates are measured here, none are passed to motionEstimate */
+                for (int idx = 0; idx < numc; idx++)
+                {
+                    intptr_t stride = X265_LOWRES_CU_SIZE;
+                    pixel *src = fref->lowresMC(pelOffset, mvc[idx], subpelbuf, stride);
+                    int cost = tld.me.bufSATD(src, stride);
+                    COPY2_IF_LT(mvpcost, cost, mvp, mvc[idx]);
+                }
             }
+
+            /* ME will never return a cost larger than the cost @MVP, so we do not
+             * have to check that ME cost is more than the estimated merge cost */
+            fenc->lowresMvCosts[list][listDist][cuXY] = tld.me.motionEstimate(fref, mvmin, mvmax, mvp, 0, NULL, s_merange, *fencMV);
         }
+    }
+}
 
-        score = fenc->costEst[b - p0][p1 - b];
+void CostEstimateGroup::estimateRows(LookaheadTLD& tld, Job& job, int firstY, int lastY)
+{
+    Lowres* fenc = m_frames[job.b];
+    int64_t costEst = 0, costEstAq = 0;
+    int intraMbs = 0;
 
-        if (b != p1)
-            score = score * 100 / (130 + param->bFrameBias);
+    for (int cuY = lastY; cuY >= firstY; cuY--)
+    {
+        fenc->rowSatds[job.b - job.p0][job.p1 - job.b][cuY] = 0;
 
-        fenc->costEst[b - p0][p1 - b] = score;
+        for (int cuX = m_lookahead.m_8x8Width - 1; cuX >= 0; cuX--)
+            estimateCUCost(tld, cuX, cuY, job.p0, job.p1, job.b, costEst, costEstAq, intraMbs);
     }
 
-    if (bIntraPenalty)
-        // arbitrary penalty for I-blocks after B-frames
-        score += score * fenc->intraMbs[b - p0] / (tld.ncu * 8);
-
-    return score;
+    ScopedLock lock(m_lock);
+    job.costEst += costEst;
+    job.costEstAq += costEstAq;
+    job.intraMbs += intraMbs;
 }
 
-void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, int slice)
+void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int p0, int p1, int b, int64_t& costEst, int64_t& costEstAq, int& intraMbs)
 {
     Lowres *fref0 = m_frames[p0];
     Lowres *fref1 = m_frames[p1];
     Lowres *fenc  = m_frames[b];
 
-    ReferencePlanes *wfref0 = tld.weightedRef.isWeighted ? &tld.weightedRef : fref0;
-
     const int widthInCU = m_lookahead.m_8x8Width;
     const int heightInCU = m_lookahead.m_8x8Height;
     const int bBidir = (b < p1);
@@ -1982,76 +2627,19 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
     const int cuSize = X265_LOWRES_CU_SIZE;
     const intptr_t pelOffset = cuSize * cuX + cuSize * cuY * fenc->lumaStride;
 
-    if (bBidir || bDoSearch[0] || bDoSearch[1])
+    if (bBidir)
         tld.me.setSourcePU(fenc->lowresPlane[0], fenc->lumaStride, pelOffset, cuSize, cuSize);
 
     /* A small, arbitrary bias to avoid VBV problems caused by zero-residual lookahead blocks. */
     int lowresPenalty = 4;
     int listDist[2] = { b - p0 - 1, p1 - b - 1 };
 
-    MV mvmin, mvmax;
     int bcost = tld.me.COST_MAX;
     int listused = 0;
 
-    // establish search bounds that don't cross extended frame boundaries
-    mvmin.x = (int16_t)(-cuX * cuSize - 8);
-    mvmin.y = (int16_t)(-cuY * cuSize - 8);
-    mvmax.x = (int16_t)((widthInCU - cuX - 1) * cuSize + 8);
-    mvmax.y = (int16_t)((heightInCU - cuY - 1) * cuSize + 8);
-
+    /* the motion searches of both lists are done */
     for (int i = 0; i < 1 + bBidir; i++)
-    {
-        int& fencCost = fenc->lowresMvCosts[i][listDist[i]][cuXY];
-
-        if (!bDoSearch[i])
-        {
-            COPY2_IF_LT(bcost, fencCost, listused, i + 1);
-            continue;
-        }
-
-        int numc = 0;
-        MV mvc[4], mvp;
-        MV* fencMV = &fenc->lowresMvs[i][listDist[i]][cuXY];
-        ReferencePlanes* fref = i ? fref1 : wfref0;
-
-        /* Reverse-order MV prediction */
-#define MVC(mv) mvc[numc++] = mv;
-        if (cuX < widthInCU - 1)
-            MVC(fencMV[1]);
-        if (!lastRow)
-        {
-            MVC(fencMV[widthInCU]);
-            if (cuX > 0)
-                MVC(fencMV[widthInCU - 1]);
-            if (cuX < widthInCU - 1)
-                MVC(fencMV[widthInCU + 1]);
-        }
-#undef MVC
-
-        if (!numc)
-            mvp = 0;
-        else
-        {
-            ALIGN_VAR_32(pixel, subpelbuf[X265_LOWRES_CU_SIZE * X265_LOWRES_CU_SIZE]);
-            int mvpcost = MotionEstimate::COST_MAX;
-
-            /* measure SATD cost of each neighbor MV (estimating merge analysis)
-             * and use the lowest cost MV as MVP (estimating AMVP). Since all
-             * mvc[] candidates are measured here, none are passed to motionEstimate */
-            for (int idx = 0; idx < numc; idx++)
-            {
-                intptr_t stride = X265_LOWRES_CU_SIZE;
-                pixel *src = fref->lowresMC(pelOffset, mvc[idx], subpelbuf, stride);
-                int cost = tld.me.bufSATD(src, stride);
-                COPY2_IF_LT(mvpcost, cost, mvp, mvc[idx]);
-            }
-        }
-
-        /* ME will never return a cost larger than the cost @MVP, so we do not
-         * have to check that ME cost is more than the estimated merge cost */
-        fencCost = tld.me.motionEstimate(fref, mvmin, mvmax, mvp, 0, NULL, s_merange, *fencMV);
-        COPY2_IF_LT(bcost, fencCost, listused, i + 1);
-    }
+        COPY2_IF_LT(bcost, fenc->lowresMvCosts[i][listDist[i]][cuXY], listused, i + 1);
 
     if (bBidir) /* B, also consider bidir */
     {
@@ -2097,20 +2685,10 @@ void CostEstimateGroup::estimateCUCost(LookaheadTLD& tld, int cuX, int cuY, int
 
     if (bFrameScoreCU)
     {
-        if (slice < 0)
-        {
-            fenc->costEst[b - p0][p1 - b] += bcost;
-            fenc->costEstAq[b - p0][p1 - b] += bcostAq;
-            if (!listused && !bBidir)
-                fenc->intraMbs[b - p0]++;
-        }
-        else
-        {
-            m_slice[slice].costEst += bcost;
-            m_slice[slice].costEstAq += bcostAq;
-            if (!listused && !bBidir)
-                m_slice[slice].intraMbs++;
-        }
+        costEst += bcost;
+        costEstAq += bcostAq;
+        if (!listused && !bBidir)
+            intraMbs++;
     }
 
     fenc->rowSatds[b - p0][p1 - b][cuY] += bcostAq;
@@ -44,55 +44,68 @@ class Lookahead;
 struct LookaheadTLD
 {
     MotionEstimate  me;
-    ReferencePlanes weightedRef;
-    pixel*          wbuffer[4];
+    pixel*          wbuffer;         // luma plane weighted by trial weights
+    int32_t*        propagateAmount; // one row of cu-tree propagate amounts
+    int32_t*        propagateShares; // one row of propagate amounts split by MV
+    int16_t*        propagateOffsets;
     int             widthInCU;
     int             heightInCU;
     int             ncu;
     int             paddedLines;
 
 #if DETAILED_CU_STATS
-    int64_t         batchElapsedTime;
-    int64_t         coopSliceElapsedTime;
-    uint64_t        countBatches;
-    uint64_t        countCoopSlices;
+    int64_t         searchElapsedTime;
+    int64_t         estimateElapsedTime;
+    uint64_t        countSearches;
+    uint64_t        countEstimates;
 #endif
 
     LookaheadTLD()
     {
         me.setQP(X265_LOOKAHEAD_QP);
         me.init(X265_HEX_SEARCH, 1, X265_CSP_I400);
-        for (int i = 0; i < 4; i++)
-            wbuffer[i] = NULL;
+        wbuffer = NULL;
+        propagateAmount = propagateShares = NULL;
+        propagateOffsets = NULL;
         widthInCU = heightInCU = ncu = paddedLines = 0;
 
 #if DETAILED_CU_STATS
-        batchElapsedTime = 0;
-        coopSliceElapsedTime = 0;
-        countBatches = 0;
-        countCoopSlices = 0;
+        searchElapsedTime = 0;
+        estimateElapsedTime = 0;
+        countSearches = 0;
+        countEstimates = 0;
 #endif
     }
 
-    void init(int w, int h, int n)
+    bool init(int w, int h, int n)
     {
         widthInCU = w;
         heightInCU = h;
         ncu = n;
+
+        propagateAmount = X265_MALLOC(int32_t, w);
+        propagateShares = X265_MALLOC(int32_t, w * 4);
+        propagateOffsets = X265_MALLOC(int16_t, w * 2);
+        return propagateAmount && propagateShares && propagateOffsets;
     }
 
-    ~LookaheadTLD() { X265_FREE(wbuffer[0]); }
+    ~LookaheadTLD()
+    {
+        X265_FREE(wbuffer);
+        X265_FREE(propagateAmount);
+        X265_FREE(propagateShares);
+        X265_FREE(propagateOffsets);
+    }
 
     void calcAdaptiveQuantFrame(Frame *curFrame, x265_param* param);
     void lowresIntraEstimate(Lowres& fenc);
 
-    void weightsAnalyse(Lowres& fenc, Lowres& ref);
+    void weightsAnalyse(Lowres& fenc, Lowres& ref, WeightParam& wp);
 
 protected:
 
     uint32_t acEnergyCu(Frame* curFrame, uint32_t blockX, uint32_t blockY, int csp);
     uint32_t weightCostLuma(Lowres& fenc, Lowres& ref, WeightParam& wp);
-    bool     allocWeightedRef(Lowres& fenc);
 };
 
 class Lookahead : public JobProvider
@@ -113,12 +126,14 @@ public:
     bool          m_bBatchMotionSearch;
     bool          m_bBatchFrameCosts;
     Event         m_outputSignal;
+    Frame*        m_preNext;         // first input picture not yet claimed for pre-analysis
+    int           m_preInFlight;     // pre-analysis jobs running on worker threads
+    Event         m_preDone;         // triggered as each worker pre-analysis job completes
 
     LookaheadTLD* m_tld;
     x265_param*   m_param;
     Lowres*       m_lastNonB;
-    int*          m_scratch;         // temp buffer for cutree propagate
-    
+
     int           m_histogram[X265_BFRAME_MAX + 1];
     int           m_lastKeyframe;
     int           m_8x8Width;
@@ -127,6 +142,22 @@ public:
     int           m_numCoopSlices;
     int           m_numRowsPerSlice;
     bool          m_filled;
+    Lookahead*    m_coarse;          // quarter resolution estimates, hierarchical lookahead
+
+    /* rc-lookahead and b-adapt of the slice type decisions, reduced by the
+     * deadline mode. The limits are taken by the next slicetypeDecide() */
+    int           m_lookaheadDepth;
+    int           m_bFrameAdaptive;
+    int           m_nextLookaheadDepth;
+    int           m_nextBFrameAdaptive;
+
+    /* B-adapt trellis mini-GOP costs, keyed by the frame number of the leading
+     * P frame so they are reused by the decisions of the following windows */
+    struct MiniGopCost
+    {
+        int           frameNum;
+        int64_t       cost[X265_BFRAME_MAX + 1]; // by distance to the trailing P frame, less one
+    } m_miniGopCost[X265_LOOKAHEAD_MAX + 1];
 
     Lookahead(x265_param *param, ThreadPool *pool);
 
@@ -135,7 +166,7 @@ public:
     int64_t       m_preLookaheadElapsedTime;
     uint64_t      m_countSlicetypeDecide;
     uint64_t      m_countPreLookahead;
-    void          getWorkerStats(int64_t& batchElapsedTime, uint64_t& batchCount, int64_t& coopSliceElapsedTime, uint64_t& coopSliceCount);
+    void          getWorkerStats(int64_t& searchElapsedTime, uint64_t& searchCount, int64_t& estimateElapsedTime, uint64_t& estimateCount);
 #endif
 
     bool    create();
@@ -144,22 +175,31 @@ public:
 
     void    addPicture(Frame&, int sliceType);
     void    flush();
+    void    setDecisionLimits(int lookaheadDepth, int bFrameAdaptive);
     Frame*  getDecidedPicture();
 
     void    getEstimatedPictureCost(Frame *pic);
+    void    estimatePictureCost(Frame *pic, Frame *ref0, Frame *ref1);
 
+    /* downscale, adaptive quant and intra estimate of one input picture */
+    void    preAnalyse(Frame* curFrame, int tldIdx);
 
 protected:
 
     void    findJob(int workerThreadID);
     void    slicetypeDecide();
     void    slicetypeAnalyse(Lowres **frames, bool bKeyframe);
+    void    estimateBatch(Lowres **frames, int numFrames);
+    int     refineMiniGop(Lowres **frames, Lowres **coarse, int numFrames, char *path);
 
     /* called by slicetypeAnalyse() to make slice decisions */
     bool    scenecut(Lowres **frames, int p0, int p1, bool bRealScenecut, int numFrames, int maxSearch);
     bool    scenecutInternal(Lowres **frames, int p0, int p1, bool bRealScenecut);
-    void    slicetypePath(Lowres **frames, int length, char(*best_paths)[X265_LOOKAHEAD_MAX + 1]);
+    int     scenecutHistogram(Lowres *f0, Lowres *f1);
+    void    slicetypePath(Lowres **frames, int length, char(*best_paths)[X265_LOOKAHEAD_MAX + 1], int64_t *best_costs);
     int64_t slicetypePathCost(Lowres **frames, char *path, int64_t threshold);
+    int64_t miniGopCost(Lowres **frames, int p0, int p1, int64_t threshold);
+    void    resetMiniGopCosts();
     int64_t vbvFrameCost(Lowres **frames, int p0, int p1, int b);
     void    vbvLookahead(Lowres **frames, int numFrames, int keyframes);
 
@@ -189,40 +229,54 @@ protected:
     PreLookaheadGroup& operator=(const PreLookaheadGroup&);
 };
 
-class CostEstimateGroup : public BondedTaskGroup
+/* Propagates the cu-tree costs of one frame to its references. Each task is a
+ * band of CU rows; bands of the same parity never write the same rows of the
+ * references, so the even bands and then the odd bands run in parallel */
+class CuTreeGroup : public BondedTaskGroup
 {
 public:
 
     Lookahead& m_lookahead;
     Lowres**   m_frames;
-    bool       m_batchMode;
+    int        m_p0, m_p1, m_b;
+    bool       m_referenced;
+    int32_t    m_bipredWeight;
+    double     m_fpsFactor;
+    int        m_bandHeight;
+    int        m_parity;
 
-    CostEstimateGroup(Lookahead& l, Lowres** f) : m_lookahead(l), m_frames(f), m_batchMode(false) {}
+    enum { MIN_BAND_HEIGHT = 4 };
 
-    /* Cooperative cost estimate using multiple slices of downscaled frame */
-    struct Coop
-    {
-        int  p0, b, p1;
-        bool bDoSearch[2];
-    } m_coop;
+    CuTreeGroup(Lookahead& l, Lowres** f) : m_lookahead(l), m_frames(f) {}
 
-    enum { MAX_COOP_SLICES = 32 };
-    struct Slice
-    {
-        int  costEst;
-        int  costEstAq;
-        int  intraMbs;
-    } m_slice[MAX_COOP_SLICES];
+    void propagate(double averageDuration, int p0, int p1, int b, bool referenced);
 
-    int64_t singleCost(int p0, int p1, int b, bool intraPenalty = false);
+protected:
 
-    /* Batch cost estimates, using one worker thread per estimateFrameCost() call */
-    enum { MAX_BATCH_SIZE = 512 };
-    struct Estimate
-    {
-        int  p0, b, p1;
-    } m_estimates[MAX_BATCH_SIZE];
+    void processTasks(int workerThreadID);
+    void propagateRows(LookaheadTLD& tld, int rowStart, int rowEnd);
+
+    CuTreeGroup& operator=(const CuTreeGroup&);
+};
 
+/* Lowres frame cost estimates as a job graph. Every motion search is a job
+ * shared by all the estimates which need it, an estimate job waits for its
+ * searches, and an L0 search waits for the analysis of the reference weights.
+ * Searches and estimates are split into the row ranges of the lookahead
+ * slices, any worker bonded to the group pulls the next ready range */
+class CostEstimateGroup : public BondedTaskGroup
+{
+public:
+
+    Lookahead& m_lookahead;
+    Lowres**   m_frames;
+
+    CostEstimateGroup(Lookahead& l, Lowres** f);
+    ~CostEstimateGroup();
+
+    int64_t singleCost(int p0, int p1, int b, bool intraPenalty = false);
+
+    /* queue an estimate, finishBatch() runs all queued estimates */
     void add(int p0, int p1, int b);
     void finishBatch();
 
@@ -230,10 +284,49 @@ protected:
 
     static const int s_merange = 16;
 
+    enum JobType { JOB_WEIGHTS, JOB_SEARCH, JOB_ESTIMATE };
+
+    /* A search has p1 == b for L0 or p0 == b for L1 */
+    struct Job
+    {
+        JobType     type;
+        int         p0, b, p1;
+        int         waiting;           // prerequisite jobs not yet completed
+        int         firstDependent;    // first job waiting for this one
+        int         nextDependent[2];  // next job waiting for the same L0 or L1 prerequisite
+        int         numRanges;
+        int         nextRange;         // row ranges handed out
+        int         rangesDone;
+        int         nextReady;         // next job of the ready queue
+        WeightParam wp;                // weights: the analysed weights
+        ReferencePlanes* wref;         // search: the weighted L0 reference, or NULL
+        int64_t     costEst;           // estimate: sums of the completed ranges
+        int64_t     costEstAq;
+        int         intraMbs;
+    };
+
+    enum { INLINE_JOBS = 8 }; // a single estimate needs at most four jobs
+
+    Job               m_inlineJobs[INLINE_JOBS];
+    Job*              m_jobs;
+    int               m_numJobs;
+    int               m_maxJobs;
+    int               m_readyHead;
+    int               m_readyTail;
+    ThreadSafeInteger m_readyCount;   // bumped whenever ranges become ready
+
     void    processTasks(int workerThreadID);
 
-    int64_t estimateFrameCost(LookaheadTLD& tld, int p0, int p1, int b, bool intraPenalty);
-    void    estimateCUCost(LookaheadTLD& tld, int cux, int cuy, int p0, int p1, int b, bool bDoSearch[2], bool lastRow, int slice);
+    bool    reserveJobs(int count);
+    int     newJob(JobType type, int p0, int p1, int b);
+    int     addSearch(int p0, int p1, int b);
+    void    addDependent(int prereq, int job, int list);
+    void    pushReady(int job);
+    bool    completeJob(int job);
+
+    void    searchRows(LookaheadTLD& tld, const Job& job, int firstY, int lastY);
+    void    estimateRows(LookaheadTLD& tld, Job& job, int firstY, int lastY);
+    void    estimateCUCost(LookaheadTLD& tld, int cux, int cuy, int p0, int p1, int b, int64_t& costEst, int64_t& costEstAq, int& intraMbs);
 
     CostEstimateGroup& operator=(const CostEstimateGroup&);
 };
@@ -5,7 +5,7 @@ CPU_EVENT(encodeCTU)
 CPU_EVENT(filterCTURow)
 CPU_EVENT(slicetypeDecideEV)
 CPU_EVENT(prelookahead)
-CPU_EVENT(estCostSingle)
-CPU_EVENT(estCostCoop)
+CPU_EVENT(estCostSearch)
+CPU_EVENT(estCostRows)
 CPU_EVENT(pmode)
 CPU_EVENT(pme)
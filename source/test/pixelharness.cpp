@@ -1236,6 +1236,78 @@ bool PixelHarness::check_cutree_propagate_cost(cutree_propagate_cost ref, cutree
     return true;
 }
 
+bool PixelHarness::check_cutree_propagate_list(cutree_propagate_list_t ref, cutree_propagate_list_t opt)
+{
+    ALIGN_VAR_16(int32_t, ref_shares[64 * 4]);
+    ALIGN_VAR_16(int32_t, opt_shares[64 * 4]);
+    ALIGN_VAR_16(int16_t, ref_offsets[64 * 2]);
+    ALIGN_VAR_16(int16_t, opt_offsets[64 * 2]);
+
+    memset(ref_shares, 0xCD, sizeof(ref_shares));
+    memset(opt_shares, 0xCD, sizeof(opt_shares));
+    memset(ref_offsets, 0xCD, sizeof(ref_offsets));
+    memset(opt_offsets, 0xCD, sizeof(opt_offsets));
+
+    int j = 0;
+
+    for (int i = 0; i < ITERS; i++)
+    {
+        int index = i % TEST_CASES;
+        int width = 1 + rand() % 64;
+        int weight = rand() % 65;
+        int list = rand() & 1;
+        checked(opt, opt_shares, opt_offsets, int_test_buff[index] + j, ushort_test_buff[index] + j, short_test_buff[index] + 2 * j, weight, list, width);
+        ref(ref_shares, ref_offsets, int_test_buff[index] + j, ushort_test_buff[index] + j, short_test_buff[index] + 2 * j, weight, list, width);
+
+        if (memcmp(ref_shares, opt_shares, width * 4 * sizeof(int32_t)) ||
+            memcmp(ref_offsets, opt_offsets, width * 2 * sizeof(int16_t)))
+            return false;
+
+        reportfail();
+        j += INCR;
+    }
+
+    return true;
+}
+
+bool PixelHarness::check_cutree_finish(cutree_finish_t ref, cutree_finish_t opt)
+{
+    ALIGN_VAR_16(double, ref_dest[64]);
+    ALIGN_VAR_16(double, opt_dest[64]);
+    ALIGN_VAR_16(double, aqOffset[64]);
+    ALIGN_VAR_16(int32_t, intraCosts[64]);
+    ALIGN_VAR_16(int32_t, invQscales[64]);
+    ALIGN_VAR_16(uint16_t, propagateCosts[64]);
+
+    for (int i = 0; i < ITERS; i++)
+    {
+        int width = 1 + rand() % 64;
+        for (int k = 0; k < width; k++)
+        {
+            /* some blocks have no intra cost and keep their offset */
+            intraCosts[k] = rand() % 8 ? rand() % 16384 : 0;
+            invQscales[k] = 64 + rand() % 1024;
+            propagateCosts[k] = (uint16_t)(rand() % 65536);
+            aqOffset[k] = (rand() % 2001 - 1000) / 100.0;
+            ref_dest[k] = opt_dest[k] = (rand() % 2001 - 1000) / 100.0;
+        }
+        int fpsFactor = 128 + rand() % 512;
+        double strength = (rand() % 501) / 100.0;
+        double weightDelta = (rand() % 101) / 100.0;
+
+        checked(opt, opt_dest, aqOffset, intraCosts, invQscales, propagateCosts, fpsFactor, &strength, &weightDelta, width);
+        ref(ref_dest, aqOffset, intraCosts, invQscales, propagateCosts, fpsFactor, &strength, &weightDelta, width);
+
+        for (int k = 0; k < width; k++)
+            if (fabs(ref_dest[k] - opt_dest[k]) > 0.00001)
+                return false;
+
+        reportfail();
+    }
+
+    return true;
+}
+
 bool PixelHarness::check_psyCost_pp(pixelcmp_t ref, pixelcmp_t opt)
 {
     int j = 0, index1, index2, optres, refres;
@@ -2139,6 +2211,24 @@ bool PixelHarness::testCorrectness(const EncoderPrimitives& ref, const EncoderPr
         }
     }
 
+    if (opt.propagateList)
+    {
+        if (!check_cutree_propagate_list(ref.propagateList, opt.propagateList))
+        {
+            printf("propagateList failed\n");
+            return false;
+        }
+    }
+
+    if (opt.cuTreeFinish)
+    {
+        if (!check_cutree_finish(ref.cuTreeFinish, opt.cuTreeFinish))
+        {
+            printf("cuTreeFinish failed\n");
+            return false;
+        }
+    }
+
     if (opt.scanPosLast)
     {
         if (!check_scanPosLast(ref.scanPosLast, opt.scanPosLast))
@@ -2564,6 +2654,18 @@ void PixelHarness::measureSpeed(const EncoderPrimitives& ref, const EncoderPrimi
         REPORT_SPEEDUP(opt.propagateCost, ref.propagateCost, ibuf1, ushort_test_buff[0], int_test_buff[0], ushort_test_buff[0], int_test_buff[0], double_test_buff[0], 80);
     }
 
+    if (opt.propagateList)
+    {
+        HEADER0("propagateList");
+        REPORT_SPEEDUP(opt.propagateList, ref.propagateList, ibuf1, sbuf1, int_test_buff[0], ushort_test_buff[0], short_test_buff[0], 40, 0, 80);
+    }
+
+    if (opt.cuTreeFinish)
+    {
+        HEADER0("cuTreeFinish");
+        REPORT_SPEEDUP(opt.cuTreeFinish, ref.cuTreeFinish, double_test_buff[0], double_test_buff[1], int_test_buff[2], int_test_buff[2], ushort_test_buff[0], 256, double_test_buff[2], double_test_buff[2] + 1, 80);
+    }
+
     if (opt.scanPosLast)
     {
         HEADER0("scanPosLast");
@@ -171,7 +171,7 @@ bool CLIOptions::parseCSVFile()
                     fprintf(csvfpt, "RateFactor, ");
                 fprintf(csvfpt, "Y PSNR, U PSNR, V PSNR, YUV PSNR, SSIM, SSIM (dB),  List 0, List 1");
                 /* detailed performance statistics */
-                fprintf(csvfpt, ", DecideWait (ms), Row0Wait (ms), Wall time (ms), Ref Wait Wall (ms), Total CTU time (ms), Stall Time (ms), Avg WPP, Row Blocks\n");
+                fprintf(csvfpt, ", DecideWait (ms), Row0Wait (ms), Wall time (ms), Ref Wait Wall (ms), Total CTU time (ms), Stall Time (ms), Avg WPP, Row Blocks, VBV Restarts\n");
             }
             else
                 fputs(summaryCSVHeader, csvfpt);
@@ -311,7 +311,7 @@ void CLIOptions::writeFrameLog(x265_frame_stats* frameStats)
                 fputs(" -,", csvfpt);
         }
         fprintf(csvfpt, " %.1lf, %.1lf, %.1lf, %.1lf, %.1lf, %.1lf,", frameStats->decideWaitTime, frameStats->row0WaitTime, frameStats->wallTime, frameStats->refWaitWallTime, frameStats->totalCTUTime, frameStats->stallTime);
-        fprintf(csvfpt, " %.3lf, %d", frameStats->avgWPP, frameStats->countRowBlocks);
+        fprintf(csvfpt, " %.3lf, %d, %d", frameStats->avgWPP, frameStats->countRowBlocks, frameStats->countVbvRestarts);
         fprintf(csvfpt, "\n");
         fflush(stderr);
     }
@@ -328,11 +328,11 @@ void CLIOptions::printStatus(uint32_t frameNum)
     int64_t elapsed = time - startTime;
     double fps = elapsed > 0 ? frameNum * 1000000. / elapsed : 0;
     float bitrate = 0.008f * totalbytes * (param->fpsNum / param->fpsDenom) / ((float)frameNum);
-    if (framesToBeEncoded)
+    if (param->totalFrames)
     {
-        int eta = (int)(elapsed * (framesToBeEncoded - frameNum) / ((int64_t)frameNum * 1000000));
+        int eta = (int)(elapsed * (param->totalFrames - frameNum) / ((int64_t)frameNum * 1000000));
         sprintf(buf, "x265 [%.1f%%] %d/%d frames, %.2f fps, %.2f kb/s, eta %d:%02d:%02d",
-                100. * frameNum / framesToBeEncoded, frameNum, framesToBeEncoded, fps, bitrate,
+                100. * frameNum / param->totalFrames, frameNum, param->totalFrames, fps, bitrate,
                 eta / 3600, (eta / 60) % 60, eta % 60);
     }
     else
@@ -527,6 +527,33 @@ bool CLIOptions::parse(int argc, char **argv)
         return true;
     }
 
+    /* the frames following the chunk are not encoded, do not read them */
+    if (param->chunkEnd && (!this->framesToBeEncoded || this->framesToBeEncoded > (uint32_t)param->chunkEnd + 1))
+        this->framesToBeEncoded = param->chunkEnd + 1;
+
+    /* nor the frames preceding it, but for a pre-roll of at most rc-lookahead
+     * frames and one GOP which only passes through the lookahead. A second
+     * pass reads the slice types of the chunk from the stats file and needs
+     * no pre-roll. The chunk is then numbered from the first frame read */
+    if (param->chunkStart > 0)
+    {
+        int preroll = param->rc.bStatRead ? 0 : param->lookaheadDepth;
+        if (param->keyframeMax > 0)
+            preroll = X265_MIN(preroll, param->keyframeMax);
+        uint32_t skip = (uint32_t)X265_MAX(param->chunkStart - preroll, 0);
+        if (this->framesToBeEncoded && this->framesToBeEncoded <= (uint32_t)param->chunkStart)
+        {
+            x265_log(param, X265_LOG_ERROR, "no frames of the chunk are within the frames to be encoded\n");
+            return true;
+        }
+        this->seek += skip;
+        if (this->framesToBeEncoded)
+            this->framesToBeEncoded -= skip;
+        param->chunkStart -= skip;
+        if (param->chunkEnd)
+            param->chunkEnd -= skip;
+    }
+
     InputFileInfo info;
     info.filename = inputfn;
     info.depth = inputBitDepth;
@@ -569,7 +596,8 @@ bool CLIOptions::parse(int argc, char **argv)
         setParamAspectRatio(param, info.sarWidth, info.sarHeight);
     if (this->framesToBeEncoded == 0 && info.frameCount > (int)seek)
         this->framesToBeEncoded = info.frameCount - seek;
-    param->totalFrames = this->framesToBeEncoded;
+    /* the pre-roll preceding a chunk is not encoded */
+    param->totalFrames = this->framesToBeEncoded > (uint32_t)param->chunkStart ? this->framesToBeEncoded - param->chunkStart : 0;
 
     /* Force CFR until we have support for VFR */
     info.timebaseNum = param->fpsDenom;
@@ -599,6 +627,11 @@ bool CLIOptions::parse(int argc, char **argv)
 
     this->input->startReader();
 
+    if (reconfn && param->bLookaheadOnly)
+    {
+        x265_log(param, X265_LOG_WARNING, "--recon ignored, no picture is reconstructed with --lookahead-only\n");
+        reconfn = NULL;
+    }
     if (reconfn)
     {
         if (reconFileBitDepth == 0)
@@ -811,6 +844,10 @@ int main(int argc, char **argv)
             break;
         }
 
+        /* recon files start at the first frame of the chunk, not the pre-roll */
+        if (numEncoded && pic_recon)
+            pic_recon->poc -= param->chunkStart;
+
         if (reconPlay && numEncoded)
             reconPlay->writePicture(*pic_recon);
 
@@ -844,6 +881,9 @@ int main(int argc, char **argv)
             break;
         }
 
+        if (numEncoded && pic_recon)
+            pic_recon->poc -= param->chunkStart;
+
         if (reconPlay && numEncoded)
             reconPlay->writePicture(*pic_recon);
 
@@ -35,6 +35,10 @@ extern "C" {
  *      opaque handler for encoder */
 typedef struct x265_encoder x265_encoder;
 
+/* x265_ladder:
+ *      opaque handler for a ladder of encoders sharing one input */
+typedef struct x265_ladder x265_ladder;
+
 /* Application developers planning to link against a shared library version of
  * libx265 from a Microsoft Visual Studio or similar development environment
  * will need to define X265_API_IMPORTS before including this header.
@@ -121,6 +125,7 @@ typedef struct x265_frame_stats
     int              encoderOrder;
     int              poc;
     int              countRowBlocks;
+    int              countVbvRestarts;
     int              list0POC[16];
     int              list1POC[16];
     char             sliceType;
@@ -190,6 +195,25 @@ typedef struct x265_picture
     /* Frame level statistics */
     x265_frame_stats frameData;
 
+    /* Optional map of QP offsets for this picture, one per 16x16 block in
+     * raster order: (sourceWidth + 15) / 16 offsets per row and
+     * (sourceHeight + 15) / 16 rows. It replaces the offsets of adaptive
+     * quantization, which must be enabled, as described by quantOffsetsMode.
+     * The map is not copied. The encoder keeps the pointer until this picture
+     * is output, when it is returned in this field of the output picture, so
+     * it must remain valid and unmodified until then or until the encoder is
+     * closed */
+    double* quantOffsets;
+
+    /* X265_QPMAP_AQ or X265_QPMAP_FINAL. Returned on output */
+    int     quantOffsetsMode;
+
+    /* Ignored on input. On output, the QP offsets the blocks of the picture
+     * were coded with, relative to the QP chosen by rate control, in the
+     * layout of quantOffsets. NULL without adaptive quantization. The map
+     * belongs to the encoder and is valid until the next call to
+     * x265_encoder_encode() */
+    const double* qpOffsets;
 } x265_picture;
 
 typedef enum
@@ -279,6 +303,12 @@ typedef enum
 #define X265_AQ_VARIANCE             1
 #define X265_AQ_AUTO_VARIANCE        2
 
+/* x265_picture.quantOffsetsMode: the map replaces the AQ offsets and cu-tree
+ * still adjusts the referenced pictures, or the map is coded as is and the
+ * lookahead skips cu-tree for the picture */
+#define X265_QPMAP_AQ                0
+#define X265_QPMAP_FINAL             1
+
 /* NOTE! For this release only X265_CSP_I420 and X265_CSP_I444 are supported */
 
 /* Supported internal color space types (according to semantics of chroma_format_idc) */
@@ -421,6 +451,22 @@ typedef struct x265_param
      * But when no thread pools are used no node affinity is assigned. */
     int       frameNumThreads;
 
+    /* Adapt the number of frames which are compressed concurrently during the
+     * encode. frameNumThreads frame encoders are still allocated and remain
+     * the upper bound, but the encoder measures worker utilization and the
+     * time each frame spends stalled on reference rows and admits more or
+     * fewer frames to CTU compression accordingly. The output bitstream is not
+     * affected. Requires WPP. Default disabled */
+    int       bAdaptiveFrameThreads;
+
+    /* Hold the encode to the wall-clock budget of the frame rate, for live
+     * encodes. The encoder measures how long it takes to produce each output
+     * frame against the frame duration and, when it falls behind, reduces
+     * rc-lookahead, b-adapt, subme and rd level by steps until it keeps up
+     * again. Once there is headroom the steps are undone one at a time. Each
+     * change is logged. Default disabled */
+    int       bDeadline;
+
     /* Comma seperated list of threads per NUMA node. If "none", then no worker
      * pools are created and only frame parallelism is possible. If NULL or ""
      * (default) x265 will use all available threads on each NUMA node.
@@ -467,6 +513,22 @@ typedef struct x265_param
      * by default */
     int       bEnableWavefront;
 
+    /* Split each picture into this many independent slices of whole CTU rows.
+     * The slices do not predict from one another, so their rows are analyzed
+     * and entropy coded in parallel even when WPP is disabled, and each slice
+     * is emitted as its own slice NAL unit. Slices cost compression efficiency
+     * at their top edges. The value is clamped to the number of CTU rows.
+     * Default 1 */
+    int       maxSlices;
+
+    /* When non-zero, each slice is further split into dependent slice segments
+     * whose NAL units are not larger than this many bytes, so they fit into
+     * network packets for low latency delivery. Dependent segments do not
+     * break prediction or entropy coder contexts. The size excludes start
+     * codes and emulation prevention bytes, and a segment always contains at
+     * least one CTU. Default 0, disabled */
+    int       maxSliceBytes;
+
     /* Use multiple threads to measure CU mode costs. Recommended for many core
      * CPUs. On RD levels less than 5, it may not offload enough work to warrant
      * the overhead. It is useful with the slow preset since it has the
@@ -621,6 +683,28 @@ typedef struct x265_param
      * which effectively makes frame 0 the only I frame. Default is 250 */
     int       keyframeMax;
 
+    /* Enable periodic intra refresh. Instead of coding a keyframe every
+     * keyframeMax frames, a column of intra coded CTUs sweeps across successive
+     * P frames, and motion vectors of the refreshed area may not reference
+     * pixels which are not yet refreshed. The first frame of each sweep is
+     * signaled with a recovery point SEI. B frames, multiple references and
+     * temporal MVPs are disabled and constrained intra prediction is enabled.
+     * Default disabled */
+    int       bIntraRefresh;
+
+    /* First frame of a chunk, for encoding one title in several independent
+     * segments, counted from the first picture passed to the encoder. The
+     * chunk begins with an IDR frame. Of the pictures preceding it, at most
+     * lookaheadDepth (and keyframeMax) pass through the lookahead alone, to
+     * carry their complexity over to rate control, and earlier ones are
+     * dropped. None of them are encoded. Default 0 (disabled) */
+    int       chunkStart;
+
+    /* Last frame of a chunk. The frames following it are not encoded and the
+     * last GOP of the chunk is closed, so the segment may be concatenated with
+     * one which starts at the following frame. Default 0 (disabled) */
+    int       chunkEnd;
+
     /* Maximum consecutive B frames that can be emitted by the lookahead. When
      * b-adapt is 0 and keyframMax is greater than bframes, the lookahead emits
      * a fixed pattern of `bframes` B frames between each P.  With b-adapt 1 the
@@ -669,10 +753,37 @@ typedef struct x265_param
      * decisions. Default is 0 - disabled. 1 is the same as 0. Max 16 */
     int       lookaheadSlices;
 
+    /* Analyse the lookahead at quarter resolution first. The scenecut checks,
+     * the b-adapt 2 path search and the first motion searches are performed
+     * on quarter resolution frames, then the half resolution lookahead only
+     * refines the first mini-GOP decision among the nearest candidates and
+     * seeds its motion searches from the quarter resolution vectors. This
+     * greatly reduces lookahead CPU for long lookaheads and large pictures
+     * at some loss of decision accuracy. Default disabled */
+    int       bHierarchicalLookahead;
+
+    /* Run only the lookahead; no picture is encoded. The slice types decided
+     * by the lookahead, the intra and inter lowres costs and the CU-tree QP
+     * offsets of every picture are written to the binary stats file (see
+     * rc.statFileName), which a later pass may read in place of the stats of
+     * a first pass. x265_encoder_encode() returns each picture with its slice
+     * type once it was analysed and its stats record was appended, but without
+     * NALs or reconstructed planes. Incompatible with reading stats and with
+     * analysis load/save. Default disabled */
+    int       bLookaheadOnly;
+
     /* An arbitrary threshold which determines how aggressively the lookahead
      * should detect scene cuts. The default (40) is recommended. */
     int       scenecutThreshold;
 
+    /* Compare luma and chroma histograms and regional luma and gradient
+     * statistics of the lowres frames before each scenecut check. Pairs of
+     * frames which clearly are, or clearly are not, a scene change skip the
+     * inter cost estimate, which then only decides the ambiguous pairs.
+     * Speeds up the lookahead of content with many cuts and flashes.
+     * Default disabled */
+    int       bHistBasedSceneCut;
+
     /*== Coding Unit (CU) definitions ==*/
 
     /* Maximum CU width and height in pixels.  The size must be 64, 32, or 16.
@@ -818,6 +929,12 @@ typedef struct x265_param
     /* Enable availability of temporal motion vector for AMVP, default is enabled */
     int       bEnableTemporalMvp;
 
+    /* Use the lowres motion vectors of the lookahead as motion search
+     * candidates for every PU size and reference distance, and narrow the
+     * search range when they agree with the motion vector predictor. Default
+     * disabled */
+    int       bLowresMvSeed;
+
     /* Enable weighted prediction in P slices.  This enables weighting analysis
      * in the lookahead, which influences slice decisions, and enables weighting
      * analysis in the main encoder which allows P reference samples to have a
@@ -1012,6 +1129,12 @@ typedef struct x265_param
          * encoder will default to using x265_2pass.log */
         const char* statFileName;
 
+        /* Write the stats file as binary, with fixed size frame records and the
+         * CU-tree offsets in the same file. The next pass maps it into memory
+         * rather than parsing it. Text and binary stats files are both
+         * recognized when reading. Default disabled (text) */
+        int       bStatBinary;
+
         /* temporally blur quants */
         double    qblur;
 
@@ -1329,6 +1452,43 @@ void x265_encoder_log(x265_encoder *encoder, int argc, char **argv);
  *      close an encoder handler */
 void x265_encoder_close(x265_encoder *);
 
+/* x265_ladder_open:
+ *      create a ladder of count encoders (renditions) over one input sequence.
+ *      params[0] describes the highest rendition; every other rendition must
+ *      have the same color space and CTU size and may not be larger. The
+ *      slice types of the highest rendition, and its CU depths, skip
+ *      decisions and intra modes scaled to each lower resolution, are
+ *      passed to the lower renditions through the analysis reuse path, so
+ *      all renditions share one GOP structure. The GOP parameters (keyint,
+ *      min-keyint, bframes, b-pyramid, open-gop) of the lower renditions are
+ *      taken from params[0] and analysisMode is managed by the ladder.
+ *      Returns NULL on failure */
+x265_ladder* x265_ladder_open(x265_param **params, int count);
+
+/* x265_ladder_encoder:
+ *      returns the encoder handle of one rendition, to be used with
+ *      x265_encoder_headers(), x265_encoder_parameters() and
+ *      x265_encoder_get_stats(). It must not be passed to
+ *      x265_encoder_encode() or x265_encoder_close() */
+x265_encoder* x265_ladder_encoder(x265_ladder *, int rendition);
+
+/* x265_ladder_encode:
+ *      pic_in is an array of count pictures, one per rendition, each one the
+ *      same source picture scaled by the application to the resolution of its
+ *      rendition, or NULL to flush. pp_nal and pi_nal are arrays of count
+ *      entries which receive the NAL units of each rendition (*pi_nal is zero
+ *      for a rendition without output from this call), and pic_out is either
+ *      NULL or an array of count pictures. The lower renditions are delayed
+ *      until the analysis of the highest rendition is available, their input
+ *      pictures are copied by the ladder. Returns negative on error, else the
+ *      number of renditions which output a picture. While flushing, call
+ *      until zero is returned. */
+int x265_ladder_encode(x265_ladder *, x265_nal **pp_nal, uint32_t *pi_nal, x265_picture **pic_in, x265_picture **pic_out);
+
+/* x265_ladder_close:
+ *      close a ladder and all of its encoders */
+void x265_ladder_close(x265_ladder *);
+
 /* x265_cleanup:
  *       release library static allocations, reset configured CTU size */
 void x265_cleanup(void);
@@ -1376,6 +1536,10 @@ typedef struct x265_api
     void          (*cleanup)(void);
 
     int           sizeof_frame_stats;   /* sizeof(x265_frame_stats) */
+    x265_ladder*  (*ladder_open)(x265_param**, int);
+    x265_encoder* (*ladder_encoder)(x265_ladder*, int);
+    int           (*ladder_encode)(x265_ladder*, x265_nal**, uint32_t*, x265_picture**, x265_picture**);
+    void          (*ladder_close)(x265_ladder*);
     /* add new pointers to the end, or increment X265_MAJOR_VERSION */
 } x265_api;
 
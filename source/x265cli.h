@@ -42,6 +42,10 @@ static const struct option long_options[] =
     { "preset",         required_argument, NULL, 'p' },
     { "tune",           required_argument, NULL, 't' },
     { "frame-threads",  required_argument, NULL, 'F' },
+    { "no-adaptive-frame-threads", no_argument, NULL, 0 },
+    { "adaptive-frame-threads", no_argument, NULL, 0 },
+    { "no-deadline",          no_argument, NULL, 0 },
+    { "deadline",             no_argument, NULL, 0 },
     { "no-pmode",             no_argument, NULL, 0 },
     { "pmode",                no_argument, NULL, 0 },
     { "no-pme",               no_argument, NULL, 0 },
@@ -75,6 +79,8 @@ static const struct option long_options[] =
     { "recon-depth",    required_argument, NULL, 0 },
     { "no-wpp",               no_argument, NULL, 0 },
     { "wpp",                  no_argument, NULL, 0 },
+    { "slices",         required_argument, NULL, 0 },
+    { "slice-max-bytes", required_argument, NULL, 0 },
     { "ctu",            required_argument, NULL, 's' },
     { "min-cu-size",    required_argument, NULL, 0 },
     { "max-tu-size",    required_argument, NULL, 0 },
@@ -86,6 +92,8 @@ static const struct option long_options[] =
     { "max-merge",      required_argument, NULL, 0 },
     { "no-temporal-mvp",      no_argument, NULL, 0 },
     { "temporal-mvp",         no_argument, NULL, 0 },
+    { "no-lowres-mv-seed",    no_argument, NULL, 0 },
+    { "lowres-mv-seed",       no_argument, NULL, 0 },
     { "rdpenalty",      required_argument, NULL, 0 },
     { "no-rect",              no_argument, NULL, 0 },
     { "rect",                 no_argument, NULL, 0 },
@@ -109,12 +117,22 @@ static const struct option long_options[] =
     { "no-fast-intra",        no_argument, NULL, 0 },
     { "no-open-gop",          no_argument, NULL, 0 },
     { "open-gop",             no_argument, NULL, 0 },
+    { "no-intra-refresh",     no_argument, NULL, 0 },
+    { "intra-refresh",        no_argument, NULL, 0 },
     { "keyint",         required_argument, NULL, 'I' },
     { "min-keyint",     required_argument, NULL, 'i' },
+    { "chunk-start",    required_argument, NULL, 0 },
+    { "chunk-end",      required_argument, NULL, 0 },
     { "scenecut",       required_argument, NULL, 0 },
     { "no-scenecut",          no_argument, NULL, 0 },
+    { "hist-scenecut",        no_argument, NULL, 0 },
+    { "no-hist-scenecut",     no_argument, NULL, 0 },
     { "rc-lookahead",   required_argument, NULL, 0 },
     { "lookahead-slices", required_argument, NULL, 0 },
+    { "hierarchical-lookahead", no_argument, NULL, 0 },
+    { "no-hierarchical-lookahead", no_argument, NULL, 0 },
+    { "lookahead-only",       no_argument, NULL, 0 },
+    { "no-lookahead-only",    no_argument, NULL, 0 },
     { "bframes",        required_argument, NULL, 'b' },
     { "bframe-bias",    required_argument, NULL, 0 },
     { "b-adapt",        required_argument, NULL, 0 },
@@ -204,6 +222,8 @@ static const struct option long_options[] =
     { "nr-intra",       required_argument, NULL, 0 },
     { "nr-inter",       required_argument, NULL, 0 },
     { "stats",          required_argument, NULL, 0 },
+    { "binary-stats",         no_argument, NULL, 0 },
+    { "no-binary-stats",      no_argument, NULL, 0 },
     { "pass",           required_argument, NULL, 0 },
     { "slow-firstpass",       no_argument, NULL, 0 },
     { "no-slow-firstpass",    no_argument, NULL, 0 },
@@ -271,7 +291,11 @@ static void showHelp(x265_param *param)
     H0("   --pools <integer,...>         Comma separated thread count per thread pool (pool per NUMA node)\n");
     H0("                                 '-' implies no threads on node, '+' implies one thread per core on node\n");
     H0("-F/--frame-threads <integer>     Number of concurrently encoded frames. 0: auto-determined by core count\n");
+    H0("   --[no-]adaptive-frame-threads Adapt concurrently compressed frames to measured stalls, up to frame-threads. Default %s\n", OPT(param->bAdaptiveFrameThreads));
+    H0("   --[no-]deadline               Trade lookahead and analysis depth for speed to keep up with the frame rate. Default %s\n", OPT(param->bDeadline));
     H0("   --[no-]wpp                    Enable Wavefront Parallel Processing. Default %s\n", OPT(param->bEnableWavefront));
+    H0("   --slices <integer>            Number of independent slices per picture, encoded in parallel. Default %d\n", param->maxSlices);
+    H0("   --slice-max-bytes <integer>   Split slices into dependent segments of at most this many bytes. Default %d\n", param->maxSliceBytes);
     H0("   --[no-]pmode                  Parallel mode analysis. Default %s\n", OPT(param->bDistributeModeAnalysis));
     H0("   --[no-]pme                    Parallel motion estimation. Default %s\n", OPT(param->bDistributeMotionEstimation));
     H0("   --[no-]asm <bool|int|string>  Override CPU detection. Default: auto\n");
@@ -311,6 +335,7 @@ static void showHelp(x265_param *param)
     H0("   --[no-]rect                   Enable rectangular motion partitions Nx2N and 2NxN. Default %s\n", OPT(param->bEnableRectInter));
     H0("   --[no-]amp                    Enable asymmetric motion partitions, requires --rect. Default %s\n", OPT(param->bEnableAMP));
     H1("   --[no-]temporal-mvp           Enable temporal MV predictors. Default %s\n", OPT(param->bEnableTemporalMvp));
+    H1("   --[no-]lowres-mv-seed         Seed motion searches with lookahead motion vectors. Default %s\n", OPT(param->bLowresMvSeed));
     H0("\nSpatial / intra options:\n");
     H0("   --[no-]strong-intra-smoothing Enable strong intra smoothing for 32x32 blocks. Default %s\n", OPT(param->bEnableStrongIntraSmoothing));
     H0("   --[no-]constrained-intra      Constrained intra prediction (use only intra coded reference pixels) Default %s\n", OPT(param->bEnableConstrainedIntra));
@@ -320,11 +345,17 @@ static void showHelp(x265_param *param)
     H0("\nSlice decision options:\n");
     H0("   --[no-]open-gop               Enable open-GOP, allows I slices to be non-IDR. Default %s\n", OPT(param->bOpenGOP));
     H0("-I/--keyint <integer>            Max IDR period in frames. -1 for infinite-gop. Default %d\n", param->keyframeMax);
+    H0("   --[no-]intra-refresh          Use periodic intra refresh columns instead of IDR frames. Default %s\n", OPT(param->bIntraRefresh));
     H0("-i/--min-keyint <integer>        Scenecuts closer together than this are coded as I, not IDR. Default: auto\n");
+    H1("   --chunk-start <integer>       First frame of the chunk, earlier frames are not encoded. Default 0 (disabled)\n");
+    H1("   --chunk-end <integer>         Last frame of the chunk, later frames are not encoded. Default 0 (disabled)\n");
     H0("   --no-scenecut                 Disable adaptive I-frame decision\n");
     H0("   --scenecut <integer>          How aggressively to insert extra I-frames. Default %d\n", param->scenecutThreshold);
+    H1("   --[no-]hist-scenecut          Rule out or confirm scenecuts by histogram before estimating costs. Default %s\n", OPT(param->bHistBasedSceneCut));
     H0("   --rc-lookahead <integer>      Number of frames for frame-type lookahead (determines encoder latency) Default %d\n", param->lookaheadDepth);
     H1("   --lookahead-slices <0..16>    Number of slices to use per lookahead cost estimate. Default %d\n", param->lookaheadSlices);
+    H1("   --[no-]hierarchical-lookahead Analyse the lookahead at quarter resolution first. Default %s\n", OPT(param->bHierarchicalLookahead));
+    H1("   --[no-]lookahead-only         Only write the lookahead decisions and costs to the stats file. Default %s\n", OPT(param->bLookaheadOnly));
     H0("   --bframes <integer>           Maximum number of consecutive b-frames (now it only enables B GOP structure) Default %d\n", param->bframes);
     H1("   --bframe-bias <integer>       Bias towards B frame decisions. Default %d\n", param->bFrameBias);
     H0("   --b-adapt <0..2>              0 - none, 1 - fast, 2 - full (trellis) adaptive B frame scheduling. Default %d\n", param->bFrameAdaptive);
@@ -356,6 +387,7 @@ static void showHelp(x265_param *param)
        "                                   - 2 : Last pass, does not overwrite stats file\n"
        "                                   - 3 : Nth pass, overwrites stats file\n");
     H0("   --stats                       Filename for stats file in multipass pass rate control. Default x265_2pass.log\n");
+    H1("   --[no-]binary-stats           Write a binary, memory mapped multipass stats file. Default %s\n", OPT(param->rc.bStatBinary));
     H0("   --[no-]slow-firstpass         Enable a slow first pass in a multipass rate control mode. Default %s\n", OPT(param->rc.bEnableSlowFirstPass));
     H0("   --[no-]strict-cbr             Enable stricter conditions and tolerance for bitrate deviations in CBR mode. Default %s\n", OPT(param->rc.bStrictCbr));
     H0("   --analysis-mode <string|int>  save - Dump analysis info into file, load - Load analysis buffers from the file. Default %d\n", param->analysisMode);